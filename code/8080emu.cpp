@@ -52,6 +52,53 @@ internal_func u8 SetParityFlag(u8 value)
 	return !(parityByteCount % 2);
 }
 
+// Passes the pages written since the last call on to every user's bits
+internal_func void SpreadDirtyPages(CPUState *cpuState)
+{
+	u64 pages = cpuState->dirtyPages;
+	if (pages)
+	{
+		for (u32 user = 0; user < (u32)DirtyPageUser::COUNT; ++user)
+		{
+			cpuState->userDirtyPages[user] |= pages;
+		}
+		cpuState->dirtyPages = 0;
+	}
+}
+
+// The RAM pages written since user last cleared its bits
+internal_func u64 GetDirtyPages(CPUState *cpuState, DirtyPageUser user)
+{
+	SpreadDirtyPages(cpuState);
+	u64 result = cpuState->userDirtyPages[(u32)user];
+	return result;
+}
+
+// Every other user still sees the pages as written
+internal_func void ClearDirtyPages(CPUState *cpuState, DirtyPageUser user)
+{
+	SpreadDirtyPages(cpuState);
+	cpuState->userDirtyPages[(u32)user] = 0;
+}
+
+internal_func u64 TakeDirtyPages(CPUState *cpuState, DirtyPageUser user)
+{
+	u64 result = GetDirtyPages(cpuState, user);
+	cpuState->userDirtyPages[(u32)user] = 0;
+	return result;
+}
+
+// Copies everything but memory and the dirty page bits, which dest keeps, for putting a saved CPU
+// back. Whoever copies RAM along with it marks the pages it copied in dest->dirtyPages
+internal_func void CopyCPURegisters(CPUState *dest, CPUState *source)
+{
+	CPUState kept = *dest;
+	*dest = *source;
+	dest->memory = kept.memory;
+	dest->dirtyPages = kept.dirtyPages;
+	memcpy(dest->userDirtyPages, kept.userDirtyPages, sizeof(dest->userDirtyPages));
+}
+
 internal_func u8 BuildPSW(CPUState *cpuState)
 {
 	u8 psw = 0x00;
@@ -69,6 +116,7 @@ internal_func void SafeMemWrite(CPUState *cpuState, u16 adr, u8 value)
 	if (!(adr < 0x2000) && !(adr >= 0x4000))
 	{
 		cpuState->memory[adr] = value;
+		cpuState->dirtyPages |= 1ULL << ((adr - RAM_START) / RAM_PAGE_SIZE);
 	}
 	
 	// NOTE(bSalmon): Used for debugging VRAM issues
@@ -201,6 +249,65 @@ internal_func void ProcessMachineKeyUp(u8 *port, u8 key)
 	}
 }
 
+struct MachineInputMapping
+{
+	u8 portNum;
+	u8 key;
+	char *name;
+};
+
+// NOTE(bSalmon): In the same order as MachineInput
+global_var const MachineInputMapping machineInputMappings[] = {
+	{1, (u8)Port1MachineKeys::COIN, "coin"},
+	{1, (u8)Port1MachineKeys::P1START, "p1start"},
+	{1, (u8)Port1MachineKeys::P1SHOOT, "p1shoot"},
+	{1, (u8)Port1MachineKeys::P1LEFT, "p1left"},
+	{1, (u8)Port1MachineKeys::P1RIGHT, "p1right"},
+	{1, (u8)Port1MachineKeys::P2START, "p2start"},
+	{2, (u8)Port2MachineKeys::P2SHOOT, "p2shoot"},
+	{2, (u8)Port2MachineKeys::P2LEFT, "p2left"},
+	{2, (u8)Port2MachineKeys::P2RIGHT, "p2right"},
+	{2, (u8)Port2MachineKeys::TILT, "tilt"},
+	{2, (u8)Port2MachineKeys::DIPSWITCH1, "dipswitch1"},
+	{2, (u8)Port2MachineKeys::DIPSWITCH2, "dipswitch2"},
+	{2, (u8)Port2MachineKeys::DIPSWITCHBONUS, "dipswitchbonus"},
+	{2, (u8)Port2MachineKeys::DIPSWITCHCOIN, "dipswitchcoin"},
+};
+
+internal_func void SetMachineInput(MachineState *machine, MachineInput input, b32 pressed)
+{
+	if ((u32)input >= (u32)MachineInput::COUNT)
+	{
+		return;
+	}
+	
+	const MachineInputMapping *mapping = &machineInputMappings[(u32)input];
+	u8 *port = (mapping->portNum == 1) ? &machine->inputPort1 : &machine->inputPort2;
+	if (pressed)
+	{
+		ProcessMachineKeyDown(port, mapping->key);
+	}
+	else
+	{
+		ProcessMachineKeyUp(port, mapping->key);
+	}
+}
+
+// Looks an input up by its name in machineInputMappings, returns false if there is no such input
+internal_func b32 FindMachineInput(char *name, MachineInput *input)
+{
+	for (u32 inputIndex = 0; inputIndex < (u32)MachineInput::COUNT; ++inputIndex)
+	{
+		if (strcmp(machineInputMappings[inputIndex].name, name) == 0)
+		{
+			*input = (MachineInput)inputIndex;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
 internal_func void HandleINInst(CPUState *cpuState, MachineState *machine, u8 *opCode)
 {
 	switch(opCode[1])
@@ -258,76 +365,266 @@ internal_func void HandleOUTInst(CPUState *cpuState, MachineState *machine, u8 *
 	}
 }
 
-internal_func void RenderVideoMemContents(BackBuffer *backBuffer, CPUState *cpuState, b32 enableColour)
+// Minimum pitch of a row of width pixels for each format
+internal_func s32 GetFrameFormatPitch(FrameFormat format, s32 width)
 {
-	// Pixel Colours
+	s32 result = 0;
+	switch (format)
+	{
+		case FrameFormat::ARGB32:
+		{
+			result = width * 4;
+			break;
+		}
+		
+		case FrameFormat::INDEXED8:
+		{
+			result = width;
+			break;
+		}
+		
+		case FrameFormat::PACKED1:
+		{
+			result = (width + 7) / 8;
+			break;
+		}
+	}
 	
-	u32 white = 0xFFFFFFFF;
-	u32 black = 0xFF000000;
-	u32 red;
-	u32 green;
+	return result;
+}
+
+struct VideoOverlay
+{
+	// NOTE(bSalmon): Distances from the bottom of the screen of the colour gel strips
+	s32 scoresStart;
+	s32 scoresEnd;
+	s32 playerStart;
+	s32 playerEnd;
+	s32 livesStart;
+	s32 livesLeft;
+	s32 livesRight;
 	
+	b32 enableColour;
+};
+
+internal_func VideoOverlay GetVideoOverlay(s32 width, s32 height, b32 enableColour)
+{
+	VideoOverlay result = {};
+	result.scoresStart = height / 8;
+	result.scoresEnd = height / 4;
+	result.playerStart = (s32)(height / 1.39f);
+	result.playerEnd = (s32)(height / 1.06667f);
+	result.livesStart = (s32)(height / 1.05f);
+	result.livesLeft = width / 16;
+	result.livesRight = (s32)(width / 1.91f);
+	result.enableColour = enableColour;
+	
+	return result;
+}
+
+// Colour of the set pixels in the 8 pixel column starting at y from the bottom of the screen
+inline u8 GetOverlayColour(VideoOverlay *overlay, s32 height, s32 x, s32 y)
+{
 	// If Colour is not enabled, red and green are set to white;
-	if (enableColour)
+	u8 result = (u8)FrameColour::WHITE;
+	if (overlay->enableColour)
 	{
-		red = 0xFFFF0000;
-		green = 0xFF00FF00;
+		s32 fromBottom = height - y;
+		if (fromBottom >= overlay->scoresStart && fromBottom < overlay->scoresEnd)
+		{
+			// Scores
+			result = (u8)FrameColour::RED;
+		}
+		else if (fromBottom >= overlay->playerStart && fromBottom < overlay->playerEnd)
+		{
+			// Player and Shields
+			result = (u8)FrameColour::GREEN;
+		}
+		else if (fromBottom >= overlay->livesStart && x >= overlay->livesLeft && x < overlay->livesRight)
+		{
+			// Lives indicator
+			result = (u8)FrameColour::GREEN;
+		}
 	}
-	else
+	
+	return result;
+}
+
+/*
+NOTE(bSalmon):
+
+Video memory is stored as columns from the bottom of the screen up, 1 bit per pixel,
+(height / 8) bytes per column. The kernels below gather the byte at the same height from
+16 neighbouring columns and transpose them with movemask, which gives one 16 bit mask per
+screen row with the leftmost column in the high bit. Output is written a row at a time.
+*/
+
+struct VideoColumnBlock
+{
+	__m128i bits;
+	s32 columnCount;
+};
+
+inline VideoColumnBlock GatherVideoColumns(u8 *videoBuffer, s32 bytesPerColumn, s32 byteRow, s32 x, s32 width)
+{
+	VideoColumnBlock result = {};
+	result.columnCount = ((width - x) < 16) ? (width - x) : 16;
+	
+	// NOTE(bSalmon): Reversed so the movemask puts the leftmost column in the high bit
+	u8 gathered[16] = {};
+	for (s32 column = 0; column < result.columnCount; ++column)
 	{
-		red = white;
-		green = white;
+		gathered[15 - column] = videoBuffer[((x + column) * bytesPerColumn) + byteRow];
 	}
+	result.bits = _mm_loadu_si128((__m128i *)gathered);
 	
+	return result;
+}
+
+// Expands the 8 bits of a packed byte into 8 bytes of 0x00 or 0xFF, high bit first
+inline u64 ExpandPackedByte(u8 packed)
+{
+	u64 result = ((u64)packed * 0x0101010101010101ULL) & 0x0102040810204080ULL;
+	result = ((result + 0x7F7F7F7F7F7F7F7FULL) & 0x8080808080808080ULL) >> 7;
+	result *= 0xFF;
+	
+	return result;
+}
+
+internal_func void RenderVideoMemPacked1(BackBuffer *backBuffer, u8 *videoBuffer)
+{
 	u8 *screenBuffer = (u8 *)backBuffer->memory;
-	u8 *videoBuffer = &cpuState->memory[0x2400];
-	for (s32 x = 0; x < backBuffer->width; ++x)
+	s32 bytesPerColumn = backBuffer->height / 8;
+	
+	for (s32 byteRow = 0; byteRow < bytesPerColumn; ++byteRow)
+	{
+		s32 y = byteRow * 8;
+		for (s32 x = 0; x < backBuffer->width; x += 16)
+		{
+			VideoColumnBlock block = GatherVideoColumns(videoBuffer, bytesPerColumn, byteRow, x, backBuffer->width);
+			for (s32 bit = 7; bit >= 0; --bit)
+			{
+				u32 rowMask = _mm_movemask_epi8(block.bits);
+				block.bits = _mm_add_epi8(block.bits, block.bits);
+				
+				u8 *outputRow = &screenBuffer[(((backBuffer->height - 1) - y - bit) * backBuffer->pitch) + (x / 8)];
+				outputRow[0] = (u8)(rowMask >> 8);
+				if (block.columnCount > 8)
+				{
+					outputRow[1] = (u8)rowMask;
+				}
+			}
+		}
+	}
+}
+
+internal_func void RenderVideoMemIndexed8(BackBuffer *backBuffer, u8 *videoBuffer, VideoOverlay *overlay)
+{
+	u8 *screenBuffer = (u8 *)backBuffer->memory;
+	s32 bytesPerColumn = backBuffer->height / 8;
+	
+	for (s32 byteRow = 0; byteRow < bytesPerColumn; ++byteRow)
 	{
-		for (s32 y = 0; y < backBuffer->height; y += 8)
+		s32 y = byteRow * 8;
+		for (s32 x = 0; x < backBuffer->width; x += 16)
 		{
-			u8 pixel8080 = videoBuffer[(x * (backBuffer->height / 8)) + (y / 8)];
+			VideoColumnBlock block = GatherVideoColumns(videoBuffer, bytesPerColumn, byteRow, x, backBuffer->width);
 			
-			s32 offset = ((backBuffer->height - 1) - y) * (backBuffer->pitch) + (x * 4);
-			u32 *outputPixel = (u32 *)(&screenBuffer[offset]);
+			u8 colours[16] = {};
+			for (s32 column = 0; column < block.columnCount; ++column)
+			{
+				colours[column] = GetOverlayColour(overlay, backBuffer->height, x + column, y);
+			}
+			u64 leftColours = *(u64 *)&colours[0];
+			u64 rightColours = *(u64 *)&colours[8];
 			
-			for (s32 bit = 0; bit < 8; bit++)
+			for (s32 bit = 7; bit >= 0; --bit)
 			{
-				if (((1<<bit) & pixel8080) != 0)
+				u32 rowMask = _mm_movemask_epi8(block.bits);
+				block.bits = _mm_add_epi8(block.bits, block.bits);
+				
+				u8 *outputRow = &screenBuffer[(((backBuffer->height - 1) - y - bit) * backBuffer->pitch) + x];
+				*(u64 *)&outputRow[0] = ExpandPackedByte((u8)(rowMask >> 8)) & leftColours;
+				if (block.columnCount > 8)
 				{
-					if ((backBuffer->height-y) >= (backBuffer->height/8) && (backBuffer->height-y) < (backBuffer->height/4))
-					{
-						// Scores
-						*outputPixel = red;
-					}
-					else if ((backBuffer->height-y) >= (s32)(backBuffer->height/1.39f) &&
-							 (backBuffer->height-y) < (s32)(backBuffer->height/1.06667f))
-					{
-						// Player and Shields
-						*outputPixel = green;
-					}
-					else if ((backBuffer->height-y) >= (s32)(backBuffer->height/1.05f) &&
-							 x >= (backBuffer->width/16) && 
-							 x < (s32)(backBuffer->width/1.91f))
-					{
-						// Lives indicator
-						*outputPixel = green;
-					}
-					else
-					{
-						*outputPixel = white;
-					}
+					*(u64 *)&outputRow[8] = ExpandPackedByte((u8)rowMask) & rightColours;
 				}
-				else
+			}
+		}
+	}
+}
+
+internal_func void RenderVideoMemARGB32(BackBuffer *backBuffer, u8 *videoBuffer, VideoOverlay *overlay)
+{
+	u8 *screenBuffer = (u8 *)backBuffer->memory;
+	s32 bytesPerColumn = backBuffer->height / 8;
+	
+	for (s32 byteRow = 0; byteRow < bytesPerColumn; ++byteRow)
+	{
+		s32 y = byteRow * 8;
+		for (s32 x = 0; x < backBuffer->width; x += 16)
+		{
+			VideoColumnBlock block = GatherVideoColumns(videoBuffer, bytesPerColumn, byteRow, x, backBuffer->width);
+			
+			// NOTE(bSalmon): Set pixel colour of each column, the unset pixels are always black
+			__m128i colours[4];
+			u32 *columnColours = (u32 *)colours;
+			for (s32 column = 0; column < 16; ++column)
+			{
+				u8 colour = (column < block.columnCount) ? GetOverlayColour(overlay, backBuffer->height, x + column, y) : 0;
+				columnColours[column] = framePalette[colour];
+			}
+			__m128i black = _mm_set1_epi32(framePalette[(u8)FrameColour::BLACK]);
+			__m128i pixelBits = _mm_set_epi32(1 << 12, 1 << 13, 1 << 14, 1 << 15);
+			
+			for (s32 bit = 7; bit >= 0; --bit)
+			{
+				u32 rowMask = _mm_movemask_epi8(block.bits);
+				block.bits = _mm_add_epi8(block.bits, block.bits);
+				
+				u32 *outputPixel = (u32 *)&screenBuffer[(((backBuffer->height - 1) - y - bit) * backBuffer->pitch) + (x * 4)];
+				__m128i rowBits = _mm_set1_epi32(rowMask);
+				for (s32 group = 0; (group * 4) < block.columnCount; ++group)
 				{
-					*outputPixel = black;
+					// NOTE(bSalmon): Shifting the mask lines the bits of the next 4 columns up with pixelBits
+					__m128i groupBits = _mm_and_si128(_mm_slli_epi32(rowBits, group * 4), pixelBits);
+					__m128i isSet = _mm_cmpeq_epi32(groupBits, pixelBits);
+					__m128i pixels = _mm_or_si128(_mm_and_si128(isSet, colours[group]), _mm_andnot_si128(isSet, black));
+					_mm_storeu_si128((__m128i *)&outputPixel[group * 4], pixels);
 				}
-				
-				outputPixel -= backBuffer->width;
 			}
 		}
 	}
 }
 
+// Width must be a multiple of 4 (8 for INDEXED8 and PACKED1) and height a multiple of 8
+internal_func void RenderVideoMemContents(BackBuffer *backBuffer, CPUState *cpuState, b32 enableColour)
+{
+	u8 *videoBuffer = &cpuState->memory[0x2400];
+	VideoOverlay overlay = GetVideoOverlay(backBuffer->width, backBuffer->height, enableColour);
+	
+	switch (backBuffer->format)
+	{
+		case FrameFormat::ARGB32:
+		{
+			RenderVideoMemARGB32(backBuffer, videoBuffer, &overlay);
+			break;
+		}
+		
+		case FrameFormat::INDEXED8:
+		{
+			RenderVideoMemIndexed8(backBuffer, videoBuffer, &overlay);
+			break;
+		}
+		
+		case FrameFormat::PACKED1:
+		{
+			RenderVideoMemPacked1(backBuffer, videoBuffer);
+			break;
+		}
+	}
+}
+
 internal_func void Interrupt(CPUState *cpuState, u8 interruptNum, u64 *cycles)
 {
 	SafeMemWrite(cpuState, cpuState->stackPointer - 1, (cpuState->programCounter >> 8) & 0xff);
@@ -338,6 +635,7 @@ internal_func void Interrupt(CPUState *cpuState, u8 interruptNum, u64 *cycles)
 	cpuState->programCounter = 8 * interruptNum;
 	
 	cpuState->enableInterrupt = false;
+	cpuState->halted = false;
 	*cycles += 4;
 }
 
@@ -1351,7 +1649,9 @@ internal_func void Emulate(CPUState *cpuState, MachineState *machine, unsigned c
 		case 0x76:
 		{
 			// HLT
-			exit(0);
+			// NOTE(bSalmon): Waits for an interrupt, the platform layer decides what to do
+			// if interrupts are disabled as the CPU can then never continue
+			cpuState->halted = true;
 			break;
 		}
 		
@@ -3059,3 +3359,144 @@ internal_func void Emulate(CPUState *cpuState, MachineState *machine, unsigned c
 		*cycles += cyclesArray[*opCode];
 	}
 }
+
+// NOTE(bSalmon): The Space Invaders hardware runs the 8080 at 2MHz with a 60Hz display,
+// RST 1 is raised when the beam reaches the middle of the screen and RST 2 at vblank
+#define CPU_CLOCK_HZ 2000000
+#define FRAMES_PER_SECOND 60
+#define CYCLES_PER_FRAME (CPU_CLOCK_HZ / FRAMES_PER_SECOND)
+
+// Clears the registers and machine state, the memory, romSize, romFilename and enableColour are left alone
+internal_func void ResetMachine(CPUState *cpuState, MachineState *machine)
+{
+	cpuState->regA = 0x00;
+	cpuState->regF = {};
+	
+	cpuState->regB = 0x00;
+	cpuState->regC = 0x00;
+	
+	cpuState->regD = 0x00;
+	cpuState->regE = 0x00;
+	
+	cpuState->regH = 0x00;
+	cpuState->regL = 0x00;
+	
+	cpuState->enableInterrupt = false;
+	cpuState->halted = false;
+	cpuState->stackPointer = 0x0000;
+	cpuState->programCounter = 0x0000;
+	
+	machine->shift0 = 0x00;
+	machine->shift1 = 0x00;
+	machine->shiftOffset = 0x00;
+	
+	machine->inputPort1 = 0x00;
+	machine->inputPort2 = 0x00;
+	
+	machine->cycles = 0;
+	machine->instructionCount = 0;
+	machine->frameCount = 0;
+	machine->nextInterruptCycle = CYCLES_PER_FRAME / 2;
+	machine->nextInterruptNum = 1;
+}
+
+// True when the CPU has halted with interrupts disabled, nothing can wake it
+internal_func b32 IsMachineStopped(CPUState *cpuState)
+{
+	b32 result = cpuState->halted && !cpuState->enableInterrupt;
+	return result;
+}
+
+// Raises RST 1 or RST 2 once the beam has reached the middle of the screen or vblank
+internal_func void UpdateScheduledInterrupt(CPUState *cpuState, MachineState *machine)
+{
+	if (machine->cycles >= machine->nextInterruptCycle)
+	{
+		if (cpuState->enableInterrupt)
+		{
+			Interrupt(cpuState, machine->nextInterruptNum, &machine->cycles);
+		}
+		
+		if (machine->nextInterruptNum == 1)
+		{
+			machine->nextInterruptCycle += CYCLES_PER_FRAME - (CYCLES_PER_FRAME / 2);
+			machine->nextInterruptNum = 2;
+		}
+		else
+		{
+			machine->nextInterruptCycle += CYCLES_PER_FRAME / 2;
+			machine->nextInterruptNum = 1;
+			machine->frameCount++;
+		}
+	}
+}
+
+// Runs one instruction, then raises any interrupt that is due
+internal_func void EmulateStep(CPUState *cpuState, MachineState *machine)
+{
+	if (cpuState->halted)
+	{
+		// NOTE(bSalmon): A halted 8080 idles until an interrupt arrives
+		machine->cycles += 4;
+	}
+	else
+	{
+		Emulate(cpuState, machine, cpuState->memory, &machine->cycles);
+		machine->instructionCount++;
+	}
+	
+	UpdateScheduledInterrupt(cpuState, machine);
+}
+
+// Runs instructions until targetCycles, the next interrupt or a HLT, whichever is first
+internal_func void EmulateUntil(CPUState *cpuState, MachineState *machine, u64 targetCycles)
+{
+	if (targetCycles > machine->nextInterruptCycle)
+	{
+		targetCycles = machine->nextInterruptCycle;
+	}
+	
+	if (cpuState->halted)
+	{
+		// NOTE(bSalmon): Idle in the same 4 cycle steps EmulateStep takes
+		if (machine->cycles < targetCycles)
+		{
+			machine->cycles += ((targetCycles - machine->cycles + 3) / 4) * 4;
+		}
+	}
+	else
+	{
+		// NOTE(bSalmon): Kept in locals so the compiler can hold them in registers across instructions
+		u64 cycles = machine->cycles;
+		u64 instructionCount = 0;
+		while (cycles < targetCycles && !cpuState->halted)
+		{
+			Emulate(cpuState, machine, cpuState->memory, &cycles);
+			instructionCount++;
+		}
+		machine->cycles = cycles;
+		machine->instructionCount += instructionCount;
+	}
+	
+	UpdateScheduledInterrupt(cpuState, machine);
+}
+
+// Runs at least cycleCount cycles, stops early if the machine stops
+internal_func void EmulateCycles(CPUState *cpuState, MachineState *machine, u64 cycleCount)
+{
+	u64 targetCycles = machine->cycles + cycleCount;
+	while (machine->cycles < targetCycles && !IsMachineStopped(cpuState))
+	{
+		EmulateUntil(cpuState, machine, targetCycles);
+	}
+}
+
+// Runs the CPU up to and including the next vblank, stops early if the machine stops
+internal_func void EmulateFrame(CPUState *cpuState, MachineState *machine)
+{
+	u64 frameCount = machine->frameCount;
+	while (machine->frameCount == frameCount && !IsMachineStopped(cpuState))
+	{
+		EmulateUntil(cpuState, machine, machine->nextInterruptCycle);
+	}
+}
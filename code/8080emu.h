@@ -25,6 +25,7 @@ limitations under the License.
 
 // Typedefs
 #include <stdint.h>
+#include <string.h>
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -40,6 +41,9 @@ typedef int32_t b32;
 typedef float f32;
 typedef double f64;
 
+#include "8080emu_intrinsics.h"
+#include "8080emu_platform.h"
+
 #if EMU8080_SLOW
 #define ASSERT(expr) if(!(expr)) {*(int *)0 = 0;}
 #else
@@ -49,6 +53,8 @@ typedef double f64;
 #define KILOBYTES(value) ((value)*1024LL)
 #define MEGABYTES(value) (KILOBYTES(value)*1024LL)
 
+#define ARRAY_COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
 enum class Port1MachineKeys
 {
 	COIN,
@@ -73,6 +79,27 @@ enum class Port2MachineKeys
 	DIPSWITCHCOIN
 };
 
+// Every cabinet input regardless of the port it is wired to, see machineInputMappings
+enum class MachineInput
+{
+	COIN,
+	P1START,
+	P1SHOOT,
+	P1LEFT,
+	P1RIGHT,
+	P2START,
+	P2SHOOT,
+	P2LEFT,
+	P2RIGHT,
+	TILT,
+	DIPSWITCH1,
+	DIPSWITCH2,
+	DIPSWITCHBONUS,
+	DIPSWITCHCOIN,
+	
+	COUNT
+};
+
 struct CPUFlags
 {
 	u8 s : 1;
@@ -85,6 +112,26 @@ struct CPUFlags
 	u8 c : 1;
 };
 
+// NOTE(bSalmon): RAM (2000-3fff) is tracked in 128 byte pages for the dirty page bits,
+// bit n of dirtyPages is set by any write to 2000 + (n * RAM_PAGE_SIZE)
+#define RAM_START 0x2000
+#define RAM_SIZE 0x2000
+#define RAM_PAGE_SIZE 128
+#define RAM_PAGE_COUNT (RAM_SIZE / RAM_PAGE_SIZE)
+
+// NOTE(bSalmon): Each of these keeps its own copy of the dirty page bits and only ever clears
+// its own, so any of them can be used on the same machine at once
+enum class DirtyPageUser
+{
+	FORK,
+	RUN_AHEAD,
+	STATE_HASH,
+	SNAPSHOT,
+	MIGRATION,
+	
+	COUNT
+};
+
 struct CPUState
 {
 	u8 regA;
@@ -101,8 +148,14 @@ struct CPUState
 	
 	u8 *memory;
 	b32 enableInterrupt;
+	b32 halted;
 	u16 stackPointer;
 	u16 programCounter;
+	
+	// NOTE(bSalmon): Set by every memory write, or to ~0 by whatever replaces all of RAM. Only
+	// read through GetDirtyPages, which first passes the bits on to every user in userDirtyPages
+	u64 dirtyPages;
+	u64 userDirtyPages[(u32)DirtyPageUser::COUNT];
 };
 
 struct MachineState
@@ -118,20 +171,50 @@ struct MachineState
 	u16 romSize;
 	
 	b32 enableColour;
+	
+	// NOTE(bSalmon): Running totals since the last reset, the next interrupt is scheduled
+	// from cycles so any overshoot of a half frame is taken out of the next one
+	u64 cycles;
+	u64 instructionCount;
+	u64 frameCount;
+	u64 nextInterruptCycle;
+	u8 nextInterruptNum;
+};
+
+enum class FrameFormat
+{
+	ARGB32,
+	INDEXED8,
+	PACKED1
 };
 
+// Palette for INDEXED8, index 0 is black and set pixels use 1-3
+enum class FrameColour
+{
+	BLACK,
+	WHITE,
+	RED,
+	GREEN
+};
+
+global_var const u32 framePalette[] = {0xFF000000, 0xFFFFFFFF, 0xFFFF0000, 0xFF00FF00};
+
 struct BackBuffer
 {
-	// NOTE[bSalmon]: 32-bit wide, Mem Order BB GG RR xx
+	// NOTE[bSalmon]: ARGB32 is 32-bit wide, Mem Order BB GG RR xx
+	// INDEXED8 is one FrameColour byte per pixel
+	// PACKED1 is 1 bit per pixel, leftmost pixel in the high bit, bytesPerPixel is 0
+	// All formats are top-down and rotated to the upright screen
 	void *memory;
 	s32 width;
 	s32 height;
 	s32 pitch;
 	s32 bytesPerPixel;
+	FrameFormat format;
 };
 
 // NOTE(bSalmon): From Emulator 101, Array of cycles values for the opcodes, used as: cycleArray[opCode], might change to each instruction individually adding the cycles to currentCycles instead
-global_var u8 cyclesArray[] = {
+global_var const u8 cyclesArray[] = {
 	4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
 	4, 10, 7, 5, 5, 5, 7, 4, 4, 10, 7, 5, 5, 5, 7, 4,
 	4, 10, 16, 5, 5, 5, 7, 4, 4, 10, 16, 5, 5, 5, 7, 4,
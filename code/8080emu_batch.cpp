@@ -0,0 +1,580 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_batch.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Batch Runner, runs a list of independent emulator jobs across a fixed pool of worker threads.
+
+Job List, one job per line, # starts a comment:
+<rom path> <frames> [inputs=<script path>] [ram] [frame]
+ram   - writes the final 8KB of RAM (2000 - 3fff) to <output dir>/job<N>.ram
+frame - writes the final frame to <output dir>/job<N>.ppm
+
+Input Script, one event per line, frames count from 0:
+<frame> <input name> <down|up>    e.g. 60 coin down
+Input names are the ones in machineInputMappings.
+
+Every ROM and input script is loaded once no matter how many jobs use it. A worker takes the
+next job by atomically incrementing a shared index and runs it on its own emulator instance,
+which is reset and reused for every job it takes. Each job has a result slot that is only ever
+written by the worker that ran it, so nothing is locked while the batch runs.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BATCH_MAX_ROMS 64
+#define BATCH_MAX_SCRIPTS 64
+#define BATCH_MAX_THREADS 64
+#define BATCH_MEMORY_SIZE (KILOBYTES(64) + 16)
+
+enum BatchOutputFlags
+{
+	BATCH_OUTPUT_RAM = 0x1,
+	BATCH_OUTPUT_FRAME = 0x2
+};
+
+struct BatchROM
+{
+	char path[256];
+	u8 *contents;
+	u64 size;
+};
+
+struct BatchInputEvent
+{
+	u64 frame;
+	MachineInput input;
+	b32 pressed;
+};
+
+struct BatchInputScript
+{
+	char path[256];
+	BatchInputEvent *events;
+	u32 eventCount;
+};
+
+struct BatchJob
+{
+	BatchROM *rom;
+	BatchInputScript *inputs;
+	u64 frameCount;
+	u32 outputFlags;
+};
+
+struct BatchResult
+{
+	b32 completed;
+	b32 outputFailed;
+	u32 workerIndex;
+	
+	u64 frames;
+	u64 cycles;
+	u64 stateHash;
+	u64 frameHash;
+	u64 ramHash;
+	f64 seconds;
+};
+
+struct Batch;
+
+struct BatchWorker
+{
+	Batch *batch;
+	u32 workerIndex;
+	PlatformThread *thread;
+	
+	u8 *memory;
+	BackBuffer frame;
+	u8 *ppm;
+};
+
+struct Batch
+{
+	BatchJob *jobs;
+	BatchResult *results;
+	u32 jobCount;
+	
+	BatchROM roms[BATCH_MAX_ROMS];
+	u32 romCount;
+	BatchInputScript scripts[BATCH_MAX_SCRIPTS];
+	u32 scriptCount;
+	
+	char outputDir[256];
+	b32 writeOutputs;
+	
+	u32 volatile nextJob;
+	u32 volatile completedJobs;
+	
+	BatchWorker workers[BATCH_MAX_THREADS];
+};
+
+// Reads a file and null terminates it, returns 0 on failure
+internal_func char *ReadBatchTextFile(char *path)
+{
+	char *result = 0;
+	
+	u64 size = 0;
+	u8 *contents = PlatformReadEntireFile(path, &size);
+	if (contents)
+	{
+		result = (char *)PlatformAllocateMemory(size + 1);
+		memcpy(result, contents, size);
+		result[size] = 0;
+		PlatformFreeMemory(contents);
+	}
+	
+	return result;
+}
+
+// Splits off the next line and returns it, 0 when there are no lines left
+internal_func char *NextBatchLine(char **at)
+{
+	char *result = *at;
+	if (!*result)
+	{
+		return 0;
+	}
+	
+	char *end = result;
+	while (*end && *end != '\n')
+	{
+		++end;
+	}
+	
+	*at = *end ? (end + 1) : end;
+	*end = 0;
+	if (end > result && end[-1] == '\r')
+	{
+		end[-1] = 0;
+	}
+	
+	char *comment = strchr(result, '#');
+	if (comment)
+	{
+		*comment = 0;
+	}
+	
+	return result;
+}
+
+// Splits off the next whitespace separated token in a line, 0 when there are none left
+internal_func char *NextBatchToken(char **at)
+{
+	char *result = *at;
+	while (*result == ' ' || *result == '\t')
+	{
+		++result;
+	}
+	
+	if (!*result)
+	{
+		return 0;
+	}
+	
+	char *end = result;
+	while (*end && *end != ' ' && *end != '\t')
+	{
+		++end;
+	}
+	
+	*at = *end ? (end + 1) : end;
+	*end = 0;
+	
+	return result;
+}
+
+internal_func u32 CountBatchLines(char *text)
+{
+	u32 result = 1;
+	for (char *at = text; *at; ++at)
+	{
+		if (*at == '\n')
+		{
+			++result;
+		}
+	}
+	
+	return result;
+}
+
+internal_func BatchROM *GetBatchROM(Batch *batch, char *path)
+{
+	for (u32 romIndex = 0; romIndex < batch->romCount; ++romIndex)
+	{
+		if (strcmp(batch->roms[romIndex].path, path) == 0)
+		{
+			return &batch->roms[romIndex];
+		}
+	}
+	
+	if (batch->romCount >= BATCH_MAX_ROMS)
+	{
+		return 0;
+	}
+	
+	BatchROM *rom = &batch->roms[batch->romCount];
+	rom->contents = PlatformReadEntireFile(path, &rom->size);
+	if (!rom->contents)
+	{
+		return 0;
+	}
+	
+	snprintf(rom->path, sizeof(rom->path), "%s", path);
+	batch->romCount++;
+	
+	return rom;
+}
+
+internal_func BatchInputScript *GetBatchInputScript(Batch *batch, char *path)
+{
+	for (u32 scriptIndex = 0; scriptIndex < batch->scriptCount; ++scriptIndex)
+	{
+		if (strcmp(batch->scripts[scriptIndex].path, path) == 0)
+		{
+			return &batch->scripts[scriptIndex];
+		}
+	}
+	
+	if (batch->scriptCount >= BATCH_MAX_SCRIPTS)
+	{
+		return 0;
+	}
+	
+	char *text = ReadBatchTextFile(path);
+	if (!text)
+	{
+		return 0;
+	}
+	
+	BatchInputScript *script = &batch->scripts[batch->scriptCount];
+	script->events = (BatchInputEvent *)PlatformAllocateMemory(CountBatchLines(text) * sizeof(BatchInputEvent));
+	script->eventCount = 0;
+	
+	b32 valid = true;
+	char *at = text;
+	for (char *line = NextBatchLine(&at); line && valid; line = NextBatchLine(&at))
+	{
+		char *frame = NextBatchToken(&line);
+		if (!frame)
+		{
+			continue;
+		}
+		
+		char *inputName = NextBatchToken(&line);
+		char *state = NextBatchToken(&line);
+		
+		BatchInputEvent *event = &script->events[script->eventCount];
+		event->frame = strtoull(frame, 0, 10);
+		valid = inputName && state && FindMachineInput(inputName, &event->input) &&
+			(strcmp(state, "down") == 0 || strcmp(state, "up") == 0);
+		
+		if (valid)
+		{
+			event->pressed = (strcmp(state, "down") == 0);
+			script->eventCount++;
+			
+			// NOTE(bSalmon): Events are applied in order, so a frame number going backwards is an error
+			if (script->eventCount > 1 && event->frame < event[-1].frame)
+			{
+				valid = false;
+			}
+		}
+	}
+	PlatformFreeMemory(text);
+	
+	if (!valid)
+	{
+		PlatformFreeMemory(script->events);
+		return 0;
+	}
+	
+	snprintf(script->path, sizeof(script->path), "%s", path);
+	batch->scriptCount++;
+	
+	return script;
+}
+
+// Loads a job list and everything it refers to, errors are printed with the line they are on
+internal_func b32 LoadBatchJobList(Batch *batch, char *path)
+{
+	char *text = ReadBatchTextFile(path);
+	if (!text)
+	{
+		fprintf(stderr, "Could not read job list: %s\n", path);
+		return false;
+	}
+	
+	u32 maxJobCount = CountBatchLines(text);
+	batch->jobs = (BatchJob *)PlatformAllocateMemory(maxJobCount * sizeof(BatchJob));
+	batch->results = (BatchResult *)PlatformAllocateMemory(maxJobCount * sizeof(BatchResult));
+	batch->jobCount = 0;
+	
+	b32 result = true;
+	u32 lineNumber = 0;
+	char *at = text;
+	for (char *line = NextBatchLine(&at); line && result; line = NextBatchLine(&at))
+	{
+		++lineNumber;
+		
+		char *romPath = NextBatchToken(&line);
+		if (!romPath)
+		{
+			continue;
+		}
+		
+		BatchJob *job = &batch->jobs[batch->jobCount];
+		*job = {};
+		
+		char *frames = NextBatchToken(&line);
+		job->frameCount = frames ? strtoull(frames, 0, 10) : 0;
+		if (!job->frameCount)
+		{
+			fprintf(stderr, "%s(%u): Missing frame count\n", path, lineNumber);
+			result = false;
+			break;
+		}
+		
+		job->rom = GetBatchROM(batch, romPath);
+		if (!job->rom)
+		{
+			fprintf(stderr, "%s(%u): Could not load ROM %s\n", path, lineNumber, romPath);
+			result = false;
+			break;
+		}
+		
+		for (char *option = NextBatchToken(&line); option; option = NextBatchToken(&line))
+		{
+			if (strncmp(option, "inputs=", 7) == 0)
+			{
+				job->inputs = GetBatchInputScript(batch, option + 7);
+				if (!job->inputs)
+				{
+					fprintf(stderr, "%s(%u): Could not load input script %s\n", path, lineNumber, option + 7);
+					result = false;
+				}
+			}
+			else if (strcmp(option, "ram") == 0)
+			{
+				job->outputFlags |= BATCH_OUTPUT_RAM;
+			}
+			else if (strcmp(option, "frame") == 0)
+			{
+				job->outputFlags |= BATCH_OUTPUT_FRAME;
+			}
+			else
+			{
+				fprintf(stderr, "%s(%u): Unknown option %s\n", path, lineNumber, option);
+				result = false;
+			}
+		}
+		
+		batch->jobCount++;
+	}
+	PlatformFreeMemory(text);
+	
+	return result;
+}
+
+internal_func void WriteBatchOutputs(Batch *batch, BatchWorker *worker, u32 jobIndex, BatchJob *job, BatchResult *result, CPUState *cpuState)
+{
+	char outputPath[512];
+	
+	if (job->outputFlags & BATCH_OUTPUT_RAM)
+	{
+		snprintf(outputPath, sizeof(outputPath), "%s/job%u.ram", batch->outputDir, jobIndex);
+		if (!PlatformWriteEntireFile(outputPath, &cpuState->memory[0x2000], 0x2000))
+		{
+			result->outputFailed = true;
+		}
+	}
+	
+	if (job->outputFlags & BATCH_OUTPUT_FRAME)
+	{
+		RenderVideoMemContents(&worker->frame, cpuState, false);
+		
+		u8 *output = worker->ppm;
+		output += snprintf((char *)output, 32, "P6\n%d %d\n255\n", worker->frame.width, worker->frame.height);
+		
+		u8 *row = (u8 *)worker->frame.memory;
+		for (s32 y = 0; y < worker->frame.height; ++y)
+		{
+			u32 *pixel = (u32 *)row;
+			for (s32 x = 0; x < worker->frame.width; ++x)
+			{
+				*output++ = (u8)(pixel[x] >> 16);
+				*output++ = (u8)(pixel[x] >> 8);
+				*output++ = (u8)pixel[x];
+			}
+			row += worker->frame.pitch;
+		}
+		
+		snprintf(outputPath, sizeof(outputPath), "%s/job%u.ppm", batch->outputDir, jobIndex);
+		if (!PlatformWriteEntireFile(outputPath, worker->ppm, output - worker->ppm))
+		{
+			result->outputFailed = true;
+		}
+	}
+}
+
+internal_func void RunBatchJob(Batch *batch, BatchWorker *worker, u32 jobIndex)
+{
+	BatchJob *job = &batch->jobs[jobIndex];
+	BatchResult *result = &batch->results[jobIndex];
+	
+	u64 startTime = PlatformGetWallClock();
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	machine.romSize = 0x2000;
+	
+	memset(worker->memory, 0, BATCH_MEMORY_SIZE);
+	memcpy(worker->memory, job->rom->contents, (job->rom->size < machine.romSize) ? job->rom->size : machine.romSize);
+	cpuState.memory = worker->memory;
+	ResetMachine(&cpuState, &machine);
+	
+	u32 nextEvent = 0;
+	for (u64 frameIndex = 0; frameIndex < job->frameCount && !IsMachineStopped(&cpuState); ++frameIndex)
+	{
+		if (job->inputs)
+		{
+			BatchInputScript *inputs = job->inputs;
+			while (nextEvent < inputs->eventCount && inputs->events[nextEvent].frame <= frameIndex)
+			{
+				SetMachineInput(&machine, inputs->events[nextEvent].input, inputs->events[nextEvent].pressed);
+				++nextEvent;
+			}
+		}
+		
+		EmulateFrame(&cpuState, &machine);
+	}
+	
+	result->workerIndex = worker->workerIndex;
+	result->frames = machine.frameCount;
+	result->cycles = machine.cycles;
+	result->stateHash = HashMachineState(&cpuState, &machine);
+	result->frameHash = HashVideoMemory(&cpuState, false);
+	result->ramHash = HashMemory64(&cpuState.memory[0x2000], 0x2000, 0);
+	
+	if (batch->writeOutputs)
+	{
+		WriteBatchOutputs(batch, worker, jobIndex, job, result, &cpuState);
+	}
+	
+	result->seconds = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+}
+
+internal_func PLATFORM_THREAD_PROC(BatchWorkerThread)
+{
+	BatchWorker *worker = (BatchWorker *)data;
+	Batch *batch = worker->batch;
+	
+	for (;;)
+	{
+		u32 jobIndex = AtomicAddU32(&batch->nextJob, 1);
+		if (jobIndex >= batch->jobCount)
+		{
+			break;
+		}
+		
+		RunBatchJob(batch, worker, jobIndex);
+		
+		CompletePreviousWritesBeforeFutureWrites;
+		batch->results[jobIndex].completed = true;
+		AtomicAddU32(&batch->completedJobs, 1);
+	}
+}
+
+// Runs every job in the batch across threadCount workers and returns the wall clock time it took
+internal_func f64 RunBatch(Batch *batch, u32 threadCount)
+{
+	if (threadCount < 1)
+	{
+		threadCount = 1;
+	}
+	else if (threadCount > BATCH_MAX_THREADS)
+	{
+		threadCount = BATCH_MAX_THREADS;
+	}
+	
+	memset(batch->results, 0, batch->jobCount * sizeof(BatchResult));
+	batch->nextJob = 0;
+	batch->completedJobs = 0;
+	
+	u64 startTime = PlatformGetWallClock();
+	
+	for (u32 workerIndex = 0; workerIndex < threadCount; ++workerIndex)
+	{
+		BatchWorker *worker = &batch->workers[workerIndex];
+		worker->batch = batch;
+		worker->workerIndex = workerIndex;
+		
+		if (!worker->memory)
+		{
+			worker->memory = (u8 *)PlatformAllocateMemory(BATCH_MEMORY_SIZE);
+			
+			worker->frame.width = 224;
+			worker->frame.height = 256;
+			worker->frame.bytesPerPixel = 4;
+			worker->frame.pitch = worker->frame.width * 4;
+			worker->frame.format = FrameFormat::ARGB32;
+			worker->frame.memory = PlatformAllocateMemory(worker->frame.pitch * worker->frame.height);
+			worker->ppm = (u8 *)PlatformAllocateMemory((worker->frame.width * worker->frame.height * 3) + 32);
+		}
+		
+		worker->thread = PlatformStartThread(BatchWorkerThread, worker);
+	}
+	
+	for (u32 workerIndex = 0; workerIndex < threadCount; ++workerIndex)
+	{
+		PlatformJoinThread(batch->workers[workerIndex].thread);
+		batch->workers[workerIndex].thread = 0;
+	}
+	
+	f64 result = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	return result;
+}
+
+internal_func void FreeBatch(Batch *batch)
+{
+	for (u32 workerIndex = 0; workerIndex < BATCH_MAX_THREADS; ++workerIndex)
+	{
+		BatchWorker *worker = &batch->workers[workerIndex];
+		PlatformFreeMemory(worker->memory);
+		PlatformFreeMemory(worker->frame.memory);
+		PlatformFreeMemory(worker->ppm);
+	}
+	
+	for (u32 romIndex = 0; romIndex < batch->romCount; ++romIndex)
+	{
+		PlatformFreeMemory(batch->roms[romIndex].contents);
+	}
+	
+	for (u32 scriptIndex = 0; scriptIndex < batch->scriptCount; ++scriptIndex)
+	{
+		PlatformFreeMemory(batch->scripts[scriptIndex].events);
+	}
+	
+	PlatformFreeMemory(batch->jobs);
+	PlatformFreeMemory(batch->results);
+	*batch = {};
+}
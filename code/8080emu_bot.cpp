@@ -0,0 +1,89 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_bot.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Bot Player, a deterministic stand-in for a person at the cabinet so load tests have
+instances doing different things. Inserts a coin, starts a one player game and then holds
+random moves and shots for random lengths of time. The same seed always plays the same game.
+*/
+
+struct BotPlayer
+{
+	u32 randomState;
+	MachineInput heldInput;
+	u32 framesLeft;
+};
+
+internal_func void InitBotPlayer(BotPlayer *bot, u32 seed)
+{
+	*bot = {};
+	bot->randomState = (seed * 0x9E3779B9) | 1;
+	bot->heldInput = MachineInput::P1SHOOT;
+}
+
+internal_func u32 NextBotRandom(BotPlayer *bot)
+{
+	// NOTE(bSalmon): xorshift32
+	u32 x = bot->randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	bot->randomState = x;
+	
+	return x;
+}
+
+// Sets the bot's inputs for the next frame, call once before every frame
+internal_func void UpdateBotPlayer(BotPlayer *bot, MachineState *machine)
+{
+	if (machine->frameCount == 60)
+	{
+		SetMachineInput(machine, MachineInput::COIN, true);
+	}
+	else if (machine->frameCount == 70)
+	{
+		SetMachineInput(machine, MachineInput::COIN, false);
+	}
+	else if (machine->frameCount == 120)
+	{
+		SetMachineInput(machine, MachineInput::P1START, true);
+	}
+	else if (machine->frameCount == 130)
+	{
+		SetMachineInput(machine, MachineInput::P1START, false);
+	}
+	else if (machine->frameCount > 130)
+	{
+		if (bot->framesLeft == 0)
+		{
+			SetMachineInput(machine, bot->heldInput, false);
+			
+			local_persist const MachineInput botInputs[] = {MachineInput::P1SHOOT, MachineInput::P1LEFT, MachineInput::P1RIGHT};
+			u32 random = NextBotRandom(bot);
+			bot->heldInput = botInputs[random % ARRAY_COUNT(botInputs)];
+			bot->framesLeft = 4 + ((random >> 8) % 30);
+			SetMachineInput(machine, bot->heldInput, true);
+		}
+		
+		bot->framesLeft--;
+	}
+}
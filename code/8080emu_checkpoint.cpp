@@ -0,0 +1,403 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_checkpoint.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Checkpoints, periodic save states written to disk without pausing emulation.
+
+The emulation thread copies the state into a slot of a pool allocated up front, a bounded single
+producer/single consumer ring, and carries on. A background writer thread takes every slot that is
+waiting as one batch and hands it to PlatformWriteFileBatch, so checkpoints that pile up behind a
+slow disk share a single round of syncs. The emulation thread never waits on the writer or the disk.
+
+A path with a number field such as %llu is numbered with the frame count and every checkpoint is
+kept (see 8080emu_path.cpp), if the ring is full the new one is dropped and counted. Otherwise the
+one file is replaced each time and only the newest checkpoint matters. Only the last of a batch is
+written and the rest go straight back to the ring, and with the ring full the new checkpoint
+replaces the newest waiting one the writer hasn't taken yet. Both are counted as superseded.
+
+Files are ordinary save states, see 8080emu_savestate.cpp, compressed on the writer thread if the
+writer was started with compress.
+
+Latency is measured from the copy on the emulation thread to the file being synced.
+
+Needs 8080emu_savestate.cpp and 8080emu_path.cpp.
+*/
+
+#include <stdio.h>
+
+#define CHECKPOINT_QUEUE_SIZE 16
+
+enum class CheckpointWriterError
+{
+	NONE,
+	PATH_TOO_LONG,
+	BAD_NUMBER_FIELD,
+	OUT_OF_MEMORY,
+	NO_THREAD
+};
+
+// NOTE(bSalmon): Indexed by CheckpointWriterError
+global_var char *checkpointWriterErrorNames[] = {
+	"None",
+	"the path is too long",
+	"it has a % that isn't one number field such as %llu",
+	"the checkpoint slots could not be allocated",
+	"the writer thread could not be started"
+};
+
+struct CheckpointStats
+{
+	u64 submittedCheckpoints;
+	u64 writtenCheckpoints;
+	u64 droppedCheckpoints;
+	u64 supersededCheckpoints;
+	u64 failedCheckpoints;
+	u64 batches;
+	u64 bytesWritten;
+	u32 queueDepth;
+	u32 maxQueueDepth;
+	u32 maxBatchSize;
+	
+	f64 totalLatency;
+	f64 maxLatency;
+	f64 totalSubmitTime;
+	f64 maxSubmitTime;
+};
+
+struct CheckpointSlot
+{
+	SaveState state;
+	u64 submitTime;
+	u8 compressed[COMPRESSED_STATE_MAX_SIZE];
+};
+
+struct CheckpointWriter
+{
+	NumberedPath path;
+	b32 compress;
+	u64 romHash;
+	
+	// NOTE(bSalmon): Indices only ever increase, slot = index % CHECKPOINT_QUEUE_SIZE
+	u32 volatile writeIndex;
+	u32 volatile readIndex;
+	u32 volatile finished;
+	CheckpointSlot *slots;
+	
+	// NOTE(bSalmon): The writer takes a batch by setting claimedIndex under slotLock, so
+	// ReplaceNewestCheckpoint can't be overwriting a slot while it is being taken
+	u32 volatile slotLock;
+	u32 volatile claimedIndex;
+	
+	PlatformSemaphore *checkpointsReady;
+	PlatformThread *writerThread;
+	
+	// NOTE(bSalmon): Each thread only ever writes its own stats. The writer thread's are copied out
+	// after every batch with a sequence number around the copy, odd while it is being written, so
+	// GetCheckpointStats can tell when it read a copy that was being changed and read it again
+	CheckpointStats submitStats;
+	CheckpointStats writeStats;
+	CheckpointStats publishedWriteStats;
+	u32 volatile publishedSequence;
+};
+
+internal_func void WriteCheckpointBatch(CheckpointWriter *writer, u32 readIndex, u32 batchSize)
+{
+	char paths[CHECKPOINT_QUEUE_SIZE][NUMBERED_PATH_MAX + 32];
+	PlatformFileWrite writes[CHECKPOINT_QUEUE_SIZE];
+	CheckpointSlot *writeSlots[CHECKPOINT_QUEUE_SIZE];
+	u32 writeCount = 0;
+	
+	u32 firstWritten = writer->path.numbered ? 0 : (batchSize - 1);
+	writer->writeStats.supersededCheckpoints += firstWritten;
+	for (u32 batchIndex = firstWritten; batchIndex < batchSize; ++batchIndex)
+	{
+		CheckpointSlot *slot = &writer->slots[(readIndex + batchIndex) % CHECKPOINT_QUEUE_SIZE];
+		
+		PlatformFileWrite *write = &writes[writeCount];
+		*write = {};
+		FormatNumberedPath(&writer->path, slot->state.header.frameCount, paths[writeCount], sizeof(paths[writeCount]));
+		write->path = paths[writeCount];
+		if (writer->compress)
+		{
+			write->memory = slot->compressed;
+			write->size = CompressSaveState(slot->compressed, &slot->state);
+		}
+		else
+		{
+			write->memory = &slot->state;
+			write->size = sizeof(slot->state);
+		}
+		writeSlots[writeCount++] = slot;
+	}
+	
+	PlatformWriteFileBatch(writes, writeCount);
+	u64 syncedTime = PlatformGetWallClock();
+	
+	writer->writeStats.batches++;
+	if (batchSize > writer->writeStats.maxBatchSize)
+	{
+		writer->writeStats.maxBatchSize = batchSize;
+	}
+	
+	for (u32 writeIndex = 0; writeIndex < writeCount; ++writeIndex)
+	{
+		if (writes[writeIndex].succeeded)
+		{
+			f64 latency = PlatformGetSecondsElapsed(writeSlots[writeIndex]->submitTime, syncedTime);
+			writer->writeStats.totalLatency += latency;
+			if (latency > writer->writeStats.maxLatency)
+			{
+				writer->writeStats.maxLatency = latency;
+			}
+			writer->writeStats.bytesWritten += writes[writeIndex].size;
+			writer->writeStats.writtenCheckpoints++;
+		}
+		else
+		{
+			writer->writeStats.failedCheckpoints++;
+		}
+	}
+}
+
+// Writer thread only
+internal_func void PublishCheckpointWriteStats(CheckpointWriter *writer)
+{
+	writer->publishedSequence++;
+	CompletePreviousWritesBeforeFutureWrites;
+	writer->publishedWriteStats = writer->writeStats;
+	CompletePreviousWritesBeforeFutureWrites;
+	writer->publishedSequence++;
+}
+
+// Writer thread only, returns the end of the batch
+internal_func u32 ClaimCheckpointBatch(CheckpointWriter *writer)
+{
+	while (AtomicCompareExchangeU32(&writer->slotLock, 1, 0) != 0)
+	{
+		PlatformYieldThread();
+	}
+	
+	u32 result = writer->writeIndex;
+	writer->claimedIndex = result;
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	writer->slotLock = 0;
+	
+	return result;
+}
+
+internal_func PLATFORM_THREAD_PROC(CheckpointWriterThread)
+{
+	CheckpointWriter *writer = (CheckpointWriter *)data;
+	
+	for (;;)
+	{
+		u32 readIndex = writer->readIndex;
+		u32 writeIndex = writer->writeIndex;
+		if (readIndex != writeIndex)
+		{
+			writeIndex = ClaimCheckpointBatch(writer);
+			CompletePreviousReadsBeforeFutureReads;
+			
+			// NOTE(bSalmon): One file only needs the last slot of the batch, the rest are handed straight back
+			if (!writer->path.numbered)
+			{
+				writer->readIndex = writeIndex - 1;
+			}
+			
+			// NOTE(bSalmon): Slots are only handed back once the whole batch is on disk
+			WriteCheckpointBatch(writer, readIndex, writeIndex - readIndex);
+			PublishCheckpointWriteStats(writer);
+			
+			CompletePreviousWritesBeforeFutureWrites;
+			writer->readIndex = writeIndex;
+		}
+		else if (writer->finished)
+		{
+			// NOTE(bSalmon): Check again, the last checkpoint may have been published before finished was seen
+			CompletePreviousReadsBeforeFutureReads;
+			if (readIndex == writer->writeIndex)
+			{
+				break;
+			}
+		}
+		else
+		{
+			PlatformWaitSemaphore(writer->checkpointsReady);
+		}
+	}
+}
+
+internal_func CheckpointWriterError BeginCheckpointWriter(CheckpointWriter *writer, char *path, CPUState *cpuState,
+															b32 compress = false)
+{
+	*writer = {};
+	
+	if (strlen(path) >= NUMBERED_PATH_MAX)
+	{
+		return CheckpointWriterError::PATH_TOO_LONG;
+	}
+	
+	// NOTE(bSalmon): The path is never used as a format string, a stray % is refused here
+	if (!ParseNumberedPath(&writer->path, path))
+	{
+		return CheckpointWriterError::BAD_NUMBER_FIELD;
+	}
+	writer->compress = compress;
+	writer->romHash = GetROMHash(cpuState->memory);
+	
+	writer->slots = (CheckpointSlot *)PlatformAllocateMemory(sizeof(CheckpointSlot) * CHECKPOINT_QUEUE_SIZE);
+	if (!writer->slots)
+	{
+		return CheckpointWriterError::OUT_OF_MEMORY;
+	}
+	
+	// NOTE(bSalmon): Touch the pool now so the first checkpoints don't take page faults on the emulation thread
+	memset(writer->slots, 0, sizeof(CheckpointSlot) * CHECKPOINT_QUEUE_SIZE);
+	
+	writer->checkpointsReady = PlatformCreateSemaphore(0);
+	writer->writerThread = PlatformStartThread(CheckpointWriterThread, writer);
+	if (!writer->writerThread)
+	{
+		PlatformDestroySemaphore(writer->checkpointsReady);
+		PlatformFreeMemory(writer->slots);
+		writer->slots = 0;
+		return CheckpointWriterError::NO_THREAD;
+	}
+	
+	return CheckpointWriterError::NONE;
+}
+
+// Emulation thread only, returns false if the lock is held or the writer has taken every waiting slot
+internal_func b32 ReplaceNewestCheckpoint(CheckpointWriter *writer, CPUState *cpuState, MachineState *machine, u64 submitTime)
+{
+	b32 result = false;
+	
+	// NOTE(bSalmon): Only tried once, the writer holds the lock just long enough to read writeIndex
+	if (AtomicCompareExchangeU32(&writer->slotLock, 1, 0) == 0)
+	{
+		u32 writeIndex = writer->writeIndex;
+		if (writer->claimedIndex != writeIndex)
+		{
+			CheckpointSlot *slot = &writer->slots[(writeIndex - 1) % CHECKPOINT_QUEUE_SIZE];
+			SaveMachineState(&slot->state, cpuState, machine, writer->romHash);
+			slot->submitTime = submitTime;
+			writer->submitStats.supersededCheckpoints++;
+			result = true;
+		}
+		
+		CompletePreviousWritesBeforeFutureWrites;
+		writer->slotLock = 0;
+	}
+	
+	return result;
+}
+
+// Called from the emulation thread, copies the state and never blocks
+internal_func void SubmitCheckpoint(CheckpointWriter *writer, CPUState *cpuState, MachineState *machine)
+{
+	u64 submitTime = PlatformGetWallClock();
+	writer->submitStats.submittedCheckpoints++;
+	
+	u32 writeIndex = writer->writeIndex;
+	u32 queueDepth = writeIndex - writer->readIndex;
+	if (queueDepth >= CHECKPOINT_QUEUE_SIZE)
+	{
+		if (writer->path.numbered || !ReplaceNewestCheckpoint(writer, cpuState, machine, submitTime))
+		{
+			writer->submitStats.droppedCheckpoints++;
+			return;
+		}
+	}
+	else
+	{
+		CheckpointSlot *slot = &writer->slots[writeIndex % CHECKPOINT_QUEUE_SIZE];
+		SaveMachineState(&slot->state, cpuState, machine, writer->romHash);
+		slot->submitTime = submitTime;
+		
+		CompletePreviousWritesBeforeFutureWrites;
+		writer->writeIndex = writeIndex + 1;
+		PlatformSignalSemaphore(writer->checkpointsReady);
+		
+		writer->submitStats.queueDepth = queueDepth + 1;
+		if (writer->submitStats.queueDepth > writer->submitStats.maxQueueDepth)
+		{
+			writer->submitStats.maxQueueDepth = writer->submitStats.queueDepth;
+		}
+	}
+	
+	f64 submitSeconds = PlatformGetSecondsElapsed(submitTime, PlatformGetWallClock());
+	writer->submitStats.totalSubmitTime += submitSeconds;
+	if (submitSeconds > writer->submitStats.maxSubmitTime)
+	{
+		writer->submitStats.maxSubmitTime = submitSeconds;
+	}
+}
+
+// Called from the emulation thread, the writer's side is from the last batch it finished
+internal_func CheckpointStats GetCheckpointStats(CheckpointWriter *writer)
+{
+	CheckpointStats written;
+	for (;;)
+	{
+		u32 sequence = writer->publishedSequence;
+		CompletePreviousReadsBeforeFutureReads;
+		if (!(sequence & 1))
+		{
+			written = writer->publishedWriteStats;
+			CompletePreviousReadsBeforeFutureReads;
+			if (writer->publishedSequence == sequence)
+			{
+				break;
+			}
+		}
+	}
+	
+	CheckpointStats result = writer->submitStats;
+	result.writtenCheckpoints = written.writtenCheckpoints;
+	result.supersededCheckpoints += written.supersededCheckpoints;
+	result.failedCheckpoints = written.failedCheckpoints;
+	result.batches = written.batches;
+	result.bytesWritten = written.bytesWritten;
+	result.maxBatchSize = written.maxBatchSize;
+	result.totalLatency = written.totalLatency;
+	result.maxLatency = written.maxLatency;
+	result.queueDepth = writer->writeIndex - writer->readIndex;
+	
+	return result;
+}
+
+// Waits for the writer to finish the queued checkpoints
+internal_func void EndCheckpointWriter(CheckpointWriter *writer)
+{
+	if (writer->writerThread)
+	{
+		writer->finished = true;
+		PlatformSignalSemaphore(writer->checkpointsReady);
+		PlatformJoinThread(writer->writerThread);
+		writer->writerThread = 0;
+		PlatformDestroySemaphore(writer->checkpointsReady);
+	}
+	
+	PlatformFreeMemory(writer->slots);
+	writer->slots = 0;
+}
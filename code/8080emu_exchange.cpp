@@ -0,0 +1,255 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_exchange.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Lets the emulation run on its own thread, separate from the thread pumping window messages.
+
+Input Queue - Wait-free single producer/single consumer ring of timestamped events, the UI
+thread pushes and the emulation thread pops at the start of each frame. A full queue drops
+the event rather than waiting, so neither side can be held up by the other.
+
+Frame Exchange - Triple buffer, the emulation thread always has a buffer to render into and the
+UI thread always has the newest finished frame to present. Finished frames are swapped through
+a single atomic index, a frame that is replaced before the UI picks it up is counted as skipped.
+
+Both keep latency metrics, input latency is push to pop and frame latency is publish to present.
+*/
+
+#define INPUT_QUEUE_SIZE 256
+
+enum class InputEventType
+{
+	KEY_DOWN,
+	KEY_UP,
+	SET_COLOUR,
+	LOAD_ROM,
+	SAVE_STATE,
+	LOAD_STATE,
+	SET_REWIND,
+	RECORD_MOVIE,
+	PLAY_MOVIE,
+	STOP_MOVIE
+};
+
+struct InputEvent
+{
+	InputEventType type;
+	u64 timestamp;
+	
+	// NOTE(bSalmon): KEY_DOWN/KEY_UP use port and key, SET_COLOUR and SET_REWIND use value,
+	// LOAD_ROM passes ownership of a PlatformAllocateMemory'd filename in data, SAVE_STATE,
+	// LOAD_STATE and the movie events use nothing
+	u8 port;
+	u8 key;
+	b32 value;
+	void *data;
+};
+
+struct LatencyStats
+{
+	u64 count;
+	f64 totalSeconds;
+	f64 maxSeconds;
+};
+
+struct InputQueue
+{
+	// NOTE(bSalmon): Indices only ever increase, slot = index % INPUT_QUEUE_SIZE
+	u32 volatile writeIndex;
+	u32 volatile readIndex;
+	InputEvent events[INPUT_QUEUE_SIZE];
+	
+	// NOTE(bSalmon): Written by the producer only
+	u64 pushedEvents;
+	u64 droppedEvents;
+	
+	// NOTE(bSalmon): Written by the consumer only
+	LatencyStats latency;
+};
+
+// Flags packed in with the index of the middle buffer
+#define FRAME_EXCHANGE_INDEX_MASK 0x3
+#define FRAME_EXCHANGE_FRESH 0x4
+
+struct ExchangeFrame
+{
+	BackBuffer buffer;
+	u64 frameIndex;
+	u64 sequence;
+	u64 publishTime;
+};
+
+struct FrameExchange
+{
+	ExchangeFrame frames[3];
+	
+	// NOTE(bSalmon): Each side owns one index, the third is swapped through middle
+	u32 writeIndex;
+	u32 volatile middle;
+	u32 readIndex;
+	
+	// NOTE(bSalmon): Written by the emulation thread only
+	u64 publishedFrames;
+	
+	// NOTE(bSalmon): Written by the UI thread only
+	u64 lastAcquiredSequence;
+	u64 skippedFrames;
+	LatencyStats latency;
+};
+
+internal_func void RecordLatency(LatencyStats *stats, f64 seconds)
+{
+	stats->count++;
+	stats->totalSeconds += seconds;
+	if (seconds > stats->maxSeconds)
+	{
+		stats->maxSeconds = seconds;
+	}
+}
+
+internal_func f64 GetAverageLatency(LatencyStats *stats)
+{
+	f64 result = stats->count ? (stats->totalSeconds / stats->count) : 0.0;
+	return result;
+}
+
+// Producer side, returns false and drops the event if the queue is full
+internal_func b32 PushInputEvent(InputQueue *queue, InputEvent *event)
+{
+	u32 writeIndex = queue->writeIndex;
+	if ((writeIndex - queue->readIndex) >= INPUT_QUEUE_SIZE)
+	{
+		queue->droppedEvents++;
+		return false;
+	}
+	
+	queue->events[writeIndex % INPUT_QUEUE_SIZE] = *event;
+	queue->events[writeIndex % INPUT_QUEUE_SIZE].timestamp = PlatformGetWallClock();
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	queue->writeIndex = writeIndex + 1;
+	queue->pushedEvents++;
+	
+	return true;
+}
+
+// Consumer side, returns false if there is nothing queued
+internal_func b32 PopInputEvent(InputQueue *queue, InputEvent *event)
+{
+	u32 readIndex = queue->readIndex;
+	if (readIndex == queue->writeIndex)
+	{
+		return false;
+	}
+	
+	CompletePreviousReadsBeforeFutureReads;
+	*event = queue->events[readIndex % INPUT_QUEUE_SIZE];
+	RecordLatency(&queue->latency, PlatformGetSecondsElapsed(event->timestamp, PlatformGetWallClock()));
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	queue->readIndex = readIndex + 1;
+	
+	return true;
+}
+
+internal_func void InitFrameExchange(FrameExchange *exchange, FrameFormat format, s32 width, s32 height)
+{
+	*exchange = {};
+	
+	for (s32 frameIndex = 0; frameIndex < (s32)ARRAY_COUNT(exchange->frames); ++frameIndex)
+	{
+		BackBuffer *buffer = &exchange->frames[frameIndex].buffer;
+		buffer->width = width;
+		buffer->height = height;
+		buffer->format = format;
+		buffer->bytesPerPixel = (format == FrameFormat::ARGB32) ? 4 : 1;
+		buffer->pitch = GetFrameFormatPitch(format, width);
+		buffer->memory = PlatformAllocateMemory((u64)buffer->pitch * height);
+	}
+	
+	exchange->readIndex = 0;
+	exchange->middle = 1;
+	exchange->writeIndex = 2;
+}
+
+internal_func void FreeFrameExchange(FrameExchange *exchange)
+{
+	for (s32 frameIndex = 0; frameIndex < (s32)ARRAY_COUNT(exchange->frames); ++frameIndex)
+	{
+		PlatformFreeMemory(exchange->frames[frameIndex].buffer.memory);
+	}
+	
+	*exchange = {};
+}
+
+// Emulation side, the buffer to render the next frame into
+internal_func ExchangeFrame *GetWriteFrame(FrameExchange *exchange)
+{
+	ExchangeFrame *result = &exchange->frames[exchange->writeIndex];
+	return result;
+}
+
+// Emulation side, hands the write frame over and takes back whichever buffer was in the middle
+internal_func void PublishFrame(FrameExchange *exchange, u64 frameIndex)
+{
+	ExchangeFrame *frame = &exchange->frames[exchange->writeIndex];
+	frame->frameIndex = frameIndex;
+	frame->sequence = ++exchange->publishedFrames;
+	frame->publishTime = PlatformGetWallClock();
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	u32 previousMiddle = AtomicExchangeU32(&exchange->middle, exchange->writeIndex | FRAME_EXCHANGE_FRESH);
+	exchange->writeIndex = previousMiddle & FRAME_EXCHANGE_INDEX_MASK;
+}
+
+// UI side, swaps in the newest published frame if there is one, returns false if nothing new
+internal_func b32 AcquireFrame(FrameExchange *exchange)
+{
+	if (!(exchange->middle & FRAME_EXCHANGE_FRESH))
+	{
+		return false;
+	}
+	
+	u32 previousMiddle = AtomicExchangeU32(&exchange->middle, exchange->readIndex);
+	exchange->readIndex = previousMiddle & FRAME_EXCHANGE_INDEX_MASK;
+	CompletePreviousReadsBeforeFutureReads;
+	
+	ExchangeFrame *frame = &exchange->frames[exchange->readIndex];
+	exchange->skippedFrames += frame->sequence - (exchange->lastAcquiredSequence + 1);
+	exchange->lastAcquiredSequence = frame->sequence;
+	
+	return true;
+}
+
+// UI side, the most recently acquired frame
+internal_func ExchangeFrame *GetReadFrame(FrameExchange *exchange)
+{
+	ExchangeFrame *result = &exchange->frames[exchange->readIndex];
+	return result;
+}
+
+// UI side, call once the read frame is on screen
+internal_func void RecordFramePresented(FrameExchange *exchange)
+{
+	ExchangeFrame *frame = GetReadFrame(exchange);
+	RecordLatency(&exchange->latency, PlatformGetSecondsElapsed(frame->publishTime, PlatformGetWallClock()));
+}
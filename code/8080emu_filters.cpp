@@ -0,0 +1,663 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_filters.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Post-processing Filter Pipeline, run on the Back Buffer after RenderVideoMemContents.
+
+Each stage reads the output of the previous stage and writes into its own buffer.
+The output rows of a stage are split into tiles which are handed to the platform
+work queue, all tiles of a stage are completed before the next stage starts.
+If no work queue is given the tiles are run on the calling thread.
+
+Stages:
+NEAREST   - Integer nearest neighbour scale by param
+SCALE2X   - AdvMAME2x edge directed 2x scale
+SCALE3X   - AdvMAME3x edge directed 3x scale
+SCANLINES - Darkens the last row of every param rows, use the scale of the previous stages
+CRT       - RGB triad mask, horizontal bleed and scanlines every param rows
+
+All buffers are 32-bit, Mem Order BB GG RR xx.
+*/
+
+#define MAX_FILTER_STAGES 8
+#define MAX_FILTER_TILES 128
+#define DEFAULT_FILTER_TILE_ROWS 32
+
+enum class FilterType
+{
+	NEAREST,
+	SCALE2X,
+	SCALE3X,
+	SCANLINES,
+	CRT
+};
+
+enum class FilterPreset
+{
+	NONE,
+	SCALE2X,
+	SCALE4X,
+	SCALE6X,
+	SCANLINES,
+	CRT
+};
+
+struct FilterStage
+{
+	FilterType type;
+	s32 param;
+	s32 scale;
+	
+	BackBuffer output;
+	
+	// NOTE(bSalmon): Per column channel multipliers for the CRT and Scanline stages
+	u32 *normalRowFactors;
+	u32 *darkRowFactors;
+	
+	f64 lastSeconds;
+	f64 totalSeconds;
+	u64 runCount;
+};
+
+struct FilterTile
+{
+	FilterStage *stage;
+	BackBuffer *source;
+	s32 startRow;
+	s32 endRow;
+};
+
+struct FilterPipeline
+{
+	PlatformWorkQueue *queue;
+	s32 tileRows;
+	
+	s32 sourceWidth;
+	s32 sourceHeight;
+	
+	s32 stageCount;
+	FilterStage stages[MAX_FILTER_STAGES];
+	FilterTile tiles[MAX_FILTER_TILES];
+	
+	f64 lastSeconds;
+};
+
+inline __m128i BlendPixels(__m128i original, __m128i replacement, __m128i mask)
+{
+	__m128i result = _mm_or_si128(_mm_and_si128(mask, replacement), _mm_andnot_si128(mask, original));
+	return result;
+}
+
+inline u32 ClampedPixel(u32 *row, s32 x, s32 width)
+{
+	x = (x < 0) ? 0 : x;
+	x = (x >= width) ? (width - 1) : x;
+	return row[x];
+}
+
+// Multiply every channel of the pixels by the matching channel of the factors, 255 = 1.0
+internal_func void ModulatePixelRow(u32 *dest, u32 *source, u32 *factors, s32 count)
+{
+	s32 x = 0;
+	__m128i zero = _mm_setzero_si128();
+	__m128i round = _mm_set1_epi16(255);
+	for (; x + 4 <= count; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((__m128i *)&source[x]);
+		__m128i factor = _mm_loadu_si128((__m128i *)&factors[x]);
+		
+		__m128i low = _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(factor, zero));
+		__m128i high = _mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(factor, zero));
+		low = _mm_srli_epi16(_mm_add_epi16(low, round), 8);
+		high = _mm_srli_epi16(_mm_add_epi16(high, round), 8);
+		
+		_mm_storeu_si128((__m128i *)&dest[x], _mm_packus_epi16(low, high));
+	}
+	
+	for (; x < count; ++x)
+	{
+		u32 result = 0;
+		for (s32 shift = 0; shift < 32; shift += 8)
+		{
+			u32 channel = (source[x] >> shift) & 0xFF;
+			u32 factor = (factors[x] >> shift) & 0xFF;
+			result |= (((channel * factor) + 255) >> 8) << shift;
+		}
+		dest[x] = result;
+	}
+}
+
+internal_func void Scale2xPixelRange(u32 *dest, u32 *above, u32 *centre, u32 *below, s32 width, b32 bottomHalf, s32 startX, s32 endX)
+{
+	for (s32 x = startX; x < endX; ++x)
+	{
+		u32 p = centre[x];
+		u32 a = above[x];
+		u32 d = below[x];
+		u32 c = ClampedPixel(centre, x - 1, width);
+		u32 b = ClampedPixel(centre, x + 1, width);
+		
+		if (!bottomHalf)
+		{
+			dest[x * 2] = (c == a && c != d && a != b) ? a : p;
+			dest[(x * 2) + 1] = (a == b && a != c && b != d) ? b : p;
+		}
+		else
+		{
+			dest[x * 2] = (d == c && d != b && c != a) ? c : p;
+			dest[(x * 2) + 1] = (b == d && b != a && d != c) ? d : p;
+		}
+	}
+}
+
+internal_func void Scale2xPixelRow(u32 *dest, u32 *above, u32 *centre, u32 *below, s32 width, b32 bottomHalf)
+{
+	// NOTE(bSalmon): Neighbour names follow the AdvMAME2x description
+	//   A
+	// C P B
+	//   D
+	// The first and last pixels need clamped neighbours so they go through the scalar path
+	Scale2xPixelRange(dest, above, centre, below, width, bottomHalf, 0, 1);
+	
+	s32 x = 1;
+	for (; x + 5 <= width; x += 4)
+	{
+		__m128i p = _mm_loadu_si128((__m128i *)&centre[x]);
+		__m128i a = _mm_loadu_si128((__m128i *)&above[x]);
+		__m128i d = _mm_loadu_si128((__m128i *)&below[x]);
+		__m128i c = _mm_loadu_si128((__m128i *)&centre[x - 1]);
+		__m128i b = _mm_loadu_si128((__m128i *)&centre[x + 1]);
+		
+		__m128i ca = _mm_cmpeq_epi32(c, a);
+		__m128i cd = _mm_cmpeq_epi32(c, d);
+		__m128i ab = _mm_cmpeq_epi32(a, b);
+		__m128i bd = _mm_cmpeq_epi32(b, d);
+		
+		__m128i left;
+		__m128i right;
+		if (!bottomHalf)
+		{
+			left = BlendPixels(p, a, _mm_andnot_si128(_mm_or_si128(cd, ab), ca));
+			right = BlendPixels(p, b, _mm_andnot_si128(_mm_or_si128(ca, bd), ab));
+		}
+		else
+		{
+			left = BlendPixels(p, c, _mm_andnot_si128(_mm_or_si128(bd, ca), cd));
+			right = BlendPixels(p, d, _mm_andnot_si128(_mm_or_si128(ab, cd), bd));
+		}
+		
+		_mm_storeu_si128((__m128i *)&dest[x * 2], _mm_unpacklo_epi32(left, right));
+		_mm_storeu_si128((__m128i *)&dest[(x * 2) + 4], _mm_unpackhi_epi32(left, right));
+	}
+	
+	Scale2xPixelRange(dest, above, centre, below, width, bottomHalf, x, width);
+}
+
+// [a0 a1 a2 a3] [b0 b1 b2 b3] [c0 c1 c2 c3] -> a0 b0 c0 a1 b1 c1 a2 b2 c2 a3 b3 c3
+inline void StoreInterleaved3(u32 *dest, __m128i first, __m128i second, __m128i third)
+{
+	__m128i firstShifted = _mm_srli_si128(first, 4);
+	
+	__m128i out0 = _mm_unpacklo_epi64(_mm_unpacklo_epi32(first, second), _mm_unpacklo_epi32(third, firstShifted));
+	__m128i out1 = _mm_unpacklo_epi64(_mm_unpacklo_epi32(_mm_srli_si128(second, 4), _mm_srli_si128(third, 4)),
+									  _mm_unpackhi_epi32(first, second));
+	__m128i out2 = _mm_unpacklo_epi64(_mm_unpackhi_epi32(third, firstShifted),
+									  _mm_srli_si128(_mm_unpackhi_epi32(second, third), 8));
+	
+	_mm_storeu_si128((__m128i *)&dest[0], out0);
+	_mm_storeu_si128((__m128i *)&dest[4], out1);
+	_mm_storeu_si128((__m128i *)&dest[8], out2);
+}
+
+internal_func void Scale3xPixelRange(u32 *dest, u32 *above, u32 *centre, u32 *below, s32 width, s32 subRow, s32 startX, s32 endX)
+{
+	for (s32 x = startX; x < endX; ++x)
+	{
+		u32 a = ClampedPixel(above, x - 1, width);
+		u32 b = above[x];
+		u32 c = ClampedPixel(above, x + 1, width);
+		u32 d = ClampedPixel(centre, x - 1, width);
+		u32 e = centre[x];
+		u32 f = ClampedPixel(centre, x + 1, width);
+		u32 g = ClampedPixel(below, x - 1, width);
+		u32 h = below[x];
+		u32 i = ClampedPixel(below, x + 1, width);
+		
+		b32 topLeft = (d == b && b != f && d != h);
+		b32 topRight = (b == f && b != d && f != h);
+		b32 bottomLeft = (d == h && d != b && h != f);
+		b32 bottomRight = (h == f && d != h && b != f);
+		
+		u32 *output = &dest[x * 3];
+		if (subRow == 0)
+		{
+			output[0] = topLeft ? d : e;
+			output[1] = ((topLeft && e != c) || (topRight && e != a)) ? b : e;
+			output[2] = topRight ? f : e;
+		}
+		else if (subRow == 1)
+		{
+			output[0] = ((topLeft && e != g) || (bottomLeft && e != a)) ? d : e;
+			output[1] = e;
+			output[2] = ((topRight && e != i) || (bottomRight && e != c)) ? f : e;
+		}
+		else
+		{
+			output[0] = bottomLeft ? d : e;
+			output[1] = ((bottomLeft && e != i) || (bottomRight && e != g)) ? h : e;
+			output[2] = bottomRight ? f : e;
+		}
+	}
+}
+
+
+internal_func void Scale3xPixelRow(u32 *dest, u32 *above, u32 *centre, u32 *below, s32 width, s32 subRow)
+{
+	// NOTE(bSalmon): Neighbour names follow the AdvMAME3x description
+	// A B C
+	// D E F
+	// G H I
+	Scale3xPixelRange(dest, above, centre, below, width, subRow, 0, 1);
+	
+	s32 x = 1;
+	for (; x + 5 <= width; x += 4)
+	{
+		__m128i a = _mm_loadu_si128((__m128i *)&above[x - 1]);
+		__m128i b = _mm_loadu_si128((__m128i *)&above[x]);
+		__m128i c = _mm_loadu_si128((__m128i *)&above[x + 1]);
+		__m128i d = _mm_loadu_si128((__m128i *)&centre[x - 1]);
+		__m128i e = _mm_loadu_si128((__m128i *)&centre[x]);
+		__m128i f = _mm_loadu_si128((__m128i *)&centre[x + 1]);
+		__m128i g = _mm_loadu_si128((__m128i *)&below[x - 1]);
+		__m128i h = _mm_loadu_si128((__m128i *)&below[x]);
+		__m128i i = _mm_loadu_si128((__m128i *)&below[x + 1]);
+		
+		__m128i db = _mm_cmpeq_epi32(d, b);
+		__m128i bf = _mm_cmpeq_epi32(b, f);
+		__m128i dh = _mm_cmpeq_epi32(d, h);
+		__m128i hf = _mm_cmpeq_epi32(h, f);
+		
+		// NOTE(bSalmon): The four corner conditions of AdvMAME3x
+		__m128i topLeft = _mm_andnot_si128(_mm_or_si128(bf, dh), db);
+		__m128i topRight = _mm_andnot_si128(_mm_or_si128(db, hf), bf);
+		__m128i bottomLeft = _mm_andnot_si128(_mm_or_si128(db, hf), dh);
+		__m128i bottomRight = _mm_andnot_si128(_mm_or_si128(dh, bf), hf);
+		
+		__m128i out0;
+		__m128i out1;
+		__m128i out2;
+		if (subRow == 0)
+		{
+			out0 = BlendPixels(e, d, topLeft);
+			out1 = BlendPixels(e, b, _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(e, c), topLeft),
+												  _mm_andnot_si128(_mm_cmpeq_epi32(e, a), topRight)));
+			out2 = BlendPixels(e, f, topRight);
+		}
+		else if (subRow == 1)
+		{
+			out0 = BlendPixels(e, d, _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(e, g), topLeft),
+												  _mm_andnot_si128(_mm_cmpeq_epi32(e, a), bottomLeft)));
+			out1 = e;
+			out2 = BlendPixels(e, f, _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(e, i), topRight),
+												  _mm_andnot_si128(_mm_cmpeq_epi32(e, c), bottomRight)));
+		}
+		else
+		{
+			out0 = BlendPixels(e, d, bottomLeft);
+			out1 = BlendPixels(e, h, _mm_or_si128(_mm_andnot_si128(_mm_cmpeq_epi32(e, i), bottomLeft),
+												  _mm_andnot_si128(_mm_cmpeq_epi32(e, g), bottomRight)));
+			out2 = BlendPixels(e, f, bottomRight);
+		}
+		
+		StoreInterleaved3(&dest[x * 3], out0, out1, out2);
+	}
+	
+	Scale3xPixelRange(dest, above, centre, below, width, subRow, x, width);
+}
+
+internal_func void BleedPixelRange(u32 *dest, u32 *source, s32 width, s32 startX, s32 endX)
+{
+	for (s32 x = startX; x < endX; ++x)
+	{
+		u32 left = ClampedPixel(source, x - 1, width);
+		u32 right = ClampedPixel(source, x + 1, width);
+		u32 result = 0;
+		for (s32 shift = 0; shift < 32; shift += 8)
+		{
+			u32 sides = ((((left >> shift) & 0xFF) + ((right >> shift) & 0xFF)) + 1) >> 1;
+			u32 channel = ((((source[x] >> shift) & 0xFF) + sides) + 1) >> 1;
+			result |= channel << shift;
+		}
+		dest[x] = result;
+	}
+}
+
+// Averages each pixel with its horizontal neighbours, 50% centre and 25% either side
+internal_func void BleedPixelRow(u32 *dest, u32 *source, s32 width)
+{
+	BleedPixelRange(dest, source, width, 0, 1);
+	
+	s32 x = 1;
+	for (; x + 5 <= width; x += 4)
+	{
+		__m128i left = _mm_loadu_si128((__m128i *)&source[x - 1]);
+		__m128i centre = _mm_loadu_si128((__m128i *)&source[x]);
+		__m128i right = _mm_loadu_si128((__m128i *)&source[x + 1]);
+		_mm_storeu_si128((__m128i *)&dest[x], _mm_avg_epu8(centre, _mm_avg_epu8(left, right)));
+	}
+	
+	BleedPixelRange(dest, source, width, x, width);
+}
+
+internal_func void RunFilterTile(FilterTile *tile)
+{
+	FilterStage *stage = tile->stage;
+	BackBuffer *source = tile->source;
+	BackBuffer *output = &stage->output;
+	
+	for (s32 y = tile->startRow; y < tile->endRow; ++y)
+	{
+		u32 *destRow = (u32 *)((u8 *)output->memory + (y * output->pitch));
+		s32 sourceY = y / stage->scale;
+		s32 subRow = y % stage->scale;
+		
+		s32 aboveY = (sourceY > 0) ? (sourceY - 1) : 0;
+		s32 belowY = (sourceY < (source->height - 1)) ? (sourceY + 1) : sourceY;
+		u32 *above = (u32 *)((u8 *)source->memory + (aboveY * source->pitch));
+		u32 *centre = (u32 *)((u8 *)source->memory + (sourceY * source->pitch));
+		u32 *below = (u32 *)((u8 *)source->memory + (belowY * source->pitch));
+		
+		switch (stage->type)
+		{
+			case FilterType::NEAREST:
+			{
+				ScalePixelRow(destRow, centre, source->width, stage->scale);
+				break;
+			}
+			
+			case FilterType::SCALE2X:
+			{
+				Scale2xPixelRow(destRow, above, centre, below, source->width, subRow);
+				break;
+			}
+			
+			case FilterType::SCALE3X:
+			{
+				Scale3xPixelRow(destRow, above, centre, below, source->width, subRow);
+				break;
+			}
+			
+			case FilterType::SCANLINES:
+			{
+				u32 *factors = ((y % stage->param) == (stage->param - 1)) ? stage->darkRowFactors : stage->normalRowFactors;
+				ModulatePixelRow(destRow, centre, factors, source->width);
+				break;
+			}
+			
+			case FilterType::CRT:
+			{
+				u32 *factors = ((y % stage->param) == (stage->param - 1)) ? stage->darkRowFactors : stage->normalRowFactors;
+				BleedPixelRow(destRow, centre, source->width);
+				ModulatePixelRow(destRow, destRow, factors, source->width);
+				break;
+			}
+			
+			default:
+			{
+				break;
+			}
+		}
+	}
+}
+
+internal_func PLATFORM_WORK_QUEUE_CALLBACK(DoFilterTileWork)
+{
+	FilterTile *tile = (FilterTile *)data;
+	RunFilterTile(tile);
+}
+
+internal_func void AddFilterStage(FilterPipeline *pipeline, FilterType type, s32 param)
+{
+	ASSERT(pipeline->stageCount < MAX_FILTER_STAGES);
+	if (pipeline->stageCount < MAX_FILTER_STAGES)
+	{
+		FilterStage *stage = &pipeline->stages[pipeline->stageCount++];
+		*stage = {};
+		stage->type = type;
+		stage->param = (param > 0) ? param : 1;
+		
+		switch (type)
+		{
+			case FilterType::NEAREST:
+			{
+				stage->scale = stage->param;
+				break;
+			}
+			
+			case FilterType::SCALE2X:
+			{
+				stage->scale = 2;
+				break;
+			}
+			
+			case FilterType::SCALE3X:
+			{
+				stage->scale = 3;
+				break;
+			}
+			
+			default:
+			{
+				stage->scale = 1;
+				break;
+			}
+		}
+	}
+}
+
+internal_func void FreeFilterPipeline(FilterPipeline *pipeline)
+{
+	for (s32 stageIndex = 0; stageIndex < pipeline->stageCount; ++stageIndex)
+	{
+		FilterStage *stage = &pipeline->stages[stageIndex];
+		if (stage->output.memory)
+		{
+			PlatformFreeMemory(stage->output.memory);
+		}
+		if (stage->normalRowFactors)
+		{
+			PlatformFreeMemory(stage->normalRowFactors);
+		}
+		*stage = {};
+	}
+	
+	pipeline->stageCount = 0;
+}
+
+// Allocate the output buffers of every stage, call after all stages are added
+internal_func void BuildFilterPipeline(FilterPipeline *pipeline, s32 sourceWidth, s32 sourceHeight)
+{
+	pipeline->sourceWidth = sourceWidth;
+	pipeline->sourceHeight = sourceHeight;
+	if (pipeline->tileRows <= 0)
+	{
+		pipeline->tileRows = DEFAULT_FILTER_TILE_ROWS;
+	}
+	
+	s32 width = sourceWidth;
+	s32 height = sourceHeight;
+	s32 totalScale = 1;
+	for (s32 stageIndex = 0; stageIndex < pipeline->stageCount; ++stageIndex)
+	{
+		FilterStage *stage = &pipeline->stages[stageIndex];
+		width *= stage->scale;
+		height *= stage->scale;
+		totalScale *= stage->scale;
+		
+		stage->output.width = width;
+		stage->output.height = height;
+		stage->output.bytesPerPixel = 4;
+		stage->output.pitch = width * 4;
+		if (!stage->output.memory)
+		{
+			stage->output.memory = PlatformAllocateMemory((u64)stage->output.pitch * height);
+		}
+		
+		if (stage->type == FilterType::SCANLINES || stage->type == FilterType::CRT)
+		{
+			// NOTE(bSalmon): A param of 1 would darken every row, use the scale so far instead
+			if (stage->param < 2)
+			{
+				stage->param = (totalScale >= 2) ? totalScale : 2;
+			}
+			
+			if (!stage->normalRowFactors)
+			{
+				stage->normalRowFactors = (u32 *)PlatformAllocateMemory(sizeof(u32) * width * 2);
+			}
+			stage->darkRowFactors = stage->normalRowFactors + width;
+			
+			for (s32 x = 0; x < width; ++x)
+			{
+				if (stage->type == FilterType::SCANLINES)
+				{
+					stage->normalRowFactors[x] = 0xFFFFFFFF;
+					stage->darkRowFactors[x] = 0xFF808080;
+				}
+				else
+				{
+					// NOTE(bSalmon): Triad mask, one channel at full and the others dimmed
+					local_persist const u32 triad[] = {0xFFFFB4B4, 0xFFB4FFB4, 0xFFB4B4FF};
+					u32 mask = triad[x % 3];
+					stage->normalRowFactors[x] = mask;
+					stage->darkRowFactors[x] = 0xFF000000 | ((mask >> 1) & 0x007F7F7F);
+				}
+			}
+		}
+	}
+}
+
+internal_func void ApplyFilterPreset(FilterPipeline *pipeline, FilterPreset preset, s32 sourceWidth, s32 sourceHeight)
+{
+	FreeFilterPipeline(pipeline);
+	
+	switch (preset)
+	{
+		case FilterPreset::SCALE2X:
+		{
+			AddFilterStage(pipeline, FilterType::SCALE2X, 0);
+			break;
+		}
+		
+		case FilterPreset::SCALE4X:
+		{
+			AddFilterStage(pipeline, FilterType::SCALE2X, 0);
+			AddFilterStage(pipeline, FilterType::SCALE2X, 0);
+			break;
+		}
+		
+		case FilterPreset::SCALE6X:
+		{
+			AddFilterStage(pipeline, FilterType::SCALE2X, 0);
+			AddFilterStage(pipeline, FilterType::SCALE3X, 0);
+			break;
+		}
+		
+		case FilterPreset::SCANLINES:
+		{
+			AddFilterStage(pipeline, FilterType::NEAREST, 3);
+			AddFilterStage(pipeline, FilterType::SCANLINES, 3);
+			break;
+		}
+		
+		case FilterPreset::CRT:
+		{
+			AddFilterStage(pipeline, FilterType::SCALE2X, 0);
+			AddFilterStage(pipeline, FilterType::NEAREST, 2);
+			AddFilterStage(pipeline, FilterType::CRT, 4);
+			break;
+		}
+		
+		default:
+		{
+			break;
+		}
+	}
+	
+	BuildFilterPipeline(pipeline, sourceWidth, sourceHeight);
+}
+
+// Returns the buffer holding the final image, which is the source when there are no stages
+internal_func BackBuffer *RunFilterPipeline(FilterPipeline *pipeline, BackBuffer *source)
+{
+	ASSERT(source->width == pipeline->sourceWidth && source->height == pipeline->sourceHeight);
+	
+	u64 pipelineStart = PlatformGetWallClock();
+	
+	BackBuffer *input = source;
+	for (s32 stageIndex = 0; stageIndex < pipeline->stageCount; ++stageIndex)
+	{
+		FilterStage *stage = &pipeline->stages[stageIndex];
+		u64 stageStart = PlatformGetWallClock();
+		
+		s32 tileRows = pipeline->tileRows;
+		s32 minTileRows = (stage->output.height + (MAX_FILTER_TILES - 1)) / MAX_FILTER_TILES;
+		if (tileRows < minTileRows)
+		{
+			tileRows = minTileRows;
+		}
+		
+		s32 tileCount = 0;
+		for (s32 startRow = 0; startRow < stage->output.height; startRow += tileRows)
+		{
+			FilterTile *tile = &pipeline->tiles[tileCount++];
+			tile->stage = stage;
+			tile->source = input;
+			tile->startRow = startRow;
+			tile->endRow = ((startRow + tileRows) < stage->output.height) ? (startRow + tileRows) : stage->output.height;
+			
+			if (pipeline->queue)
+			{
+				PlatformAddWorkEntry(pipeline->queue, DoFilterTileWork, tile);
+			}
+			else
+			{
+				RunFilterTile(tile);
+			}
+		}
+		
+		if (pipeline->queue)
+		{
+			PlatformCompleteAllWork(pipeline->queue);
+		}
+		
+		stage->lastSeconds = PlatformGetSecondsElapsed(stageStart, PlatformGetWallClock());
+		stage->totalSeconds += stage->lastSeconds;
+		stage->runCount++;
+		
+		input = &stage->output;
+	}
+	
+	pipeline->lastSeconds = PlatformGetSecondsElapsed(pipelineStart, PlatformGetWallClock());
+	
+	return input;
+}
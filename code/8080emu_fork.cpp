@@ -0,0 +1,160 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_fork.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Instance Forking, for running lots of short branches off one point in a game (search, what-if
+runs, bots trying out moves). A MachineSnapshot holds the CPU, the machine and a copy of RAM.
+ForkMachine() turns a ForkedMachine into a copy of a snapshot, the first fork copies all of
+RAM but after that the instance only copies back the RAM pages it has written since its last
+fork from the same snapshot, using its own dirty page bits (DirtyPageUser::FORK), so a forked
+instance can also be run ahead, hashed or snapshotted. The pages copied back are marked as
+written for those other users. RAM is only 8KB, so
+once more than FORK_MAX_DIRTY_PAGES are dirty one straight copy of all of it is quicker than
+copying the pages one run at a time and that is done instead. ROM is never copied,
+every instance keeps its own memory mapping from PlatformMapInstanceMemory so the ROM pages
+are shared already.
+
+Snapshots are given an id when captured, unique across the process and every thread, an
+instance remembers the id it was forked from so recapturing a snapshot in place can't leave
+an instance copying back against the wrong RAM.
+Nothing here is locked, a snapshot can be read by forks on any number of threads but must not
+be recaptured while they run.
+*/
+
+struct MachineSnapshot
+{
+	u64 id;
+	CPUState cpuState;
+	MachineState machine;
+	u8 ram[RAM_SIZE];
+};
+
+struct ForkedMachine
+{
+	CPUState cpuState;
+	MachineState machine;
+	
+	// NOTE(bSalmon): Id of the snapshot cpuState.memory matched when its FORK dirty page bits were last cleared, 0 for none
+	u64 baseId;
+};
+
+struct ForkStats
+{
+	u64 forks;
+	u64 fullCopies;
+	u64 pagesCopied;
+};
+
+#define FORK_MAX_DIRTY_PAGES (RAM_PAGE_COUNT / 4)
+
+// NOTE(bSalmon): Shared by every instance in the process, snapshots can be captured on any thread
+global_var u64 volatile nextSnapshotId = 1;
+
+// Copies every page set in pages from source RAM to dest RAM, runs of neighbouring pages are
+// copied together
+internal_func u32 CopyRAMPages(u8 *dest, u8 *source, u64 pages)
+{
+	u32 result = 0;
+	
+	while (pages)
+	{
+		u32 firstPage = FindLeastSignificantSetBit64(pages);
+		u64 run = pages >> firstPage;
+		u32 runLength = (~run) ? FindLeastSignificantSetBit64(~run) : (RAM_PAGE_COUNT - firstPage);
+		pages &= (runLength + firstPage < 64) ? ~(((1ULL << runLength) - 1) << firstPage) : ((1ULL << firstPage) - 1);
+		
+		u32 offset = firstPage * RAM_PAGE_SIZE;
+		memcpy(&dest[offset], &source[offset], runLength * RAM_PAGE_SIZE);
+		result += runLength;
+	}
+	
+	return result;
+}
+
+// CopyRAMPages, or one copy of all of RAM when that would be quicker
+internal_func u32 CopyDirtyRAM(u8 *dest, u8 *source, u64 pages)
+{
+	u32 result = 0;
+	if (CountSetBits64(pages) > FORK_MAX_DIRTY_PAGES)
+	{
+		memcpy(dest, source, RAM_SIZE);
+		result = RAM_PAGE_COUNT;
+	}
+	else
+	{
+		result = CopyRAMPages(dest, source, pages);
+	}
+	
+	return result;
+}
+
+// Snapshots instance as it is now, instance also becomes a fork of the snapshot so it can be
+// sent back to this point as cheaply as any other fork
+internal_func void CaptureMachineSnapshot(MachineSnapshot *snapshot, ForkedMachine *instance)
+{
+	snapshot->id = AtomicAddU64(&nextSnapshotId, 1);
+	snapshot->cpuState = {};
+	CopyCPURegisters(&snapshot->cpuState, &instance->cpuState);
+	snapshot->machine = instance->machine;
+	memcpy(snapshot->ram, &instance->cpuState.memory[RAM_START], RAM_SIZE);
+	
+	ClearDirtyPages(&instance->cpuState, DirtyPageUser::FORK);
+	instance->baseId = snapshot->id;
+}
+
+// Makes instance a copy of snapshot, returns the number of RAM pages copied
+internal_func u32 ForkMachine(ForkedMachine *instance, MachineSnapshot *snapshot, ForkStats *stats = 0)
+{
+	u32 result = 0;
+	u8 *memory = instance->cpuState.memory;
+	
+	u64 copiedPages = GetDirtyPages(&instance->cpuState, DirtyPageUser::FORK);
+	if (instance->baseId == snapshot->id && CountSetBits64(copiedPages) <= FORK_MAX_DIRTY_PAGES)
+	{
+		result = CopyRAMPages(&memory[RAM_START], snapshot->ram, copiedPages);
+	}
+	else
+	{
+		memcpy(&memory[RAM_START], snapshot->ram, RAM_SIZE);
+		result = RAM_PAGE_COUNT;
+		copiedPages = ~0ULL;
+		
+		if (stats)
+		{
+			++stats->fullCopies;
+		}
+	}
+	
+	instance->cpuState.dirtyPages |= copiedPages;
+	ClearDirtyPages(&instance->cpuState, DirtyPageUser::FORK);
+	CopyCPURegisters(&instance->cpuState, &snapshot->cpuState);
+	instance->machine = snapshot->machine;
+	instance->baseId = snapshot->id;
+	
+	if (stats)
+	{
+		++stats->forks;
+		stats->pagesCopied += result;
+	}
+	
+	return result;
+}
@@ -0,0 +1,390 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_framedump.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Frame Dump, streams rendered frames to a file or pipe without blocking emulation.
+
+The emulation thread renders each frame as INDEXED8 straight into a slot of a bounded
+single producer/single consumer ring, a background writer thread converts the slot to
+the output format and writes it. If the ring is full the frame is dropped and counted,
+the emulation thread never waits on the writer.
+
+Output Formats:
+RAW - Headerless rgb24, e.g. ffmpeg -f rawvideo -pix_fmt rgb24 -s 224x256 -r 60 -i -
+PPM - P6 images, one file per frame if the path has a number field (e.g. %06d), otherwise concatenated
+Y4M - YUV4MPEG2 4:4:4 stream at 60fps
+
+A path of "-" writes to stdout. Only PPM paths can be numbered, see 8080emu_path.cpp, the
+number is the emulated frame count passed to SubmitFrameDump so dropped frames leave gaps.
+
+Needs 8080emu_path.cpp.
+*/
+
+#include <stdio.h>
+
+#define FRAME_DUMP_QUEUE_SIZE 64
+
+enum class FrameDumpFormat
+{
+	RAW,
+	PPM,
+	Y4M
+};
+
+struct FrameDumpStats
+{
+	u64 submittedFrames;
+	u64 writtenFrames;
+	u64 droppedFrames;
+	u64 bytesWritten;
+	u32 queueDepth;
+	u32 maxQueueDepth;
+	b32 writeFailed;
+};
+
+struct FrameDump
+{
+	FrameDumpFormat format;
+	b32 enableColour;
+	s32 width;
+	s32 height;
+	NumberedPath path;
+	FILE *file;
+	
+	// NOTE(bSalmon): Indices only ever increase, slot = index % FRAME_DUMP_QUEUE_SIZE
+	u32 volatile writeIndex;
+	u32 volatile readIndex;
+	u32 volatile finished;
+	u8 *slots;
+	u32 slotSize;
+	u64 slotFrames[FRAME_DUMP_QUEUE_SIZE];
+	
+	u8 *staging;
+	u32 stagingSize;
+	b32 wroteHeader;
+	
+	PlatformSemaphore *framesReady;
+	PlatformThread *writerThread;
+	
+	// NOTE(bSalmon): submitStats belong to the emulation thread and writeStats to the writer thread.
+	// The writer copies writeStats out after every frame, publishedSequence is odd during the copy
+	FrameDumpStats submitStats;
+	FrameDumpStats writeStats;
+	FrameDumpStats publishedWriteStats;
+	u32 volatile publishedSequence;
+};
+
+// Indexed by FrameDumpFormat
+global_var char *frameDumpFormatNames[] = {"raw", "ppm", "y4m"};
+
+// Looks a format up by its name in frameDumpFormatNames, returns false if there is no such format
+internal_func b32 FindFrameDumpFormat(char *name, FrameDumpFormat *format)
+{
+	for (u32 formatIndex = 0; formatIndex < ARRAY_COUNT(frameDumpFormatNames); ++formatIndex)
+	{
+		if (strcmp(frameDumpFormatNames[formatIndex], name) == 0)
+		{
+			*format = (FrameDumpFormat)formatIndex;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+// Converts a slot to the output format in staging and returns the number of bytes to write
+internal_func u32 EncodeFrameDumpSlot(FrameDump *dump, u8 *slot)
+{
+	u8 *output = dump->staging;
+	s32 pixelCount = dump->width * dump->height;
+	
+	switch (dump->format)
+	{
+		case FrameDumpFormat::RAW:
+		case FrameDumpFormat::PPM:
+		{
+			if (dump->format == FrameDumpFormat::PPM)
+			{
+				output += sprintf((char *)output, "P6\n%d %d\n255\n", dump->width, dump->height);
+			}
+			
+			u8 paletteRGB[ARRAY_COUNT(framePalette)][3];
+			for (s32 colour = 0; colour < (s32)ARRAY_COUNT(framePalette); ++colour)
+			{
+				paletteRGB[colour][0] = (u8)(framePalette[colour] >> 16);
+				paletteRGB[colour][1] = (u8)(framePalette[colour] >> 8);
+				paletteRGB[colour][2] = (u8)framePalette[colour];
+			}
+			
+			for (s32 pixel = 0; pixel < pixelCount; ++pixel)
+			{
+				u8 *rgb = paletteRGB[slot[pixel]];
+				output[0] = rgb[0];
+				output[1] = rgb[1];
+				output[2] = rgb[2];
+				output += 3;
+			}
+			break;
+		}
+		
+		case FrameDumpFormat::Y4M:
+		{
+			if (!dump->wroteHeader)
+			{
+				output += sprintf((char *)output, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", dump->width, dump->height);
+				dump->wroteHeader = true;
+			}
+			output += sprintf((char *)output, "FRAME\n");
+			
+			// NOTE(bSalmon): BT.601 limited range, only the palette colours need converting
+			u8 paletteYUV[ARRAY_COUNT(framePalette)][3];
+			for (s32 colour = 0; colour < (s32)ARRAY_COUNT(framePalette); ++colour)
+			{
+				f32 red = (f32)((framePalette[colour] >> 16) & 0xFF);
+				f32 green = (f32)((framePalette[colour] >> 8) & 0xFF);
+				f32 blue = (f32)(framePalette[colour] & 0xFF);
+				paletteYUV[colour][0] = (u8)(16.5f + ((65.481f * red) + (128.553f * green) + (24.966f * blue)) / 255.0f);
+				paletteYUV[colour][1] = (u8)(128.5f + ((-37.797f * red) - (74.203f * green) + (112.0f * blue)) / 255.0f);
+				paletteYUV[colour][2] = (u8)(128.5f + ((112.0f * red) - (93.786f * green) - (18.214f * blue)) / 255.0f);
+			}
+			
+			for (s32 plane = 0; plane < 3; ++plane)
+			{
+				for (s32 pixel = 0; pixel < pixelCount; ++pixel)
+				{
+					output[pixel] = paletteYUV[slot[pixel]][plane];
+				}
+				output += pixelCount;
+			}
+			break;
+		}
+	}
+	
+	return (u32)(output - dump->staging);
+}
+
+internal_func void WriteFrameDumpSlot(FrameDump *dump, u8 *slot, u64 frameNumber)
+{
+	u32 size = EncodeFrameDumpSlot(dump, slot);
+	
+	FILE *file = dump->file;
+	if (dump->path.numbered)
+	{
+		char framePath[NUMBERED_PATH_MAX + 32];
+		FormatNumberedPath(&dump->path, frameNumber, framePath, sizeof(framePath));
+		file = fopen(framePath, "wb");
+	}
+	
+	if (file && fwrite(dump->staging, 1, size, file) == size)
+	{
+		dump->writeStats.bytesWritten += size;
+		dump->writeStats.writtenFrames++;
+	}
+	else
+	{
+		dump->writeStats.writeFailed = true;
+	}
+	
+	if (dump->path.numbered && file)
+	{
+		fclose(file);
+	}
+}
+
+// Writer thread only
+internal_func void PublishFrameDumpWriteStats(FrameDump *dump)
+{
+	dump->publishedSequence++;
+	CompletePreviousWritesBeforeFutureWrites;
+	dump->publishedWriteStats = dump->writeStats;
+	CompletePreviousWritesBeforeFutureWrites;
+	dump->publishedSequence++;
+}
+
+internal_func PLATFORM_THREAD_PROC(FrameDumpWriterThread)
+{
+	FrameDump *dump = (FrameDump *)data;
+	
+	for (;;)
+	{
+		u32 readIndex = dump->readIndex;
+		if (readIndex != dump->writeIndex)
+		{
+			CompletePreviousReadsBeforeFutureReads;
+			
+			u32 slotIndex = readIndex % FRAME_DUMP_QUEUE_SIZE;
+			WriteFrameDumpSlot(dump, &dump->slots[slotIndex * dump->slotSize], dump->slotFrames[slotIndex]);
+			PublishFrameDumpWriteStats(dump);
+			
+			CompletePreviousWritesBeforeFutureWrites;
+			dump->readIndex = readIndex + 1;
+		}
+		else if (dump->finished)
+		{
+			// NOTE(bSalmon): Check again, the last frame may have been published before finished was seen
+			CompletePreviousReadsBeforeFutureReads;
+			if (readIndex == dump->writeIndex)
+			{
+				break;
+			}
+		}
+		else
+		{
+			PlatformWaitSemaphore(dump->framesReady);
+		}
+	}
+	
+	if (dump->file)
+	{
+		fflush(dump->file);
+	}
+}
+
+internal_func b32 BeginFrameDump(FrameDump *dump, char *path, FrameDumpFormat format, s32 width, s32 height, b32 enableColour)
+{
+	*dump = {};
+	dump->format = format;
+	dump->width = width;
+	dump->height = height;
+	dump->enableColour = enableColour;
+	
+	// NOTE(bSalmon): The path is never used as a format string, a stray % is refused here
+	if (!ParseNumberedPath(&dump->path, path) || (dump->path.numbered && format != FrameDumpFormat::PPM))
+	{
+		return false;
+	}
+	
+	if (!dump->path.numbered)
+	{
+		if (strcmp(path, "-") == 0)
+		{
+			dump->file = stdout;
+		}
+		else
+		{
+			dump->file = fopen(dump->path.prefix, "wb");
+		}
+		
+		if (!dump->file)
+		{
+			return false;
+		}
+	}
+	
+	dump->slotSize = GetFrameFormatPitch(FrameFormat::INDEXED8, width) * height;
+	dump->slots = (u8 *)PlatformAllocateMemory((u64)dump->slotSize * FRAME_DUMP_QUEUE_SIZE);
+	dump->stagingSize = (width * height * 3) + 128;
+	dump->staging = (u8 *)PlatformAllocateMemory(dump->stagingSize);
+	dump->framesReady = PlatformCreateSemaphore(0);
+	dump->writerThread = PlatformStartThread(FrameDumpWriterThread, dump);
+	
+	return true;
+}
+
+// Called from the emulation thread once per emulated frame, never blocks. frameNumber names the file
+// for numbered paths, usually MachineState::frameCount
+internal_func void SubmitFrameDump(FrameDump *dump, CPUState *cpuState, u64 frameNumber)
+{
+	dump->submitStats.submittedFrames++;
+	
+	u32 writeIndex = dump->writeIndex;
+	u32 queueDepth = writeIndex - dump->readIndex;
+	if (queueDepth >= FRAME_DUMP_QUEUE_SIZE)
+	{
+		dump->submitStats.droppedFrames++;
+		return;
+	}
+	
+	u32 slotIndex = writeIndex % FRAME_DUMP_QUEUE_SIZE;
+	dump->slotFrames[slotIndex] = frameNumber;
+	
+	BackBuffer slotBuffer = {};
+	slotBuffer.memory = &dump->slots[slotIndex * dump->slotSize];
+	slotBuffer.width = dump->width;
+	slotBuffer.height = dump->height;
+	slotBuffer.pitch = GetFrameFormatPitch(FrameFormat::INDEXED8, dump->width);
+	slotBuffer.bytesPerPixel = 1;
+	slotBuffer.format = FrameFormat::INDEXED8;
+	RenderVideoMemContents(&slotBuffer, cpuState, dump->enableColour);
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	dump->writeIndex = writeIndex + 1;
+	PlatformSignalSemaphore(dump->framesReady);
+	
+	dump->submitStats.queueDepth = queueDepth + 1;
+	if (dump->submitStats.queueDepth > dump->submitStats.maxQueueDepth)
+	{
+		dump->submitStats.maxQueueDepth = dump->submitStats.queueDepth;
+	}
+}
+
+// Called from the emulation thread, the writer's counts are as of the last frame it finished
+internal_func FrameDumpStats GetFrameDumpStats(FrameDump *dump)
+{
+	FrameDumpStats written;
+	for (;;)
+	{
+		u32 sequence = dump->publishedSequence;
+		CompletePreviousReadsBeforeFutureReads;
+		if (!(sequence & 1))
+		{
+			written = dump->publishedWriteStats;
+			CompletePreviousReadsBeforeFutureReads;
+			if (dump->publishedSequence == sequence)
+			{
+				break;
+			}
+		}
+	}
+	
+	FrameDumpStats result = dump->submitStats;
+	result.writtenFrames = written.writtenFrames;
+	result.bytesWritten = written.bytesWritten;
+	result.writeFailed = written.writeFailed;
+	result.queueDepth = dump->writeIndex - dump->readIndex;
+	
+	return result;
+}
+
+// Waits for the writer to finish the queued frames, then closes the output
+internal_func void EndFrameDump(FrameDump *dump)
+{
+	if (dump->writerThread)
+	{
+		dump->finished = true;
+		PlatformSignalSemaphore(dump->framesReady);
+		PlatformJoinThread(dump->writerThread);
+		dump->writerThread = 0;
+		PlatformDestroySemaphore(dump->framesReady);
+	}
+	
+	if (dump->file && dump->file != stdout)
+	{
+		fclose(dump->file);
+	}
+	dump->file = 0;
+	
+	PlatformFreeMemory(dump->slots);
+	PlatformFreeMemory(dump->staging);
+	dump->slots = 0;
+	dump->staging = 0;
+}
@@ -0,0 +1,350 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_hash.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+64-bit non-cryptographic hash, built the same way as XXH3:
+8 independent 64-bit accumulators, each 64 byte stripe adds the stripe to the
+accumulators along with a 32x32->64 multiply of the stripe xor'd with a secret.
+Every 16 stripes the accumulators are scrambled, and at the end they are merged
+and avalanched. Only 32x32 multiplies are used in the loop so it maps directly
+onto SSE2 and AVX2, the scalar path gives the same result and is kept for reference.
+
+The hash is stable across platforms and builds but is not the real XXH3.
+
+State Hash - a fingerprint of everything that decides what the machine does next, for telling
+states apart in searches and determinism checks. Each 128 byte RAM page is hashed on its own
+and the page hashes are summed, so after a frame only the pages written since the last update
+(its own dirty page bits, DirtyPageUser::STATE_HASH) are hashed again.
+Registers, ports, the shifter and how far away the next interrupt is are hashed on top every
+time. The cycle and frame totals are left out so the same state reached at two different times
+hashes the same, which also means it is not the same value as HashMachineState.
+*/
+
+#define HASH_STRIPE_SIZE 64
+#define HASH_STRIPES_PER_SCRAMBLE 16
+
+global_var const u64 hashPrime32_1 = 0x9E3779B1ULL;
+global_var const u64 hashPrime64_1 = 0x9E3779B185EBCA87ULL;
+global_var const u64 hashPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+global_var const u64 hashPrime64_3 = 0x165667B19E3779F9ULL;
+global_var const u64 hashPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+
+// NOTE(bSalmon): Taken from the digits of pi, any bytes without long runs of 0s would do
+global_var const u64 hashSecret[] = {
+	0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+	0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+};
+
+inline u64 ReadU64(u8 *data)
+{
+	u64 result;
+	memcpy(&result, data, sizeof(result));
+	return result;
+}
+
+inline u64 RotateLeft64(u64 value, s32 amount)
+{
+	u64 result = (value << amount) | (value >> (64 - amount));
+	return result;
+}
+
+inline u64 AvalancheHash64(u64 hash)
+{
+	hash ^= hash >> 33;
+	hash *= hashPrime64_2;
+	hash ^= hash >> 29;
+	hash *= hashPrime64_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+internal_func void HashStripesScalar(u64 *acc, u8 *data, u64 stripeCount)
+{
+	for (u64 stripe = 0; stripe < stripeCount; ++stripe)
+	{
+		u8 *stripeData = data + (stripe * HASH_STRIPE_SIZE);
+		for (s32 lane = 0; lane < 8; ++lane)
+		{
+			u64 value = ReadU64(stripeData + ((lane ^ 1) * 8));
+			u64 keyed = ReadU64(stripeData + (lane * 8)) ^ hashSecret[lane];
+			acc[lane] += value + ((keyed & 0xFFFFFFFF) * (keyed >> 32));
+		}
+	}
+}
+
+internal_func void ScrambleHashScalar(u64 *acc)
+{
+	for (s32 lane = 0; lane < 8; ++lane)
+	{
+		u64 value = acc[lane];
+		value ^= value >> 47;
+		value ^= hashSecret[lane];
+		acc[lane] = value * hashPrime32_1;
+	}
+}
+
+#if EMU8080_AVX2
+internal_func void HashStripes(u64 *acc, u8 *data, u64 stripeCount)
+{
+	__m256i acc0 = _mm256_loadu_si256((__m256i *)&acc[0]);
+	__m256i acc1 = _mm256_loadu_si256((__m256i *)&acc[4]);
+	__m256i secret0 = _mm256_loadu_si256((__m256i *)&hashSecret[0]);
+	__m256i secret1 = _mm256_loadu_si256((__m256i *)&hashSecret[4]);
+	
+	for (u64 stripe = 0; stripe < stripeCount; ++stripe)
+	{
+		u8 *stripeData = data + (stripe * HASH_STRIPE_SIZE);
+		__m256i data0 = _mm256_loadu_si256((__m256i *)stripeData);
+		__m256i data1 = _mm256_loadu_si256((__m256i *)(stripeData + 32));
+		
+		__m256i keyed0 = _mm256_xor_si256(data0, secret0);
+		__m256i keyed1 = _mm256_xor_si256(data1, secret1);
+		__m256i product0 = _mm256_mul_epu32(keyed0, _mm256_shuffle_epi32(keyed0, _MM_SHUFFLE(0, 3, 0, 1)));
+		__m256i product1 = _mm256_mul_epu32(keyed1, _mm256_shuffle_epi32(keyed1, _MM_SHUFFLE(0, 3, 0, 1)));
+		
+		// NOTE(bSalmon): Swap the 64-bit halves of each 128-bit lane so acc[n] gets data[n ^ 1]
+		acc0 = _mm256_add_epi64(acc0, _mm256_add_epi64(product0, _mm256_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2))));
+		acc1 = _mm256_add_epi64(acc1, _mm256_add_epi64(product1, _mm256_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+	
+	_mm256_storeu_si256((__m256i *)&acc[0], acc0);
+	_mm256_storeu_si256((__m256i *)&acc[4], acc1);
+}
+#else
+internal_func void HashStripes(u64 *acc, u8 *data, u64 stripeCount)
+{
+	__m128i accLanes[4];
+	__m128i secretLanes[4];
+	for (s32 pair = 0; pair < 4; ++pair)
+	{
+		accLanes[pair] = _mm_loadu_si128((__m128i *)&acc[pair * 2]);
+		secretLanes[pair] = _mm_loadu_si128((__m128i *)&hashSecret[pair * 2]);
+	}
+	
+	for (u64 stripe = 0; stripe < stripeCount; ++stripe)
+	{
+		u8 *stripeData = data + (stripe * HASH_STRIPE_SIZE);
+		for (s32 pair = 0; pair < 4; ++pair)
+		{
+			__m128i value = _mm_loadu_si128((__m128i *)(stripeData + (pair * 16)));
+			__m128i keyed = _mm_xor_si128(value, secretLanes[pair]);
+			__m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+			
+			// NOTE(bSalmon): Swap the 64-bit halves so acc[n] gets data[n ^ 1]
+			__m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+			accLanes[pair] = _mm_add_epi64(accLanes[pair], _mm_add_epi64(product, swapped));
+		}
+	}
+	
+	for (s32 pair = 0; pair < 4; ++pair)
+	{
+		_mm_storeu_si128((__m128i *)&acc[pair * 2], accLanes[pair]);
+	}
+}
+#endif
+
+internal_func u64 HashMemory64(void *memory, u64 size, u64 seed)
+{
+	u8 *data = (u8 *)memory;
+	u64 acc[8] = {
+		hashPrime32_1 + seed, hashPrime64_1, hashPrime64_2, hashPrime64_3,
+		hashPrime64_4 ^ seed, hashPrime32_1, hashPrime64_1 ^ seed, hashPrime64_2,
+	};
+	
+	u64 fullStripes = size / HASH_STRIPE_SIZE;
+	u64 stripe = 0;
+	while (stripe < fullStripes)
+	{
+		u64 stripeCount = fullStripes - stripe;
+		if (stripeCount > HASH_STRIPES_PER_SCRAMBLE)
+		{
+			stripeCount = HASH_STRIPES_PER_SCRAMBLE;
+		}
+		
+		HashStripes(acc, data + (stripe * HASH_STRIPE_SIZE), stripeCount);
+		stripe += stripeCount;
+		
+		if ((stripe % HASH_STRIPES_PER_SCRAMBLE) == 0)
+		{
+			ScrambleHashScalar(acc);
+		}
+	}
+	
+	u64 remaining = size - (fullStripes * HASH_STRIPE_SIZE);
+	if (remaining)
+	{
+		u8 lastStripe[HASH_STRIPE_SIZE] = {};
+		memcpy(lastStripe, data + (fullStripes * HASH_STRIPE_SIZE), remaining);
+		HashStripesScalar(acc, lastStripe, 1);
+	}
+	
+	u64 result = size * hashPrime64_1;
+	for (s32 lane = 0; lane < 8; ++lane)
+	{
+		result ^= AvalancheHash64(acc[lane] + hashSecret[7 - lane]);
+		result = (RotateLeft64(result, 27) * hashPrime64_1) + hashPrime64_4;
+	}
+	result = AvalancheHash64(result);
+	
+	return result;
+}
+
+// Fingerprint of what RenderVideoMemContents would draw, colour is included as it changes the output
+internal_func u64 HashVideoMemory(CPUState *cpuState, b32 enableColour)
+{
+	u64 result = HashMemory64(&cpuState->memory[0x2400], 0x4000 - 0x2400, enableColour ? 1 : 0);
+	return result;
+}
+
+// Fingerprint of the whole machine, registers, shifter and the 16KB address space
+internal_func u64 HashMachineState(CPUState *cpuState, MachineState *machine)
+{
+	u8 registers[16] = {};
+	registers[0] = cpuState->regA;
+	registers[1] = BuildPSW(cpuState);
+	registers[2] = cpuState->regB;
+	registers[3] = cpuState->regC;
+	registers[4] = cpuState->regD;
+	registers[5] = cpuState->regE;
+	registers[6] = cpuState->regH;
+	registers[7] = cpuState->regL;
+	registers[8] = (u8)(cpuState->stackPointer & 0xFF);
+	registers[9] = (u8)(cpuState->stackPointer >> 8);
+	registers[10] = (u8)(cpuState->programCounter & 0xFF);
+	registers[11] = (u8)(cpuState->programCounter >> 8);
+	registers[12] = cpuState->enableInterrupt ? 1 : 0;
+	registers[13] = machine->shift0;
+	registers[14] = machine->shift1;
+	registers[15] = machine->shiftOffset;
+	
+	u64 registerHash = HashMemory64(registers, sizeof(registers), 0);
+	u64 result = HashMemory64(cpuState->memory, 0x4000, registerHash);
+	
+	return result;
+}
+
+#define STATE_HASH_REGISTERS_SIZE 32
+
+struct StateHash
+{
+	u64 pageHashes[RAM_PAGE_COUNT];
+	u64 ramHash;
+	u64 romHash;
+	b32 valid;
+};
+
+// NOTE(bSalmon): A page is exactly two stripes. The lanes are folded with a multiply each and
+// only the result is avalanched, where HashMemory64 avalanches every lane, which at this size
+// is most of the cost
+internal_func u64 HashRAMPage(u8 *page, u64 pageIndex)
+{
+	u64 acc[8] = {
+		hashPrime32_1 + pageIndex, hashPrime64_1, hashPrime64_2, hashPrime64_3,
+		hashPrime64_4 ^ pageIndex, hashPrime32_1, hashPrime64_1, hashPrime64_2,
+	};
+	HashStripes(acc, page, RAM_PAGE_SIZE / HASH_STRIPE_SIZE);
+	
+	u64 result = pageIndex * hashPrime64_3;
+	for (s32 lane = 0; lane < 8; ++lane)
+	{
+		result = RotateLeft64(result ^ acc[lane], 31) * hashPrime64_1;
+	}
+	result = AvalancheHash64(result);
+	
+	return result;
+}
+
+// Everything but memory that goes into the state hash
+internal_func void PackStateHashRegisters(u8 *registers, CPUState *cpuState, MachineState *machine)
+{
+	memset(registers, 0, STATE_HASH_REGISTERS_SIZE);
+	registers[0] = cpuState->regA;
+	registers[1] = BuildPSW(cpuState);
+	registers[2] = cpuState->regB;
+	registers[3] = cpuState->regC;
+	registers[4] = cpuState->regD;
+	registers[5] = cpuState->regE;
+	registers[6] = cpuState->regH;
+	registers[7] = cpuState->regL;
+	registers[8] = (u8)(cpuState->stackPointer & 0xFF);
+	registers[9] = (u8)(cpuState->stackPointer >> 8);
+	registers[10] = (u8)(cpuState->programCounter & 0xFF);
+	registers[11] = (u8)(cpuState->programCounter >> 8);
+	registers[12] = cpuState->enableInterrupt ? 1 : 0;
+	registers[13] = cpuState->halted ? 1 : 0;
+	registers[14] = machine->shift0;
+	registers[15] = machine->shift1;
+	registers[16] = machine->shiftOffset;
+	registers[17] = machine->inputPort1;
+	registers[18] = machine->inputPort2;
+	registers[19] = machine->nextInterruptNum;
+	u64 cyclesToInterrupt = machine->nextInterruptCycle - machine->cycles;
+	memcpy(&registers[20], &cyclesToInterrupt, sizeof(cyclesToInterrupt));
+}
+
+// Forgets the page hashes, for when the machine's memory is replaced rather than written to
+internal_func void ResetStateHash(StateHash *stateHash)
+{
+	stateHash->valid = false;
+}
+
+// Hashes the given RAM pages again, or all of memory the first time, and returns the state hash
+internal_func u64 UpdateStateHash(StateHash *stateHash, CPUState *cpuState, MachineState *machine, u64 pages)
+{
+	u8 *ram = &cpuState->memory[RAM_START];
+	if (!stateHash->valid)
+	{
+		stateHash->romHash = HashMemory64(cpuState->memory, RAM_START, 0);
+		stateHash->ramHash = 0;
+		for (u32 pageIndex = 0; pageIndex < RAM_PAGE_COUNT; ++pageIndex)
+		{
+			stateHash->pageHashes[pageIndex] = HashRAMPage(&ram[pageIndex * RAM_PAGE_SIZE], pageIndex);
+			stateHash->ramHash += stateHash->pageHashes[pageIndex];
+		}
+		stateHash->valid = true;
+	}
+	else
+	{
+		while (pages)
+		{
+			u32 pageIndex = FindLeastSignificantSetBit64(pages);
+			pages &= pages - 1;
+			
+			u64 pageHash = HashRAMPage(&ram[pageIndex * RAM_PAGE_SIZE], pageIndex);
+			stateHash->ramHash += pageHash - stateHash->pageHashes[pageIndex];
+			stateHash->pageHashes[pageIndex] = pageHash;
+		}
+	}
+	
+	u8 registers[STATE_HASH_REGISTERS_SIZE];
+	PackStateHashRegisters(registers, cpuState, machine);
+	
+	u64 result = HashMemory64(registers, sizeof(registers), stateHash->ramHash ^ stateHash->romHash);
+	return result;
+}
+
+// The state hash, hashing again the pages written since the last update
+internal_func u64 UpdateStateHash(StateHash *stateHash, CPUState *cpuState, MachineState *machine)
+{
+	u64 result = UpdateStateHash(stateHash, cpuState, machine, TakeDirtyPages(cpuState, DirtyPageUser::STATE_HASH));
+	return result;
+}
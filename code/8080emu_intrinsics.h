@@ -0,0 +1,129 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_intrinsics.h
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+// NOTE(bSalmon): SSE2 is always available on x64, AVX2 paths are only compiled
+// when the compiler is told it can use them (/arch:AVX2 or -mavx2)
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EMU8080_AVX2 1
+#else
+#define EMU8080_AVX2 0
+#endif
+
+// Atomics
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+inline u32 AtomicCompareExchangeU32(u32 volatile *value, u32 newValue, u32 expected)
+{
+	u32 result = _InterlockedCompareExchange((long volatile *)value, newValue, expected);
+	return result;
+}
+
+inline u32 AtomicAddU32(u32 volatile *value, u32 addend)
+{
+	// NOTE(bSalmon): Returns the value from before the add
+	u32 result = _InterlockedExchangeAdd((long volatile *)value, addend);
+	return result;
+}
+
+inline u64 AtomicAddU64(u64 volatile *value, u64 addend)
+{
+	u64 result = _InterlockedExchangeAdd64((__int64 volatile *)value, addend);
+	return result;
+}
+
+inline u32 AtomicExchangeU32(u32 volatile *value, u32 newValue)
+{
+	// NOTE(bSalmon): Returns the value that was replaced
+	u32 result = _InterlockedExchange((long volatile *)value, newValue);
+	return result;
+}
+
+#define CompletePreviousWritesBeforeFutureWrites _WriteBarrier(); _mm_sfence()
+#define CompletePreviousReadsBeforeFutureReads _ReadBarrier()
+// NOTE(bSalmon): Full fence, x64 can otherwise move a later read ahead of an earlier write
+#define CompletePreviousWritesBeforeFutureReads _mm_mfence()
+#define ReadTimestampCounter() __rdtsc()
+
+// NOTE(bSalmon): value must not be 0
+inline u32 FindLeastSignificantSetBit64(u64 value)
+{
+	unsigned long result;
+	_BitScanForward64(&result, value);
+	return (u32)result;
+}
+
+inline u32 CountSetBits64(u64 value)
+{
+	u32 result = (u32)__popcnt64(value);
+	return result;
+}
+
+#else
+#include <x86intrin.h>
+
+inline u32 AtomicCompareExchangeU32(u32 volatile *value, u32 newValue, u32 expected)
+{
+	u32 result = __sync_val_compare_and_swap(value, expected, newValue);
+	return result;
+}
+
+inline u32 AtomicAddU32(u32 volatile *value, u32 addend)
+{
+	// NOTE(bSalmon): Returns the value from before the add
+	u32 result = __sync_fetch_and_add(value, addend);
+	return result;
+}
+
+inline u64 AtomicAddU64(u64 volatile *value, u64 addend)
+{
+	u64 result = __sync_fetch_and_add(value, addend);
+	return result;
+}
+
+inline u32 AtomicExchangeU32(u32 volatile *value, u32 newValue)
+{
+	// NOTE(bSalmon): Returns the value that was replaced
+	u32 result = __atomic_exchange_n(value, newValue, __ATOMIC_SEQ_CST);
+	return result;
+}
+
+#define CompletePreviousWritesBeforeFutureWrites asm volatile("" ::: "memory")
+#define CompletePreviousReadsBeforeFutureReads asm volatile("" ::: "memory")
+// NOTE(bSalmon): Full fence, x64 can otherwise move a later read ahead of an earlier write
+#define CompletePreviousWritesBeforeFutureReads __sync_synchronize()
+#define ReadTimestampCounter() __rdtsc()
+
+// NOTE(bSalmon): value must not be 0
+inline u32 FindLeastSignificantSetBit64(u64 value)
+{
+	u32 result = (u32)__builtin_ctzll(value);
+	return result;
+}
+
+inline u32 CountSetBits64(u64 value)
+{
+	u32 result = (u32)__builtin_popcountll(value);
+	return result;
+}
+
+#endif
@@ -0,0 +1,191 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_lib.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Emulator Library implementation, see 8080emu_lib.h.
+Built on its own, it doesn't need a platform layer.
+*/
+
+#include <stdlib.h>
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "8080emu_lib.h"
+
+#define EMU8080_SCREEN_WIDTH 224
+#define EMU8080_SCREEN_HEIGHT 256
+// NOTE(bSalmon): 64KB address space, plus room for the operand bytes of an instruction at 0xFFFF
+#define EMU8080_MEMORY_SIZE (KILOBYTES(64) + 16)
+
+struct Emu8080
+{
+	CPUState cpuState;
+	MachineState machine;
+	
+	BackBuffer framebuffer;
+	u64 renderedHash;
+	b32 framebufferValid;
+	
+	StateHash stateHash;
+	
+	u8 memory[EMU8080_MEMORY_SIZE];
+	u32 pixels[EMU8080_SCREEN_WIDTH * EMU8080_SCREEN_HEIGHT];
+};
+
+extern "C" EMU8080_API Emu8080 *Emu8080_Create(void)
+{
+	Emu8080 *emu = (Emu8080 *)calloc(1, sizeof(Emu8080));
+	if (emu)
+	{
+		emu->cpuState.memory = emu->memory;
+		emu->machine.romSize = 0x2000;
+		ResetMachine(&emu->cpuState, &emu->machine);
+		
+		emu->framebuffer.memory = emu->pixels;
+		emu->framebuffer.width = EMU8080_SCREEN_WIDTH;
+		emu->framebuffer.height = EMU8080_SCREEN_HEIGHT;
+		emu->framebuffer.bytesPerPixel = 4;
+		emu->framebuffer.pitch = EMU8080_SCREEN_WIDTH * 4;
+		emu->framebuffer.format = FrameFormat::ARGB32;
+	}
+	
+	return emu;
+}
+
+extern "C" EMU8080_API void Emu8080_Destroy(Emu8080 *emu)
+{
+	free(emu);
+}
+
+extern "C" EMU8080_API Emu8080_Result Emu8080_LoadROM(Emu8080 *emu, const void *rom, size_t size)
+{
+	if (!emu || (!rom && size))
+	{
+		return EMU8080_ERROR_INVALID_ARGUMENT;
+	}
+	
+	if (size > emu->machine.romSize)
+	{
+		return EMU8080_ERROR_ROM_TOO_LARGE;
+	}
+	
+	memset(emu->memory, 0, sizeof(emu->memory));
+	memcpy(emu->memory, rom, size);
+	ResetMachine(&emu->cpuState, &emu->machine);
+	emu->framebufferValid = false;
+	ResetStateHash(&emu->stateHash);
+	
+	return EMU8080_OK;
+}
+
+extern "C" EMU8080_API void Emu8080_Reset(Emu8080 *emu)
+{
+	// NOTE(bSalmon): RAM is cleared but the ROM is kept
+	memset(&emu->memory[emu->machine.romSize], 0, sizeof(emu->memory) - emu->machine.romSize);
+	ResetMachine(&emu->cpuState, &emu->machine);
+	emu->framebufferValid = false;
+	ResetStateHash(&emu->stateHash);
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_RunCycles(Emu8080 *emu, uint64_t cycleCount)
+{
+	u64 startCycles = emu->machine.cycles;
+	EmulateCycles(&emu->cpuState, &emu->machine, cycleCount);
+	
+	return emu->machine.cycles - startCycles;
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_RunFrames(Emu8080 *emu, uint64_t frameCount)
+{
+	u64 startFrame = emu->machine.frameCount;
+	for (u64 frameIndex = 0; frameIndex < frameCount && !IsMachineStopped(&emu->cpuState); ++frameIndex)
+	{
+		EmulateFrame(&emu->cpuState, &emu->machine);
+	}
+	
+	return emu->machine.frameCount - startFrame;
+}
+
+extern "C" EMU8080_API void Emu8080_SetInput(Emu8080 *emu, Emu8080_Input input, int pressed)
+{
+	// NOTE(bSalmon): Emu8080_Input is in the same order as MachineInput
+	SetMachineInput(&emu->machine, (MachineInput)input, pressed ? true : false);
+}
+
+extern "C" EMU8080_API void Emu8080_SetColour(Emu8080 *emu, int enable)
+{
+	emu->machine.enableColour = enable ? true : false;
+}
+
+extern "C" EMU8080_API Emu8080_Result Emu8080_GetFramebuffer(Emu8080 *emu, Emu8080_Framebuffer *framebuffer)
+{
+	if (!emu || !framebuffer)
+	{
+		return EMU8080_ERROR_INVALID_ARGUMENT;
+	}
+	
+	// NOTE(bSalmon): Only rendered when asked for, and only if VRAM has changed since the last time
+	u64 videoHash = HashVideoMemory(&emu->cpuState, emu->machine.enableColour);
+	if (!emu->framebufferValid || videoHash != emu->renderedHash)
+	{
+		RenderVideoMemContents(&emu->framebuffer, &emu->cpuState, emu->machine.enableColour);
+		emu->renderedHash = videoHash;
+		emu->framebufferValid = true;
+	}
+	
+	framebuffer->pixels = emu->pixels;
+	framebuffer->width = emu->framebuffer.width;
+	framebuffer->height = emu->framebuffer.height;
+	framebuffer->pitch = emu->framebuffer.pitch;
+	
+	return EMU8080_OK;
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_GetCycleCount(Emu8080 *emu)
+{
+	return emu->machine.cycles;
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_GetFrameCount(Emu8080 *emu)
+{
+	return emu->machine.frameCount;
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_GetStateHash(Emu8080 *emu)
+{
+	return HashMachineState(&emu->cpuState, &emu->machine);
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_GetFrameHash(Emu8080 *emu)
+{
+	return HashVideoMemory(&emu->cpuState, emu->machine.enableColour);
+}
+
+extern "C" EMU8080_API uint64_t Emu8080_GetFastStateHash(Emu8080 *emu)
+{
+	return UpdateStateHash(&emu->stateHash, &emu->cpuState, &emu->machine);
+}
+
+extern "C" EMU8080_API int Emu8080_IsHalted(Emu8080 *emu)
+{
+	return emu->cpuState.halted ? 1 : 0;
+}
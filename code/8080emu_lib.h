@@ -0,0 +1,137 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_lib.h
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Emulator Library, a C API around the core for embedding in other programs.
+
+Every emulator is an opaque instance with all of its state inside it, so any number of
+instances can run at the same time as long as each one is only used by one thread at a time.
+Built as a static library (lib8080emu) or a shared library (8080emu.dll/lib8080emu.so),
+define EMU8080_SHARED when using the shared library on Windows.
+
+Emu8080 *emu = Emu8080_Create();
+Emu8080_LoadROM(emu, romData, romSize);
+Emu8080_SetInput(emu, EMU8080_INPUT_COIN, 1);
+Emu8080_RunFrames(emu, 60);
+Emu8080_Framebuffer frame;
+Emu8080_GetFramebuffer(emu, &frame);
+Emu8080_Destroy(emu);
+*/
+
+#ifndef EMU8080_LIB_H
+#define EMU8080_LIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(EMU8080_BUILD_SHARED)
+#define EMU8080_API __declspec(dllexport)
+#elif defined(EMU8080_SHARED)
+#define EMU8080_API __declspec(dllimport)
+#else
+#define EMU8080_API
+#endif
+#else
+#define EMU8080_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Emu8080 Emu8080;
+
+typedef enum Emu8080_Result
+{
+	EMU8080_OK = 0,
+	EMU8080_ERROR_INVALID_ARGUMENT = -1,
+	EMU8080_ERROR_ROM_TOO_LARGE = -2
+} Emu8080_Result;
+
+// Space Invaders cabinet inputs
+typedef enum Emu8080_Input
+{
+	EMU8080_INPUT_COIN,
+	EMU8080_INPUT_P1_START,
+	EMU8080_INPUT_P1_SHOOT,
+	EMU8080_INPUT_P1_LEFT,
+	EMU8080_INPUT_P1_RIGHT,
+	EMU8080_INPUT_P2_START,
+	EMU8080_INPUT_P2_SHOOT,
+	EMU8080_INPUT_P2_LEFT,
+	EMU8080_INPUT_P2_RIGHT,
+	EMU8080_INPUT_TILT,
+	EMU8080_INPUT_DIPSWITCH1,
+	EMU8080_INPUT_DIPSWITCH2,
+	EMU8080_INPUT_DIPSWITCH_BONUS,
+	EMU8080_INPUT_DIPSWITCH_COIN,
+	
+	EMU8080_INPUT_COUNT
+} Emu8080_Input;
+
+// 32-bit pixels, Mem Order BB GG RR AA, top-down and rotated to the upright screen
+typedef struct Emu8080_Framebuffer
+{
+	const uint32_t *pixels;
+	int32_t width;
+	int32_t height;
+	int32_t pitch;
+} Emu8080_Framebuffer;
+
+// Returns 0 if out of memory
+EMU8080_API Emu8080 *Emu8080_Create(void);
+EMU8080_API void Emu8080_Destroy(Emu8080 *emu);
+
+// Copies the ROM to address 0 and resets the CPU, at most 8KB
+EMU8080_API Emu8080_Result Emu8080_LoadROM(Emu8080 *emu, const void *rom, size_t size);
+EMU8080_API void Emu8080_Reset(Emu8080 *emu);
+
+// Both return how many cycles/frames actually ran, less than asked if the CPU halted with interrupts disabled
+EMU8080_API uint64_t Emu8080_RunCycles(Emu8080 *emu, uint64_t cycleCount);
+EMU8080_API uint64_t Emu8080_RunFrames(Emu8080 *emu, uint64_t frameCount);
+
+EMU8080_API void Emu8080_SetInput(Emu8080 *emu, Emu8080_Input input, int pressed);
+EMU8080_API void Emu8080_SetColour(Emu8080 *emu, int enable);
+
+// The pixels stay valid until the next call on this instance
+EMU8080_API Emu8080_Result Emu8080_GetFramebuffer(Emu8080 *emu, Emu8080_Framebuffer *framebuffer);
+
+EMU8080_API uint64_t Emu8080_GetCycleCount(Emu8080 *emu);
+EMU8080_API uint64_t Emu8080_GetFrameCount(Emu8080 *emu);
+EMU8080_API uint64_t Emu8080_GetStateHash(Emu8080 *emu);
+
+// Hash of the video memory and colour setting, equal hashes mean Emu8080_GetFramebuffer would
+// return the same picture. A cheap frame fingerprint, nothing is rendered
+EMU8080_API uint64_t Emu8080_GetFrameHash(Emu8080 *emu);
+
+// Hash of what decides what happens next: registers, ports, shifter, time to the next interrupt
+// and memory, but not the cycle or frame totals. Only the RAM written since the last call is
+// hashed again, so calling it every frame costs well under a microsecond
+EMU8080_API uint64_t Emu8080_GetFastStateHash(Emu8080 *emu);
+EMU8080_API int Emu8080_IsHalted(Emu8080 *emu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,954 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_lockstep.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Lockstep Interpreter, EXPERIMENTAL. Runs a group of up to 32 instances (lanes) of the same
+ROM together, with the CPU state kept as structure of arrays so one SIMD instruction can work
+on the same register of every lane at once.
+
+Every step the opcode under each lane's PC is fetched and the opcode the most lanes are
+sitting on is run for all of those lanes together, lanes on other opcodes wait their turn.
+Lanes are still separate machines with their own cycle counts and interrupts, waiting only
+changes the order the host runs them in, so the results are the same as running each lane
+on its own with Emulate().
+
+Register, ALU and flag work is done in SIMD over the whole group with a lane mask. Anything
+that touches memory (operands, stores, the stack, branch targets) is done lane by lane, the
+lanes all use different memory. Opcodes without a vector version, or an opcode only one lane
+is on, go through the scalar EmulateStep() which stays the reference.
+
+Register rows are indexed with the 8080's own register encoding (B C D E H L M A), the M row
+holds the memory or immediate operand of the current step.
+*/
+
+#define LOCKSTEP_MAX_LANES 32
+#define LOCKSTEP_MIN_VECTOR_LANES 2
+#define LOCKSTEP_MEMORY_SIZE (KILOBYTES(64) + 16)
+
+#define LOCKSTEP_REG_B 0
+#define LOCKSTEP_REG_C 1
+#define LOCKSTEP_REG_D 2
+#define LOCKSTEP_REG_E 3
+#define LOCKSTEP_REG_H 4
+#define LOCKSTEP_REG_L 5
+#define LOCKSTEP_REG_M 6
+#define LOCKSTEP_REG_A 7
+
+#define LOCKSTEP_PAIR_SP 3
+
+// Vector Helpers
+#if EMU8080_AVX2
+#define LOCKSTEP_VECTOR_WIDTH 32
+typedef __m256i LaneVector;
+
+inline LaneVector LoadLanes(void *lanes) { return _mm256_loadu_si256((__m256i *)lanes); }
+inline void StoreLanes(void *lanes, LaneVector value) { _mm256_storeu_si256((__m256i *)lanes, value); }
+inline LaneVector SetLanes(u8 value) { return _mm256_set1_epi8((char)value); }
+inline LaneVector AndLanes(LaneVector a, LaneVector b) { return _mm256_and_si256(a, b); }
+inline LaneVector OrLanes(LaneVector a, LaneVector b) { return _mm256_or_si256(a, b); }
+inline LaneVector XorLanes(LaneVector a, LaneVector b) { return _mm256_xor_si256(a, b); }
+inline LaneVector AndNotLanes(LaneVector a, LaneVector b) { return _mm256_andnot_si256(a, b); }
+inline LaneVector AddLanes(LaneVector a, LaneVector b) { return _mm256_add_epi8(a, b); }
+inline LaneVector SubLanes(LaneVector a, LaneVector b) { return _mm256_sub_epi8(a, b); }
+inline LaneVector EqualLanes(LaneVector a, LaneVector b) { return _mm256_cmpeq_epi8(a, b); }
+inline LaneVector GreaterLanes(LaneVector a, LaneVector b) { return _mm256_cmpgt_epi8(a, b); }
+inline LaneVector SelectLanes(LaneVector mask, LaneVector a, LaneVector b) { return _mm256_blendv_epi8(b, a, mask); }
+// NOTE(bSalmon): Shifts 16-bit pairs, bits from the neighbouring byte end up in the top of the low byte
+inline LaneVector ShiftRightLanes(LaneVector a, s32 shift) { return _mm256_srli_epi16(a, shift); }
+#else
+#define LOCKSTEP_VECTOR_WIDTH 16
+typedef __m128i LaneVector;
+
+inline LaneVector LoadLanes(void *lanes) { return _mm_loadu_si128((__m128i *)lanes); }
+inline void StoreLanes(void *lanes, LaneVector value) { _mm_storeu_si128((__m128i *)lanes, value); }
+inline LaneVector SetLanes(u8 value) { return _mm_set1_epi8((char)value); }
+inline LaneVector AndLanes(LaneVector a, LaneVector b) { return _mm_and_si128(a, b); }
+inline LaneVector OrLanes(LaneVector a, LaneVector b) { return _mm_or_si128(a, b); }
+inline LaneVector XorLanes(LaneVector a, LaneVector b) { return _mm_xor_si128(a, b); }
+inline LaneVector AndNotLanes(LaneVector a, LaneVector b) { return _mm_andnot_si128(a, b); }
+inline LaneVector AddLanes(LaneVector a, LaneVector b) { return _mm_add_epi8(a, b); }
+inline LaneVector SubLanes(LaneVector a, LaneVector b) { return _mm_sub_epi8(a, b); }
+inline LaneVector EqualLanes(LaneVector a, LaneVector b) { return _mm_cmpeq_epi8(a, b); }
+inline LaneVector GreaterLanes(LaneVector a, LaneVector b) { return _mm_cmpgt_epi8(a, b); }
+inline LaneVector SelectLanes(LaneVector mask, LaneVector a, LaneVector b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+// NOTE(bSalmon): Shifts 16-bit pairs, bits from the neighbouring byte end up in the top of the low byte
+inline LaneVector ShiftRightLanes(LaneVector a, s32 shift) { return _mm_srli_epi16(a, shift); }
+#endif
+
+// 0 or 1 in every lane
+inline LaneVector ToFlagLanes(LaneVector mask)
+{
+	return AndLanes(mask, SetLanes(1));
+}
+
+inline LaneVector ZeroFlagLanes(LaneVector result)
+{
+	return ToFlagLanes(EqualLanes(result, SetLanes(0)));
+}
+
+inline LaneVector SignFlagLanes(LaneVector result)
+{
+	return AndLanes(ShiftRightLanes(result, 7), SetLanes(1));
+}
+
+inline LaneVector ParityFlagLanes(LaneVector result)
+{
+	// NOTE(bSalmon): Folds the byte down to its parity in bit 0, only the low bits of each
+	// fold are used so the bits ShiftRightLanes drags in from the next byte never matter
+	LaneVector fold = XorLanes(result, ShiftRightLanes(result, 4));
+	fold = XorLanes(fold, ShiftRightLanes(fold, 2));
+	fold = XorLanes(fold, ShiftRightLanes(fold, 1));
+	
+	return XorLanes(AndLanes(fold, SetLanes(1)), SetLanes(1));
+}
+
+// Same as SetAuxiliaryFlag, (reg & 0xf) > (result & 0xf)
+inline LaneVector AuxiliaryFlagLanes(LaneVector reg, LaneVector result)
+{
+	LaneVector nibbleMask = SetLanes(0x0f);
+	return ToFlagLanes(GreaterLanes(AndLanes(reg, nibbleMask), AndLanes(result, nibbleMask)));
+}
+
+// Carry out of bit 7 of a + b (+ carry in) given the 8-bit sum
+inline LaneVector CarryFlagLanes(LaneVector a, LaneVector b, LaneVector sum)
+{
+	LaneVector carry = OrLanes(AndLanes(a, b), AndNotLanes(sum, OrLanes(a, b)));
+	return AndLanes(ShiftRightLanes(carry, 7), SetLanes(1));
+}
+
+// Borrow out of bit 7 of a - b (- borrow in) given the 8-bit difference
+inline LaneVector BorrowFlagLanes(LaneVector a, LaneVector b, LaneVector difference)
+{
+	LaneVector notA = XorLanes(a, SetLanes(0xff));
+	LaneVector borrow = OrLanes(AndLanes(notA, b), AndLanes(OrLanes(notA, b), difference));
+	return AndLanes(ShiftRightLanes(borrow, 7), SetLanes(1));
+}
+
+enum class LockstepOpKind
+{
+	SCALAR,
+	MOV,
+	MVI,
+	INR,
+	DCR,
+	ALU,
+	LXI,
+	INX,
+	DCX,
+	DAD,
+	LDA,
+	STA,
+	LDAX,
+	STAX,
+	XCHG,
+	JUMP,
+	CALL,
+	RET,
+	PUSH,
+	POP
+};
+
+// NOTE(bSalmon): In the order of the 8080 encoding, opcode bits 3-5
+enum class LockstepALUOp
+{
+	ADD,
+	ADC,
+	SUB,
+	SBB,
+	ANA,
+	XRA,
+	ORA,
+	CMP
+};
+
+struct LockstepOp
+{
+	LockstepOpKind kind;
+	LockstepALUOp aluOp;
+	u8 dest;
+	u8 source;
+	// NOTE(bSalmon): Register pair 0-3 is BC, DE, HL, SP
+	u8 pair;
+	u8 length;
+	b32 conditional;
+	u8 condition;
+};
+
+struct LockstepStats
+{
+	u64 steps;
+	u64 vectorSteps;
+	u64 vectorInstructions;
+	u64 scalarInstructions;
+	u64 laneSteps;
+	// NOTE(bSalmon): vectorStepLanes[n] is the number of vector steps that ran n lanes
+	u64 vectorStepLanes[LOCKSTEP_MAX_LANES + 1];
+};
+
+struct LockstepGroup
+{
+	u32 laneCount;
+	
+	u8 regs[8][LOCKSTEP_MAX_LANES];
+	u8 flagS[LOCKSTEP_MAX_LANES];
+	u8 flagZ[LOCKSTEP_MAX_LANES];
+	u8 flagA[LOCKSTEP_MAX_LANES];
+	u8 flagP[LOCKSTEP_MAX_LANES];
+	u8 flagC[LOCKSTEP_MAX_LANES];
+	// NOTE(bSalmon): The 3 unused CPUFlags bits, kept so POP PSW round trips through the group
+	u8 flagUnused[LOCKSTEP_MAX_LANES];
+	
+	u16 stackPointer[LOCKSTEP_MAX_LANES];
+	u16 programCounter[LOCKSTEP_MAX_LANES];
+	b32 enableInterrupt[LOCKSTEP_MAX_LANES];
+	b32 halted[LOCKSTEP_MAX_LANES];
+	u8 *memory[LOCKSTEP_MAX_LANES];
+	u64 dirtyPages[LOCKSTEP_MAX_LANES];
+	
+	// NOTE(bSalmon): Machine state the vector path never touches except for the cycle counts
+	MachineState machines[LOCKSTEP_MAX_LANES];
+	
+	// Per step scratch
+	u8 laneMask[LOCKSTEP_MAX_LANES];
+	u8 operand2[LOCKSTEP_MAX_LANES];
+	u8 taken[LOCKSTEP_MAX_LANES];
+	u8 running[LOCKSTEP_MAX_LANES];
+	u64 frameEnd[LOCKSTEP_MAX_LANES];
+	
+	LockstepStats stats;
+};
+
+internal_func LockstepOp DecodeLockstepOp(u8 opCode)
+{
+	LockstepOp result = {};
+	result.length = 1;
+	
+	u8 reg = (opCode >> 3) & 0x07;
+	u8 pair = (opCode >> 4) & 0x03;
+	
+	if (opCode == 0x76)
+	{
+		// NOTE(bSalmon): HLT
+		result.kind = LockstepOpKind::SCALAR;
+	}
+	else if (opCode >= 0x40 && opCode < 0x80)
+	{
+		result.kind = LockstepOpKind::MOV;
+		result.dest = reg;
+		result.source = opCode & 0x07;
+	}
+	else if (opCode >= 0x80 && opCode < 0xc0)
+	{
+		result.kind = LockstepOpKind::ALU;
+		result.aluOp = (LockstepALUOp)reg;
+		result.source = opCode & 0x07;
+	}
+	else if (opCode < 0x40)
+	{
+		switch (opCode & 0x0f)
+		{
+			case 0x01: { result.kind = LockstepOpKind::LXI; result.length = 3; break; }
+			case 0x03: { result.kind = LockstepOpKind::INX; break; }
+			case 0x0b: { result.kind = LockstepOpKind::DCX; break; }
+			case 0x09:
+			{
+				result.kind = (pair != LOCKSTEP_PAIR_SP) ? LockstepOpKind::DAD : LockstepOpKind::SCALAR;
+				break;
+			}
+			
+			case 0x04: case 0x0c:
+			{
+				result.kind = (reg != LOCKSTEP_REG_M) ? LockstepOpKind::INR : LockstepOpKind::SCALAR;
+				break;
+			}
+			
+			case 0x05: case 0x0d:
+			{
+				result.kind = (reg != LOCKSTEP_REG_M) ? LockstepOpKind::DCR : LockstepOpKind::SCALAR;
+				break;
+			}
+			
+			case 0x06: case 0x0e: { result.kind = LockstepOpKind::MVI; result.length = 2; break; }
+			default: { break; }
+		}
+		
+		result.dest = reg;
+		result.pair = pair;
+		
+		switch (opCode)
+		{
+			case 0x02: case 0x12: { result.kind = LockstepOpKind::STAX; break; }
+			case 0x0a: case 0x1a: { result.kind = LockstepOpKind::LDAX; break; }
+			case 0x32: { result.kind = LockstepOpKind::STA; result.length = 3; break; }
+			case 0x3a: { result.kind = LockstepOpKind::LDA; result.length = 3; break; }
+			default: { break; }
+		}
+	}
+	else
+	{
+		result.pair = pair;
+		result.condition = reg;
+		
+		switch (opCode & 0x07)
+		{
+			case 0x00: { result.kind = LockstepOpKind::RET; result.conditional = true; break; }
+			case 0x02: { result.kind = LockstepOpKind::JUMP; result.conditional = true; result.length = 3; break; }
+			case 0x04: { result.kind = LockstepOpKind::CALL; result.conditional = true; result.length = 3; break; }
+			
+			case 0x06:
+			{
+				result.kind = LockstepOpKind::ALU;
+				result.aluOp = (LockstepALUOp)reg;
+				result.source = LOCKSTEP_REG_M;
+				result.length = 2;
+				break;
+			}
+			
+			default: { break; }
+		}
+		
+		switch (opCode)
+		{
+			case 0xc1: case 0xd1: case 0xe1: { result.kind = LockstepOpKind::POP; break; }
+			case 0xc5: case 0xd5: case 0xe5: { result.kind = LockstepOpKind::PUSH; break; }
+			case 0xc3: { result.kind = LockstepOpKind::JUMP; result.length = 3; break; }
+			case 0xc9: { result.kind = LockstepOpKind::RET; break; }
+			case 0xcd: { result.kind = LockstepOpKind::CALL; result.length = 3; break; }
+			case 0xeb: { result.kind = LockstepOpKind::XCHG; break; }
+			default: { break; }
+		}
+	}
+	
+	return result;
+}
+
+internal_func void LoadLockstepLane(LockstepGroup *group, u32 lane, CPUState *cpuState)
+{
+	cpuState->regB = group->regs[LOCKSTEP_REG_B][lane];
+	cpuState->regC = group->regs[LOCKSTEP_REG_C][lane];
+	cpuState->regD = group->regs[LOCKSTEP_REG_D][lane];
+	cpuState->regE = group->regs[LOCKSTEP_REG_E][lane];
+	cpuState->regH = group->regs[LOCKSTEP_REG_H][lane];
+	cpuState->regL = group->regs[LOCKSTEP_REG_L][lane];
+	cpuState->regA = group->regs[LOCKSTEP_REG_A][lane];
+	
+	cpuState->regF.s = group->flagS[lane];
+	cpuState->regF.z = group->flagZ[lane];
+	cpuState->regF.a = group->flagA[lane];
+	cpuState->regF.p = group->flagP[lane];
+	cpuState->regF.c = group->flagC[lane];
+	cpuState->regF.unused1 = group->flagUnused[lane] & 0x01;
+	cpuState->regF.unused2 = (group->flagUnused[lane] >> 1) & 0x01;
+	cpuState->regF.unused3 = (group->flagUnused[lane] >> 2) & 0x01;
+	
+	cpuState->memory = group->memory[lane];
+	cpuState->enableInterrupt = group->enableInterrupt[lane];
+	cpuState->halted = group->halted[lane];
+	cpuState->stackPointer = group->stackPointer[lane];
+	cpuState->programCounter = group->programCounter[lane];
+	cpuState->dirtyPages = group->dirtyPages[lane];
+}
+
+internal_func void StoreLockstepLane(LockstepGroup *group, u32 lane, CPUState *cpuState)
+{
+	group->regs[LOCKSTEP_REG_B][lane] = cpuState->regB;
+	group->regs[LOCKSTEP_REG_C][lane] = cpuState->regC;
+	group->regs[LOCKSTEP_REG_D][lane] = cpuState->regD;
+	group->regs[LOCKSTEP_REG_E][lane] = cpuState->regE;
+	group->regs[LOCKSTEP_REG_H][lane] = cpuState->regH;
+	group->regs[LOCKSTEP_REG_L][lane] = cpuState->regL;
+	group->regs[LOCKSTEP_REG_A][lane] = cpuState->regA;
+	
+	group->flagS[lane] = cpuState->regF.s;
+	group->flagZ[lane] = cpuState->regF.z;
+	group->flagA[lane] = cpuState->regF.a;
+	group->flagP[lane] = cpuState->regF.p;
+	group->flagC[lane] = cpuState->regF.c;
+	group->flagUnused[lane] = (u8)(cpuState->regF.unused1 | (cpuState->regF.unused2 << 1) | (cpuState->regF.unused3 << 2));
+	
+	group->enableInterrupt[lane] = cpuState->enableInterrupt;
+	group->halted[lane] = cpuState->halted;
+	group->stackPointer[lane] = cpuState->stackPointer;
+	group->programCounter[lane] = cpuState->programCounter;
+	group->dirtyPages[lane] = cpuState->dirtyPages;
+}
+
+// Lanes are given their own memory with the ROM already in it, either from PlatformMapInstanceMemory or
+// LOCKSTEP_MEMORY_SIZE bytes of their own
+internal_func void InitLockstepGroup(LockstepGroup *group, u32 laneCount, u8 **laneMemory)
+{
+	ASSERT(laneCount <= LOCKSTEP_MAX_LANES);
+	*group = {};
+	group->laneCount = laneCount;
+	
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		CPUState cpuState = {};
+		cpuState.memory = laneMemory[lane];
+		group->machines[lane].romSize = 0x2000;
+		ResetMachine(&cpuState, &group->machines[lane]);
+		
+		group->memory[lane] = laneMemory[lane];
+		StoreLockstepLane(group, lane, &cpuState);
+	}
+}
+
+// Condition codes in the order of the 8080 encoding, NZ Z NC C PO PE P M
+internal_func LaneVector ConditionLanes(LockstepGroup *group, u8 condition, u32 offset)
+{
+	u8 *flagRows[] = {group->flagZ, group->flagC, group->flagP, group->flagS};
+	LaneVector flag = LoadLanes(&flagRows[condition >> 1][offset]);
+	LaneVector result = EqualLanes(flag, SetLanes(condition & 0x01));
+	
+	return result;
+}
+
+// Register, ALU and flag work for every lane in laneMask, operands must already be gathered into the M row
+internal_func void ExecuteLockstepVector(LockstepGroup *group, LockstepOp *op)
+{
+	for (u32 offset = 0; offset < LOCKSTEP_MAX_LANES; offset += LOCKSTEP_VECTOR_WIDTH)
+	{
+		LaneVector mask = LoadLanes(&group->laneMask[offset]);
+		
+		switch (op->kind)
+		{
+			case LockstepOpKind::MOV:
+			case LockstepOpKind::MVI:
+			{
+				if (op->dest != LOCKSTEP_REG_M)
+				{
+					u8 source = (op->kind == LockstepOpKind::MOV) ? op->source : LOCKSTEP_REG_M;
+					u8 *dest = &group->regs[op->dest][offset];
+					StoreLanes(dest, SelectLanes(mask, LoadLanes(&group->regs[source][offset]), LoadLanes(dest)));
+				}
+				break;
+			}
+			
+			case LockstepOpKind::LDA:
+			case LockstepOpKind::LDAX:
+			{
+				u8 *dest = &group->regs[LOCKSTEP_REG_A][offset];
+				StoreLanes(dest, SelectLanes(mask, LoadLanes(&group->regs[LOCKSTEP_REG_M][offset]), LoadLanes(dest)));
+				break;
+			}
+			
+			case LockstepOpKind::INR:
+			case LockstepOpKind::DCR:
+			{
+				u8 *dest = &group->regs[op->dest][offset];
+				LaneVector reg = LoadLanes(dest);
+				LaneVector result = (op->kind == LockstepOpKind::INR) ? AddLanes(reg, SetLanes(1)) : SubLanes(reg, SetLanes(1));
+				
+				StoreLanes(dest, SelectLanes(mask, result, reg));
+				StoreLanes(&group->flagZ[offset], SelectLanes(mask, ZeroFlagLanes(result), LoadLanes(&group->flagZ[offset])));
+				StoreLanes(&group->flagS[offset], SelectLanes(mask, SignFlagLanes(result), LoadLanes(&group->flagS[offset])));
+				StoreLanes(&group->flagA[offset], SelectLanes(mask, AuxiliaryFlagLanes(reg, result), LoadLanes(&group->flagA[offset])));
+				StoreLanes(&group->flagP[offset], SelectLanes(mask, ParityFlagLanes(result), LoadLanes(&group->flagP[offset])));
+				break;
+			}
+			
+			case LockstepOpKind::ALU:
+			{
+				u8 *regA = &group->regs[LOCKSTEP_REG_A][offset];
+				LaneVector a = LoadLanes(regA);
+				LaneVector b = LoadLanes(&group->regs[op->source][offset]);
+				LaneVector carryIn = LoadLanes(&group->flagC[offset]);
+				LaneVector result = a;
+				LaneVector carry = SetLanes(0);
+				b32 setsAuxiliary = true;
+				
+				switch (op->aluOp)
+				{
+					case LockstepALUOp::ADD: { result = AddLanes(a, b); carry = CarryFlagLanes(a, b, result); break; }
+					case LockstepALUOp::ADC: { result = AddLanes(AddLanes(a, b), carryIn); carry = CarryFlagLanes(a, b, result); break; }
+					case LockstepALUOp::SUB:
+					case LockstepALUOp::CMP: { result = SubLanes(a, b); carry = BorrowFlagLanes(a, b, result); break; }
+					case LockstepALUOp::SBB: { result = SubLanes(SubLanes(a, b), carryIn); carry = BorrowFlagLanes(a, b, result); break; }
+					case LockstepALUOp::ANA: { result = AndLanes(a, b); setsAuxiliary = false; break; }
+					case LockstepALUOp::XRA: { result = XorLanes(a, b); setsAuxiliary = false; break; }
+					case LockstepALUOp::ORA: { result = OrLanes(a, b); setsAuxiliary = false; break; }
+				}
+				
+				if (op->aluOp != LockstepALUOp::CMP)
+				{
+					StoreLanes(regA, SelectLanes(mask, result, a));
+				}
+				
+				StoreLanes(&group->flagZ[offset], SelectLanes(mask, ZeroFlagLanes(result), LoadLanes(&group->flagZ[offset])));
+				StoreLanes(&group->flagS[offset], SelectLanes(mask, SignFlagLanes(result), LoadLanes(&group->flagS[offset])));
+				StoreLanes(&group->flagP[offset], SelectLanes(mask, ParityFlagLanes(result), LoadLanes(&group->flagP[offset])));
+				StoreLanes(&group->flagC[offset], SelectLanes(mask, carry, carryIn));
+				if (setsAuxiliary)
+				{
+					StoreLanes(&group->flagA[offset], SelectLanes(mask, AuxiliaryFlagLanes(a, result), LoadLanes(&group->flagA[offset])));
+				}
+				break;
+			}
+			
+			case LockstepOpKind::LXI:
+			case LockstepOpKind::POP:
+			{
+				// NOTE(bSalmon): Low byte in the M row, high byte in operand2
+				if (op->pair != LOCKSTEP_PAIR_SP)
+				{
+					u8 *high = &group->regs[op->pair * 2][offset];
+					u8 *low = &group->regs[(op->pair * 2) + 1][offset];
+					StoreLanes(high, SelectLanes(mask, LoadLanes(&group->operand2[offset]), LoadLanes(high)));
+					StoreLanes(low, SelectLanes(mask, LoadLanes(&group->regs[LOCKSTEP_REG_M][offset]), LoadLanes(low)));
+				}
+				break;
+			}
+			
+			case LockstepOpKind::INX:
+			case LockstepOpKind::DCX:
+			{
+				if (op->pair != LOCKSTEP_PAIR_SP)
+				{
+					// NOTE(bSalmon): Compare masks are -1, so subtracting one adds 1 and adding one subtracts 1
+					u8 *high = &group->regs[op->pair * 2][offset];
+					u8 *low = &group->regs[(op->pair * 2) + 1][offset];
+					LaneVector highValue = LoadLanes(high);
+					LaneVector lowValue = LoadLanes(low);
+					LaneVector lowResult;
+					LaneVector highResult;
+					if (op->kind == LockstepOpKind::INX)
+					{
+						lowResult = AddLanes(lowValue, SetLanes(1));
+						highResult = SubLanes(highValue, EqualLanes(lowResult, SetLanes(0)));
+					}
+					else
+					{
+						lowResult = SubLanes(lowValue, SetLanes(1));
+						highResult = AddLanes(highValue, EqualLanes(lowResult, SetLanes(0xff)));
+					}
+					
+					StoreLanes(high, SelectLanes(mask, highResult, highValue));
+					StoreLanes(low, SelectLanes(mask, lowResult, lowValue));
+				}
+				break;
+			}
+			
+			case LockstepOpKind::DAD:
+			{
+				u8 *regH = &group->regs[LOCKSTEP_REG_H][offset];
+				u8 *regL = &group->regs[LOCKSTEP_REG_L][offset];
+				LaneVector h = LoadLanes(regH);
+				LaneVector l = LoadLanes(regL);
+				LaneVector pairHigh = LoadLanes(&group->regs[op->pair * 2][offset]);
+				LaneVector pairLow = LoadLanes(&group->regs[(op->pair * 2) + 1][offset]);
+				
+				LaneVector lowResult = AddLanes(l, pairLow);
+				LaneVector highResult = AddLanes(AddLanes(h, pairHigh), CarryFlagLanes(l, pairLow, lowResult));
+				
+				StoreLanes(regH, SelectLanes(mask, highResult, h));
+				StoreLanes(regL, SelectLanes(mask, lowResult, l));
+				StoreLanes(&group->flagC[offset], SelectLanes(mask, CarryFlagLanes(h, pairHigh, highResult), LoadLanes(&group->flagC[offset])));
+				break;
+			}
+			
+			case LockstepOpKind::XCHG:
+			{
+				for (u32 regIndex = 0; regIndex < 2; ++regIndex)
+				{
+					u8 *de = &group->regs[LOCKSTEP_REG_D + regIndex][offset];
+					u8 *hl = &group->regs[LOCKSTEP_REG_H + regIndex][offset];
+					LaneVector deValue = LoadLanes(de);
+					LaneVector hlValue = LoadLanes(hl);
+					StoreLanes(de, SelectLanes(mask, hlValue, deValue));
+					StoreLanes(hl, SelectLanes(mask, deValue, hlValue));
+				}
+				break;
+			}
+			
+			case LockstepOpKind::JUMP:
+			case LockstepOpKind::CALL:
+			case LockstepOpKind::RET:
+			{
+				LaneVector taken = op->conditional ? ConditionLanes(group, op->condition, offset) : SetLanes(0xff);
+				StoreLanes(&group->taken[offset], taken);
+				break;
+			}
+			
+			default:
+			{
+				break;
+			}
+		}
+	}
+}
+
+internal_func u16 GetLockstepPair(LockstepGroup *group, u8 pair, u32 lane)
+{
+	u16 result = (u16)((group->regs[pair * 2][lane] << 8) | group->regs[(pair * 2) + 1][lane]);
+	return result;
+}
+
+inline void LockstepMemWrite(LockstepGroup *group, u32 lane, u16 adr, u8 value)
+{
+	// NOTE(bSalmon): Same rule as SafeMemWrite, ROM and the mirror above 0x4000 are read only
+	if (adr >= 0x2000 && adr < 0x4000)
+	{
+		group->memory[lane][adr] = value;
+		group->dirtyPages[lane] |= 1ULL << ((adr - RAM_START) / RAM_PAGE_SIZE);
+	}
+}
+
+// Runs op for every lane in laneList, op must have a vector version
+internal_func void ExecuteLockstepStep(LockstepGroup *group, LockstepOp *op, u8 opCode, u8 *laneList, u32 laneListCount)
+{
+	// NOTE(bSalmon): Gather operands lane by lane into the M row (and operand2 for 16-bit values)
+	for (u32 listIndex = 0; listIndex < laneListCount; ++listIndex)
+	{
+		u32 lane = laneList[listIndex];
+		u8 *memory = group->memory[lane];
+		u16 pc = group->programCounter[lane];
+		group->laneMask[lane] = 0xff;
+		
+		switch (op->kind)
+		{
+			case LockstepOpKind::MOV:
+			case LockstepOpKind::ALU:
+			{
+				if (op->length == 2)
+				{
+					group->regs[LOCKSTEP_REG_M][lane] = memory[pc + 1];
+				}
+				else if (op->source == LOCKSTEP_REG_M)
+				{
+					group->regs[LOCKSTEP_REG_M][lane] = memory[GetLockstepPair(group, 2, lane)];
+				}
+				break;
+			}
+			
+			case LockstepOpKind::MVI:
+			{
+				group->regs[LOCKSTEP_REG_M][lane] = memory[pc + 1];
+				break;
+			}
+			
+			case LockstepOpKind::LXI:
+			{
+				group->regs[LOCKSTEP_REG_M][lane] = memory[pc + 1];
+				group->operand2[lane] = memory[pc + 2];
+				break;
+			}
+			
+			case LockstepOpKind::POP:
+			{
+				u16 sp = group->stackPointer[lane];
+				group->regs[LOCKSTEP_REG_M][lane] = memory[sp];
+				group->operand2[lane] = memory[sp + 1];
+				break;
+			}
+			
+			case LockstepOpKind::LDA:
+			{
+				group->regs[LOCKSTEP_REG_M][lane] = memory[(memory[pc + 2] << 8) | memory[pc + 1]];
+				break;
+			}
+			
+			case LockstepOpKind::LDAX:
+			{
+				group->regs[LOCKSTEP_REG_M][lane] = memory[GetLockstepPair(group, op->pair, lane)];
+				break;
+			}
+			
+			default:
+			{
+				break;
+			}
+		}
+	}
+	
+	ExecuteLockstepVector(group, op);
+	
+	// NOTE(bSalmon): Stores, the stack, the program counter and cycles lane by lane
+	for (u32 listIndex = 0; listIndex < laneListCount; ++listIndex)
+	{
+		u32 lane = laneList[listIndex];
+		u8 *memory = group->memory[lane];
+		u16 pc = group->programCounter[lane];
+		u16 sp = group->stackPointer[lane];
+		u16 nextPC = pc + op->length;
+		u64 cycles = cyclesArray[opCode];
+		group->laneMask[lane] = 0x00;
+		
+		switch (op->kind)
+		{
+			case LockstepOpKind::MOV:
+			{
+				if (op->dest == LOCKSTEP_REG_M)
+				{
+					LockstepMemWrite(group, lane, GetLockstepPair(group, 2, lane), group->regs[op->source][lane]);
+				}
+				break;
+			}
+			
+			case LockstepOpKind::MVI:
+			{
+				if (op->dest == LOCKSTEP_REG_M)
+				{
+					LockstepMemWrite(group, lane, GetLockstepPair(group, 2, lane), group->regs[LOCKSTEP_REG_M][lane]);
+				}
+				break;
+			}
+			
+			case LockstepOpKind::STA:
+			{
+				LockstepMemWrite(group, lane, (u16)((memory[pc + 2] << 8) | memory[pc + 1]), group->regs[LOCKSTEP_REG_A][lane]);
+				break;
+			}
+			
+			case LockstepOpKind::STAX:
+			{
+				LockstepMemWrite(group, lane, GetLockstepPair(group, op->pair, lane), group->regs[LOCKSTEP_REG_A][lane]);
+				break;
+			}
+			
+			case LockstepOpKind::LXI:
+			{
+				if (op->pair == LOCKSTEP_PAIR_SP)
+				{
+					group->stackPointer[lane] = (u16)((memory[pc + 2] << 8) | memory[pc + 1]);
+				}
+				break;
+			}
+			
+			case LockstepOpKind::INX:
+			case LockstepOpKind::DCX:
+			{
+				if (op->pair == LOCKSTEP_PAIR_SP)
+				{
+					group->stackPointer[lane] = (op->kind == LockstepOpKind::INX) ? (u16)(sp + 1) : (u16)(sp - 1);
+				}
+				break;
+			}
+			
+			case LockstepOpKind::PUSH:
+			{
+				LockstepMemWrite(group, lane, sp - 1, group->regs[op->pair * 2][lane]);
+				LockstepMemWrite(group, lane, sp - 2, group->regs[(op->pair * 2) + 1][lane]);
+				group->stackPointer[lane] = sp - 2;
+				break;
+			}
+			
+			case LockstepOpKind::POP:
+			{
+				group->stackPointer[lane] = sp + 2;
+				break;
+			}
+			
+			case LockstepOpKind::JUMP:
+			{
+				if (group->taken[lane])
+				{
+					nextPC = (u16)((memory[pc + 2] << 8) | memory[pc + 1]);
+				}
+				break;
+			}
+			
+			case LockstepOpKind::CALL:
+			{
+				if (group->taken[lane])
+				{
+					LockstepMemWrite(group, lane, sp - 1, (nextPC >> 8) & 0xff);
+					LockstepMemWrite(group, lane, sp - 2, nextPC & 0xff);
+					group->stackPointer[lane] = sp - 2;
+					nextPC = (u16)((memory[pc + 2] << 8) | memory[pc + 1]);
+				}
+				else
+				{
+					cycles = 11;
+				}
+				break;
+			}
+			
+			case LockstepOpKind::RET:
+			{
+				if (group->taken[lane])
+				{
+					nextPC = (u16)((memory[sp + 1] << 8) | memory[sp]);
+					group->stackPointer[lane] = sp + 2;
+				}
+				else
+				{
+					cycles = 5;
+				}
+				break;
+			}
+			
+			default:
+			{
+				break;
+			}
+		}
+		
+		group->programCounter[lane] = nextPC;
+		
+		MachineState *machine = &group->machines[lane];
+		machine->cycles += cycles;
+		machine->instructionCount++;
+		if (machine->cycles >= machine->nextInterruptCycle)
+		{
+			CPUState cpuState;
+			LoadLockstepLane(group, lane, &cpuState);
+			UpdateScheduledInterrupt(&cpuState, machine);
+			StoreLockstepLane(group, lane, &cpuState);
+		}
+	}
+}
+
+internal_func void EmulateLockstepLaneScalar(LockstepGroup *group, u32 lane)
+{
+	CPUState cpuState;
+	LoadLockstepLane(group, lane, &cpuState);
+	if (cpuState.halted)
+	{
+		// NOTE(bSalmon): Nothing to run in step with, idle straight through to the interrupt
+		EmulateUntil(&cpuState, &group->machines[lane], group->machines[lane].nextInterruptCycle);
+	}
+	else
+	{
+		EmulateStep(&cpuState, &group->machines[lane]);
+	}
+	StoreLockstepLane(group, lane, &cpuState);
+}
+
+// Runs every lane up to and including its next vblank, the same as EmulateFrame() on each lane
+internal_func void EmulateLockstepFrame(LockstepGroup *group)
+{
+	for (u32 lane = 0; lane < group->laneCount; ++lane)
+	{
+		CPUState cpuState;
+		LoadLockstepLane(group, lane, &cpuState);
+		group->running[lane] = !IsMachineStopped(&cpuState);
+		group->frameEnd[lane] = group->machines[lane].frameCount + 1;
+	}
+	
+	for (;;)
+	{
+		// NOTE(bSalmon): Find the opcode most of the running lanes are on, halted lanes have
+		// nothing to run and sit out the vote
+		u8 votingLanes[LOCKSTEP_MAX_LANES];
+		u8 opCodes[LOCKSTEP_MAX_LANES];
+		u8 opCodeCounts[256];
+		u32 votingCount = 0;
+		b32 anyRunning = false;
+		
+		for (u32 lane = 0; lane < group->laneCount; ++lane)
+		{
+			if (group->running[lane])
+			{
+				anyRunning = true;
+				if (!group->halted[lane])
+				{
+					u8 opCode = group->memory[lane][group->programCounter[lane]];
+					votingLanes[votingCount] = (u8)lane;
+					opCodes[votingCount++] = opCode;
+					opCodeCounts[opCode] = 0;
+				}
+			}
+		}
+		
+		if (!anyRunning)
+		{
+			break;
+		}
+		
+		u32 bestCount = 0;
+		u8 bestOpCode = 0;
+		for (u32 index = 0; index < votingCount; ++index)
+		{
+			u32 count = ++opCodeCounts[opCodes[index]];
+			if (count > bestCount)
+			{
+				bestCount = count;
+				bestOpCode = opCodes[index];
+			}
+		}
+		
+		u8 laneList[LOCKSTEP_MAX_LANES];
+		u32 laneListCount = 0;
+		if (votingCount == 0)
+		{
+			// NOTE(bSalmon): Every running lane is halted, they all idle through to their interrupts
+			for (u32 lane = 0; lane < group->laneCount; ++lane)
+			{
+				if (group->running[lane])
+				{
+					laneList[laneListCount++] = (u8)lane;
+				}
+			}
+		}
+		else
+		{
+			for (u32 index = 0; index < votingCount; ++index)
+			{
+				if (opCodes[index] == bestOpCode)
+				{
+					laneList[laneListCount++] = votingLanes[index];
+				}
+			}
+		}
+		
+		LockstepOp op = DecodeLockstepOp(bestOpCode);
+		if (votingCount && op.kind != LockstepOpKind::SCALAR && laneListCount >= LOCKSTEP_MIN_VECTOR_LANES)
+		{
+			ExecuteLockstepStep(group, &op, bestOpCode, laneList, laneListCount);
+			group->stats.vectorSteps++;
+			group->stats.vectorInstructions += laneListCount;
+			group->stats.vectorStepLanes[laneListCount]++;
+		}
+		else
+		{
+			for (u32 listIndex = 0; listIndex < laneListCount; ++listIndex)
+			{
+				EmulateLockstepLaneScalar(group, laneList[listIndex]);
+			}
+			group->stats.scalarInstructions += laneListCount;
+		}
+		
+		group->stats.steps++;
+		group->stats.laneSteps += group->laneCount;
+		
+		for (u32 listIndex = 0; listIndex < laneListCount; ++listIndex)
+		{
+			u32 lane = laneList[listIndex];
+			if (group->machines[lane].frameCount >= group->frameEnd[lane] || (group->halted[lane] && !group->enableInterrupt[lane]))
+			{
+				group->running[lane] = false;
+			}
+		}
+	}
+}
+
+// Fraction of lane slots that did work, 1.0 if every lane ran every step
+internal_func f64 GetLockstepLaneUtilisation(LockstepStats *stats)
+{
+	f64 result = 0.0;
+	if (stats->laneSteps)
+	{
+		result = (f64)(stats->vectorInstructions + stats->scalarInstructions) / (f64)stats->laneSteps;
+	}
+	
+	return result;
+}
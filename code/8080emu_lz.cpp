@@ -0,0 +1,355 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_lz.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+A small byte oriented LZ codec in the LZ4 family, written for machine state rather than text.
+8080 RAM and VRAM is mostly zero with long runs of the same byte and repeated sprite rows, so the
+encoder checks for a run of the byte just before every position ahead of the hash table, a run
+becomes a single offset 1 match however cold the table is. The decoder turns offset 1 matches
+into a memset and everything else into 16 byte copies, it is the side that has to be fast.
+
+A compressed block is a list of sequences, each one:
+  token           high nibble literal length, low nibble match length - LZ_MIN_MATCH
+  [length bytes]  if a nibble is 15, bytes of 255 and a final byte < 255 are added to it
+  literals
+  offset          u16 little endian, how far back the match starts (1 to 65535)
+  [length bytes]  for the match length
+The last sequence stops after its literals, a block is complete when the input runs out.
+
+The decoder is safe on any input, nothing is read or written outside the buffers it is given and
+a block that does not produce exactly destSize bytes is refused.
+*/
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+#define LZ_WILD_COPY 16
+// NOTE(bSalmon): Worst case is all literals, one length byte per 255 of them plus the token
+#define LZ_MAX_COMPRESSED_SIZE(size) ((size) + ((size) / 255) + 16)
+
+inline u32 ReadLZU32(u8 *memory)
+{
+	u32 result;
+	memcpy(&result, memory, sizeof(result));
+	return result;
+}
+
+inline u64 ReadLZU64(u8 *memory)
+{
+	u64 result;
+	memcpy(&result, memory, sizeof(result));
+	return result;
+}
+
+inline u32 HashLZSequence(u32 sequence)
+{
+	u32 result = (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+	return result;
+}
+
+// Length of the match between a and b, stopping at end
+internal_func u32 CountLZMatch(u8 *a, u8 *b, u8 *end)
+{
+	u8 *start = b;
+	while ((b + 8) <= end)
+	{
+		u64 difference = ReadLZU64(a) ^ ReadLZU64(b);
+		if (difference)
+		{
+			b += FindLeastSignificantSetBit64(difference) / 8;
+			return (u32)(b - start);
+		}
+		a += 8;
+		b += 8;
+	}
+	
+	while (b < end && *a == *b)
+	{
+		++a;
+		++b;
+	}
+	
+	return (u32)(b - start);
+}
+
+internal_func u8 *WriteLZLength(u8 *out, u32 length)
+{
+	while (length >= 255)
+	{
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = (u8)length;
+	
+	return out;
+}
+
+internal_func u8 *WriteLZSequence(u8 *out, u8 *literals, u32 literalLength, u32 offset, u32 matchLength)
+{
+	u8 *token = out++;
+	*token = (u8)(((literalLength < 15) ? literalLength : 15) << 4);
+	if (literalLength >= 15)
+	{
+		out = WriteLZLength(out, literalLength - 15);
+	}
+	memcpy(out, literals, literalLength);
+	out += literalLength;
+	
+	if (matchLength)
+	{
+		*out++ = (u8)offset;
+		*out++ = (u8)(offset >> 8);
+		
+		u32 lengthCode = matchLength - LZ_MIN_MATCH;
+		*token |= (u8)((lengthCode < 15) ? lengthCode : 15);
+		if (lengthCode >= 15)
+		{
+			out = WriteLZLength(out, lengthCode - 15);
+		}
+	}
+	
+	return out;
+}
+
+// Returns the length of the longest match found for position and its offset, 0 if there isn't one
+internal_func u32 FindLZMatch(u32 *hashTable, u8 *source, u32 size, u32 position, u32 *offset)
+{
+	u32 result = 0;
+	u8 *end = source + size;
+	
+	u32 sequence = ReadLZU32(&source[position]);
+	u32 hash = HashLZSequence(sequence);
+	u32 candidate = hashTable[hash];
+	hashTable[hash] = position;
+	
+	if (candidate < position && (position - candidate) <= LZ_MAX_OFFSET && ReadLZU32(&source[candidate]) == sequence)
+	{
+		result = LZ_MIN_MATCH + CountLZMatch(&source[candidate + LZ_MIN_MATCH], &source[position + LZ_MIN_MATCH], end);
+		*offset = position - candidate;
+	}
+	
+	// NOTE(bSalmon): Runs of one byte are most of a state, continuing the last byte finds them however
+	// cold the table is and the decoder fills them with memset
+	if (position && sequence == (source[position - 1] * 0x01010101U))
+	{
+		u32 runLength = LZ_MIN_MATCH + CountLZMatch(&source[position - 1 + LZ_MIN_MATCH], &source[position + LZ_MIN_MATCH], end);
+		if (runLength >= result)
+		{
+			result = runLength;
+			*offset = 1;
+		}
+	}
+	
+	return result;
+}
+
+// dest must hold LZ_MAX_COMPRESSED_SIZE(size) bytes, returns the compressed size
+internal_func u32 CompressLZ(u8 *dest, u8 *source, u32 size)
+{
+	u32 hashTable[1 << LZ_HASH_BITS] = {};
+	
+	u8 *out = dest;
+	u32 anchor = 0;
+	u32 position = 0;
+	u32 missCount = 0;
+	while ((position + LZ_MIN_MATCH) <= size)
+	{
+		u32 offset = 0;
+		u32 matchLength = FindLZMatch(hashTable, source, size, position, &offset);
+		if (matchLength)
+		{
+			// NOTE(bSalmon): Fewer, longer sequences decode faster, take a longer match one byte on if there is one
+			u32 nextOffset = 0;
+			u32 nextLength = ((position + 1 + LZ_MIN_MATCH) <= size) ? FindLZMatch(hashTable, source, size, position + 1, &nextOffset) : 0;
+			if (nextLength > (matchLength + 1))
+			{
+				++position;
+				matchLength = nextLength;
+				offset = nextOffset;
+			}
+			
+			out = WriteLZSequence(out, &source[anchor], position - anchor, offset, matchLength);
+			
+			position += matchLength;
+			anchor = position;
+			missCount = 0;
+			
+			// NOTE(bSalmon): Keep the table useful for the data just after a long match
+			if ((position - 2 + LZ_MIN_MATCH) <= size)
+			{
+				hashTable[HashLZSequence(ReadLZU32(&source[position - 2]))] = position - 2;
+			}
+		}
+		else
+		{
+			// NOTE(bSalmon): Step faster through data that isn't compressing
+			position += 1 + (missCount++ >> 6);
+		}
+	}
+	
+	if (anchor < size || out == dest)
+	{
+		out = WriteLZSequence(out, &source[anchor], size - anchor, 0, 0);
+	}
+	
+	u32 result = (u32)(out - dest);
+	return result;
+}
+
+// NOTE(bSalmon): May write up to LZ_WILD_COPY - 1 bytes past count, the caller checks there is room
+inline void WildCopyLZ(u8 *dest, u8 *source, u32 count)
+{
+	u8 *end = dest + count;
+	do
+	{
+		_mm_storeu_si128((__m128i *)dest, _mm_loadu_si128((__m128i *)source));
+		dest += LZ_WILD_COPY;
+		source += LZ_WILD_COPY;
+	} while (dest < end);
+}
+
+// Adds the length bytes at in to length, returns where they end or 0 if they run off the input or past limit
+inline u8 *ReadLZLength(u8 *in, u8 *inEnd, u32 *length, u32 limit)
+{
+	u32 result = *length;
+	u32 byte = 255;
+	while (byte == 255)
+	{
+		if (in >= inEnd || result > limit)
+		{
+			return 0;
+		}
+		byte = *in++;
+		result += byte;
+	}
+	*length = result;
+	
+	return in;
+}
+
+// Returns true only if source decodes to exactly destSize bytes
+internal_func b32 DecompressLZ(u8 *dest, u32 destSize, u8 *source, u32 sourceSize)
+{
+	u8 *in = source;
+	u8 *inEnd = source + sourceSize;
+	u8 *out = dest;
+	u8 *outEnd = dest + destSize;
+	
+	while (in < inEnd)
+	{
+		u32 token = *in++;
+		
+		u32 literalLength = token >> 4;
+		if (literalLength == 15)
+		{
+			in = ReadLZLength(in, inEnd, &literalLength, destSize);
+			if (!in)
+			{
+				return false;
+			}
+		}
+		if (literalLength > (u32)(inEnd - in) || literalLength > (u32)(outEnd - out))
+		{
+			return false;
+		}
+		
+		if ((u32)(inEnd - in) >= (literalLength + LZ_WILD_COPY) && (u32)(outEnd - out) >= (literalLength + LZ_WILD_COPY))
+		{
+			WildCopyLZ(out, in, literalLength);
+		}
+		else
+		{
+			memcpy(out, in, literalLength);
+		}
+		in += literalLength;
+		out += literalLength;
+		
+		if (in == inEnd)
+		{
+			break;
+		}
+		
+		if ((inEnd - in) < 2)
+		{
+			return false;
+		}
+		u32 offset = in[0] | (in[1] << 8);
+		in += 2;
+		
+		u32 matchLength = token & 15;
+		if (matchLength == 15)
+		{
+			in = ReadLZLength(in, inEnd, &matchLength, destSize);
+			if (!in)
+			{
+				return false;
+			}
+		}
+		matchLength += LZ_MIN_MATCH;
+		if (!offset || offset > (u32)(out - dest) || matchLength > (u32)(outEnd - out))
+		{
+			return false;
+		}
+		
+		u8 *match = out - offset;
+		if (offset == 1)
+		{
+			memset(out, *match, matchLength);
+		}
+		else if ((u32)(outEnd - out) < (matchLength + (2 * LZ_WILD_COPY)))
+		{
+			// NOTE(bSalmon): Only near the end of the output where a wide copy could write past it
+			for (u32 index = 0; index < matchLength; ++index)
+			{
+				out[index] = match[index];
+			}
+		}
+		else if (offset >= LZ_WILD_COPY)
+		{
+			// NOTE(bSalmon): Most matches are short, two copies without a loop cover up to 32 bytes
+			_mm_storeu_si128((__m128i *)out, _mm_loadu_si128((__m128i *)match));
+			_mm_storeu_si128((__m128i *)(out + LZ_WILD_COPY), _mm_loadu_si128((__m128i *)(match + LZ_WILD_COPY)));
+			if (matchLength > (2 * LZ_WILD_COPY))
+			{
+				WildCopyLZ(out + (2 * LZ_WILD_COPY), match + (2 * LZ_WILD_COPY), matchLength - (2 * LZ_WILD_COPY));
+			}
+		}
+		else
+		{
+			// NOTE(bSalmon): A short repeating pattern, write the first 16 bytes one at a time then copy
+			// from a whole number of patterns back that is at least 16, the source is then always written
+			for (u32 index = 0; index < LZ_WILD_COPY; ++index)
+			{
+				out[index] = match[index];
+			}
+			if (matchLength > LZ_WILD_COPY)
+			{
+				u32 step = offset * ((LZ_WILD_COPY + offset - 1) / offset);
+				WildCopyLZ(out + LZ_WILD_COPY, out + LZ_WILD_COPY - step, matchLength - LZ_WILD_COPY);
+			}
+		}
+		out += matchLength;
+	}
+	
+	b32 result = (out == outEnd);
+	return result;
+}
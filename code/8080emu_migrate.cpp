@@ -0,0 +1,354 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_migrate.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Live Migration, moves a running machine to another process (or host) while it keeps running.
+
+The source first sends all of RAM, then keeps emulating. Each time a round has gone out it sends
+the pages written while it was going (its own dirty page bits, DirtyPageUser::MIGRATION) as
+the next round. Once a round is down to MIGRATION_COMMIT_PAGES pages, or MIGRATION_MAX_ROUNDS
+have gone, the source stops and sends the commit: the last written pages, the save state header
+(see 8080emu_savestate.cpp) and any data of the caller's, such as where its input is up to. The
+target resumes as soon as the commit is applied, so the machine is only paused for one small
+message. The target answers with a RESUMED message that holds how long the pause was.
+
+Messages are a MigrationMessage followed by
+	PAGES   - one RAM_PAGE_SIZE page for each bit in pages, lowest page first
+	COMMIT  - a SaveStateHeader, the pages, then userDataSize bytes
+	RESUMED - nothing
+Every field says how long the message is, so they can go over any byte stream. Moving the bytes
+is up to the caller, the source and target only build and read messages. Times are
+PlatformGetWallClock values, the pause is only meaningful when both ends share a clock.
+
+Needs 8080emu_savestate.cpp.
+*/
+
+#define MIGRATION_MAGIC 0x5247494D // "MIGR"
+#define MIGRATION_COMMIT_PAGES 16
+#define MIGRATION_MAX_ROUNDS 32
+#define MIGRATION_MAX_USER_DATA 1024
+
+enum class MigrationMessageType
+{
+	PAGES = 1,
+	COMMIT,
+	RESUMED
+};
+
+struct MigrationMessage
+{
+	u32 magic;
+	u32 type;
+	
+	// NOTE(bSalmon): Bytes after this header
+	u32 size;
+	u32 userDataSize;
+	u64 pages;
+	
+	// NOTE(bSalmon): COMMIT is when the source stopped, RESUMED is how long the machine was stopped for
+	u64 stopTime;
+	u64 pauseNanoseconds;
+};
+
+#define MIGRATION_MAX_MESSAGE_SIZE (sizeof(MigrationMessage) + sizeof(SaveStateHeader) + RAM_SIZE + MIGRATION_MAX_USER_DATA)
+
+struct MigrationStats
+{
+	u32 rounds;
+	u64 pagesSent;
+	u64 bytesSent;
+	u32 commitPages;
+	u32 commitBytes;
+	u64 pauseNanoseconds;
+};
+
+struct MigrationSource
+{
+	u8 *buffer;
+	u32 size;
+	u32 sent;
+	b32 committed;
+	u32 lastRoundPages;
+	
+	MigrationStats stats;
+};
+
+struct MigrationTarget
+{
+	u8 *buffer;
+	b32 hasRAM;
+	b32 committed;
+	u64 stopTime;
+	u64 resumeTime;
+	
+	u8 userData[MIGRATION_MAX_USER_DATA];
+	u32 userDataSize;
+	
+	MigrationStats stats;
+};
+
+// Writes the pages set in pages after the message header and returns where it finished
+internal_func u8 *PackMigrationPages(u8 *dest, CPUState *cpuState, u64 pages)
+{
+	u8 *ram = &cpuState->memory[RAM_START];
+	if (pages == ~0ULL)
+	{
+		memcpy(dest, ram, RAM_SIZE);
+		dest += RAM_SIZE;
+	}
+	else
+	{
+		for (; pages; pages &= pages - 1)
+		{
+			u32 page = FindLeastSignificantSetBit64(pages);
+			memcpy(dest, &ram[page * RAM_PAGE_SIZE], RAM_PAGE_SIZE);
+			dest += RAM_PAGE_SIZE;
+		}
+	}
+	
+	return dest;
+}
+
+internal_func u8 *UnpackMigrationPages(CPUState *cpuState, u8 *source, u64 pages)
+{
+	u8 *ram = &cpuState->memory[RAM_START];
+	cpuState->dirtyPages |= pages;
+	for (; pages; pages &= pages - 1)
+	{
+		u32 page = FindLeastSignificantSetBit64(pages);
+		memcpy(&ram[page * RAM_PAGE_SIZE], source, RAM_PAGE_SIZE);
+		source += RAM_PAGE_SIZE;
+	}
+	
+	return source;
+}
+
+internal_func void FinishMigrationMessage(MigrationSource *source, u8 *end)
+{
+	MigrationMessage *message = (MigrationMessage *)source->buffer;
+	source->size = (u32)(end - source->buffer);
+	source->sent = 0;
+	message->size = source->size - sizeof(MigrationMessage);
+	
+	source->stats.bytesSent += source->size;
+	source->stats.pagesSent += CountSetBits64(message->pages);
+}
+
+internal_func void BuildMigrationPages(MigrationSource *source, CPUState *cpuState, u64 pages)
+{
+	MigrationMessage *message = (MigrationMessage *)source->buffer;
+	*message = {};
+	message->magic = MIGRATION_MAGIC;
+	message->type = (u32)MigrationMessageType::PAGES;
+	message->pages = pages;
+	
+	FinishMigrationMessage(source, PackMigrationPages((u8 *)(message + 1), cpuState, message->pages));
+	source->lastRoundPages = CountSetBits64(message->pages);
+	source->stats.rounds++;
+}
+
+// Builds the next round from the pages written since the last one
+internal_func void BuildMigrationRound(MigrationSource *source, CPUState *cpuState)
+{
+	BuildMigrationPages(source, cpuState, TakeDirtyPages(cpuState, DirtyPageUser::MIGRATION));
+}
+
+// The first round is all of RAM
+internal_func b32 BeginMigrationSource(MigrationSource *source, CPUState *cpuState)
+{
+	*source = {};
+	source->buffer = (u8 *)PlatformAllocateMemory(MIGRATION_MAX_MESSAGE_SIZE);
+	if (!source->buffer)
+	{
+		return false;
+	}
+	
+	ClearDirtyPages(cpuState, DirtyPageUser::MIGRATION);
+	BuildMigrationPages(source, cpuState, ~0ULL);
+	
+	return true;
+}
+
+internal_func void EndMigrationSource(MigrationSource *source)
+{
+	PlatformFreeMemory(source->buffer);
+	source->buffer = 0;
+}
+
+// The bytes of the current message still to go
+internal_func u8 *GetMigrationSendData(MigrationSource *source, u32 *size)
+{
+	*size = source->size - source->sent;
+	u8 *result = source->buffer + source->sent;
+	return result;
+}
+
+internal_func void AdvanceMigrationSend(MigrationSource *source, u32 bytesSent)
+{
+	ASSERT(bytesSent <= source->size - source->sent);
+	source->sent += bytesSent;
+}
+
+internal_func b32 IsMigrationMessageSent(MigrationSource *source)
+{
+	b32 result = (source->sent == source->size);
+	return result;
+}
+
+// Call once the last round is sent, before building another
+internal_func b32 ShouldCommitMigration(MigrationSource *source, CPUState *cpuState)
+{
+	u32 dirtyCount = CountSetBits64(GetDirtyPages(cpuState, DirtyPageUser::MIGRATION));
+	b32 result = (dirtyCount <= MIGRATION_COMMIT_PAGES) || (source->stats.rounds >= MIGRATION_MAX_ROUNDS);
+	return result;
+}
+
+// Stops the machine here, it must not run again on this side once the commit is built
+internal_func void BuildMigrationCommit(MigrationSource *source, CPUState *cpuState, MachineState *machine,
+										void *userData, u32 userDataSize, u64 stopTime)
+{
+	ASSERT(userDataSize <= MIGRATION_MAX_USER_DATA);
+	
+	MigrationMessage *message = (MigrationMessage *)source->buffer;
+	*message = {};
+	message->magic = MIGRATION_MAGIC;
+	message->type = (u32)MigrationMessageType::COMMIT;
+	message->pages = TakeDirtyPages(cpuState, DirtyPageUser::MIGRATION);
+	message->userDataSize = userDataSize;
+	message->stopTime = stopTime;
+	
+	SaveStateHeader *header = (SaveStateHeader *)(message + 1);
+	SaveMachineStateHeader(header, cpuState, machine, GetROMHash(cpuState->memory));
+	u8 *end = PackMigrationPages((u8 *)(header + 1), cpuState, message->pages);
+	memcpy(end, userData, userDataSize);
+	FinishMigrationMessage(source, end + userDataSize);
+	
+	source->committed = true;
+	source->stats.commitPages = CountSetBits64(message->pages);
+	source->stats.commitBytes = source->size;
+}
+
+// Reads the target's answer to the commit, returns false if it isn't one
+internal_func b32 ReceiveMigrationResumed(MigrationSource *source, void *data, u64 size)
+{
+	MigrationMessage *message = (MigrationMessage *)data;
+	b32 result = (size == sizeof(MigrationMessage) && message->magic == MIGRATION_MAGIC &&
+				  message->type == (u32)MigrationMessageType::RESUMED && message->size == 0);
+	if (result)
+	{
+		source->stats.pauseNanoseconds = message->pauseNanoseconds;
+	}
+	
+	return result;
+}
+
+internal_func b32 BeginMigrationTarget(MigrationTarget *target)
+{
+	*target = {};
+	target->buffer = (u8 *)PlatformAllocateMemory(MIGRATION_MAX_MESSAGE_SIZE);
+	b32 result = (target->buffer != 0);
+	return result;
+}
+
+internal_func void EndMigrationTarget(MigrationTarget *target)
+{
+	PlatformFreeMemory(target->buffer);
+	target->buffer = 0;
+}
+
+// How many more bytes the message in target->buffer needs, from the header read so far.
+// 0 if the header is bad
+internal_func u32 GetMigrationMessageRemaining(MigrationTarget *target)
+{
+	MigrationMessage *message = (MigrationMessage *)target->buffer;
+	u32 result = 0;
+	if (message->magic == MIGRATION_MAGIC && message->size <= (MIGRATION_MAX_MESSAGE_SIZE - sizeof(MigrationMessage)))
+	{
+		result = message->size;
+	}
+	
+	return result;
+}
+
+// Applies the whole message in target->buffer to the machine, returns false if it is damaged,
+// out of order or for another ROM. cpuState->memory must already hold the ROM
+internal_func b32 ApplyMigrationMessage(MigrationTarget *target, CPUState *cpuState, MachineState *machine)
+{
+	MigrationMessage *message = (MigrationMessage *)target->buffer;
+	u32 pageBytes = CountSetBits64(message->pages) * RAM_PAGE_SIZE;
+	u8 *payload = (u8 *)(message + 1);
+	
+	b32 result = false;
+	if (message->magic != MIGRATION_MAGIC || target->committed)
+	{
+		return false;
+	}
+	else if (message->type == (u32)MigrationMessageType::PAGES)
+	{
+		// NOTE(bSalmon): The first round has to be all of RAM, nothing else can be built on
+		result = (message->size == pageBytes) && (target->hasRAM || message->pages == ~0ULL);
+		if (result)
+		{
+			UnpackMigrationPages(cpuState, payload, message->pages);
+			target->hasRAM = true;
+			target->stats.rounds++;
+		}
+	}
+	else if (message->type == (u32)MigrationMessageType::COMMIT)
+	{
+		SaveStateHeader *header = (SaveStateHeader *)payload;
+		result = target->hasRAM && (message->size == sizeof(SaveStateHeader) + pageBytes + message->userDataSize) &&
+			(message->userDataSize <= MIGRATION_MAX_USER_DATA) && IsSaveStateValid(header, GetROMHash(cpuState->memory));
+		if (result)
+		{
+			u8 *userData = UnpackMigrationPages(cpuState, (u8 *)(header + 1), message->pages);
+			memcpy(target->userData, userData, message->userDataSize);
+			target->userDataSize = message->userDataSize;
+			LoadMachineStateHeader(header, cpuState, machine);
+			
+			target->committed = true;
+			target->stopTime = message->stopTime;
+			target->stats.commitPages = CountSetBits64(message->pages);
+			target->stats.commitBytes = message->size + sizeof(MigrationMessage);
+		}
+	}
+	
+	if (result)
+	{
+		target->stats.pagesSent += CountSetBits64(message->pages);
+		target->stats.bytesSent += message->size + sizeof(MigrationMessage);
+	}
+	
+	return result;
+}
+
+// Call as the machine starts running again after the commit, builds the RESUMED answer in message
+internal_func void BuildMigrationResumed(MigrationTarget *target, MigrationMessage *message, u64 resumeTime)
+{
+	target->resumeTime = resumeTime;
+	target->stats.pauseNanoseconds = (u64)(PlatformGetSecondsElapsed(target->stopTime, resumeTime) * 1000000000.0);
+	
+	*message = {};
+	message->magic = MIGRATION_MAGIC;
+	message->type = (u32)MigrationMessageType::RESUMED;
+	message->pauseNanoseconds = target->stats.pauseNanoseconds;
+}
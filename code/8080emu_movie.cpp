@@ -0,0 +1,410 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_movie.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Input Movies, everything needed to play a run back bit for bit with nobody at the keyboard:
+  MovieHeader
+  SaveStateHeader + RAM_SIZE bytes of RAM, unless the movie starts from power on
+  Changes, changeBytes bytes
+
+The only thing the outside world gives the machine is the two input port bytes, so the
+changes are just those bytes and when they changed, which is a run length encoding of the
+port values. Each change is the distance from the previous one as an LEB128 varint followed by
+inputPort1 and inputPort2, usually 3 bytes. The first change is always at 0 and sets the
+ports to what they are at the start.
+
+Changes are keyed by one of:
+  - Frame: how many frames into the movie, the ports change before that frame runs. Fits
+	frontends that only change input between frames, which is all of them so far
+  - Cycle: how many cycles into the movie, the ports change before the first instruction at or
+	after that cycle. For anything that changes input part way through a frame
+
+The header holds the ROM hash, a movie for another ROM is refused, and the machine state hash
+at the end so playback can check it got there. Playback replaces the ports, so whatever the
+frontend does with them while a movie plays is lost.
+
+Needs 8080emu_hash.cpp and 8080emu_savestate.cpp.
+*/
+
+#define MOVIE_MAGIC 0x564D3038 // "80MV"
+#define MOVIE_VERSION 1
+#define MOVIE_FLAG_POWER_ON 0x1
+#define MOVIE_MAX_CHANGE_SIZE 12 // 10 byte varint + 2 ports
+
+enum class MovieKeying
+{
+	FRAME,
+	CYCLE
+};
+
+struct MovieHeader
+{
+	u32 magic;
+	u32 version;
+	u32 keying;
+	u32 flags;
+	u64 romHash;
+	
+	// NOTE(bSalmon): From the start of the movie, not the machine's totals
+	u64 frameCount;
+	u64 cycleCount;
+	
+	u64 endStateHash;
+	u32 changeCount;
+	u32 changeBytes;
+};
+
+struct MovieRecorder
+{
+	MovieHeader header;
+	SaveStateHeader startState;
+	u8 *startRAM;
+	
+	u8 *changes;
+	u32 changesCapacity;
+	
+	u64 startFrame;
+	u64 startCycle;
+	u64 lastKey;
+	u8 inputPort1;
+	u8 inputPort2;
+};
+
+struct MoviePlayer
+{
+	u8 *file;
+	MovieHeader *header;
+	
+	u8 *nextChange;
+	u8 *nextPorts;
+	u8 *changesEnd;
+	u32 changesLeft;
+	u64 nextKey;
+	
+	u64 startFrame;
+	u64 startCycle;
+};
+
+// Frames or cycles since the movie started
+internal_func u64 GetMovieKey(MovieHeader *header, MachineState *machine, u64 startFrame, u64 startCycle)
+{
+	u64 result = ((MovieKeying)header->keying == MovieKeying::FRAME) ? (machine->frameCount - startFrame) :
+		(machine->cycles - startCycle);
+	return result;
+}
+
+internal_func u32 WriteMovieVarint(u8 *dest, u64 value)
+{
+	u32 result = 0;
+	do
+	{
+		u8 byte = (u8)(value & 0x7F);
+		value >>= 7;
+		dest[result++] = byte | (value ? 0x80 : 0x00);
+	} while (value);
+	
+	return result;
+}
+
+// Returns 0 if the varint runs past end
+internal_func u8 *ReadMovieVarint(u8 *source, u8 *end, u64 *value)
+{
+	*value = 0;
+	for (u32 shift = 0; source < end && shift < 64; shift += 7)
+	{
+		u8 byte = *source++;
+		*value |= (u64)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+		{
+			return source;
+		}
+	}
+	
+	return 0;
+}
+
+internal_func b32 AppendMovieChange(MovieRecorder *recorder, u64 delta, u8 inputPort1, u8 inputPort2)
+{
+	MovieHeader *header = &recorder->header;
+	if ((header->changeBytes + MOVIE_MAX_CHANGE_SIZE) > recorder->changesCapacity)
+	{
+		u32 newCapacity = recorder->changesCapacity * 2;
+		u8 *newChanges = (u8 *)PlatformAllocateMemory(newCapacity);
+		if (!newChanges)
+		{
+			return false;
+		}
+		memcpy(newChanges, recorder->changes, header->changeBytes);
+		PlatformFreeMemory(recorder->changes);
+		recorder->changes = newChanges;
+		recorder->changesCapacity = newCapacity;
+	}
+	
+	u8 *change = &recorder->changes[header->changeBytes];
+	u32 size = WriteMovieVarint(change, delta);
+	change[size++] = inputPort1;
+	change[size++] = inputPort2;
+	header->changeBytes += size;
+	header->changeCount++;
+	
+	return true;
+}
+
+// Starts recording from the machine as it is now, or with fromPowerOn resets it and clears RAM first
+internal_func b32 BeginMovieRecording(MovieRecorder *recorder, MovieKeying keying, b32 fromPowerOn,
+									  CPUState *cpuState, MachineState *machine)
+{
+	*recorder = {};
+	recorder->changesCapacity = KILOBYTES(4);
+	recorder->changes = (u8 *)PlatformAllocateMemory(recorder->changesCapacity);
+	if (!fromPowerOn)
+	{
+		recorder->startRAM = (u8 *)PlatformAllocateMemory(RAM_SIZE);
+	}
+	
+	b32 result = recorder->changes && (fromPowerOn || recorder->startRAM);
+	if (result)
+	{
+		if (fromPowerOn)
+		{
+			ResetMachine(cpuState, machine);
+			memset(&cpuState->memory[RAM_START], 0, RAM_SIZE);
+		}
+		
+		MovieHeader *header = &recorder->header;
+		header->magic = MOVIE_MAGIC;
+		header->version = MOVIE_VERSION;
+		header->keying = (u32)keying;
+		header->flags = fromPowerOn ? MOVIE_FLAG_POWER_ON : 0;
+		header->romHash = GetROMHash(cpuState->memory);
+		
+		if (!fromPowerOn)
+		{
+			SaveMachineStateHeader(&recorder->startState, cpuState, machine, header->romHash);
+			memcpy(recorder->startRAM, &cpuState->memory[RAM_START], RAM_SIZE);
+		}
+		
+		recorder->startFrame = machine->frameCount;
+		recorder->startCycle = machine->cycles;
+		recorder->inputPort1 = machine->inputPort1;
+		recorder->inputPort2 = machine->inputPort2;
+		result = AppendMovieChange(recorder, 0, machine->inputPort1, machine->inputPort2);
+	}
+	
+	return result;
+}
+
+internal_func void FreeMovieRecorder(MovieRecorder *recorder)
+{
+	PlatformFreeMemory(recorder->changes);
+	PlatformFreeMemory(recorder->startRAM);
+	*recorder = {};
+}
+
+// Call whenever the ports might have changed, with frame keying once before every frame is enough
+internal_func b32 RecordMovieInput(MovieRecorder *recorder, MachineState *machine)
+{
+	b32 result = true;
+	if (machine->inputPort1 != recorder->inputPort1 || machine->inputPort2 != recorder->inputPort2)
+	{
+		u64 key = GetMovieKey(&recorder->header, machine, recorder->startFrame, recorder->startCycle);
+		result = AppendMovieChange(recorder, key - recorder->lastKey, machine->inputPort1, machine->inputPort2);
+		if (result)
+		{
+			// NOTE(bSalmon): Changes that land on the same key are kept in order, playback ends up on the last
+			recorder->lastKey = key;
+			recorder->inputPort1 = machine->inputPort1;
+			recorder->inputPort2 = machine->inputPort2;
+		}
+	}
+	
+	return result;
+}
+
+// Ends the movie where the machine is now and writes it out, the recorder is freed either way
+internal_func b32 EndMovieRecording(MovieRecorder *recorder, char *path, CPUState *cpuState, MachineState *machine)
+{
+	MovieHeader *header = &recorder->header;
+	header->frameCount = machine->frameCount - recorder->startFrame;
+	header->cycleCount = machine->cycles - recorder->startCycle;
+	header->endStateHash = HashMachineState(cpuState, machine);
+	
+	b32 fromPowerOn = (header->flags & MOVIE_FLAG_POWER_ON);
+	u64 fileSize = sizeof(MovieHeader) + (fromPowerOn ? 0 : (sizeof(SaveStateHeader) + RAM_SIZE)) + header->changeBytes;
+	u8 *file = (u8 *)PlatformAllocateMemory(fileSize);
+	
+	b32 result = false;
+	if (file)
+	{
+		u8 *out = file;
+		memcpy(out, header, sizeof(MovieHeader));
+		out += sizeof(MovieHeader);
+		if (!fromPowerOn)
+		{
+			memcpy(out, &recorder->startState, sizeof(SaveStateHeader));
+			out += sizeof(SaveStateHeader);
+			memcpy(out, recorder->startRAM, RAM_SIZE);
+			out += RAM_SIZE;
+		}
+		memcpy(out, recorder->changes, header->changeBytes);
+		
+		result = PlatformWriteEntireFile(path, file, fileSize);
+		PlatformFreeMemory(file);
+	}
+	
+	FreeMovieRecorder(recorder);
+	return result;
+}
+
+// Reads the next change's key, the player is finished when there are none left
+internal_func b32 ReadNextMovieChange(MoviePlayer *player)
+{
+	b32 result = false;
+	if (player->changesLeft)
+	{
+		u64 delta = 0;
+		u8 *ports = ReadMovieVarint(player->nextChange, player->changesEnd, &delta);
+		if (ports && (ports + 2) <= player->changesEnd)
+		{
+			player->nextKey += delta;
+			player->nextPorts = ports;
+			result = true;
+		}
+		else
+		{
+			// NOTE(bSalmon): Truncated, play what there is
+			player->changesLeft = 0;
+		}
+	}
+	
+	return result;
+}
+
+// Loads the movie and puts the machine at its start, cpuState->memory must already hold the ROM
+internal_func b32 BeginMoviePlayback(MoviePlayer *player, char *path, CPUState *cpuState, MachineState *machine)
+{
+	*player = {};
+	
+	u64 fileSize = 0;
+	u8 *file = PlatformReadEntireFile(path, &fileSize);
+	MovieHeader *header = (MovieHeader *)file;
+	
+	b32 result = file && fileSize >= sizeof(MovieHeader) && header->magic == MOVIE_MAGIC &&
+		header->version == MOVIE_VERSION && header->romHash == GetROMHash(cpuState->memory);
+	
+	b32 fromPowerOn = result && (header->flags & MOVIE_FLAG_POWER_ON);
+	u64 changesOffset = sizeof(MovieHeader) + (fromPowerOn ? 0 : (sizeof(SaveStateHeader) + RAM_SIZE));
+	result = result && (changesOffset + header->changeBytes) <= fileSize;
+	
+	SaveStateHeader *startState = (SaveStateHeader *)(file + sizeof(MovieHeader));
+	result = result && (fromPowerOn || IsSaveStateValid(startState, header->romHash));
+	
+	if (result)
+	{
+		if (fromPowerOn)
+		{
+			ResetMachine(cpuState, machine);
+			memset(&cpuState->memory[RAM_START], 0, RAM_SIZE);
+			cpuState->dirtyPages = ~0ULL;
+		}
+		else
+		{
+			LoadMachineStateHeader(startState, cpuState, machine);
+			memcpy(&cpuState->memory[RAM_START], (u8 *)(startState + 1), RAM_SIZE);
+		}
+		
+		player->file = file;
+		player->header = header;
+		player->nextChange = file + changesOffset;
+		player->changesEnd = player->nextChange + header->changeBytes;
+		player->changesLeft = header->changeCount;
+		player->startFrame = machine->frameCount;
+		player->startCycle = machine->cycles;
+		ReadNextMovieChange(player);
+	}
+	else
+	{
+		PlatformFreeMemory(file);
+	}
+	
+	return result;
+}
+
+internal_func void EndMoviePlayback(MoviePlayer *player)
+{
+	PlatformFreeMemory(player->file);
+	*player = {};
+}
+
+// Sets the ports to every change due by now, call before running any further
+internal_func void ApplyMovieInput(MoviePlayer *player, MachineState *machine)
+{
+	if (player->changesLeft)
+	{
+		u64 key = GetMovieKey(player->header, machine, player->startFrame, player->startCycle);
+		while (player->changesLeft && player->nextKey <= key)
+		{
+			machine->inputPort1 = player->nextPorts[0];
+			machine->inputPort2 = player->nextPorts[1];
+			player->nextChange = player->nextPorts + 2;
+			player->changesLeft--;
+			ReadNextMovieChange(player);
+		}
+	}
+}
+
+// The machine's cycle total the next change is due at, or ~0 if there isn't one
+internal_func u64 GetNextMovieChangeCycle(MoviePlayer *player)
+{
+	u64 result = ~0ULL;
+	if (player->changesLeft && (MovieKeying)player->header->keying == MovieKeying::CYCLE)
+	{
+		result = player->startCycle + player->nextKey;
+	}
+	
+	return result;
+}
+
+// EmulateFrame with the movie's input, stops early at cycle keyed changes to apply them
+internal_func void EmulateMovieFrame(MoviePlayer *player, CPUState *cpuState, MachineState *machine)
+{
+	u64 frameCount = machine->frameCount;
+	while (machine->frameCount == frameCount && !IsMachineStopped(cpuState))
+	{
+		ApplyMovieInput(player, machine);
+		EmulateUntil(cpuState, machine, GetNextMovieChangeCycle(player));
+	}
+}
+
+internal_func b32 IsMovieFinished(MoviePlayer *player, MachineState *machine)
+{
+	b32 result = (machine->frameCount - player->startFrame) >= player->header->frameCount &&
+		(machine->cycles - player->startCycle) >= player->header->cycleCount;
+	return result;
+}
+
+// Only meaningful once the machine is exactly at the end, which cycle keyed playback can stop on
+internal_func b32 DoesMovieEndMatch(MoviePlayer *player, CPUState *cpuState, MachineState *machine)
+{
+	b32 result = (HashMachineState(cpuState, machine) == player->header->endStateHash);
+	return result;
+}
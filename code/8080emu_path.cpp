@@ -0,0 +1,153 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_path.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Numbered Paths, output paths with a field the caller fills with a frame number so each
+output gets its own file, e.g. /tmp/frames/frame_%06d.ppm or state_%llu.st.
+
+The field is written like a printf integer: %d, %u or %llu with an optional zero padded width
+(%06d). There can be at most one, %% is a literal %, and any other % is refused. Paths are
+never passed to printf, the number is put in by hand.
+*/
+
+#define NUMBERED_PATH_MAX 256
+
+struct NumberedPath
+{
+	b32 numbered;
+	u32 width;
+	
+	// NOTE(bSalmon): With %% already turned into %, the number goes between prefix and suffix.
+	// A path without a field is all prefix
+	char prefix[NUMBERED_PATH_MAX];
+	char suffix[NUMBERED_PATH_MAX];
+};
+
+internal_func b32 AppendPathChar(char *dest, u32 *length, char c)
+{
+	b32 result = (*length + 1) < NUMBERED_PATH_MAX;
+	if (result)
+	{
+		dest[(*length)++] = c;
+		dest[*length] = 0;
+	}
+	
+	return result;
+}
+
+// Returns false if the path is too long or has a % that isn't a single number field or %%
+internal_func b32 ParseNumberedPath(NumberedPath *result, char *path)
+{
+	*result = {};
+	if (strlen(path) >= NUMBERED_PATH_MAX)
+	{
+		return false;
+	}
+	
+	u32 prefixLength = 0;
+	u32 suffixLength = 0;
+	for (char *c = path; *c; ++c)
+	{
+		char *dest = result->numbered ? result->suffix : result->prefix;
+		u32 *length = result->numbered ? &suffixLength : &prefixLength;
+		if (*c != '%')
+		{
+			AppendPathChar(dest, length, *c);
+			continue;
+		}
+		
+		++c;
+		if (*c == '%')
+		{
+			AppendPathChar(dest, length, '%');
+			continue;
+		}
+		
+		if (result->numbered)
+		{
+			return false;
+		}
+		
+		if (*c == '0')
+		{
+			while (*c >= '0' && *c <= '9')
+			{
+				result->width = (result->width * 10) + (*c++ - '0');
+				if (result->width > 20)
+				{
+					return false;
+				}
+			}
+		}
+		
+		if (c[0] == 'l' && c[1] == 'l' && c[2] == 'u')
+		{
+			c += 2;
+		}
+		else if (*c != 'd' && *c != 'u')
+		{
+			return false;
+		}
+		result->numbered = true;
+	}
+	
+	return true;
+}
+
+// Writes the path with number in the field, number is ignored if the path isn't numbered
+internal_func void FormatNumberedPath(NumberedPath *numberedPath, u64 number, char *dest, u32 destSize)
+{
+	char digits[24];
+	u32 digitCount = 0;
+	do
+	{
+		digits[digitCount++] = (char)('0' + (number % 10));
+		number /= 10;
+	} while (number);
+	
+	u32 length = 0;
+	for (char *c = numberedPath->prefix; *c && (length + 1) < destSize; ++c)
+	{
+		dest[length++] = *c;
+	}
+	
+	if (numberedPath->numbered)
+	{
+		for (u32 pad = digitCount; pad < numberedPath->width && (length + 1) < destSize; ++pad)
+		{
+			dest[length++] = '0';
+		}
+		while (digitCount && (length + 1) < destSize)
+		{
+			dest[length++] = digits[--digitCount];
+		}
+		for (char *c = numberedPath->suffix; *c && (length + 1) < destSize; ++c)
+		{
+			dest[length++] = *c;
+		}
+	}
+	
+	if (destSize)
+	{
+		dest[length] = 0;
+	}
+}
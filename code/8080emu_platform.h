@@ -0,0 +1,94 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_platform.h
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Services the platform layer provides to the non-platform specific code.
+Every platform layer must define these functions and the PlatformWorkQueue struct.
+*/
+
+// Memory
+internal_func void *PlatformAllocateMemory(u64 size);
+internal_func void PlatformFreeMemory(void *memory);
+
+// Files, read memory is freed with PlatformFreeMemory, returns 0 on failure
+internal_func u8 *PlatformReadEntireFile(char *path, u64 *size);
+internal_func b32 PlatformWriteEntireFile(char *path, void *memory, u64 size);
+
+// Batched File Writes
+// NOTE(bSalmon): Every file in the batch is written in full and synced to disk before this returns.
+// The syncs are issued together, so a batch costs about one sync however many files are in it. Each
+// file is replaced atomically through a temporary beside it, a crash leaves the old or the new file.
+// It blocks on the disk and is only for writer threads, not the emulation thread.
+// Returns the number of writes that succeeded, succeeded is set on each
+struct PlatformFileWrite
+{
+	char *path;
+	void *memory;
+	u64 size;
+	b32 succeeded;
+};
+internal_func u32 PlatformWriteFileBatch(PlatformFileWrite *writes, u32 count);
+
+// Timing
+internal_func u64 PlatformGetWallClock();
+internal_func f64 PlatformGetSecondsElapsed(u64 start, u64 end);
+
+// Work Queue
+struct PlatformWorkQueue;
+#define PLATFORM_WORK_QUEUE_CALLBACK(name) void name(PlatformWorkQueue *queue, void *data)
+typedef PLATFORM_WORK_QUEUE_CALLBACK(PlatformWorkQueueCallback);
+
+internal_func void PlatformAddWorkEntry(PlatformWorkQueue *queue, PlatformWorkQueueCallback *callback, void *data);
+internal_func void PlatformCompleteAllWork(PlatformWorkQueue *queue);
+
+// Threads
+struct PlatformThread;
+#define PLATFORM_THREAD_PROC(name) void name(void *data)
+typedef PLATFORM_THREAD_PROC(PlatformThreadProc);
+
+internal_func PlatformThread *PlatformStartThread(PlatformThreadProc *proc, void *data);
+internal_func void PlatformJoinThread(PlatformThread *thread);
+// Gives the rest of this thread's time slice to any other thread that is ready to run
+internal_func void PlatformYieldThread();
+
+struct PlatformSemaphore;
+internal_func PlatformSemaphore *PlatformCreateSemaphore(u32 initialCount);
+internal_func void PlatformSignalSemaphore(PlatformSemaphore *semaphore);
+internal_func void PlatformWaitSemaphore(PlatformSemaphore *semaphore);
+internal_func void PlatformDestroySemaphore(PlatformSemaphore *semaphore);
+
+// Instance Memory
+// NOTE(bSalmon): A ROM image holds one copy of a ROM (0000-1fff). Instance memory is a full 64KB
+// address space (plus the overrun Emulate reads past the top) with the image mapped read-only
+// at 0000, only RAM/VRAM (2000-3fff) is writable and private to the instance. Instance memory
+// is given back with PlatformUnmapInstanceMemory, not PlatformFreeMemory
+struct PlatformROMImage;
+internal_func PlatformROMImage *PlatformCreateROMImage(u8 *rom, u64 romSize);
+internal_func void PlatformDestroyROMImage(PlatformROMImage *image);
+internal_func u8 *PlatformMapInstanceMemory(PlatformROMImage *image);
+internal_func void PlatformUnmapInstanceMemory(u8 *memory);
+// NOTE(bSalmon): Instance memory with RAM/VRAM taken from path at fileOffset (a multiple of 4KB),
+// the first headerSize bytes of the file are read into header. Where the platform can, the RAM is
+// the file mapped copy-on-write so nothing is read until it is touched and the file is never
+// written, the file must not be changed while it is mapped
+internal_func u8 *PlatformMapInstanceMemoryFromFile(PlatformROMImage *image, char *path, u64 fileOffset,
+													void *header, u64 headerSize);
@@ -0,0 +1,331 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_rewind.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Rewind, a history of the machine one snapshot per frame. A snapshot is the save state header
+and RAM (see 8080emu_savestate.cpp). Only the newest snapshot is kept whole, every older one
+is kept as the XOR of it with the snapshot after it, run-length encoded as
+	[u16 zero bytes][u16 literal bytes][literal bytes...] ...
+with the zero run at the end left off. Most of RAM doesn't change from frame to frame so the
+XOR is almost all zeros and most frames take a few hundred bytes.
+
+Stepping back is XORing the newest delta into the newest snapshot, which gives the snapshot
+before it, and dropping the delta. Deltas live in one ring of bytes, once it or the frame limit
+is full the oldest are dropped.
+
+Needs 8080emu_savestate.cpp.
+*/
+
+// NOTE(bSalmon): Invaders averages ~130 bytes a frame (8KB a second), frontends give twice that
+#define REWIND_DEFAULT_SECONDS 60
+#define REWIND_STORAGE_PER_SECOND KILOBYTES(16)
+
+// NOTE(bSalmon): Zero runs shorter than this are left in a literal run, a new run costs 4 bytes
+#define REWIND_MIN_ZERO_RUN 8
+
+struct RewindSnapshot
+{
+	SaveStateHeader header;
+	u8 ram[RAM_SIZE];
+};
+
+struct RewindEntry
+{
+	u32 offset;
+	u32 size;
+};
+
+struct RewindBuffer
+{
+	RewindEntry *entries;
+	u32 entryCapacity;
+	u32 oldestEntry;
+	u32 entryCount;
+	
+	u8 *storage;
+	u32 storageSize;
+	u32 writeOffset;
+	u64 storedBytes;
+	
+	RewindSnapshot *current;
+	RewindSnapshot *next;
+	u8 *encodeBuffer;
+	b32 hasCurrent;
+};
+
+// Worst case is one token holding everything
+#define REWIND_MAX_ENCODED_SIZE (sizeof(RewindSnapshot) + 4)
+
+// historyFrames is the most frames that can be stepped back, storageSize the most bytes of deltas kept
+internal_func b32 InitRewindBuffer(RewindBuffer *rewind, u32 historyFrames, u32 storageSize)
+{
+	*rewind = {};
+	if (storageSize < REWIND_MAX_ENCODED_SIZE)
+	{
+		storageSize = REWIND_MAX_ENCODED_SIZE;
+	}
+	
+	u64 totalSize = (historyFrames * sizeof(RewindEntry)) + storageSize + (2 * sizeof(RewindSnapshot)) + REWIND_MAX_ENCODED_SIZE;
+	u8 *memory = (u8 *)PlatformAllocateMemory(totalSize);
+	if (!memory || !historyFrames)
+	{
+		PlatformFreeMemory(memory);
+		return false;
+	}
+	
+	rewind->current = (RewindSnapshot *)memory;
+	rewind->next = rewind->current + 1;
+	rewind->entries = (RewindEntry *)(rewind->next + 1);
+	rewind->entryCapacity = historyFrames;
+	rewind->storage = (u8 *)(rewind->entries + historyFrames);
+	rewind->storageSize = storageSize;
+	rewind->encodeBuffer = rewind->storage + storageSize;
+	
+	return true;
+}
+
+internal_func void FreeRewindBuffer(RewindBuffer *rewind)
+{
+	PlatformFreeMemory(rewind->current);
+	*rewind = {};
+}
+
+// Forgets all history, for when the machine is replaced by a reset or a load
+internal_func void ClearRewindBuffer(RewindBuffer *rewind)
+{
+	rewind->oldestEntry = 0;
+	rewind->entryCount = 0;
+	rewind->writeOffset = 0;
+	rewind->storedBytes = 0;
+	rewind->hasCurrent = false;
+}
+
+internal_func void CaptureRewindSnapshot(RewindSnapshot *snapshot, CPUState *cpuState, MachineState *machine)
+{
+	SaveMachineStateHeader(&snapshot->header, cpuState, machine, 0);
+	memcpy(snapshot->ram, &cpuState->memory[RAM_START], RAM_SIZE);
+}
+
+// Returns the index of the first non-zero byte at or after index, or size
+internal_func u32 SkipZeroBytes(u8 *data, u32 index, u32 size)
+{
+	__m128i zero = _mm_setzero_si128();
+	for (; index + 16 <= size; index += 16)
+	{
+		u32 zeroMask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)&data[index]), zero));
+		if (zeroMask != 0xFFFF)
+		{
+			return index + FindLeastSignificantSetBit64(~zeroMask & 0xFFFF);
+		}
+	}
+	
+	while (index < size && !data[index])
+	{
+		++index;
+	}
+	
+	return index;
+}
+
+// Puts older ^ newer in delta
+internal_func void XORRewindSnapshots(u8 *delta, u8 *older, u8 *newer)
+{
+	for (u32 index = 0; index < sizeof(RewindSnapshot); index += 16)
+	{
+		__m128i a = _mm_loadu_si128((__m128i *)&older[index]);
+		__m128i b = _mm_loadu_si128((__m128i *)&newer[index]);
+		_mm_storeu_si128((__m128i *)&delta[index], _mm_xor_si128(a, b));
+	}
+}
+
+internal_func u32 EncodeRewindDelta(u8 *dest, u8 *delta, u32 size)
+{
+	u8 *out = dest;
+	u32 index = 0;
+	while (index < size)
+	{
+		u32 zeroStart = index;
+		index = SkipZeroBytes(delta, index, size);
+		
+		u32 literalStart = index;
+		while (index < size)
+		{
+			if (delta[index])
+			{
+				++index;
+				continue;
+			}
+			
+			u32 zeroEnd = SkipZeroBytes(delta, index, size);
+			if ((zeroEnd - index) >= REWIND_MIN_ZERO_RUN || zeroEnd == size)
+			{
+				break;
+			}
+			index = zeroEnd;
+		}
+		
+		u16 literalCount = (u16)(index - literalStart);
+		if (literalCount)
+		{
+			u16 zeroCount = (u16)(literalStart - zeroStart);
+			memcpy(out, &zeroCount, sizeof(u16));
+			memcpy(out + 2, &literalCount, sizeof(u16));
+			memcpy(out + 4, &delta[literalStart], literalCount);
+			out += 4 + literalCount;
+		}
+	}
+	
+	u32 result = (u32)(out - dest);
+	return result;
+}
+
+// XORs an encoded delta into dest
+internal_func void ApplyRewindDelta(u8 *dest, u8 *encoded, u32 encodedSize)
+{
+	u8 *in = encoded;
+	u8 *end = encoded + encodedSize;
+	while (in < end)
+	{
+		u16 zeroCount;
+		u16 literalCount;
+		memcpy(&zeroCount, in, sizeof(u16));
+		memcpy(&literalCount, in + 2, sizeof(u16));
+		in += 4;
+		dest += zeroCount;
+		
+		for (u32 index = 0; index < literalCount; ++index)
+		{
+			dest[index] ^= in[index];
+		}
+		dest += literalCount;
+		in += literalCount;
+	}
+}
+
+internal_func void DropOldestRewindEntry(RewindBuffer *rewind)
+{
+	rewind->storedBytes -= rewind->entries[rewind->oldestEntry].size;
+	rewind->oldestEntry = (rewind->oldestEntry + 1) % rewind->entryCapacity;
+	rewind->entryCount--;
+}
+
+// Drops the oldest entries for as long as they are in [start, end)
+internal_func void DropRewindRange(RewindBuffer *rewind, u32 start, u32 end)
+{
+	while (rewind->entryCount)
+	{
+		RewindEntry *oldest = &rewind->entries[rewind->oldestEntry];
+		if (oldest->offset >= end || (oldest->offset + oldest->size) <= start)
+		{
+			break;
+		}
+		DropOldestRewindEntry(rewind);
+	}
+}
+
+internal_func void StoreRewindEntry(RewindBuffer *rewind, u8 *encoded, u32 size)
+{
+	if (rewind->entryCount == rewind->entryCapacity)
+	{
+		DropOldestRewindEntry(rewind);
+	}
+	
+	// NOTE(bSalmon): Entries never wrap, the end of the ring is left unused instead
+	if (rewind->writeOffset + size > rewind->storageSize)
+	{
+		DropRewindRange(rewind, rewind->writeOffset, rewind->storageSize);
+		rewind->writeOffset = 0;
+	}
+	DropRewindRange(rewind, rewind->writeOffset, rewind->writeOffset + size);
+	
+	RewindEntry *entry = &rewind->entries[(rewind->oldestEntry + rewind->entryCount) % rewind->entryCapacity];
+	entry->offset = rewind->writeOffset;
+	entry->size = size;
+	memcpy(&rewind->storage[entry->offset], encoded, size);
+	
+	rewind->writeOffset += size;
+	rewind->storedBytes += size;
+	rewind->entryCount++;
+}
+
+// Adds the machine as it is now to the history, call once after every frame
+internal_func void PushRewindFrame(RewindBuffer *rewind, CPUState *cpuState, MachineState *machine)
+{
+	CaptureRewindSnapshot(rewind->next, cpuState, machine);
+	
+	if (rewind->hasCurrent)
+	{
+		// NOTE(bSalmon): The XOR is built in place of the old snapshot, it isn't needed after this
+		u8 *delta = (u8 *)rewind->current;
+		XORRewindSnapshots(delta, (u8 *)rewind->current, (u8 *)rewind->next);
+		u32 encodedSize = EncodeRewindDelta(rewind->encodeBuffer, delta, sizeof(RewindSnapshot));
+		StoreRewindEntry(rewind, rewind->encodeBuffer, encodedSize);
+	}
+	
+	RewindSnapshot *swap = rewind->current;
+	rewind->current = rewind->next;
+	rewind->next = swap;
+	rewind->hasCurrent = true;
+}
+
+// Steps the machine back to the frame before the newest in the history, returns false with the
+// machine untouched when there is no more history
+internal_func b32 RewindMachineFrame(RewindBuffer *rewind, CPUState *cpuState, MachineState *machine)
+{
+	if (!rewind->entryCount)
+	{
+		return false;
+	}
+	
+	u32 newestEntry = (rewind->oldestEntry + rewind->entryCount - 1) % rewind->entryCapacity;
+	RewindEntry *entry = &rewind->entries[newestEntry];
+	ApplyRewindDelta((u8 *)rewind->current, &rewind->storage[entry->offset], entry->size);
+	
+	// NOTE(bSalmon): The newest entry is always the last thing written so its space can be reused straight away
+	rewind->writeOffset = entry->offset;
+	rewind->storedBytes -= entry->size;
+	rewind->entryCount--;
+	
+	LoadMachineStateHeader(&rewind->current->header, cpuState, machine);
+	memcpy(&cpuState->memory[RAM_START], rewind->current->ram, RAM_SIZE);
+	
+	return true;
+}
+
+// Emulates a frame and adds it to the history, or steps back a frame while rewinding. The keys
+// held now are kept either way, stepping back doesn't give back the ones held back then
+internal_func void EmulateRewindableFrame(RewindBuffer *rewind, b32 rewinding, CPUState *cpuState, MachineState *machine)
+{
+	if (rewinding)
+	{
+		u8 inputPort1 = machine->inputPort1;
+		u8 inputPort2 = machine->inputPort2;
+		RewindMachineFrame(rewind, cpuState, machine);
+		machine->inputPort1 = inputPort1;
+		machine->inputPort2 = inputPort2;
+	}
+	else
+	{
+		EmulateFrame(cpuState, machine);
+		PushRewindFrame(rewind, cpuState, machine);
+	}
+}
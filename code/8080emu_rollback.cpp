@@ -0,0 +1,439 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_rollback.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Rollback, two machines in two places play the same two player game without either waiting on
+the other's input. Each peer owns one player's controls. Every frame a peer runs its machine
+with its own input and a guess at the other player's, the last input it heard from them.
+When the real input for a frame arrives and differs from the guess, the machine goes back to
+the state saved at the start of that frame and runs forward again with what is now known.
+
+Inputs travel in RollbackPackets sent every frame. A packet repeats every local input the
+other side hasn't acknowledged yet, so a lost packet costs nothing but a little extra rollback.
+How the packets get there is up to the caller, the session only builds and reads them.
+
+A peer can only run ROLLBACK_MAX_FRAMES past the last frame it has the other player's input
+for, after that it stalls, as the saved states to go back to run out. Peers also keep their
+frames roughly level: each packet carries how far ahead the sender thinks it is, and the one
+further ahead sits out a frame now and then (see ShouldRollbackWait).
+
+Desyncs are caught by trading a hash of the machine every ROLLBACK_CHECK_INTERVAL frames,
+once both inputs up to that frame are known.
+
+Needs 8080emu_hash.cpp and 8080emu_savestate.cpp.
+*/
+
+#define ROLLBACK_MAGIC 0x4B424C52 // "RLBK"
+#define ROLLBACK_MAX_FRAMES 8
+#define ROLLBACK_SAVED_FRAMES (ROLLBACK_MAX_FRAMES + 1)
+#define ROLLBACK_INPUT_HISTORY 64
+#define ROLLBACK_PACKET_INPUTS 16
+#define ROLLBACK_CHECK_INTERVAL 60
+#define ROLLBACK_CHECK_HISTORY 8
+#define ROLLBACK_SYNC_INTERVAL 20
+
+// NOTE(bSalmon): One player's controls, the coin slot is shared by both
+#define ROLLBACK_INPUT_LEFT 0x01
+#define ROLLBACK_INPUT_RIGHT 0x02
+#define ROLLBACK_INPUT_SHOOT 0x04
+#define ROLLBACK_INPUT_START 0x08
+#define ROLLBACK_INPUT_COIN 0x10
+
+struct RollbackPacket
+{
+	u32 magic;
+	u32 sender;
+	
+	// NOTE(bSalmon): inputs[0] is the sender's input for firstFrame
+	u32 firstFrame;
+	u32 inputCount;
+	
+	// NOTE(bSalmon): How many of the receiver's inputs the sender has, from frame 0 with no gaps
+	u32 ackFrame;
+	
+	u32 frame;
+	s32 advantage;
+	
+	u32 checkFrame;
+	u64 checkHash;
+	
+	u8 inputs[ROLLBACK_PACKET_INPUTS];
+};
+
+struct RollbackSavedFrame
+{
+	SaveStateHeader header;
+	u8 ram[RAM_SIZE];
+};
+
+struct RollbackCheck
+{
+	u32 frame;
+	b32 valid;
+	u64 hash;
+};
+
+struct RollbackStats
+{
+	u64 rollbacks;
+	u64 resimulatedFrames;
+	u32 maxRollbackFrames;
+	u64 maxRollbackNanoseconds;
+	u64 totalFrameNanoseconds;
+	u64 maxFrameNanoseconds;
+	u64 frames;
+	u64 stalls;
+	u64 syncWaits;
+	u64 checksMatched;
+	u64 packetsReceived;
+	u64 packetsRejected;
+};
+
+struct RollbackSession
+{
+	u32 localPlayer;
+	
+	// NOTE(bSalmon): The next frame to run
+	u32 frame;
+	
+	// NOTE(bSalmon): By player and frame, remote inputs past remoteReceived are guesses
+	u8 inputs[2][ROLLBACK_INPUT_HISTORY];
+	u32 remoteReceived;
+	u32 remoteAcked;
+	
+	// NOTE(bSalmon): The earliest frame run with a wrong guess, frame if there isn't one
+	u32 rollbackFrame;
+	
+	RollbackSavedFrame *saved;
+	
+	// Time sync
+	u32 remoteFrame;
+	s32 remoteAdvantage;
+	u32 lastSyncWait;
+	
+	// Desync checks
+	u32 nextCheckFrame;
+	RollbackCheck localChecks[ROLLBACK_CHECK_HISTORY];
+	RollbackCheck remoteChecks[ROLLBACK_CHECK_HISTORY];
+	RollbackCheck latestLocalCheck;
+	u32 lastComparedCheck;
+	b32 desynced;
+	u32 desyncFrame;
+	
+	RollbackStats stats;
+};
+
+internal_func b32 InitRollbackSession(RollbackSession *session, u32 localPlayer)
+{
+	*session = {};
+	session->localPlayer = localPlayer;
+	session->saved = (RollbackSavedFrame *)PlatformAllocateMemory(ROLLBACK_SAVED_FRAMES * sizeof(RollbackSavedFrame));
+	session->nextCheckFrame = ROLLBACK_CHECK_INTERVAL;
+	
+	b32 result = (session->saved != 0);
+	return result;
+}
+
+internal_func void FreeRollbackSession(RollbackSession *session)
+{
+	PlatformFreeMemory(session->saved);
+	*session = {};
+}
+
+// Sets both players' controls on the ports, the rest of the ports are left alone
+internal_func void ApplyRollbackInputs(MachineState *machine, u8 player1, u8 player2)
+{
+	SetMachineInput(machine, MachineInput::COIN, ((player1 | player2) & ROLLBACK_INPUT_COIN) != 0);
+	SetMachineInput(machine, MachineInput::P1START, (player1 & ROLLBACK_INPUT_START) != 0);
+	SetMachineInput(machine, MachineInput::P1LEFT, (player1 & ROLLBACK_INPUT_LEFT) != 0);
+	SetMachineInput(machine, MachineInput::P1RIGHT, (player1 & ROLLBACK_INPUT_RIGHT) != 0);
+	SetMachineInput(machine, MachineInput::P1SHOOT, (player1 & ROLLBACK_INPUT_SHOOT) != 0);
+	SetMachineInput(machine, MachineInput::P2START, (player2 & ROLLBACK_INPUT_START) != 0);
+	SetMachineInput(machine, MachineInput::P2LEFT, (player2 & ROLLBACK_INPUT_LEFT) != 0);
+	SetMachineInput(machine, MachineInput::P2RIGHT, (player2 & ROLLBACK_INPUT_RIGHT) != 0);
+	SetMachineInput(machine, MachineInput::P2SHOOT, (player2 & ROLLBACK_INPUT_SHOOT) != 0);
+}
+
+internal_func u8 *GetRollbackInput(RollbackSession *session, u32 player, u32 frame)
+{
+	u8 *result = &session->inputs[player][frame % ROLLBACK_INPUT_HISTORY];
+	return result;
+}
+
+internal_func RollbackSavedFrame *GetRollbackSavedFrame(RollbackSession *session, u32 frame)
+{
+	RollbackSavedFrame *result = &session->saved[frame % ROLLBACK_SAVED_FRAMES];
+	return result;
+}
+
+// The remote input to run frame with, the real one if it has arrived or else a guess
+internal_func u8 PredictRemoteInput(RollbackSession *session, u32 frame)
+{
+	u32 remotePlayer = session->localPlayer ^ 1;
+	u8 result = 0;
+	if (frame < session->remoteReceived)
+	{
+		result = *GetRollbackInput(session, remotePlayer, frame);
+	}
+	else if (session->remoteReceived > 0)
+	{
+		// NOTE(bSalmon): Whatever they were last seen doing they are probably still doing
+		result = *GetRollbackInput(session, remotePlayer, session->remoteReceived - 1);
+	}
+	
+	return result;
+}
+
+// Saves the state at the start of session->frame and runs the frame
+internal_func void RunRollbackFrame(RollbackSession *session, CPUState *cpuState, MachineState *machine)
+{
+	u32 frame = session->frame;
+	u32 remotePlayer = session->localPlayer ^ 1;
+	
+	RollbackSavedFrame *saved = GetRollbackSavedFrame(session, frame);
+	SaveMachineStateHeader(&saved->header, cpuState, machine, 0);
+	memcpy(saved->ram, &cpuState->memory[RAM_START], RAM_SIZE);
+	
+	u8 *remoteInput = GetRollbackInput(session, remotePlayer, frame);
+	*remoteInput = PredictRemoteInput(session, frame);
+	
+	u8 *inputs[2];
+	inputs[session->localPlayer] = GetRollbackInput(session, session->localPlayer, frame);
+	inputs[remotePlayer] = remoteInput;
+	ApplyRollbackInputs(machine, *inputs[0], *inputs[1]);
+	
+	EmulateFrame(cpuState, machine);
+	session->frame++;
+}
+
+internal_func RollbackCheck *FindRollbackCheck(RollbackCheck *checks, u32 frame)
+{
+	RollbackCheck *result = &checks[(frame / ROLLBACK_CHECK_INTERVAL) % ROLLBACK_CHECK_HISTORY];
+	if (!result->valid || result->frame != frame)
+	{
+		result = 0;
+	}
+	
+	return result;
+}
+
+internal_func void CompareRollbackChecks(RollbackSession *session, u32 frame)
+{
+	// NOTE(bSalmon): Every packet repeats the latest check, each pair is only compared once
+	RollbackCheck *local = FindRollbackCheck(session->localChecks, frame);
+	RollbackCheck *remote = FindRollbackCheck(session->remoteChecks, frame);
+	if (local && remote && frame > session->lastComparedCheck)
+	{
+		session->lastComparedCheck = frame;
+		if (local->hash == remote->hash)
+		{
+			session->stats.checksMatched++;
+		}
+		else if (!session->desynced)
+		{
+			session->desynced = true;
+			session->desyncFrame = frame;
+		}
+	}
+}
+
+internal_func void StoreRollbackCheck(RollbackCheck *checks, u32 frame, u64 hash)
+{
+	RollbackCheck *check = &checks[(frame / ROLLBACK_CHECK_INTERVAL) % ROLLBACK_CHECK_HISTORY];
+	check->frame = frame;
+	check->valid = true;
+	check->hash = hash;
+}
+
+// Reads a packet from the other peer, returns false if it isn't one
+internal_func b32 ReceiveRollbackPacket(RollbackSession *session, void *data, u64 size)
+{
+	RollbackPacket *packet = (RollbackPacket *)data;
+	u32 remotePlayer = session->localPlayer ^ 1;
+	b32 result = (size == sizeof(RollbackPacket) && packet->magic == ROLLBACK_MAGIC && packet->sender == remotePlayer &&
+				  packet->inputCount <= ROLLBACK_PACKET_INPUTS);
+	if (!result)
+	{
+		session->stats.packetsRejected++;
+		return result;
+	}
+	session->stats.packetsReceived++;
+	
+	// NOTE(bSalmon): Only inputs that carry on from the ones already here are taken, anything
+	// after a gap comes again in a later packet
+	for (u32 inputIndex = 0; inputIndex < packet->inputCount; ++inputIndex)
+	{
+		u32 inputFrame = packet->firstFrame + inputIndex;
+		if (inputFrame < session->remoteReceived)
+		{
+			continue;
+		}
+		else if (inputFrame > session->remoteReceived || inputFrame >= session->frame + ROLLBACK_MAX_FRAMES)
+		{
+			break;
+		}
+		
+		u8 *input = GetRollbackInput(session, remotePlayer, inputFrame);
+		if (inputFrame < session->frame && *input != packet->inputs[inputIndex] && inputFrame < session->rollbackFrame)
+		{
+			session->rollbackFrame = inputFrame;
+		}
+		*input = packet->inputs[inputIndex];
+		session->remoteReceived++;
+	}
+	
+	if (packet->ackFrame > session->remoteAcked && packet->ackFrame <= session->frame)
+	{
+		session->remoteAcked = packet->ackFrame;
+	}
+	
+	if (packet->frame >= session->remoteFrame)
+	{
+		session->remoteFrame = packet->frame;
+		session->remoteAdvantage = packet->advantage;
+	}
+	
+	if (packet->checkFrame)
+	{
+		StoreRollbackCheck(session->remoteChecks, packet->checkFrame, packet->checkHash);
+		CompareRollbackChecks(session, packet->checkFrame);
+	}
+	
+	return result;
+}
+
+internal_func void BuildRollbackPacket(RollbackSession *session, RollbackPacket *packet)
+{
+	*packet = {};
+	packet->magic = ROLLBACK_MAGIC;
+	packet->sender = session->localPlayer;
+	packet->firstFrame = session->remoteAcked;
+	packet->inputCount = session->frame - session->remoteAcked;
+	if (packet->inputCount > ROLLBACK_PACKET_INPUTS)
+	{
+		packet->inputCount = ROLLBACK_PACKET_INPUTS;
+	}
+	
+	for (u32 inputIndex = 0; inputIndex < packet->inputCount; ++inputIndex)
+	{
+		packet->inputs[inputIndex] = *GetRollbackInput(session, session->localPlayer, packet->firstFrame + inputIndex);
+	}
+	
+	packet->ackFrame = session->remoteReceived;
+	packet->frame = session->frame;
+	packet->advantage = (s32)session->frame - (s32)session->remoteFrame;
+	
+	if (session->latestLocalCheck.valid)
+	{
+		packet->checkFrame = session->latestLocalCheck.frame;
+		packet->checkHash = session->latestLocalCheck.hash;
+	}
+}
+
+// False when running another frame would go past what can be rolled back
+internal_func b32 CanAdvanceRollbackFrame(RollbackSession *session)
+{
+	b32 result = (session->frame - session->remoteReceived) < ROLLBACK_MAX_FRAMES;
+	return result;
+}
+
+// True when this peer is far enough ahead of the other that it should skip a frame to let it catch up
+internal_func b32 ShouldRollbackWait(RollbackSession *session)
+{
+	s32 localAdvantage = (s32)session->frame - (s32)session->remoteFrame;
+	b32 result = ((localAdvantage - session->remoteAdvantage) / 2) >= 1 &&
+		(session->frame - session->lastSyncWait) >= ROLLBACK_SYNC_INTERVAL;
+	if (result)
+	{
+		session->lastSyncWait = session->frame;
+		session->stats.syncWaits++;
+	}
+	
+	return result;
+}
+
+// Goes back and runs again from the first wrong guess, if there was one
+internal_func void ResolveRollback(RollbackSession *session, CPUState *cpuState, MachineState *machine)
+{
+	if (session->rollbackFrame < session->frame)
+	{
+		u64 startTime = PlatformGetWallClock();
+		
+		u32 targetFrame = session->frame;
+		RollbackSavedFrame *saved = GetRollbackSavedFrame(session, session->rollbackFrame);
+		LoadMachineStateHeader(&saved->header, cpuState, machine);
+		memcpy(&cpuState->memory[RAM_START], saved->ram, RAM_SIZE);
+		
+		session->frame = session->rollbackFrame;
+		while (session->frame < targetFrame)
+		{
+			RunRollbackFrame(session, cpuState, machine);
+		}
+		
+		u32 rollbackFrames = targetFrame - session->rollbackFrame;
+		u64 rollbackNanoseconds = PlatformGetWallClock() - startTime;
+		RollbackStats *stats = &session->stats;
+		stats->rollbacks++;
+		stats->resimulatedFrames += rollbackFrames;
+		stats->maxRollbackFrames = (rollbackFrames > stats->maxRollbackFrames) ? rollbackFrames : stats->maxRollbackFrames;
+		stats->maxRollbackNanoseconds = (rollbackNanoseconds > stats->maxRollbackNanoseconds) ? rollbackNanoseconds :
+			stats->maxRollbackNanoseconds;
+	}
+	session->rollbackFrame = session->frame;
+	
+	// NOTE(bSalmon): The state at the start of a frame is final once every input before it is known
+	u32 checkFrame = session->nextCheckFrame;
+	if (checkFrame <= session->remoteReceived && checkFrame < session->frame &&
+		(session->frame - checkFrame) < ROLLBACK_SAVED_FRAMES)
+	{
+		u64 hash = HashMemory64(GetRollbackSavedFrame(session, checkFrame), sizeof(RollbackSavedFrame), 0);
+		StoreRollbackCheck(session->localChecks, checkFrame, hash);
+		session->latestLocalCheck = session->localChecks[(checkFrame / ROLLBACK_CHECK_INTERVAL) % ROLLBACK_CHECK_HISTORY];
+		CompareRollbackChecks(session, checkFrame);
+		session->nextCheckFrame += ROLLBACK_CHECK_INTERVAL;
+	}
+}
+
+// Rolls back if needed then runs the next frame with localInput, check CanAdvanceRollbackFrame first
+internal_func void AdvanceRollbackFrame(RollbackSession *session, CPUState *cpuState, MachineState *machine, u8 localInput)
+{
+	u64 startTime = PlatformGetWallClock();
+	
+	ResolveRollback(session, cpuState, machine);
+	*GetRollbackInput(session, session->localPlayer, session->frame) = localInput;
+	RunRollbackFrame(session, cpuState, machine);
+	session->rollbackFrame = session->frame;
+	
+	u64 frameNanoseconds = PlatformGetWallClock() - startTime;
+	RollbackStats *stats = &session->stats;
+	stats->frames++;
+	stats->totalFrameNanoseconds += frameNanoseconds;
+	stats->maxFrameNanoseconds = (frameNanoseconds > stats->maxFrameNanoseconds) ? frameNanoseconds : stats->maxFrameNanoseconds;
+}
+
+// True once both sides have every input up to frameCount and the machine is final there
+internal_func b32 IsRollbackSettled(RollbackSession *session, u32 frameCount)
+{
+	b32 result = (session->frame == frameCount && session->remoteReceived >= frameCount &&
+				  session->rollbackFrame == session->frame);
+	return result;
+}
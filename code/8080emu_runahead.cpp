@@ -0,0 +1,149 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_runahead.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Run-Ahead, hides the frame or two the game takes to react to input. Every host frame the real
+machine runs one frame as usual, then BeginRunAhead() runs N more frames with the same input
+held and the caller shows those instead, EndRunAhead() puts things back. The real machine's
+timeline is exactly what it would have been without run-ahead, only what is shown is N frames
+ahead of it.
+
+Two ways of getting back:
+  - One instance: the real machine is saved before running ahead and restored after, only the
+	RAM pages written since the last save or restore are copied each way
+  - Second instance: the real machine is copied into a second instance which runs ahead, the
+	real machine is never touched so there is no restore. Only the pages either of them wrote
+	since the last copy are copied
+
+Run-ahead has its own dirty page bits (DirtyPageUser::RUN_AHEAD) on both instances, so the
+real machine can be forked, hashed or snapshotted as well. Pages put back by EndRunAhead were
+written by the frames run ahead, so the other users already see them as written.
+
+Needs 8080emu_fork.cpp.
+*/
+
+struct RunAhead
+{
+	u32 frameCount;
+	b32 useSecondInstance;
+	
+	// NOTE(bSalmon): The save for one instance, or the second instance's state
+	CPUState savedState;
+	MachineState savedMachine;
+	u8 *savedRAM;
+	
+	// NOTE(bSalmon): False until the first full copy, and after anything replaces the machine's memory
+	b32 savedValid;
+	
+	// Stats
+	u64 hostFrames;
+	u64 pagesCopied;
+};
+
+// With aheadMemory (from PlatformMapInstanceMemory) a second instance is used, without it the
+// real machine is saved and restored
+internal_func b32 InitRunAhead(RunAhead *runAhead, u32 frameCount, u8 *aheadMemory)
+{
+	*runAhead = {};
+	runAhead->frameCount = frameCount;
+	runAhead->useSecondInstance = (aheadMemory != 0);
+	runAhead->savedState.memory = aheadMemory;
+	runAhead->savedRAM = aheadMemory ? &aheadMemory[RAM_START] : (u8 *)PlatformAllocateMemory(RAM_SIZE);
+	
+	b32 result = (runAhead->savedRAM != 0);
+	return result;
+}
+
+// The second instance's memory is the caller's to unmap
+internal_func void FreeRunAhead(RunAhead *runAhead)
+{
+	if (!runAhead->useSecondInstance)
+	{
+		PlatformFreeMemory(runAhead->savedRAM);
+	}
+	*runAhead = {};
+}
+
+// Call when the real machine is reset or loaded
+internal_func void ResetRunAhead(RunAhead *runAhead)
+{
+	runAhead->savedValid = false;
+}
+
+// Copies the real machine into the save/second instance, pages are the RAM pages that differ
+internal_func void SyncRunAhead(RunAhead *runAhead, CPUState *cpuState, MachineState *machine, u64 pages)
+{
+	if (!runAhead->savedValid)
+	{
+		pages = ~0ULL;
+		runAhead->savedValid = true;
+	}
+	
+	runAhead->pagesCopied += CopyDirtyRAM(runAhead->savedRAM, &cpuState->memory[RAM_START], pages);
+	
+	CopyCPURegisters(&runAhead->savedState, cpuState);
+	runAhead->savedMachine = *machine;
+	ClearDirtyPages(&runAhead->savedState, DirtyPageUser::RUN_AHEAD);
+	ClearDirtyPages(cpuState, DirtyPageUser::RUN_AHEAD);
+}
+
+// Runs ahead from the real machine, call after its frame for this host frame. Returns the
+// machine to show, which stays valid until EndRunAhead
+internal_func CPUState *BeginRunAhead(RunAhead *runAhead, CPUState *cpuState, MachineState *machine)
+{
+	runAhead->hostFrames++;
+	
+	CPUState *result = cpuState;
+	MachineState *aheadMachine = machine;
+	if (runAhead->useSecondInstance)
+	{
+		// NOTE(bSalmon): The second instance's RAM differs wherever either of them has written since the last sync
+		SyncRunAhead(runAhead, cpuState, machine, GetDirtyPages(cpuState, DirtyPageUser::RUN_AHEAD) |
+					 GetDirtyPages(&runAhead->savedState, DirtyPageUser::RUN_AHEAD));
+		result = &runAhead->savedState;
+		aheadMachine = &runAhead->savedMachine;
+	}
+	else
+	{
+		SyncRunAhead(runAhead, cpuState, machine, GetDirtyPages(cpuState, DirtyPageUser::RUN_AHEAD));
+	}
+	
+	for (u32 frameIndex = 0; frameIndex < runAhead->frameCount && !IsMachineStopped(result); ++frameIndex)
+	{
+		EmulateFrame(result, aheadMachine);
+	}
+	
+	return result;
+}
+
+internal_func void EndRunAhead(RunAhead *runAhead, CPUState *cpuState, MachineState *machine)
+{
+	if (!runAhead->useSecondInstance)
+	{
+		u8 *memory = cpuState->memory;
+		runAhead->pagesCopied += CopyDirtyRAM(&memory[RAM_START], runAhead->savedRAM, GetDirtyPages(cpuState, DirtyPageUser::RUN_AHEAD));
+		
+		CopyCPURegisters(cpuState, &runAhead->savedState);
+		ClearDirtyPages(cpuState, DirtyPageUser::RUN_AHEAD);
+		*machine = runAhead->savedMachine;
+	}
+}
@@ -0,0 +1,340 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_savestate.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Save States, a fixed layout that is the same in memory and on disk:
+  0000  SaveStateHeader, padded out to SAVE_STATE_RAM_OFFSET
+  1000  RAM/VRAM (2000-3fff), RAM_SIZE bytes
+RAM starts on a 4KB boundary so a state file can be mapped straight in as an instance's RAM
+with PlatformMapInstanceMemoryFromFile, nothing is read or copied until the instance touches
+it. Only the header has to be read, it is a handful of fixed size little endian fields.
+
+The version is bumped whenever the layout changes, states from another version are refused
+rather than converted. The ROM is not stored, the header keeps a hash of it and a state is
+refused by a different ROM. Everything that decides what the machine does next is stored, so
+a state can be saved part way through a frame and picks up at the same cycle. enableColour and
+romFilename are settings of the frontend rather than the machine and are left alone by loads.
+
+A state can also be stored compressed, a CompressedStateHeader followed by the whole SaveState
+as one LZ block (see 8080emu_lz.cpp). The header keeps a hash of the uncompressed state that is
+checked after decompressing. LoadStateFromFile takes either kind of file, compressed files can't
+be mapped.
+
+Needs 8080emu_hash.cpp and 8080emu_lz.cpp.
+*/
+
+#define SAVE_STATE_MAGIC 0x54533038 // "80ST"
+#define SAVE_STATE_VERSION 1
+#define SAVE_STATE_RAM_OFFSET 0x1000
+#define SAVE_STATE_SIZE (SAVE_STATE_RAM_OFFSET + RAM_SIZE)
+
+#define COMPRESSED_STATE_MAGIC 0x5A533038 // "80SZ"
+#define COMPRESSED_STATE_VERSION 1
+
+struct SaveStateHeader
+{
+	u32 magic;
+	u32 version;
+	u32 ramOffset;
+	u32 ramSize;
+	u64 romHash;
+	
+	// CPUState
+	u8 regA;
+	u8 psw;
+	u8 regB;
+	u8 regC;
+	u8 regD;
+	u8 regE;
+	u8 regH;
+	u8 regL;
+	u16 stackPointer;
+	u16 programCounter;
+	u8 enableInterrupt;
+	u8 halted;
+	u16 romSize;
+	
+	// MachineState
+	u8 shift0;
+	u8 shift1;
+	u8 shiftOffset;
+	u8 inputPort1;
+	u8 inputPort2;
+	u8 nextInterruptNum;
+	u8 pad[2];
+	u64 cycles;
+	u64 instructionCount;
+	u64 frameCount;
+	u64 nextInterruptCycle;
+};
+
+struct SaveState
+{
+	union
+	{
+		SaveStateHeader header;
+		u8 headerPage[SAVE_STATE_RAM_OFFSET];
+	};
+	u8 ram[RAM_SIZE];
+};
+
+struct CompressedStateHeader
+{
+	u32 magic;
+	u32 version;
+	u32 stateSize;
+	u32 compressedSize;
+	u64 stateHash;
+};
+
+#define COMPRESSED_STATE_MAX_SIZE (sizeof(CompressedStateHeader) + LZ_MAX_COMPRESSED_SIZE(sizeof(SaveState)))
+
+internal_func u64 GetROMHash(u8 *memory)
+{
+	u64 result = HashMemory64(memory, 0x2000, 0);
+	return result;
+}
+
+// Fills in everything in a header but memory
+internal_func void SaveMachineStateHeader(SaveStateHeader *header, CPUState *cpuState, MachineState *machine, u64 romHash)
+{
+	*header = {};
+	header->magic = SAVE_STATE_MAGIC;
+	header->version = SAVE_STATE_VERSION;
+	header->ramOffset = SAVE_STATE_RAM_OFFSET;
+	header->ramSize = RAM_SIZE;
+	header->romHash = romHash;
+	
+	header->regA = cpuState->regA;
+	header->psw = BuildPSW(cpuState);
+	header->regB = cpuState->regB;
+	header->regC = cpuState->regC;
+	header->regD = cpuState->regD;
+	header->regE = cpuState->regE;
+	header->regH = cpuState->regH;
+	header->regL = cpuState->regL;
+	header->stackPointer = cpuState->stackPointer;
+	header->programCounter = cpuState->programCounter;
+	header->enableInterrupt = (u8)cpuState->enableInterrupt;
+	header->halted = (u8)cpuState->halted;
+	header->romSize = machine->romSize;
+	
+	header->shift0 = machine->shift0;
+	header->shift1 = machine->shift1;
+	header->shiftOffset = machine->shiftOffset;
+	header->inputPort1 = machine->inputPort1;
+	header->inputPort2 = machine->inputPort2;
+	header->nextInterruptNum = machine->nextInterruptNum;
+	header->cycles = machine->cycles;
+	header->instructionCount = machine->instructionCount;
+	header->frameCount = machine->frameCount;
+	header->nextInterruptCycle = machine->nextInterruptCycle;
+}
+
+internal_func void SaveMachineState(SaveState *state, CPUState *cpuState, MachineState *machine, u64 romHash)
+{
+	memset(state->headerPage, 0, sizeof(state->headerPage));
+	SaveMachineStateHeader(&state->header, cpuState, machine, romHash);
+	memcpy(state->ram, &cpuState->memory[RAM_START], RAM_SIZE);
+}
+
+// NOTE(bSalmon): Fields that are used as sizes, shifts or to schedule interrupts are range checked
+// too, a state must not be able to make the machine touch memory out of range or never interrupt
+internal_func b32 IsSaveStateValid(SaveStateHeader *header, u64 romHash)
+{
+	s64 cyclesToInterrupt = (s64)(header->nextInterruptCycle - header->cycles);
+	b32 result = (header->magic == SAVE_STATE_MAGIC && header->version == SAVE_STATE_VERSION &&
+				  header->ramOffset == SAVE_STATE_RAM_OFFSET && header->ramSize == RAM_SIZE &&
+				  header->romHash == romHash &&
+				  header->romSize > 0 && header->romSize <= RAM_START &&
+				  (header->nextInterruptNum == 1 || header->nextInterruptNum == 2) &&
+				  header->shiftOffset <= 7 &&
+				  cyclesToInterrupt > -CYCLES_PER_FRAME && cyclesToInterrupt <= CYCLES_PER_FRAME);
+	return result;
+}
+
+// Sets everything but memory from a header, the caller has already checked it with IsSaveStateValid
+internal_func void LoadMachineStateHeader(SaveStateHeader *header, CPUState *cpuState, MachineState *machine)
+{
+	cpuState->regA = header->regA;
+	cpuState->regF.s = (header->psw >> 7) & 0x01;
+	cpuState->regF.z = (header->psw >> 6) & 0x01;
+	cpuState->regF.unused1 = (header->psw >> 5) & 0x01;
+	cpuState->regF.a = (header->psw >> 4) & 0x01;
+	cpuState->regF.unused2 = (header->psw >> 3) & 0x01;
+	cpuState->regF.p = (header->psw >> 2) & 0x01;
+	cpuState->regF.unused3 = (header->psw >> 1) & 0x01;
+	cpuState->regF.c = header->psw & 0x01;
+	cpuState->regB = header->regB;
+	cpuState->regC = header->regC;
+	cpuState->regD = header->regD;
+	cpuState->regE = header->regE;
+	cpuState->regH = header->regH;
+	cpuState->regL = header->regL;
+	cpuState->stackPointer = header->stackPointer;
+	cpuState->programCounter = header->programCounter;
+	cpuState->enableInterrupt = header->enableInterrupt;
+	cpuState->halted = header->halted;
+	
+	// NOTE(bSalmon): All of RAM has changed as far as anything tracking dirty pages is concerned
+	cpuState->dirtyPages = ~0ULL;
+	
+	machine->romSize = header->romSize;
+	machine->shift0 = header->shift0;
+	machine->shift1 = header->shift1;
+	machine->shiftOffset = header->shiftOffset;
+	machine->inputPort1 = header->inputPort1;
+	machine->inputPort2 = header->inputPort2;
+	machine->nextInterruptNum = header->nextInterruptNum;
+	machine->cycles = header->cycles;
+	machine->instructionCount = header->instructionCount;
+	machine->frameCount = header->frameCount;
+	machine->nextInterruptCycle = header->nextInterruptCycle;
+}
+
+internal_func b32 LoadMachineState(SaveState *state, CPUState *cpuState, MachineState *machine, u64 romHash)
+{
+	b32 result = IsSaveStateValid(&state->header, romHash);
+	if (result)
+	{
+		LoadMachineStateHeader(&state->header, cpuState, machine);
+		memcpy(&cpuState->memory[RAM_START], state->ram, RAM_SIZE);
+	}
+	
+	return result;
+}
+
+// dest must hold COMPRESSED_STATE_MAX_SIZE bytes, returns the size of the compressed state
+internal_func u32 CompressSaveState(u8 *dest, SaveState *state)
+{
+	CompressedStateHeader *header = (CompressedStateHeader *)dest;
+	header->magic = COMPRESSED_STATE_MAGIC;
+	header->version = COMPRESSED_STATE_VERSION;
+	header->stateSize = sizeof(SaveState);
+	header->compressedSize = CompressLZ(dest + sizeof(CompressedStateHeader), (u8 *)state, sizeof(SaveState));
+	header->stateHash = HashMemory64(state, sizeof(SaveState), 0);
+	
+	u32 result = sizeof(CompressedStateHeader) + header->compressedSize;
+	return result;
+}
+
+internal_func b32 IsCompressedState(u8 *data, u64 size)
+{
+	CompressedStateHeader *header = (CompressedStateHeader *)data;
+	b32 result = (size >= sizeof(CompressedStateHeader) && header->magic == COMPRESSED_STATE_MAGIC);
+	return result;
+}
+
+// Only the container is checked, the state still has to go through IsSaveStateValid
+internal_func b32 DecompressSaveState(SaveState *state, u8 *data, u64 size)
+{
+	b32 result = false;
+	
+	CompressedStateHeader *header = (CompressedStateHeader *)data;
+	if (IsCompressedState(data, size) && header->version == COMPRESSED_STATE_VERSION &&
+		header->stateSize == sizeof(SaveState) && header->compressedSize == (size - sizeof(CompressedStateHeader)))
+	{
+		result = (DecompressLZ((u8 *)state, sizeof(SaveState), data + sizeof(CompressedStateHeader), header->compressedSize) &&
+				  HashMemory64(state, sizeof(SaveState), 0) == header->stateHash);
+	}
+	
+	return result;
+}
+
+internal_func b32 SaveStateToFile(char *path, CPUState *cpuState, MachineState *machine, b32 compress = false)
+{
+	u64 allocationSize = sizeof(SaveState) + (compress ? COMPRESSED_STATE_MAX_SIZE : 0);
+	SaveState *state = (SaveState *)PlatformAllocateMemory(allocationSize);
+	b32 result = false;
+	if (state)
+	{
+		SaveMachineState(state, cpuState, machine, GetROMHash(cpuState->memory));
+		if (compress)
+		{
+			u8 *compressed = (u8 *)(state + 1);
+			result = PlatformWriteEntireFile(path, compressed, CompressSaveState(compressed, state));
+		}
+		else
+		{
+			result = PlatformWriteEntireFile(path, state, sizeof(SaveState));
+		}
+		PlatformFreeMemory(state);
+	}
+	
+	return result;
+}
+
+// Copies the state into the instance's existing memory, the file can be compressed or not
+internal_func b32 LoadStateFromFile(char *path, CPUState *cpuState, MachineState *machine)
+{
+	b32 result = false;
+	
+	u64 fileSize = 0;
+	u8 *file = PlatformReadEntireFile(path, &fileSize);
+	if (file)
+	{
+		if (fileSize == sizeof(SaveState))
+		{
+			result = LoadMachineState((SaveState *)file, cpuState, machine, GetROMHash(cpuState->memory));
+		}
+		else if (IsCompressedState(file, fileSize))
+		{
+			SaveState *state = (SaveState *)PlatformAllocateMemory(sizeof(SaveState));
+			if (state)
+			{
+				result = (DecompressSaveState(state, file, fileSize) &&
+						  LoadMachineState(state, cpuState, machine, GetROMHash(cpuState->memory)));
+				PlatformFreeMemory(state);
+			}
+		}
+		PlatformFreeMemory(file);
+	}
+	
+	return result;
+}
+
+// Maps new instance memory for the state with its RAM backed by the file, on success the old
+// memory is unmapped and cpuState->memory replaced. The file must not change while it is mapped,
+// compressed files are refused
+internal_func b32 MapStateFromFile(PlatformROMImage *image, char *path, CPUState *cpuState, MachineState *machine)
+{
+	b32 result = false;
+	
+	SaveStateHeader header;
+	u8 *memory = PlatformMapInstanceMemoryFromFile(image, path, SAVE_STATE_RAM_OFFSET, &header, sizeof(header));
+	if (memory)
+	{
+		if (IsSaveStateValid(&header, GetROMHash(memory)))
+		{
+			PlatformUnmapInstanceMemory(cpuState->memory);
+			cpuState->memory = memory;
+			LoadMachineStateHeader(&header, cpuState, machine);
+			result = true;
+		}
+		else
+		{
+			PlatformUnmapInstanceMemory(memory);
+		}
+	}
+	
+	return result;
+}
@@ -0,0 +1,491 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_scheduler.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Frame Scheduler, keeps many live emulator instances running at 60 frames a second each.
+
+Time is split into ticks of one frame (16.7ms). Every tick each instance gets exactly one
+frame task, one call to EmulateFrame, which must finish before the end of the tick. Instances
+are split evenly between the workers (never more workers than instances), at the start of a
+tick each worker is woken by its own semaphore, pushes the tasks for its own instances onto
+its deque and then works through them. A worker that runs out takes tasks from the top of a
+random other worker's deque, so uneven frames (or a descheduled thread) get balanced out over
+the cores. Failed steals back off with pauses and then yield, a thief spinning on the only
+core would otherwise keep the owner of the remaining tasks from running.
+
+Deques are Chase-Lev work-stealing deques, the owner pushes and pops at the bottom without
+atomics and only races the thieves for the last task, thieves compete for the top with a CAS.
+
+A frame task that finishes after the end of its tick has missed its deadline and is counted
+against the instance. The order tasks are pushed in rotates every tick so under overload the
+misses are spread over every instance instead of always landing on the same ones. If the
+scheduler falls more than a whole tick behind it skips ahead, and the skipped frames are counted.
+*/
+
+struct SchedulerInstance;
+#define SCHEDULER_INPUT_PROC(name) void name(SchedulerInstance *instance, void *userData)
+typedef SCHEDULER_INPUT_PROC(SchedulerInputProc);
+
+#define SCHEDULER_MAX_WORKERS 64
+#define SCHEDULER_MAX_STEAL_BACKOFF 64
+
+struct SchedulerInstance
+{
+	CPUState cpuState;
+	MachineState machine;
+	u32 instanceIndex;
+	
+	// NOTE(bSalmon): Called before every frame, e.g. for a bot to set its inputs
+	SchedulerInputProc *inputProc;
+	void *userData;
+	
+	u64 framesRun;
+	u64 missedDeadlines;
+	u64 maxLatenessTicks;
+};
+
+struct WorkDeque
+{
+	// NOTE(bSalmon): Both only ever increase, thieves take from top and the owner works at bottom
+	u32 volatile top;
+	u32 volatile bottom;
+	u32 mask;
+	u32 *tasks;
+};
+
+struct SchedulerWorkerStats
+{
+	u64 tasksRun;
+	u64 tasksStolen;
+	u64 failedSteals;
+	u64 missedDeadlines;
+	u64 totalLateness;
+	u64 maxLateness;
+};
+
+struct Scheduler;
+
+struct SchedulerWorker
+{
+	Scheduler *scheduler;
+	u32 workerIndex;
+	PlatformThread *thread;
+	// NOTE(bSalmon): One per worker, with a shared count a worker that finished early could take
+	// another worker's start and push its own tasks twice in one tick
+	PlatformSemaphore *tickStart;
+	WorkDeque deque;
+	u32 randomState;
+	
+	u32 firstInstance;
+	u32 instanceCount;
+	
+	SchedulerWorkerStats stats;
+};
+
+struct SchedulerStats
+{
+	u64 ticks;
+	u64 framesRun;
+	u64 missedDeadlines;
+	u64 skippedTicks;
+	u64 tasksStolen;
+	u64 totalLateness;
+	u64 maxLateness;
+	f64 busySeconds;
+};
+
+struct Scheduler
+{
+	SchedulerInstance *instances;
+	u32 instanceCount;
+	// NOTE(bSalmon): Every instance maps the one copy of the ROM, only their RAM is their own
+	PlatformROMImage *romImage;
+	
+	SchedulerWorker workers[SCHEDULER_MAX_WORKERS];
+	u32 workerCount;
+	
+	PlatformSemaphore *tickDone;
+	u32 volatile tasksUnclaimed;
+	u32 volatile running;
+	
+	u64 ticksPerFrame;
+	u64 tickIndex;
+	u64 tickDeadline;
+	u64 nextTickTime;
+	b32 unthrottled;
+	
+	SchedulerStats stats;
+};
+
+// Owner only
+internal_func void PushWorkDeque(WorkDeque *deque, u32 task)
+{
+	u32 bottom = deque->bottom;
+	ASSERT((bottom - deque->top) <= deque->mask);
+	deque->tasks[bottom & deque->mask] = task;
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	deque->bottom = bottom + 1;
+}
+
+// Owner only, returns false if the deque is empty
+internal_func b32 PopWorkDeque(WorkDeque *deque, u32 *task)
+{
+	u32 bottom = deque->bottom - 1;
+	deque->bottom = bottom;
+	
+	// NOTE(bSalmon): The new bottom must be visible to thieves before top is read,
+	// otherwise the owner and a thief could both take the last task
+	CompletePreviousWritesBeforeFutureReads;
+	u32 top = deque->top;
+	
+	if ((s32)(bottom - top) < 0)
+	{
+		deque->bottom = top;
+		return false;
+	}
+	
+	*task = deque->tasks[bottom & deque->mask];
+	if (bottom != top)
+	{
+		return true;
+	}
+	
+	// NOTE(bSalmon): Last task, whoever moves top first gets it
+	b32 result = (AtomicCompareExchangeU32(&deque->top, top + 1, top) == top);
+	deque->bottom = top + 1;
+	
+	return result;
+}
+
+// Any thread, returns false if the deque was empty or another thread got the task first
+internal_func b32 StealWorkDeque(WorkDeque *deque, u32 *task)
+{
+	u32 top = deque->top;
+	CompletePreviousWritesBeforeFutureReads;
+	u32 bottom = deque->bottom;
+	
+	if ((s32)(bottom - top) <= 0)
+	{
+		return false;
+	}
+	
+	*task = deque->tasks[top & deque->mask];
+	b32 result = (AtomicCompareExchangeU32(&deque->top, top + 1, top) == top);
+	
+	return result;
+}
+
+internal_func u32 NextSchedulerRandom(u32 *state)
+{
+	// NOTE(bSalmon): xorshift32, only used to pick steal victims
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	
+	return x;
+}
+
+internal_func void RunFrameTask(Scheduler *scheduler, SchedulerWorker *worker, u32 instanceIndex)
+{
+	SchedulerInstance *instance = &scheduler->instances[instanceIndex];
+	
+	if (instance->inputProc)
+	{
+		instance->inputProc(instance, instance->userData);
+	}
+	
+	EmulateFrame(&instance->cpuState, &instance->machine);
+	instance->framesRun++;
+	
+	u64 now = PlatformGetWallClock();
+	if (now > scheduler->tickDeadline)
+	{
+		u64 lateness = now - scheduler->tickDeadline;
+		u64 latenessTicks = (lateness / scheduler->ticksPerFrame) + 1;
+		
+		instance->missedDeadlines++;
+		if (latenessTicks > instance->maxLatenessTicks)
+		{
+			instance->maxLatenessTicks = latenessTicks;
+		}
+		
+		worker->stats.missedDeadlines++;
+		worker->stats.totalLateness += lateness;
+		if (lateness > worker->stats.maxLateness)
+		{
+			worker->stats.maxLateness = lateness;
+		}
+	}
+	
+	worker->stats.tasksRun++;
+}
+
+internal_func PLATFORM_THREAD_PROC(SchedulerWorkerThread)
+{
+	SchedulerWorker *worker = (SchedulerWorker *)data;
+	Scheduler *scheduler = worker->scheduler;
+	
+	for (;;)
+	{
+		PlatformWaitSemaphore(worker->tickStart);
+		if (!scheduler->running)
+		{
+			break;
+		}
+		
+		// NOTE(bSalmon): Rotate the push order so the tasks left for last change every tick
+		if (worker->instanceCount)
+		{
+			u32 rotation = (u32)(scheduler->tickIndex % worker->instanceCount);
+			for (u32 taskIndex = 0; taskIndex < worker->instanceCount; ++taskIndex)
+			{
+				u32 instanceOffset = (rotation + taskIndex) % worker->instanceCount;
+				PushWorkDeque(&worker->deque, worker->firstInstance + instanceOffset);
+			}
+		}
+		
+		// NOTE(bSalmon): Once every task has been claimed there is nothing left to steal, so
+		// workers go back to sleep instead of spinning while the last frames finish
+		u32 stealBackoff = 1;
+		while (scheduler->tasksUnclaimed)
+		{
+			u32 task;
+			if (PopWorkDeque(&worker->deque, &task))
+			{
+				AtomicAddU32(&scheduler->tasksUnclaimed, (u32)-1);
+				RunFrameTask(scheduler, worker, task);
+			}
+			else
+			{
+				// NOTE(bSalmon): A lone worker has no one to steal from and only waits on its own last task
+				b32 stole = false;
+				if (scheduler->workerCount > 1)
+				{
+					u32 victimIndex = NextSchedulerRandom(&worker->randomState) % (scheduler->workerCount - 1);
+					if (victimIndex >= worker->workerIndex)
+					{
+						++victimIndex;
+					}
+					stole = StealWorkDeque(&scheduler->workers[victimIndex].deque, &task);
+				}
+				
+				if (stole)
+				{
+					AtomicAddU32(&scheduler->tasksUnclaimed, (u32)-1);
+					worker->stats.tasksStolen++;
+					RunFrameTask(scheduler, worker, task);
+					stealBackoff = 1;
+				}
+				else
+				{
+					worker->stats.failedSteals++;
+					if (stealBackoff < SCHEDULER_MAX_STEAL_BACKOFF)
+					{
+						for (u32 pauseIndex = 0; pauseIndex < stealBackoff; ++pauseIndex)
+						{
+							_mm_pause();
+						}
+						stealBackoff <<= 1;
+					}
+					else
+					{
+						PlatformYieldThread();
+					}
+				}
+			}
+		}
+		
+		PlatformSignalSemaphore(scheduler->tickDone);
+	}
+}
+
+internal_func u32 RoundUpPowerOf2(u32 value)
+{
+	u32 result = 1;
+	while (result < value)
+	{
+		result <<= 1;
+	}
+	
+	return result;
+}
+
+// Creates instanceCount instances of the ROM and starts workerCount worker threads (at most one per instance),
+// returns false if out of memory
+internal_func b32 BeginScheduler(Scheduler *scheduler, u8 *rom, u64 romSize, u32 instanceCount, u32 workerCount, u64 ticksPerSecond)
+{
+	*scheduler = {};
+	
+	if (workerCount < 1)
+	{
+		workerCount = 1;
+	}
+	else if (workerCount > SCHEDULER_MAX_WORKERS)
+	{
+		workerCount = SCHEDULER_MAX_WORKERS;
+	}
+	
+	// NOTE(bSalmon): A worker with no instances of its own would only ever steal
+	if (instanceCount && workerCount > instanceCount)
+	{
+		workerCount = instanceCount;
+	}
+	
+	scheduler->instanceCount = instanceCount;
+	scheduler->workerCount = workerCount;
+	scheduler->ticksPerFrame = ticksPerSecond / FRAMES_PER_SECOND;
+	
+	scheduler->instances = (SchedulerInstance *)PlatformAllocateMemory(instanceCount * sizeof(SchedulerInstance));
+	scheduler->romImage = PlatformCreateROMImage(rom, romSize);
+	if (!scheduler->instances || !scheduler->romImage)
+	{
+		return false;
+	}
+	
+	for (u32 instanceIndex = 0; instanceIndex < instanceCount; ++instanceIndex)
+	{
+		SchedulerInstance *instance = &scheduler->instances[instanceIndex];
+		instance->instanceIndex = instanceIndex;
+		instance->machine.romSize = 0x2000;
+		instance->cpuState.memory = PlatformMapInstanceMemory(scheduler->romImage);
+		if (!instance->cpuState.memory)
+		{
+			return false;
+		}
+		ResetMachine(&instance->cpuState, &instance->machine);
+	}
+	
+	// NOTE(bSalmon): Each worker's home instances are a contiguous range, so every deque only
+	// ever holds that many tasks at once
+	u32 dequeSize = RoundUpPowerOf2((instanceCount / workerCount) + 1);
+	for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+	{
+		SchedulerWorker *worker = &scheduler->workers[workerIndex];
+		worker->scheduler = scheduler;
+		worker->workerIndex = workerIndex;
+		worker->randomState = 0x9E3779B9 ^ (workerIndex * 0x85EBCA6B) ^ 1;
+		worker->firstInstance = (u32)(((u64)instanceCount * workerIndex) / workerCount);
+		worker->instanceCount = (u32)(((u64)instanceCount * (workerIndex + 1)) / workerCount) - worker->firstInstance;
+		worker->deque.mask = dequeSize - 1;
+		worker->deque.tasks = (u32 *)PlatformAllocateMemory(dequeSize * sizeof(u32));
+		worker->tickStart = PlatformCreateSemaphore(0);
+	}
+	
+	scheduler->tickDone = PlatformCreateSemaphore(0);
+	scheduler->running = true;
+	
+	for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+	{
+		scheduler->workers[workerIndex].thread = PlatformStartThread(SchedulerWorkerThread, &scheduler->workers[workerIndex]);
+	}
+	
+	scheduler->nextTickTime = PlatformGetWallClock();
+	return true;
+}
+
+// Runs one frame of every instance and returns once they are all done, the platform layer
+// should sleep until nextTickTime before calling this unless the scheduler is unthrottled
+internal_func void RunSchedulerTick(Scheduler *scheduler)
+{
+	u64 now = PlatformGetWallClock();
+	if (scheduler->unthrottled)
+	{
+		scheduler->nextTickTime = now;
+	}
+	else if (now > scheduler->nextTickTime && ((now - scheduler->nextTickTime) >= scheduler->ticksPerFrame))
+	{
+		// NOTE(bSalmon): More than a whole tick behind, those frames are gone so skip ahead
+		u64 skippedTicks = (now - scheduler->nextTickTime) / scheduler->ticksPerFrame;
+		scheduler->stats.skippedTicks += skippedTicks;
+		scheduler->nextTickTime += skippedTicks * scheduler->ticksPerFrame;
+	}
+	
+	u64 tickStartTime = PlatformGetWallClock();
+	scheduler->tickDeadline = scheduler->unthrottled ? (u64)-1 : (scheduler->nextTickTime + scheduler->ticksPerFrame);
+	scheduler->tasksUnclaimed = scheduler->instanceCount;
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		PlatformSignalSemaphore(scheduler->workers[workerIndex].tickStart);
+	}
+	
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		PlatformWaitSemaphore(scheduler->tickDone);
+	}
+	
+	scheduler->stats.busySeconds += PlatformGetSecondsElapsed(tickStartTime, PlatformGetWallClock());
+	scheduler->stats.ticks++;
+	scheduler->tickIndex++;
+	scheduler->nextTickTime += scheduler->ticksPerFrame;
+}
+
+// Totals up the per-worker counts, only call between ticks
+internal_func SchedulerStats GetSchedulerStats(Scheduler *scheduler)
+{
+	SchedulerStats result = scheduler->stats;
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		SchedulerWorkerStats *workerStats = &scheduler->workers[workerIndex].stats;
+		result.framesRun += workerStats->tasksRun;
+		result.missedDeadlines += workerStats->missedDeadlines;
+		result.tasksStolen += workerStats->tasksStolen;
+		result.totalLateness += workerStats->totalLateness;
+		if (workerStats->maxLateness > result.maxLateness)
+		{
+			result.maxLateness = workerStats->maxLateness;
+		}
+	}
+	
+	return result;
+}
+
+internal_func void EndScheduler(Scheduler *scheduler)
+{
+	scheduler->running = false;
+	CompletePreviousWritesBeforeFutureWrites;
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		PlatformSignalSemaphore(scheduler->workers[workerIndex].tickStart);
+	}
+	
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		SchedulerWorker *worker = &scheduler->workers[workerIndex];
+		PlatformJoinThread(worker->thread);
+		PlatformFreeMemory(worker->deque.tasks);
+		PlatformDestroySemaphore(worker->tickStart);
+	}
+	
+	PlatformDestroySemaphore(scheduler->tickDone);
+	for (u32 instanceIndex = 0; instanceIndex < scheduler->instanceCount; ++instanceIndex)
+	{
+		PlatformUnmapInstanceMemory(scheduler->instances[instanceIndex].cpuState.memory);
+	}
+	
+	PlatformDestroyROMImage(scheduler->romImage);
+	PlatformFreeMemory(scheduler->instances);
+}
@@ -0,0 +1,347 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_snapshot.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Snapshot Chains, a snapshot of the machine every frame (or as often as wanted) for about the
+cost of copying the RAM pages the frame wrote. A snapshot is the save state header (see
+8080emu_savestate.cpp) and only the pages written since the snapshot before, from the chain's
+own dirty page bits (DirtyPageUser::SNAPSHOT). Every
+keyframeInterval snapshots, and whenever every page is dirty, all of RAM is stored instead, a
+keyframe.
+
+Any snapshot in the chain can be rebuilt on demand by walking back from it to the nearest
+keyframe, each page is taken from the newest snapshot at or before it that stored the page.
+Restoring a machine to a snapshot only copies the pages written since then, so stepping back a
+few frames (rollback, rewind, search) touches about as much memory as the frames did.
+
+Each stored snapshot is
+	[SnapshotRecord][one RAM_PAGE_SIZE page for each bit in storedPages, lowest page first]
+in one ring of bytes, a record never wraps. When the ring or the entry limit is full the oldest
+snapshots are dropped, up to the next keyframe so the oldest kept can always be rebuilt.
+
+Needs 8080emu_savestate.cpp.
+*/
+
+#define SNAPSHOT_DEFAULT_KEYFRAME_INTERVAL 60
+
+struct SnapshotRecord
+{
+	SaveStateHeader header;
+	
+	// NOTE(bSalmon): written is what the machine wrote since the snapshot before, stored is what
+	// follows the record, every page for keyframes
+	u64 writtenPages;
+	u64 storedPages;
+};
+
+struct SnapshotEntry
+{
+	u32 offset;
+	u32 size;
+};
+
+struct SnapshotStats
+{
+	u64 snapshots;
+	u64 keyframes;
+	u64 pagesStored;
+	u64 bytesStored;
+};
+
+struct SnapshotChain
+{
+	SnapshotEntry *entries;
+	u32 entryCapacity;
+	u32 oldestEntry;
+	u32 entryCount;
+	
+	u8 *storage;
+	u32 storageSize;
+	u32 writeOffset;
+	u64 storedBytes;
+	
+	u32 keyframeInterval;
+	u32 sinceKeyframe;
+	
+	SnapshotStats stats;
+};
+
+#define SNAPSHOT_MAX_RECORD_SIZE (sizeof(SnapshotRecord) + RAM_SIZE)
+
+// maxSnapshots is the most snapshots kept, storageSize the most bytes of them, 0 for keyframeInterval is the default
+internal_func b32 InitSnapshotChain(SnapshotChain *chain, u32 maxSnapshots, u32 storageSize, u32 keyframeInterval = 0)
+{
+	*chain = {};
+	
+	// NOTE(bSalmon): Room for two keyframes, so a new one never has to drop the only one there is
+	if (storageSize < (2 * SNAPSHOT_MAX_RECORD_SIZE))
+	{
+		storageSize = 2 * SNAPSHOT_MAX_RECORD_SIZE;
+	}
+	
+	u8 *memory = (u8 *)PlatformAllocateMemory(((u64)maxSnapshots * sizeof(SnapshotEntry)) + storageSize);
+	if (!memory || !maxSnapshots)
+	{
+		PlatformFreeMemory(memory);
+		return false;
+	}
+	
+	chain->entries = (SnapshotEntry *)memory;
+	chain->entryCapacity = maxSnapshots;
+	chain->storage = (u8 *)(chain->entries + maxSnapshots);
+	chain->storageSize = storageSize;
+	chain->keyframeInterval = keyframeInterval ? keyframeInterval : SNAPSHOT_DEFAULT_KEYFRAME_INTERVAL;
+	
+	return true;
+}
+
+internal_func void FreeSnapshotChain(SnapshotChain *chain)
+{
+	PlatformFreeMemory(chain->entries);
+	*chain = {};
+}
+
+// Forgets every snapshot, the next one is a keyframe
+internal_func void ClearSnapshotChain(SnapshotChain *chain)
+{
+	chain->oldestEntry = 0;
+	chain->entryCount = 0;
+	chain->writeOffset = 0;
+	chain->storedBytes = 0;
+	chain->sinceKeyframe = 0;
+}
+
+// stepsBack 0 is the newest snapshot
+internal_func SnapshotRecord *GetSnapshotRecord(SnapshotChain *chain, u32 stepsBack)
+{
+	ASSERT(stepsBack < chain->entryCount);
+	u32 entryIndex = (chain->oldestEntry + chain->entryCount - 1 - stepsBack) % chain->entryCapacity;
+	SnapshotRecord *result = (SnapshotRecord *)&chain->storage[chain->entries[entryIndex].offset];
+	return result;
+}
+
+internal_func void DropOldestSnapshot(SnapshotChain *chain)
+{
+	chain->storedBytes -= chain->entries[chain->oldestEntry].size;
+	chain->oldestEntry = (chain->oldestEntry + 1) % chain->entryCapacity;
+	chain->entryCount--;
+}
+
+// Snapshots older than the oldest keyframe can't be rebuilt once a snapshot before them is dropped
+internal_func void DropUnbuildableSnapshots(SnapshotChain *chain)
+{
+	while (chain->entryCount && GetSnapshotRecord(chain, chain->entryCount - 1)->storedPages != ~0ULL)
+	{
+		DropOldestSnapshot(chain);
+	}
+}
+
+// Drops the oldest snapshots for as long as they are in [start, end)
+internal_func void DropSnapshotRange(SnapshotChain *chain, u32 start, u32 end)
+{
+	b32 dropped = false;
+	while (chain->entryCount)
+	{
+		SnapshotEntry *oldest = &chain->entries[chain->oldestEntry];
+		if (oldest->offset >= end || (oldest->offset + oldest->size) <= start)
+		{
+			break;
+		}
+		DropOldestSnapshot(chain);
+		dropped = true;
+	}
+	
+	if (dropped)
+	{
+		DropUnbuildableSnapshots(chain);
+	}
+}
+
+// Makes room for a record of size bytes and returns where it goes
+internal_func u32 ReserveSnapshotSpace(SnapshotChain *chain, u32 size)
+{
+	if (chain->entryCount == chain->entryCapacity)
+	{
+		DropOldestSnapshot(chain);
+		DropUnbuildableSnapshots(chain);
+	}
+	
+	// NOTE(bSalmon): Records never wrap, the end of the ring is left unused instead
+	if (chain->writeOffset + size > chain->storageSize)
+	{
+		DropSnapshotRange(chain, chain->writeOffset, chain->storageSize);
+		chain->writeOffset = 0;
+	}
+	DropSnapshotRange(chain, chain->writeOffset, chain->writeOffset + size);
+	
+	u32 result = chain->writeOffset;
+	return result;
+}
+
+// Adds the machine as it is now to the chain
+internal_func void PushSnapshot(SnapshotChain *chain, CPUState *cpuState, MachineState *machine)
+{
+	u64 writtenPages = TakeDirtyPages(cpuState, DirtyPageUser::SNAPSHOT);
+	b32 keyframe = (chain->entryCount == 0) || (chain->sinceKeyframe + 1 >= chain->keyframeInterval) || (writtenPages == ~0ULL);
+	
+	u32 offset = 0;
+	for (;;)
+	{
+		u64 storedPages = keyframe ? ~0ULL : writtenPages;
+		u32 size = (u32)sizeof(SnapshotRecord) + (CountSetBits64(storedPages) * RAM_PAGE_SIZE);
+		offset = ReserveSnapshotSpace(chain, size);
+		
+		// NOTE(bSalmon): Dropping snapshots to make room can take every keyframe with it
+		if (keyframe || chain->entryCount)
+		{
+			break;
+		}
+		keyframe = true;
+	}
+	
+	SnapshotRecord *record = (SnapshotRecord *)&chain->storage[offset];
+	SaveMachineStateHeader(&record->header, cpuState, machine, 0);
+	record->writtenPages = writtenPages;
+	record->storedPages = keyframe ? ~0ULL : writtenPages;
+	
+	u8 *ram = &cpuState->memory[RAM_START];
+	u8 *pageData = (u8 *)(record + 1);
+	if (keyframe)
+	{
+		memcpy(pageData, ram, RAM_SIZE);
+		pageData += RAM_SIZE;
+	}
+	else
+	{
+		for (u64 pages = writtenPages; pages; pages &= pages - 1)
+		{
+			u32 page = FindLeastSignificantSetBit64(pages);
+			memcpy(pageData, &ram[page * RAM_PAGE_SIZE], RAM_PAGE_SIZE);
+			pageData += RAM_PAGE_SIZE;
+		}
+	}
+	
+	SnapshotEntry *entry = &chain->entries[(chain->oldestEntry + chain->entryCount) % chain->entryCapacity];
+	entry->offset = offset;
+	entry->size = (u32)(pageData - (u8 *)record);
+	chain->writeOffset = offset + entry->size;
+	chain->storedBytes += entry->size;
+	chain->entryCount++;
+	
+	chain->sinceKeyframe = keyframe ? 0 : (chain->sinceKeyframe + 1);
+	chain->stats.snapshots++;
+	chain->stats.keyframes += keyframe ? 1 : 0;
+	chain->stats.pagesStored += CountSetBits64(record->storedPages);
+	chain->stats.bytesStored += entry->size;
+}
+
+// Copies the pages in pages of the snapshot stepsBack into ram, walking back until every one is found
+internal_func void RebuildSnapshotPages(SnapshotChain *chain, u32 stepsBack, u8 *ram, u64 pages)
+{
+	u32 entryIndex = (chain->oldestEntry + chain->entryCount - 1 - stepsBack) % chain->entryCapacity;
+	for (u32 step = stepsBack; pages && step < chain->entryCount; ++step)
+	{
+		SnapshotRecord *record = (SnapshotRecord *)&chain->storage[chain->entries[entryIndex].offset];
+		u64 found = pages & record->storedPages;
+		if (found)
+		{
+			u8 *pageData = (u8 *)(record + 1);
+			for (; found; found &= found - 1)
+			{
+				u32 page = FindLeastSignificantSetBit64(found);
+				u32 storedIndex = CountSetBits64(record->storedPages & ((1ULL << page) - 1));
+				memcpy(&ram[page * RAM_PAGE_SIZE], &pageData[storedIndex * RAM_PAGE_SIZE], RAM_PAGE_SIZE);
+			}
+			pages &= ~record->storedPages;
+		}
+		
+		entryIndex = entryIndex ? (entryIndex - 1) : (chain->entryCapacity - 1);
+	}
+	
+	ASSERT(!pages);
+}
+
+// Rebuilds the whole snapshot stepsBack into a save state, the chain and machine are untouched
+internal_func b32 ReadSnapshot(SnapshotChain *chain, u32 stepsBack, SaveState *state)
+{
+	if (stepsBack >= chain->entryCount)
+	{
+		return false;
+	}
+	
+	memset(state->headerPage, 0, sizeof(state->headerPage));
+	state->header = GetSnapshotRecord(chain, stepsBack)->header;
+	RebuildSnapshotPages(chain, stepsBack, state->ram, ~0ULL);
+	
+	return true;
+}
+
+// Puts the machine back to the snapshot stepsBack and drops every newer one, so it becomes the
+// newest. Only the pages written since that snapshot are copied. Returns false with nothing
+// changed when the chain doesn't go back that far
+internal_func b32 RestoreSnapshot(SnapshotChain *chain, u32 stepsBack, CPUState *cpuState, MachineState *machine)
+{
+	if (stepsBack >= chain->entryCount)
+	{
+		return false;
+	}
+	
+	u64 pages = GetDirtyPages(cpuState, DirtyPageUser::SNAPSHOT);
+	for (u32 step = 0; step < stepsBack; ++step)
+	{
+		pages |= GetSnapshotRecord(chain, step)->writtenPages;
+	}
+	RebuildSnapshotPages(chain, stepsBack, &cpuState->memory[RAM_START], pages);
+	
+	// NOTE(bSalmon): Only the rebuilt pages changed for the machine's other dirty page users, not
+	// all of RAM as LoadMachineStateHeader marks
+	LoadMachineStateHeader(&GetSnapshotRecord(chain, stepsBack)->header, cpuState, machine);
+	cpuState->dirtyPages = pages;
+	
+	// NOTE(bSalmon): The newest snapshot is always the last thing written so the space of the
+	// dropped ones can be reused straight away
+	for (u32 step = 0; step < stepsBack; ++step)
+	{
+		u32 newestEntry = (chain->oldestEntry + chain->entryCount - 1) % chain->entryCapacity;
+		chain->writeOffset = chain->entries[newestEntry].offset;
+		chain->storedBytes -= chain->entries[newestEntry].size;
+		chain->entryCount--;
+	}
+	
+	// NOTE(bSalmon): RAM matches the newest snapshot again. The newest keyframe is only looked for
+	// when it was one of the snapshots dropped
+	ClearDirtyPages(cpuState, DirtyPageUser::SNAPSHOT);
+	if (stepsBack <= chain->sinceKeyframe)
+	{
+		chain->sinceKeyframe -= stepsBack;
+	}
+	else
+	{
+		chain->sinceKeyframe = 0;
+		while (chain->sinceKeyframe < chain->entryCount && GetSnapshotRecord(chain, chain->sinceKeyframe)->storedPages != ~0ULL)
+		{
+			chain->sinceKeyframe++;
+		}
+	}
+	
+	return true;
+}
@@ -0,0 +1,250 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: 8080emu_upscale.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+The upscaler takes the 224x256 emulator Back Buffer and writes it into a
+presentation buffer of any size using nearest neighbour integer scaling.
+The scaled image is centred and the remaining area is filled with black, so
+the 7:8 aspect ratio of the original screen is always kept. The output can
+be blitted 1:1 by any platform layer.
+
+Both buffers must be 32-bit, source width must be a multiple of 4.
+*/
+
+global_var const u32 upscaleBorderColour = 0xFF000000;
+
+internal_func void FillPixels(u32 *dest, s32 count, u32 colour)
+{
+	s32 index = 0;
+	
+	__m128i colour4 = _mm_set1_epi32(colour);
+	for (; index + 4 <= count; index += 4)
+	{
+		_mm_storeu_si128((__m128i *)&dest[index], colour4);
+	}
+	
+	for (; index < count; ++index)
+	{
+		dest[index] = colour;
+	}
+}
+
+internal_func void CopyPixelRow(u32 *dest, u32 *source, s32 count)
+{
+	s32 index = 0;
+
+#if EMU8080_AVX2
+	for (; index + 8 <= count; index += 8)
+	{
+		__m256i pixels = _mm256_loadu_si256((__m256i *)&source[index]);
+		_mm256_storeu_si256((__m256i *)&dest[index], pixels);
+	}
+#endif
+	
+	for (; index + 4 <= count; index += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((__m128i *)&source[index]);
+		_mm_storeu_si128((__m128i *)&dest[index], pixels);
+	}
+	
+	for (; index < count; ++index)
+	{
+		dest[index] = source[index];
+	}
+}
+
+// Horizontally replicate each pixel of a source row scale times
+internal_func void ScalePixelRow(u32 *dest, u32 *source, s32 sourceWidth, s32 scale)
+{
+	switch (scale)
+	{
+		case 1:
+		{
+			CopyPixelRow(dest, source, sourceWidth);
+			break;
+		}
+		
+		case 2:
+		{
+			s32 x = 0;
+#if EMU8080_AVX2
+			for (; x + 8 <= sourceWidth; x += 8)
+			{
+				// NOTE(bSalmon): unpack works within 128-bit lanes so the source is
+				// permuted to [p0 p1 p2 p3 | p4 p5 p6 p7] -> [p0 p1 p4 p5 | p2 p3 p6 p7] first
+				__m256i pixels = _mm256_loadu_si256((__m256i *)&source[x]);
+				pixels = _mm256_permute4x64_epi64(pixels, _MM_SHUFFLE(3, 1, 2, 0));
+				_mm256_storeu_si256((__m256i *)&dest[x * 2], _mm256_unpacklo_epi32(pixels, pixels));
+				_mm256_storeu_si256((__m256i *)&dest[(x * 2) + 8], _mm256_unpackhi_epi32(pixels, pixels));
+			}
+#endif
+			for (; x + 4 <= sourceWidth; x += 4)
+			{
+				__m128i pixels = _mm_loadu_si128((__m128i *)&source[x]);
+				_mm_storeu_si128((__m128i *)&dest[x * 2], _mm_unpacklo_epi32(pixels, pixels));
+				_mm_storeu_si128((__m128i *)&dest[(x * 2) + 4], _mm_unpackhi_epi32(pixels, pixels));
+			}
+			break;
+		}
+		
+		case 3:
+		{
+			for (s32 x = 0; x < sourceWidth; x += 4)
+			{
+				__m128i pixels = _mm_loadu_si128((__m128i *)&source[x]);
+				_mm_storeu_si128((__m128i *)&dest[x * 3], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(1, 0, 0, 0)));
+				_mm_storeu_si128((__m128i *)&dest[(x * 3) + 4], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(2, 2, 1, 1)));
+				_mm_storeu_si128((__m128i *)&dest[(x * 3) + 8], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 2)));
+			}
+			break;
+		}
+		
+		case 4:
+		{
+			for (s32 x = 0; x < sourceWidth; x += 4)
+			{
+				__m128i pixels = _mm_loadu_si128((__m128i *)&source[x]);
+				_mm_storeu_si128((__m128i *)&dest[x * 4], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 0, 0, 0)));
+				_mm_storeu_si128((__m128i *)&dest[(x * 4) + 4], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(1, 1, 1, 1)));
+				_mm_storeu_si128((__m128i *)&dest[(x * 4) + 8], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(2, 2, 2, 2)));
+				_mm_storeu_si128((__m128i *)&dest[(x * 4) + 12], _mm_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 3)));
+			}
+			break;
+		}
+		
+		default:
+		{
+			u32 *outputPixel = dest;
+			for (s32 x = 0; x < sourceWidth; ++x)
+			{
+				FillPixels(outputPixel, scale, source[x]);
+				outputPixel += scale;
+			}
+			break;
+		}
+	}
+}
+
+// Used when the destination is smaller than the source, keeps the aspect ratio but pixels will be uneven
+internal_func void DownscaleBuffer(BackBuffer *source, BackBuffer *dest)
+{
+	s32 outputWidth = dest->width;
+	s32 outputHeight = (s32)(((s64)dest->width * source->height) / source->width);
+	if (outputHeight > dest->height)
+	{
+		outputHeight = dest->height;
+		outputWidth = (s32)(((s64)dest->height * source->width) / source->height);
+	}
+	
+	s32 offsetX = (dest->width - outputWidth) / 2;
+	s32 offsetY = (dest->height - outputHeight) / 2;
+	
+	u8 *destRow = (u8 *)dest->memory;
+	for (s32 y = 0; y < dest->height; ++y)
+	{
+		u32 *outputPixel = (u32 *)destRow;
+		if (y < offsetY || y >= (offsetY + outputHeight) || outputWidth <= 0)
+		{
+			FillPixels(outputPixel, dest->width, upscaleBorderColour);
+		}
+		else
+		{
+			s32 sourceY = (s32)(((s64)(y - offsetY) * source->height) / outputHeight);
+			u32 *sourceRow = (u32 *)((u8 *)source->memory + (sourceY * source->pitch));
+			
+			FillPixels(outputPixel, offsetX, upscaleBorderColour);
+			for (s32 x = 0; x < outputWidth; ++x)
+			{
+				s32 sourceX = (s32)(((s64)x * source->width) / outputWidth);
+				outputPixel[offsetX + x] = sourceRow[sourceX];
+			}
+			FillPixels(&outputPixel[offsetX + outputWidth], dest->width - (offsetX + outputWidth), upscaleBorderColour);
+		}
+		
+		destRow += dest->pitch;
+	}
+}
+
+// Returns the largest whole number scale of source that fits in dest, 0 if source does not fit at all
+internal_func s32 GetIntegerScale(s32 sourceWidth, s32 sourceHeight, s32 destWidth, s32 destHeight)
+{
+	s32 scaleX = destWidth / sourceWidth;
+	s32 scaleY = destHeight / sourceHeight;
+	s32 result = (scaleX < scaleY) ? scaleX : scaleY;
+	
+	return result;
+}
+
+internal_func void UpscaleBuffer(BackBuffer *source, BackBuffer *dest)
+{
+	ASSERT(source->bytesPerPixel == 4 && dest->bytesPerPixel == 4);
+	ASSERT((source->width % 4) == 0);
+	
+	s32 scale = GetIntegerScale(source->width, source->height, dest->width, dest->height);
+	if (scale < 1)
+	{
+		DownscaleBuffer(source, dest);
+	}
+	else
+	{
+		s32 outputWidth = source->width * scale;
+		s32 outputHeight = source->height * scale;
+		s32 offsetX = (dest->width - outputWidth) / 2;
+		s32 offsetY = (dest->height - outputHeight) / 2;
+		s32 rightBorder = dest->width - (offsetX + outputWidth);
+		
+		u8 *destRow = (u8 *)dest->memory;
+		
+		// Letterbox Top
+		for (s32 y = 0; y < offsetY; ++y)
+		{
+			FillPixels((u32 *)destRow, dest->width, upscaleBorderColour);
+			destRow += dest->pitch;
+		}
+		
+		u8 *sourceRow = (u8 *)source->memory;
+		for (s32 y = 0; y < source->height; ++y)
+		{
+			// NOTE(bSalmon): Scale the row once, then the other scale - 1 rows are straight copies of it
+			u32 *scaledRow = (u32 *)destRow;
+			FillPixels(scaledRow, offsetX, upscaleBorderColour);
+			ScalePixelRow(&scaledRow[offsetX], (u32 *)sourceRow, source->width, scale);
+			FillPixels(&scaledRow[offsetX + outputWidth], rightBorder, upscaleBorderColour);
+			destRow += dest->pitch;
+			
+			for (s32 repeat = 1; repeat < scale; ++repeat)
+			{
+				CopyPixelRow((u32 *)destRow, scaledRow, dest->width);
+				destRow += dest->pitch;
+			}
+			
+			sourceRow += source->pitch;
+		}
+		
+		// Letterbox Bottom
+		for (s32 y = offsetY + outputHeight; y < dest->height; ++y)
+		{
+			FillPixels((u32 *)destRow, dest->width, upscaleBorderColour);
+			destRow += dest->pitch;
+		}
+	}
+}
@@ -1,6 +1,7 @@
 @echo off
 
 REM -MTd for debug build
+REM add -arch:AVX2 to compiler flags to enable the AVX2 paths
 set commonFlagsCompiler= -MT -nologo -Gm- -GR- -EHa -Od -Oi -WX -W4 -wd4201 -wd4100 -wd4189 -wd4244 -FC -Z7 -DEMU8080_INTERNAL=0 -DEMU8080_SLOW=0 -DEMU8080_WIN32=1
 set commonFlagsLinker= -incremental:no -opt:ref user32.lib winmm.lib gdi32.lib comdlg32.lib
 
@@ -11,4 +12,9 @@ REM 32-bit
 REM cl %commonFlagsCompiler% ..\code\win32_8080emu.cpp /link -subsystem:windows,5.1 %commonFlagsLinker%
 
 cl %commonFlagsCompiler% ..\code\win32_8080emu.cpp /link %commonFlagsLinker%
+
+REM Emulator library, static and shared
+cl %commonFlagsCompiler% -c ..\code\8080emu_lib.cpp -Fo8080emu_lib.obj
+lib -nologo 8080emu_lib.obj -OUT:8080emu_static.lib
+cl %commonFlagsCompiler% -DEMU8080_BUILD_SHARED=1 -LD ..\code\8080emu_lib.cpp -Fe8080emu.dll /link -incremental:no -opt:ref
 popd
\ No newline at end of file
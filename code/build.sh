@@ -0,0 +1,35 @@
+#!/bin/sh
+
+# -O0 for debug build
+commonFlagsCompiler="-O2 -g -fno-rtti -fno-exceptions -Wall -Werror -Wno-unused-function -Wno-unused-variable -Wno-unused-but-set-variable -Wno-write-strings -DEMU8080_INTERNAL=0 -DEMU8080_SLOW=0 -DEMU8080_LINUX=1"
+# add -mavx2 to compiler flags to enable the AVX2 paths
+commonFlagsLinker="-lpthread"
+
+codeDir="$(cd "$(dirname "$0")" && pwd)"
+mkdir -p "$codeDir/../build"
+cd "$codeDir/../build" || exit 1
+
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu.cpp" -o linux_8080emu $commonFlagsLinker -lX11 -lXext
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_headless.cpp" -o linux_8080emu_headless $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_batch.cpp" -o linux_8080emu_batch $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_farm.cpp" -o linux_8080emu_farm $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_lockstep.cpp" -o linux_8080emu_lockstep $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_fork.cpp" -o linux_8080emu_fork $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_shard.cpp" -o linux_8080emu_shard $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_savestate.cpp" -o linux_8080emu_savestate $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_rewind.cpp" -o linux_8080emu_rewind $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_runahead.cpp" -o linux_8080emu_runahead $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_movie.cpp" -o linux_8080emu_movie $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_netplay.cpp" -o linux_8080emu_netplay $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_statehash.cpp" -o linux_8080emu_statehash $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_snapshot.cpp" -o linux_8080emu_snapshot $commonFlagsLinker
+g++ $commonFlagsCompiler "$codeDir/linux_8080emu_migrate.cpp" -o linux_8080emu_migrate $commonFlagsLinker
+
+# Emulator library, static and shared
+g++ $commonFlagsCompiler -fPIC -fvisibility=hidden -c "$codeDir/8080emu_lib.cpp" -o 8080emu_lib.o
+ar rcs lib8080emu.a 8080emu_lib.o
+g++ -shared 8080emu_lib.o -o lib8080emu.so
+
+# C check of the library, once against each build
+gcc -O2 -g -std=c99 -Wall -Werror -I"$codeDir" "$codeDir/linux_8080emu_libcheck.c" lib8080emu.a -o linux_8080emu_libcheck_static $commonFlagsLinker
+gcc -O2 -g -std=c99 -Wall -Werror -I"$codeDir" "$codeDir/linux_8080emu_libcheck.c" -L. -l8080emu -Wl,-rpath,'$ORIGIN' -o linux_8080emu_libcheck $commonFlagsLinker
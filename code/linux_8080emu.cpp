@@ -0,0 +1,715 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+8080_INTERNAL:
+0 - Public Build
+1 - Dev Build
+
+8080_SLOW:
+ 0 - Assert Code Disabled
+ 1 - Assert debugging code enabled
+*/
+
+/*
+Linux X11 Frontend
+
+Frames are upscaled straight into an XImage whose pixels live in a MIT-SHM shared
+memory segment, so XShmPutImage hands the frame to the X server without a copy.
+When MIT-SHM is not available (e.g. a remote display) a regular XPutImage is used.
+
+Usage: linux_8080emu <rom> [-frames N] [-filter none|scale2x|scale4x|scale6x|scanlines|crt]
+                           [-colour] [-noshm] [-dump <path>] [-dumpformat raw|ppm|y4m] [-rewind S]
+                           [-runahead N] [-record <path>] [-movie <path>]
+
+-frames exits after N emulated frames, which with Xvfb allows automated runs:
+  xvfb-run ./linux_8080emu invaders.rom -frames 600
+
+Holding Backspace rewinds, -rewind sets how many seconds can be rewound (60 by default, 0 turns
+it off).
+
+-runahead shows the machine N frames ahead of where it really is (see 8080emu_runahead.cpp), off
+by default.
+
+-record writes an input movie (see 8080emu_movie.cpp) of the session from power on when the
+window closes, rewinding is off while recording. -movie plays one back, the keyboard is ignored
+until it ends.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_upscale.cpp"
+#include "8080emu_filters.cpp"
+#include "8080emu_hash.cpp"
+#include "8080emu_path.cpp"
+#include "8080emu_framedump.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_rewind.cpp"
+#include "8080emu_fork.cpp"
+#include "8080emu_runahead.cpp"
+#include "8080emu_movie.cpp"
+#include "linux_8080emu_platform.cpp"
+
+#include <stdlib.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XShm.h>
+
+struct Linux_PresentImage
+{
+	XImage *image;
+	XShmSegmentInfo shmInfo;
+	b32 usingShm;
+	s32 width;
+	s32 height;
+};
+
+struct Linux_CommandLine
+{
+	char *romPath;
+	u64 maxFrames;
+	FilterPreset filterPreset;
+	b32 enableColour;
+	b32 disableShm;
+	char *dumpPath;
+	FrameDumpFormat dumpFormat;
+	u32 rewindSeconds;
+	u32 runAheadFrames;
+	char *recordPath;
+	char *moviePath;
+	b32 invalid;
+};
+
+global_var b32 globalRunning;
+global_var b32 globalXError;
+
+internal_func int Linux_XErrorHandler(Display *display, XErrorEvent *event)
+{
+	// NOTE(bSalmon): Only used while attaching the shared memory segment, a failure there means no MIT-SHM
+	globalXError = true;
+	return 0;
+}
+
+internal_func void Linux_DestroyPresentBuffer(Display *display, Linux_PresentImage *buffer)
+{
+	if (buffer->image)
+	{
+		if (buffer->usingShm)
+		{
+			XShmDetach(display, &buffer->shmInfo);
+			XSync(display, False);
+			shmdt(buffer->shmInfo.shmaddr);
+		}
+		else
+		{
+			PlatformFreeMemory(buffer->image->data);
+		}
+		
+		// NOTE(bSalmon): XDestroyImage would free data with free(), it has already been released
+		buffer->image->data = 0;
+		XDestroyImage(buffer->image);
+	}
+	
+	*buffer = {};
+}
+
+internal_func b32 Linux_CreateShmPresentBuffer(Display *display, Visual *visual, s32 depth, s32 width, s32 height, Linux_PresentImage *buffer)
+{
+	buffer->image = XShmCreateImage(display, visual, depth, ZPixmap, 0, &buffer->shmInfo, width, height);
+	if (!buffer->image)
+	{
+		return false;
+	}
+	
+	buffer->shmInfo.shmid = shmget(IPC_PRIVATE, buffer->image->bytes_per_line * height, IPC_CREAT | 0600);
+	if (buffer->shmInfo.shmid < 0)
+	{
+		XDestroyImage(buffer->image);
+		buffer->image = 0;
+		return false;
+	}
+	
+	buffer->shmInfo.shmaddr = (char *)shmat(buffer->shmInfo.shmid, 0, 0);
+	buffer->image->data = buffer->shmInfo.shmaddr;
+	buffer->shmInfo.readOnly = False;
+	
+	globalXError = false;
+	XErrorHandler previousHandler = XSetErrorHandler(Linux_XErrorHandler);
+	XShmAttach(display, &buffer->shmInfo);
+	XSync(display, False);
+	XSetErrorHandler(previousHandler);
+	
+	// NOTE(bSalmon): Marked for removal now, it is freed once both sides have detached
+	shmctl(buffer->shmInfo.shmid, IPC_RMID, 0);
+	
+	if (globalXError || buffer->shmInfo.shmaddr == (char *)-1)
+	{
+		if (buffer->shmInfo.shmaddr != (char *)-1)
+		{
+			shmdt(buffer->shmInfo.shmaddr);
+		}
+		buffer->image->data = 0;
+		XDestroyImage(buffer->image);
+		buffer->image = 0;
+		return false;
+	}
+	
+	buffer->usingShm = true;
+	return true;
+}
+
+internal_func void Linux_ResizePresentBuffer(Display *display, Visual *visual, s32 depth, s32 width, s32 height, Linux_PresentImage *buffer, b32 tryShm)
+{
+	Linux_DestroyPresentBuffer(display, buffer);
+	
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+	
+	buffer->width = width;
+	buffer->height = height;
+	
+	if (!tryShm || !Linux_CreateShmPresentBuffer(display, visual, depth, width, height, buffer))
+	{
+		char *data = (char *)PlatformAllocateMemory(width * height * 4);
+		buffer->image = XCreateImage(display, visual, depth, ZPixmap, 0, data, width, height, 32, width * 4);
+		buffer->usingShm = false;
+	}
+}
+
+// Returns true if an XShmCompletionEvent will be sent when the server is done with the image
+internal_func b32 Linux_PresentBuffer(Display *display, Window window, GC graphicsContext, Linux_PresentImage *buffer, BackBuffer *backBuffer, FilterPipeline *filterPipeline)
+{
+	if (!buffer->image)
+	{
+		return false;
+	}
+	
+	BackBuffer *filtered = RunFilterPipeline(filterPipeline, backBuffer);
+	
+	// NOTE(bSalmon): Image is 32-bit ZPixmap, Mem Order BB GG RR xx on little endian like the Back Buffer
+	BackBuffer dest = {};
+	dest.memory = buffer->image->data;
+	dest.width = buffer->width;
+	dest.height = buffer->height;
+	dest.pitch = buffer->image->bytes_per_line;
+	dest.bytesPerPixel = 4;
+	UpscaleBuffer(filtered, &dest);
+	
+	if (buffer->usingShm)
+	{
+		XShmPutImage(display, window, graphicsContext, buffer->image, 0, 0, 0, 0, buffer->width, buffer->height, True);
+	}
+	else
+	{
+		XPutImage(display, window, graphicsContext, buffer->image, 0, 0, 0, 0, buffer->width, buffer->height);
+	}
+	XFlush(display);
+	
+	return buffer->usingShm;
+}
+
+internal_func void Linux_HandleKey(MachineState *machine, KeySym key, b32 isDown)
+{
+	u8 *port = 0;
+	u8 machineKey = 0;
+	
+	switch (key)
+	{
+		// Port 1
+		case XK_a: case XK_A: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::P1LEFT; break; }
+		case XK_d: case XK_D: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::P1RIGHT; break; }
+		case XK_space: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::P1SHOOT; break; }
+		case XK_c: case XK_C: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::COIN; break; }
+		case XK_Shift_L: case XK_Shift_R: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::P1START; break; }
+		case XK_Return: { port = &machine->inputPort1; machineKey = (u8)Port1MachineKeys::P2START; break; }
+		
+		// Port 2
+		case XK_Left: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::P2LEFT; break; }
+		case XK_Right: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::P2RIGHT; break; }
+		case XK_Up: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::P2SHOOT; break; }
+		case XK_6: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::DIPSWITCH1; break; }
+		case XK_7: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::DIPSWITCH2; break; }
+		case XK_8: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::TILT; break; }
+		case XK_9: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::DIPSWITCHBONUS; break; }
+		case XK_0: { port = &machine->inputPort2; machineKey = (u8)Port2MachineKeys::DIPSWITCHCOIN; break; }
+		
+		default:
+		{
+			break;
+		}
+	}
+	
+	if (port)
+	{
+		if (isDown)
+		{
+			ProcessMachineKeyDown(port, machineKey);
+		}
+		else
+		{
+			ProcessMachineKeyUp(port, machineKey);
+		}
+	}
+}
+
+internal_func FilterPreset Linux_ParseFilterPreset(char *name)
+{
+	FilterPreset result = FilterPreset::NONE;
+	if (strcmp(name, "scale2x") == 0) { result = FilterPreset::SCALE2X; }
+	else if (strcmp(name, "scale4x") == 0) { result = FilterPreset::SCALE4X; }
+	else if (strcmp(name, "scale6x") == 0) { result = FilterPreset::SCALE6X; }
+	else if (strcmp(name, "scanlines") == 0) { result = FilterPreset::SCANLINES; }
+	else if (strcmp(name, "crt") == 0) { result = FilterPreset::CRT; }
+	
+	return result;
+}
+
+internal_func Linux_CommandLine Linux_ParseCommandLine(s32 argCount, char **args)
+{
+	Linux_CommandLine result = {};
+	result.dumpFormat = FrameDumpFormat::Y4M;
+	result.rewindSeconds = REWIND_DEFAULT_SECONDS;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.maxFrames = strtoull(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-filter") == 0 && hasValue)
+		{
+			result.filterPreset = Linux_ParseFilterPreset(args[++argIndex]);
+		}
+		else if (strcmp(args[argIndex], "-colour") == 0)
+		{
+			result.enableColour = true;
+		}
+		else if (strcmp(args[argIndex], "-noshm") == 0)
+		{
+			result.disableShm = true;
+		}
+		else if (strcmp(args[argIndex], "-dump") == 0 && hasValue)
+		{
+			result.dumpPath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-dumpformat") == 0 && hasValue)
+		{
+			if (!FindFrameDumpFormat(args[++argIndex], &result.dumpFormat))
+			{
+				result.invalid = true;
+			}
+		}
+		else if (strcmp(args[argIndex], "-rewind") == 0 && hasValue)
+		{
+			result.rewindSeconds = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-runahead") == 0 && hasValue)
+		{
+			result.runAheadFrames = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-record") == 0 && hasValue)
+		{
+			result.recordPath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-movie") == 0 && hasValue)
+		{
+			result.moviePath = args[++argIndex];
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+internal_func b32 Linux_LoadROM(CPUState *cpuState, MachineState *machine)
+{
+	b32 result = false;
+	
+	u64 fileSize = 0;
+	u8 *romContents = PlatformReadEntireFile(machine->romFilename, &fileSize);
+	if (romContents)
+	{
+		PlatformROMImage *romImage = PlatformCreateROMImage(romContents, (fileSize < machine->romSize) ? fileSize : machine->romSize);
+		if (romImage)
+		{
+			cpuState->memory = PlatformMapInstanceMemory(romImage);
+			PlatformDestroyROMImage(romImage);
+			result = (cpuState->memory != 0);
+		}
+		
+		PlatformFreeMemory(romContents);
+	}
+	
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	Linux_CommandLine commandLine = Linux_ParseCommandLine(argCount, args);
+	if (!commandLine.romPath || commandLine.invalid)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-frames N] [-filter none|scale2x|scale4x|scale6x|scanlines|crt] [-colour] [-noshm] [-dump <path>] [-dumpformat raw|ppm|y4m] [-rewind S] [-runahead N] [-record <path>] [-movie <path>]\n", args[0]);
+		return 1;
+	}
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	machine.romSize = 0x2000;
+	machine.enableColour = commandLine.enableColour;
+	snprintf(machine.romFilename, sizeof(machine.romFilename), "%s", commandLine.romPath);
+	ResetMachine(&cpuState, &machine);
+	
+	if (!Linux_LoadROM(&cpuState, &machine))
+	{
+		fprintf(stderr, "Could not load ROM: %s\n", machine.romFilename);
+		return 1;
+	}
+	
+	MoviePlayer moviePlayer = {};
+	b32 playingMovie = false;
+	if (commandLine.moviePath)
+	{
+		playingMovie = BeginMoviePlayback(&moviePlayer, commandLine.moviePath, &cpuState, &machine);
+		if (!playingMovie)
+		{
+			fprintf(stderr, "Could not play movie %s, it is missing, damaged or for another ROM\n", commandLine.moviePath);
+			return 1;
+		}
+	}
+	
+	MovieRecorder movieRecorder = {};
+	b32 recordingMovie = false;
+	if (commandLine.recordPath && !playingMovie)
+	{
+		recordingMovie = BeginMovieRecording(&movieRecorder, MovieKeying::FRAME, true, &cpuState, &machine);
+		if (!recordingMovie)
+		{
+			fprintf(stderr, "Could not start recording %s\n", commandLine.recordPath);
+			FreeMovieRecorder(&movieRecorder);
+		}
+	}
+	
+	Display *display = XOpenDisplay(0);
+	if (!display)
+	{
+		fprintf(stderr, "Could not open X display\n");
+		return 1;
+	}
+	
+	s32 screen = DefaultScreen(display);
+	XVisualInfo visualInfo = {};
+	if (!XMatchVisualInfo(display, screen, 24, TrueColor, &visualInfo))
+	{
+		fprintf(stderr, "No 24-bit TrueColor visual available\n");
+		return 1;
+	}
+	
+	BackBuffer backBuffer = {};
+	backBuffer.width = 224;
+	backBuffer.height = 256;
+	backBuffer.bytesPerPixel = 4;
+	backBuffer.pitch = backBuffer.width * backBuffer.bytesPerPixel;
+	backBuffer.memory = PlatformAllocateMemory(backBuffer.pitch * backBuffer.height);
+	
+	PlatformWorkQueue filterQueue = {};
+	u32 processorCount = Linux_GetProcessorCount();
+	Linux_MakeWorkQueue(&filterQueue, (processorCount > 1) ? (processorCount - 1) : 1);
+	
+	FilterPipeline filterPipeline = {};
+	filterPipeline.queue = &filterQueue;
+	ApplyFilterPreset(&filterPipeline, commandLine.filterPreset, backBuffer.width, backBuffer.height);
+	
+	FrameDump frameDump = {};
+	b32 dumpingFrames = false;
+	if (commandLine.dumpPath)
+	{
+		dumpingFrames = BeginFrameDump(&frameDump, commandLine.dumpPath, commandLine.dumpFormat,
+									   backBuffer.width, backBuffer.height, machine.enableColour);
+		if (!dumpingFrames)
+		{
+			fprintf(stderr, "Could not dump frames to %s, it can't be opened or has a %% that isn't one ppm frame number field\n",
+					commandLine.dumpPath);
+			return 1;
+		}
+	}
+	
+	s32 windowWidth = backBuffer.width * 2;
+	s32 windowHeight = backBuffer.height * 2;
+	
+	XSetWindowAttributes windowAttributes = {};
+	windowAttributes.background_pixel = BlackPixel(display, screen);
+	windowAttributes.colormap = XCreateColormap(display, RootWindow(display, screen), visualInfo.visual, AllocNone);
+	windowAttributes.event_mask = KeyPressMask | KeyReleaseMask | StructureNotifyMask | ExposureMask;
+	Window window = XCreateWindow(display, RootWindow(display, screen), 0, 0, windowWidth, windowHeight, 0,
+								  visualInfo.depth, InputOutput, visualInfo.visual,
+								  CWBackPixel | CWColormap | CWEventMask, &windowAttributes);
+	
+	XStoreName(display, window, "bSalmon842 8080 Emulator");
+	
+	// NOTE(bSalmon): Same 7:8 aspect ratio the Win32 version keeps while sizing
+	XSizeHints *sizeHints = XAllocSizeHints();
+	sizeHints->flags = PAspect | PMinSize;
+	sizeHints->min_aspect.x = 7;
+	sizeHints->min_aspect.y = 8;
+	sizeHints->max_aspect.x = 7;
+	sizeHints->max_aspect.y = 8;
+	sizeHints->min_width = backBuffer.width / 2;
+	sizeHints->min_height = backBuffer.height / 2;
+	XSetWMNormalHints(display, window, sizeHints);
+	XFree(sizeHints);
+	
+	Atom deleteWindowAtom = XInternAtom(display, "WM_DELETE_WINDOW", False);
+	XSetWMProtocols(display, window, &deleteWindowAtom, 1);
+	
+	// NOTE(bSalmon): Without this holding a key sends release/press pairs
+	XkbSetDetectableAutoRepeat(display, True, 0);
+	
+	XMapWindow(display, window);
+	GC graphicsContext = XCreateGC(display, window, 0, 0);
+	
+	b32 tryShm = !commandLine.disableShm && XShmQueryExtension(display);
+	s32 shmCompletionEvent = tryShm ? (XShmGetEventBase(display) + ShmCompletion) : -1;
+	
+	Linux_PresentImage presentBuffer = {};
+	Linux_ResizePresentBuffer(display, visualInfo.visual, visualInfo.depth, windowWidth, windowHeight, &presentBuffer, tryShm);
+	
+	RewindBuffer rewind = {};
+	b32 rewindEnabled = commandLine.rewindSeconds &&
+		InitRewindBuffer(&rewind, commandLine.rewindSeconds * FRAMES_PER_SECOND, commandLine.rewindSeconds * REWIND_STORAGE_PER_SECOND);
+	b32 rewinding = false;
+	
+	// NOTE(bSalmon): The ROM image is gone by now so run-ahead saves and restores the one instance
+	RunAhead runAhead = {};
+	b32 runAheadEnabled = commandLine.runAheadFrames && InitRunAhead(&runAhead, commandLine.runAheadFrames, 0);
+	
+	globalRunning = true;
+	
+	u64 frameCount = 0;
+	u64 lastRenderedHash = 0;
+	b32 frameChanged = false;
+	b32 needsPresent = false;
+	b32 shmBusy = false;
+	
+	u64 nanosecondsPerFrame = 1000000000ULL / FRAMES_PER_SECOND;
+	u64 startTime = PlatformGetWallClock();
+	u64 nextFrameTime = startTime;
+	
+	while (globalRunning)
+	{
+		while (XPending(display))
+		{
+			XEvent event;
+			XNextEvent(display, &event);
+			
+			switch (event.type)
+			{
+				// NOTE(bSalmon): Input is built around the original Space Invaders Hardware
+				case KeyPress:
+				case KeyRelease:
+				{
+					KeySym key = XLookupKeysym(&event.xkey, 0);
+					if (key == XK_BackSpace)
+					{
+						rewinding = (event.type == KeyPress) && !recordingMovie;
+					}
+					else if (!playingMovie)
+					{
+						Linux_HandleKey(&machine, key, event.type == KeyPress);
+					}
+					break;
+				}
+				
+				case ConfigureNotify:
+				{
+					if (event.xconfigure.width != windowWidth || event.xconfigure.height != windowHeight)
+					{
+						windowWidth = event.xconfigure.width;
+						windowHeight = event.xconfigure.height;
+						needsPresent = true;
+					}
+					break;
+				}
+				
+				case Expose:
+				{
+					needsPresent = true;
+					break;
+				}
+				
+				case ClientMessage:
+				{
+					if ((Atom)event.xclient.data.l[0] == deleteWindowAtom)
+					{
+						globalRunning = false;
+					}
+					break;
+				}
+				
+				default:
+				{
+					if (event.type == shmCompletionEvent)
+					{
+						shmBusy = false;
+					}
+					break;
+				}
+			}
+		}
+		
+		if (recordingMovie && !RecordMovieInput(&movieRecorder, &machine))
+		{
+			fprintf(stderr, "Ran out of memory recording %s\n", commandLine.recordPath);
+			FreeMovieRecorder(&movieRecorder);
+			recordingMovie = false;
+		}
+		
+		if (playingMovie)
+		{
+			EmulateMovieFrame(&moviePlayer, &cpuState, &machine);
+			if (IsMovieFinished(&moviePlayer, &machine))
+			{
+				printf("Movie finished at frame %llu, end state %s\n", (unsigned long long)machine.frameCount,
+					   DoesMovieEndMatch(&moviePlayer, &cpuState, &machine) ? "matches" : "DIFFERS");
+				EndMoviePlayback(&moviePlayer);
+				playingMovie = false;
+			}
+		}
+		else if (rewindEnabled)
+		{
+			EmulateRewindableFrame(&rewind, rewinding, &cpuState, &machine);
+		}
+		else
+		{
+			EmulateFrame(&cpuState, &machine);
+		}
+		frameCount++;
+		
+		if (dumpingFrames)
+		{
+			frameDump.enableColour = machine.enableColour;
+			SubmitFrameDump(&frameDump, &cpuState, machine.frameCount);
+		}
+		
+		// NOTE(bSalmon): Nothing to run ahead of while going backwards
+		CPUState *shownState = &cpuState;
+		b32 runningAhead = runAheadEnabled && !rewinding && !IsMachineStopped(&cpuState);
+		if (runningAhead)
+		{
+			shownState = BeginRunAhead(&runAhead, &cpuState, &machine);
+		}
+		
+		u64 videoHash = HashVideoMemory(shownState, machine.enableColour);
+		if (videoHash != lastRenderedHash)
+		{
+			RenderVideoMemContents(&backBuffer, shownState, machine.enableColour);
+			lastRenderedHash = videoHash;
+			frameChanged = true;
+		}
+		
+		if (runningAhead)
+		{
+			EndRunAhead(&runAhead, &cpuState, &machine);
+		}
+		
+		// NOTE(bSalmon): The shared image can't be touched until the server has finished reading it
+		if ((frameChanged || needsPresent) && !shmBusy)
+		{
+			if (presentBuffer.width != windowWidth || presentBuffer.height != windowHeight)
+			{
+				Linux_ResizePresentBuffer(display, visualInfo.visual, visualInfo.depth, windowWidth, windowHeight, &presentBuffer, tryShm);
+			}
+			
+			shmBusy = Linux_PresentBuffer(display, window, graphicsContext, &presentBuffer, &backBuffer, &filterPipeline);
+			frameChanged = false;
+			needsPresent = false;
+		}
+		
+		// NOTE(bSalmon): Halted with interrupts disabled, nothing will ever run again
+		if (IsMachineStopped(&cpuState) || (commandLine.maxFrames && frameCount >= commandLine.maxFrames))
+		{
+			globalRunning = false;
+		}
+		
+		nextFrameTime += nanosecondsPerFrame;
+		u64 now = PlatformGetWallClock();
+		if (now > (nextFrameTime + nanosecondsPerFrame))
+		{
+			// NOTE(bSalmon): Fell more than a frame behind, don't try to catch up
+			nextFrameTime = now;
+		}
+		Linux_SleepUntil(nextFrameTime);
+	}
+	
+	f64 secondsElapsed = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	printf("%llu frames in %.2fs (%.2f fps), %s presentation\n", (unsigned long long)frameCount, secondsElapsed,
+		   frameCount / secondsElapsed, presentBuffer.usingShm ? "MIT-SHM" : "XPutImage");
+	
+	if (dumpingFrames)
+	{
+		EndFrameDump(&frameDump);
+		FrameDumpStats dumpStats = GetFrameDumpStats(&frameDump);
+		printf("Frame Dump: %llu submitted, %llu written, %llu dropped, max queue depth %u/%u\n",
+			   (unsigned long long)dumpStats.submittedFrames, (unsigned long long)dumpStats.writtenFrames,
+			   (unsigned long long)dumpStats.droppedFrames, dumpStats.maxQueueDepth, FRAME_DUMP_QUEUE_SIZE);
+	}
+	
+	Linux_DestroyPresentBuffer(display, &presentBuffer);
+	XFreeGC(display, graphicsContext);
+	XDestroyWindow(display, window);
+	XCloseDisplay(display);
+	
+	if (rewindEnabled)
+	{
+		FreeRewindBuffer(&rewind);
+	}
+	if (runAheadEnabled)
+	{
+		FreeRunAhead(&runAhead);
+	}
+	if (playingMovie)
+	{
+		EndMoviePlayback(&moviePlayer);
+	}
+	if (recordingMovie)
+	{
+		if (EndMovieRecording(&movieRecorder, commandLine.recordPath, &cpuState, &machine))
+		{
+			printf("Recorded %s\n", commandLine.recordPath);
+		}
+		else
+		{
+			fprintf(stderr, "Failed to write %s\n", commandLine.recordPath);
+		}
+	}
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	return 0;
+}
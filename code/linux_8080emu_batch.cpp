@@ -0,0 +1,264 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_batch.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Batch Runner, see 8080emu_batch.cpp for the job list and input script formats.
+
+Usage: linux_8080emu_batch <job list> [-threads N] [-out <dir>] [-quiet]
+       linux_8080emu_batch <job list> -bench [-threads N] [-repeat N]
+
+Prints one line of results per job, then the totals. -threads defaults to one per core.
+
+-bench runs the whole job list (repeated -repeat times) with 1, 2, 4... up to -threads workers
+and prints the throughput, speedup and parallel efficiency of each, along with a check that
+every run produced the same results as the single threaded run. Outputs are not written.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_batch.cpp"
+
+struct BatchCommandLine
+{
+	char *jobListPath;
+	char *outputDir;
+	u32 threadCount;
+	u32 repeatCount;
+	b32 bench;
+	b32 quiet;
+};
+
+global_var Batch globalBatch;
+
+internal_func BatchCommandLine ParseBatchCommandLine(s32 argCount, char **args)
+{
+	BatchCommandLine result = {};
+	result.outputDir = ".";
+	result.threadCount = Linux_GetProcessorCount();
+	result.repeatCount = 1;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-threads") == 0 && hasValue)
+		{
+			result.threadCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-repeat") == 0 && hasValue)
+		{
+			result.repeatCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-out") == 0 && hasValue)
+		{
+			result.outputDir = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-bench") == 0)
+		{
+			result.bench = true;
+		}
+		else if (strcmp(args[argIndex], "-quiet") == 0)
+		{
+			result.quiet = true;
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.jobListPath = args[argIndex];
+		}
+	}
+	
+	if (result.threadCount < 1)
+	{
+		result.threadCount = 1;
+	}
+	else if (result.threadCount > BATCH_MAX_THREADS)
+	{
+		result.threadCount = BATCH_MAX_THREADS;
+	}
+	
+	if (result.repeatCount < 1)
+	{
+		result.repeatCount = 1;
+	}
+	
+	return result;
+}
+
+// Repeats the loaded job list so a benchmark has enough work to spread over every thread
+internal_func void RepeatBatchJobs(Batch *batch, u32 repeatCount)
+{
+	if (repeatCount <= 1)
+	{
+		return;
+	}
+	
+	u32 jobCount = batch->jobCount * repeatCount;
+	BatchJob *jobs = (BatchJob *)PlatformAllocateMemory(jobCount * sizeof(BatchJob));
+	for (u32 jobIndex = 0; jobIndex < jobCount; ++jobIndex)
+	{
+		jobs[jobIndex] = batch->jobs[jobIndex % batch->jobCount];
+	}
+	
+	PlatformFreeMemory(batch->jobs);
+	PlatformFreeMemory(batch->results);
+	batch->jobs = jobs;
+	batch->results = (BatchResult *)PlatformAllocateMemory(jobCount * sizeof(BatchResult));
+	batch->jobCount = jobCount;
+}
+
+internal_func u64 GetBatchTotalCycles(Batch *batch)
+{
+	u64 result = 0;
+	for (u32 jobIndex = 0; jobIndex < batch->jobCount; ++jobIndex)
+	{
+		result += batch->results[jobIndex].cycles;
+	}
+	
+	return result;
+}
+
+internal_func void RunBatchBenchmark(Batch *batch, u32 maxThreadCount)
+{
+	BatchResult *reference = (BatchResult *)PlatformAllocateMemory(batch->jobCount * sizeof(BatchResult));
+	f64 singleThreadSeconds = 0.0;
+	
+	printf("Threads  Seconds    Jobs/s     Emulated MHz  Speedup  Efficiency  Results\n");
+	
+	u32 threadCount = 1;
+	for (;;)
+	{
+		f64 seconds = RunBatch(batch, threadCount);
+		
+		b32 resultsMatch = true;
+		if (threadCount == 1)
+		{
+			singleThreadSeconds = seconds;
+			memcpy(reference, batch->results, batch->jobCount * sizeof(BatchResult));
+		}
+		else
+		{
+			for (u32 jobIndex = 0; jobIndex < batch->jobCount; ++jobIndex)
+			{
+				if (batch->results[jobIndex].stateHash != reference[jobIndex].stateHash)
+				{
+					resultsMatch = false;
+				}
+			}
+		}
+		
+		f64 speedup = singleThreadSeconds / seconds;
+		char efficiency[32];
+		snprintf(efficiency, sizeof(efficiency), "%.1f%%", (speedup / threadCount) * 100.0);
+		printf("%-7u  %-9.3f  %-9.1f  %-12.1f  %-7.2f  %-10s  %s\n", threadCount, seconds,
+			   batch->jobCount / seconds, (GetBatchTotalCycles(batch) / seconds) / 1000000.0,
+			   speedup, efficiency, resultsMatch ? "match" : "MISMATCH");
+		
+		if (threadCount == maxThreadCount)
+		{
+			break;
+		}
+		
+		threadCount *= 2;
+		if (threadCount > maxThreadCount)
+		{
+			threadCount = maxThreadCount;
+		}
+	}
+	
+	PlatformFreeMemory(reference);
+}
+
+int main(int argCount, char **args)
+{
+	BatchCommandLine commandLine = ParseBatchCommandLine(argCount, args);
+	if (!commandLine.jobListPath)
+	{
+		fprintf(stderr, "Usage: %s <job list> [-threads N] [-out <dir>] [-quiet]\n", args[0]);
+		fprintf(stderr, "       %s <job list> -bench [-threads N] [-repeat N]\n", args[0]);
+		return 1;
+	}
+	
+	Batch *batch = &globalBatch;
+	if (!LoadBatchJobList(batch, commandLine.jobListPath))
+	{
+		return 1;
+	}
+	
+	if (batch->jobCount == 0)
+	{
+		fprintf(stderr, "No jobs in %s\n", commandLine.jobListPath);
+		return 1;
+	}
+	
+	snprintf(batch->outputDir, sizeof(batch->outputDir), "%s", commandLine.outputDir);
+	
+	if (commandLine.bench)
+	{
+		RepeatBatchJobs(batch, commandLine.repeatCount);
+		printf("%u jobs, %u ROMs, up to %u threads on %u cores\n", batch->jobCount, batch->romCount,
+			   commandLine.threadCount, Linux_GetProcessorCount());
+		RunBatchBenchmark(batch, commandLine.threadCount);
+		FreeBatch(batch);
+		return 0;
+	}
+	
+	batch->writeOutputs = true;
+	f64 seconds = RunBatch(batch, commandLine.threadCount);
+	
+	s32 result = 0;
+	if (!commandLine.quiet)
+	{
+		printf("Job  Worker  Frames  Cycles       State Hash        Frame Hash        RAM Hash          ms\n");
+	}
+	
+	for (u32 jobIndex = 0; jobIndex < batch->jobCount; ++jobIndex)
+	{
+		BatchResult *jobResult = &batch->results[jobIndex];
+		if (commandLine.quiet)
+		{
+			printf("%u %016llx %016llx %016llx\n", jobIndex, (unsigned long long)jobResult->stateHash,
+				   (unsigned long long)jobResult->frameHash, (unsigned long long)jobResult->ramHash);
+		}
+		else
+		{
+			printf("%-3u  %-6u  %-6llu  %-11llu  %016llx  %016llx  %016llx  %.2f%s\n", jobIndex, jobResult->workerIndex,
+				   (unsigned long long)jobResult->frames, (unsigned long long)jobResult->cycles,
+				   (unsigned long long)jobResult->stateHash, (unsigned long long)jobResult->frameHash,
+				   (unsigned long long)jobResult->ramHash, jobResult->seconds * 1000.0,
+				   jobResult->outputFailed ? "  (output failed)" : "");
+		}
+		
+		if (!jobResult->completed || jobResult->outputFailed)
+		{
+			result = 1;
+		}
+	}
+	
+	if (!commandLine.quiet)
+	{
+		printf("%u jobs on %u threads in %.3fs, %.1f jobs/s, %.1f emulated MHz\n", batch->jobCount, commandLine.threadCount,
+			   seconds, batch->jobCount / seconds, (GetBatchTotalCycles(batch) / seconds) / 1000000.0);
+	}
+	
+	FreeBatch(batch);
+	return result;
+}
@@ -0,0 +1,241 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_farm.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Instance Farm, runs many live instances of a ROM in real time on the frame scheduler
+(see 8080emu_scheduler.cpp) and reports how well they keep up.
+
+Usage: linux_8080emu_farm <rom> [-instances N] [-threads N] [-seconds S] [-bots] [-unthrottled]
+
+-instances defaults to 1000 and -threads to one per core. -bots gives every instance a simple
+random player so the instances do different work each frame, otherwise they all sit in attract
+mode. -unthrottled runs ticks back to back to find out how many frames a second the farm can do.
+
+Prints one line a second and a summary at the end, a frame that finishes after the end of its
+16.7ms tick is a missed deadline.
+*/
+
+#include "8080emu.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_scheduler.cpp"
+#include "8080emu_bot.cpp"
+
+struct FarmCommandLine
+{
+	char *romPath;
+	u32 instanceCount;
+	u32 threadCount;
+	f64 seconds;
+	b32 bots;
+	b32 unthrottled;
+};
+
+global_var Scheduler globalScheduler;
+
+internal_func FarmCommandLine ParseFarmCommandLine(s32 argCount, char **args)
+{
+	FarmCommandLine result = {};
+	result.instanceCount = 1000;
+	result.threadCount = Linux_GetProcessorCount();
+	result.seconds = 10.0;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-instances") == 0 && hasValue)
+		{
+			result.instanceCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-threads") == 0 && hasValue)
+		{
+			result.threadCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-seconds") == 0 && hasValue)
+		{
+			result.seconds = strtod(args[++argIndex], 0);
+		}
+		else if (strcmp(args[argIndex], "-bots") == 0)
+		{
+			result.bots = true;
+		}
+		else if (strcmp(args[argIndex], "-unthrottled") == 0)
+		{
+			result.unthrottled = true;
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	if (result.instanceCount < 1)
+	{
+		result.instanceCount = 1;
+	}
+	
+	return result;
+}
+
+internal_func SCHEDULER_INPUT_PROC(FarmBotInput)
+{
+	UpdateBotPlayer((BotPlayer *)userData, &instance->machine);
+}
+
+internal_func void PrintFarmSummary(Scheduler *scheduler, f64 seconds)
+{
+	SchedulerStats stats = GetSchedulerStats(scheduler);
+	
+	u64 minMissed = (u64)-1;
+	u64 maxMissed = 0;
+	u64 maxLatenessTicks = 0;
+	u32 instancesMissed = 0;
+	for (u32 instanceIndex = 0; instanceIndex < scheduler->instanceCount; ++instanceIndex)
+	{
+		SchedulerInstance *instance = &scheduler->instances[instanceIndex];
+		minMissed = (instance->missedDeadlines < minMissed) ? instance->missedDeadlines : minMissed;
+		maxMissed = (instance->missedDeadlines > maxMissed) ? instance->missedDeadlines : maxMissed;
+		maxLatenessTicks = (instance->maxLatenessTicks > maxLatenessTicks) ? instance->maxLatenessTicks : maxLatenessTicks;
+		if (instance->missedDeadlines)
+		{
+			instancesMissed++;
+		}
+	}
+	
+	f64 missedPercent = stats.framesRun ? ((f64)stats.missedDeadlines / stats.framesRun) * 100.0 : 0.0;
+	f64 averageLateness = stats.missedDeadlines ? PlatformGetSecondsElapsed(0, stats.totalLateness / stats.missedDeadlines) : 0.0;
+	
+	printf("\n%llu ticks in %.2fs, %.1f ticks/s, %.1f instance frames/s, busy %.1f%% of the time\n",
+		   (unsigned long long)stats.ticks, seconds, stats.ticks / seconds, stats.framesRun / seconds,
+		   (stats.busySeconds / seconds) * 100.0);
+	printf("Frames run: %llu, missed deadlines: %llu (%.3f%%), skipped ticks: %llu\n",
+		   (unsigned long long)stats.framesRun, (unsigned long long)stats.missedDeadlines, missedPercent,
+		   (unsigned long long)stats.skippedTicks);
+	printf("Lateness: average %.3fms, max %.3fms, worst instance %llu ticks late\n", averageLateness * 1000.0,
+		   PlatformGetSecondsElapsed(0, stats.maxLateness) * 1000.0, (unsigned long long)maxLatenessTicks);
+	printf("Missed per instance: min %llu, average %.2f, max %llu, %u of %u instances missed at least once\n",
+		   (unsigned long long)minMissed, (f64)stats.missedDeadlines / scheduler->instanceCount,
+		   (unsigned long long)maxMissed, instancesMissed, scheduler->instanceCount);
+	
+	printf("Worker  Home  Tasks      Stolen     Failed Steals  Missed\n");
+	for (u32 workerIndex = 0; workerIndex < scheduler->workerCount; ++workerIndex)
+	{
+		SchedulerWorker *worker = &scheduler->workers[workerIndex];
+		printf("%-6u  %-4u  %-9llu  %-9llu  %-13llu  %llu\n", workerIndex, worker->instanceCount,
+			   (unsigned long long)worker->stats.tasksRun, (unsigned long long)worker->stats.tasksStolen,
+			   (unsigned long long)worker->stats.failedSteals, (unsigned long long)worker->stats.missedDeadlines);
+	}
+}
+
+int main(int argCount, char **args)
+{
+	FarmCommandLine commandLine = ParseFarmCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-instances N] [-threads N] [-seconds S] [-bots] [-unthrottled]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	if (!rom)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	Scheduler *scheduler = &globalScheduler;
+	u64 residentBefore = Linux_GetPrivateMemory();
+	if (!BeginScheduler(scheduler, rom, romSize, commandLine.instanceCount, commandLine.threadCount, 1000000000ULL))
+	{
+		fprintf(stderr, "Failed to allocate %u instances\n", commandLine.instanceCount);
+		return 1;
+	}
+	scheduler->unthrottled = commandLine.unthrottled;
+	
+	BotPlayer *bots = 0;
+	if (commandLine.bots)
+	{
+		bots = (BotPlayer *)PlatformAllocateMemory(commandLine.instanceCount * sizeof(BotPlayer));
+		for (u32 instanceIndex = 0; instanceIndex < commandLine.instanceCount; ++instanceIndex)
+		{
+			InitBotPlayer(&bots[instanceIndex], instanceIndex);
+			scheduler->instances[instanceIndex].inputProc = FarmBotInput;
+			scheduler->instances[instanceIndex].userData = &bots[instanceIndex];
+		}
+	}
+	
+	printf("%u instances on %u threads, %u cores%s\n", scheduler->instanceCount, scheduler->workerCount,
+		   Linux_GetProcessorCount(), commandLine.unthrottled ? ", unthrottled" : "");
+	printf("Second  Ticks  Frames     Missed   Skipped  Stolen     Busy\n");
+	
+	u64 startTime = PlatformGetWallClock();
+	u64 reportTime = startTime;
+	SchedulerStats lastStats = {};
+	u32 secondIndex = 0;
+	
+	for (;;)
+	{
+		if (!scheduler->unthrottled)
+		{
+			Linux_SleepUntil(scheduler->nextTickTime);
+		}
+		RunSchedulerTick(scheduler);
+		
+		u64 now = PlatformGetWallClock();
+		f64 reportSeconds = PlatformGetSecondsElapsed(reportTime, now);
+		b32 finished = PlatformGetSecondsElapsed(startTime, now) >= commandLine.seconds;
+		if (reportSeconds >= 1.0 || finished)
+		{
+			SchedulerStats stats = GetSchedulerStats(scheduler);
+			printf("%-6u  %-5llu  %-9llu  %-7llu  %-7llu  %-9llu  %.1f%%\n", ++secondIndex,
+				   (unsigned long long)(stats.ticks - lastStats.ticks),
+				   (unsigned long long)(stats.framesRun - lastStats.framesRun),
+				   (unsigned long long)(stats.missedDeadlines - lastStats.missedDeadlines),
+				   (unsigned long long)(stats.skippedTicks - lastStats.skippedTicks),
+				   (unsigned long long)(stats.tasksStolen - lastStats.tasksStolen),
+				   ((stats.busySeconds - lastStats.busySeconds) / reportSeconds) * 100.0);
+			
+			lastStats = stats;
+			reportTime = now;
+		}
+		
+		if (finished)
+		{
+			break;
+		}
+	}
+	
+	PrintFarmSummary(scheduler, PlatformGetSecondsElapsed(startTime, PlatformGetWallClock()));
+	
+	u64 instanceMemory = Linux_GetPrivateMemory() - residentBefore;
+	printf("Private memory for the instances: %.2fMB, %.1fKB per instance\n", instanceMemory / (1024.0 * 1024.0),
+		   (instanceMemory / 1024.0) / scheduler->instanceCount);
+	
+	EndScheduler(scheduler);
+	if (bots)
+	{
+		PlatformFreeMemory(bots);
+	}
+	PlatformFreeMemory(rom);
+	
+	return 0;
+}
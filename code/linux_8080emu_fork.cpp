@@ -0,0 +1,249 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_fork.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Fork Benchmark, plays a game with a bot up to a branch point, snapshots it and then runs
+lots of short branches from the snapshot, each one a fork (see 8080emu_fork.cpp) played for a
+few frames by a differently seeded bot. The same branches are run again with every fork
+forced to copy all of RAM, which is what a clone cost before dirty pages were tracked.
+
+Usage: linux_8080emu_fork <rom> [-frame N] [-branches N] [-depth N] [-slots N]
+
+-frame is the frame the snapshot is taken at (default 600), -branches how many forks to make
+(default 100000), -depth how many frames each branch runs (default 1) and -slots how many
+instances the branches are spread over (default 8).
+
+Prints clones/sec counting only the time spent forking, the average pages copied per clone,
+how many clones fell back to copying all of RAM and branches/sec for the whole run. Every slot's first fork and every 256th after it is
+hashed against the snapshot, exits with 1 if any differ.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_fork.cpp"
+
+#define FORK_MAX_SLOTS 64
+
+struct ForkCommandLine
+{
+	char *romPath;
+	u32 branchFrame;
+	u32 branchCount;
+	u32 branchDepth;
+	u32 slotCount;
+};
+
+struct ForkRunResult
+{
+	ForkStats stats;
+	f64 forkSeconds;
+	f64 totalSeconds;
+	u32 mismatchCount;
+};
+
+internal_func ForkCommandLine ParseForkCommandLine(s32 argCount, char **args)
+{
+	ForkCommandLine result = {};
+	result.branchFrame = 600;
+	result.branchCount = 100000;
+	result.branchDepth = 1;
+	result.slotCount = 8;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frame") == 0 && hasValue)
+		{
+			result.branchFrame = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-branches") == 0 && hasValue)
+		{
+			result.branchCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-depth") == 0 && hasValue)
+		{
+			result.branchDepth = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-slots") == 0 && hasValue)
+		{
+			result.slotCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	if (result.slotCount < 1)
+	{
+		result.slotCount = 1;
+	}
+	else if (result.slotCount > FORK_MAX_SLOTS)
+	{
+		result.slotCount = FORK_MAX_SLOTS;
+	}
+	
+	return result;
+}
+
+internal_func ForkRunResult RunForkBranches(ForkedMachine *slots, MachineSnapshot *snapshot, u64 snapshotHash,
+											ForkCommandLine *commandLine, b32 fullCopy)
+{
+	ForkRunResult result = {};
+	
+	for (u32 slotIndex = 0; slotIndex < commandLine->slotCount; ++slotIndex)
+	{
+		slots[slotIndex].baseId = 0;
+	}
+	
+	u64 forkTicks = 0;
+	u64 startTime = PlatformGetWallClock();
+	for (u32 branchIndex = 0; branchIndex < commandLine->branchCount; ++branchIndex)
+	{
+		ForkedMachine *instance = &slots[branchIndex % commandLine->slotCount];
+		if (fullCopy)
+		{
+			instance->baseId = 0;
+		}
+		
+		u64 forkStart = PlatformGetWallClock();
+		ForkMachine(instance, snapshot, &result.stats);
+		forkTicks += PlatformGetWallClock() - forkStart;
+		
+		if (branchIndex < commandLine->slotCount || (branchIndex % 256) == 0)
+		{
+			if (HashMachineState(&instance->cpuState, &instance->machine) != snapshotHash)
+			{
+				fprintf(stderr, "Branch %u does not match the snapshot after forking\n", branchIndex);
+				result.mismatchCount++;
+			}
+		}
+		
+		BotPlayer bot;
+		InitBotPlayer(&bot, branchIndex + 1);
+		for (u32 frameIndex = 0; frameIndex < commandLine->branchDepth; ++frameIndex)
+		{
+			UpdateBotPlayer(&bot, &instance->machine);
+			EmulateFrame(&instance->cpuState, &instance->machine);
+		}
+	}
+	u64 endTime = PlatformGetWallClock();
+	
+	result.forkSeconds = PlatformGetSecondsElapsed(0, forkTicks);
+	result.totalSeconds = PlatformGetSecondsElapsed(startTime, endTime);
+	
+	return result;
+}
+
+internal_func void PrintForkRun(char *name, ForkRunResult *run, u32 branchCount)
+{
+	ForkStats *stats = &run->stats;
+	printf("%s %10.0f clones/sec, %5.1f pages (%4.0f bytes) per clone, %5.1f%% full copies, %8.0f branches/sec\n", name,
+		   run->forkSeconds > 0.0 ? stats->forks / run->forkSeconds : 0.0,
+		   stats->forks ? (f64)stats->pagesCopied / stats->forks : 0.0,
+		   stats->forks ? ((f64)stats->pagesCopied * RAM_PAGE_SIZE) / stats->forks : 0.0,
+		   stats->forks ? ((f64)stats->fullCopies / stats->forks) * 100.0 : 0.0,
+		   run->totalSeconds > 0.0 ? branchCount / run->totalSeconds : 0.0);
+}
+
+int main(int argCount, char **args)
+{
+	ForkCommandLine commandLine = ParseForkCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-frame N] [-branches N] [-depth N] [-slots N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	if (!rom)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	PlatformROMImage *romImage = PlatformCreateROMImage(rom, romSize);
+	ForkedMachine parent = {};
+	ForkedMachine slots[FORK_MAX_SLOTS] = {};
+	parent.cpuState.memory = romImage ? PlatformMapInstanceMemory(romImage) : 0;
+	for (u32 slotIndex = 0; slotIndex < commandLine.slotCount; ++slotIndex)
+	{
+		slots[slotIndex].cpuState.memory = romImage ? PlatformMapInstanceMemory(romImage) : 0;
+		if (!slots[slotIndex].cpuState.memory)
+		{
+			parent.cpuState.memory = 0;
+		}
+	}
+	
+	if (!parent.cpuState.memory)
+	{
+		fprintf(stderr, "Failed to map memory for %u instances\n", commandLine.slotCount + 1);
+		return 1;
+	}
+	
+	// Play up to the branch point
+	BotPlayer parentBot;
+	InitBotPlayer(&parentBot, 0);
+	parent.machine.romSize = 0x2000;
+	ResetMachine(&parent.cpuState, &parent.machine);
+	for (u32 frameIndex = 0; frameIndex < commandLine.branchFrame; ++frameIndex)
+	{
+		UpdateBotPlayer(&parentBot, &parent.machine);
+		EmulateFrame(&parent.cpuState, &parent.machine);
+	}
+	
+	MachineSnapshot *snapshot = (MachineSnapshot *)PlatformAllocateMemory(sizeof(MachineSnapshot));
+	CaptureMachineSnapshot(snapshot, &parent);
+	u64 snapshotHash = HashMachineState(&parent.cpuState, &parent.machine);
+	
+	// NOTE(bSalmon): Fault in every slot's RAM first so neither run is charged for it
+	for (u32 slotIndex = 0; slotIndex < commandLine.slotCount; ++slotIndex)
+	{
+		ForkMachine(&slots[slotIndex], snapshot);
+	}
+	
+	ForkRunResult dirtyRun = RunForkBranches(slots, snapshot, snapshotHash, &commandLine, false);
+	ForkRunResult fullRun = RunForkBranches(slots, snapshot, snapshotHash, &commandLine, true);
+	
+	printf("%u branches of %u frames from frame %u over %u instances\n", commandLine.branchCount,
+		   commandLine.branchDepth, commandLine.branchFrame, commandLine.slotCount);
+	PrintForkRun("Dirty pages:", &dirtyRun, commandLine.branchCount);
+	PrintForkRun("Full copy:  ", &fullRun, commandLine.branchCount);
+	printf("Fork speedup: %.2fx\n", dirtyRun.forkSeconds > 0.0 ? fullRun.forkSeconds / dirtyRun.forkSeconds : 0.0);
+	
+	u32 mismatchCount = dirtyRun.mismatchCount + fullRun.mismatchCount;
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every checked fork matches the snapshot");
+	
+	PlatformFreeMemory(snapshot);
+	PlatformUnmapInstanceMemory(parent.cpuState.memory);
+	for (u32 slotIndex = 0; slotIndex < commandLine.slotCount; ++slotIndex)
+	{
+		PlatformUnmapInstanceMemory(slots[slotIndex].cpuState.memory);
+	}
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
@@ -0,0 +1,527 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_headless.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Headless Runner
+
+Runs a ROM with no window and no wall clock throttling, for regression and throughput jobs.
+Emulation stops at the first condition hit, then the emulated clock rate, frame rate and
+the final machine state and frame hashes are printed. The hashes are stable between runs
+so they can be compared against known good values.
+
+Usage: linux_8080emu_headless <rom> [-frames N] [-cycles N] [-pc XXXX] [-mem XXXX=YY] [-colour] [-quiet]
+                               [-movie <path>] [-checkpoint <path> [-checkpointframes N] [-compress] [-nouring]]
+                               [-dump <path> [-dumpformat raw|ppm|y4m]]
+
+-pc stops when the program counter reaches the hex address, -mem stops when the byte at the
+hex address holds the hex value. Both are checked after every instruction. At least one
+stop condition is required.
+
+-movie plays an input movie (see 8080emu_movie.cpp) from its start state and stops at the end
+of the movie at the latest. Ending exactly there checks the machine state
+against the movie's and exits with 1 if it differs. -frames, -cycles and the report count
+from the movie's start state, not from power on.
+
+-checkpoint writes a save state every -checkpointframes frames (default 300, 5 emulated
+seconds) in the background (see 8080emu_checkpoint.cpp), a number field such as %llu in the path
+is replaced with the frame count. -compress stores them compressed (see 8080emu_lz.cpp) and -nouring writes them
+without io_uring. A run with any checkpoint that couldn't be written exits with 1.
+
+-dump streams every emulated frame to a file or pipe at full emulation speed (see
+8080emu_framedump.cpp), -dumpformat picks the format (default y4m). The writer runs on its own
+thread and frames it can't keep up with are dropped and counted in the report. With -dump -
+the frames go to stdout and the report to stderr, e.g.
+  linux_8080emu_headless invaders.rom -frames 3600 -dump - -dumpformat raw |
+  ffmpeg -f rawvideo -pix_fmt rgb24 -s 224x256 -r 60 -i - out.mp4
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_movie.cpp"
+#include "8080emu_path.cpp"
+#include "8080emu_checkpoint.cpp"
+#include "8080emu_framedump.cpp"
+#include "linux_8080emu_platform.cpp"
+
+#include <stdlib.h>
+
+enum class StopReason
+{
+	NONE,
+	FRAMES,
+	CYCLES,
+	PC,
+	MEMORY,
+	HALTED,
+	MOVIE_END
+};
+
+global_var char *stopReasonNames[] = {"None", "Frame Limit", "Cycle Limit", "PC Reached", "Memory Condition", "Halted", "Movie End"};
+
+struct Headless_StopConditions
+{
+	// NOTE(bSalmon): The limits count from the start frame and cycle, which a movie's start state moves
+	u64 startFrame;
+	u64 startCycle;
+	u64 maxFrames;
+	u64 maxCycles;
+	
+	// NOTE(bSalmon): Frame keyed movies end on a frame, cycle keyed ones can end part way through one
+	b32 checkMovieEnd;
+	b32 movieCycleKeyed;
+	u64 movieLength;
+	
+	b32 checkPC;
+	u16 stopPC;
+	
+	b32 checkMemory;
+	u16 stopAddress;
+	u8 stopValue;
+};
+
+struct Headless_CommandLine
+{
+	char *romPath;
+	char *moviePath;
+	char *checkpointPath;
+	u64 checkpointFrames;
+	b32 compressCheckpoints;
+	b32 disableIOURing;
+	char *dumpPath;
+	FrameDumpFormat dumpFormat;
+	Headless_StopConditions conditions;
+	b32 enableColour;
+	b32 quiet;
+	b32 valid;
+};
+
+internal_func Headless_CommandLine Headless_ParseCommandLine(s32 argCount, char **args)
+{
+	Headless_CommandLine result = {};
+	result.valid = true;
+	result.checkpointFrames = 300;
+	result.dumpFormat = FrameDumpFormat::Y4M;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.conditions.maxFrames = strtoull(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-cycles") == 0 && hasValue)
+		{
+			result.conditions.maxCycles = strtoull(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-pc") == 0 && hasValue)
+		{
+			result.conditions.checkPC = true;
+			result.conditions.stopPC = (u16)strtoul(args[++argIndex], 0, 16);
+		}
+		else if (strcmp(args[argIndex], "-mem") == 0 && hasValue)
+		{
+			char *condition = args[++argIndex];
+			char *equals = strchr(condition, '=');
+			if (equals)
+			{
+				result.conditions.checkMemory = true;
+				result.conditions.stopAddress = (u16)strtoul(condition, 0, 16);
+				result.conditions.stopValue = (u8)strtoul(equals + 1, 0, 16);
+			}
+			else
+			{
+				result.valid = false;
+			}
+		}
+		else if (strcmp(args[argIndex], "-colour") == 0)
+		{
+			result.enableColour = true;
+		}
+		else if (strcmp(args[argIndex], "-quiet") == 0)
+		{
+			result.quiet = true;
+		}
+		else if (strcmp(args[argIndex], "-movie") == 0 && hasValue)
+		{
+			result.moviePath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-checkpoint") == 0 && hasValue)
+		{
+			result.checkpointPath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-checkpointframes") == 0 && hasValue)
+		{
+			result.checkpointFrames = strtoull(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-compress") == 0)
+		{
+			result.compressCheckpoints = true;
+		}
+		else if (strcmp(args[argIndex], "-nouring") == 0)
+		{
+			result.disableIOURing = true;
+		}
+		else if (strcmp(args[argIndex], "-dump") == 0 && hasValue)
+		{
+			result.dumpPath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-dumpformat") == 0 && hasValue)
+		{
+			if (!FindFrameDumpFormat(args[++argIndex], &result.dumpFormat))
+			{
+				result.valid = false;
+			}
+		}
+		else if (args[argIndex][0] != '-' && !result.romPath)
+		{
+			result.romPath = args[argIndex];
+		}
+		else
+		{
+			result.valid = false;
+		}
+	}
+	
+	Headless_StopConditions *conditions = &result.conditions;
+	if (!result.romPath || (!conditions->maxFrames && !conditions->maxCycles && !conditions->checkPC && !conditions->checkMemory &&
+							!result.moviePath) || !result.checkpointFrames)
+	{
+		result.valid = false;
+	}
+	
+	return result;
+}
+
+internal_func StopReason Headless_CheckLimits(MachineState *machine, Headless_StopConditions *conditions)
+{
+	StopReason result = StopReason::NONE;
+	
+	u64 framesRun = machine->frameCount - conditions->startFrame;
+	u64 cyclesRun = machine->cycles - conditions->startCycle;
+	if (conditions->checkMovieEnd && (conditions->movieCycleKeyed ? cyclesRun : framesRun) >= conditions->movieLength)
+	{
+		result = StopReason::MOVIE_END;
+	}
+	else if (conditions->maxFrames && framesRun >= conditions->maxFrames)
+	{
+		result = StopReason::FRAMES;
+	}
+	else if (conditions->maxCycles && cyclesRun >= conditions->maxCycles)
+	{
+		result = StopReason::CYCLES;
+	}
+	
+	return result;
+}
+
+// Same as EmulateFrame, but checks the stop conditions after every instruction, movie can be 0
+internal_func StopReason Headless_EmulateFrameChecked(CPUState *cpuState, MachineState *machine, Headless_StopConditions *conditions,
+													  MoviePlayer *movie)
+{
+	u64 frameCount = machine->frameCount;
+	while (machine->frameCount == frameCount)
+	{
+		if (IsMachineStopped(cpuState))
+		{
+			return StopReason::HALTED;
+		}
+		
+		if (movie)
+		{
+			ApplyMovieInput(movie, machine);
+		}
+		EmulateStep(cpuState, machine);
+		
+		if (conditions->checkPC && cpuState->programCounter == conditions->stopPC)
+		{
+			return StopReason::PC;
+		}
+		
+		if (conditions->checkMemory && cpuState->memory[conditions->stopAddress] == conditions->stopValue)
+		{
+			return StopReason::MEMORY;
+		}
+		
+		StopReason limitReason = Headless_CheckLimits(machine, conditions);
+		if (limitReason != StopReason::NONE)
+		{
+			return limitReason;
+		}
+	}
+	
+	return StopReason::NONE;
+}
+
+int main(int argCount, char **args)
+{
+	Headless_CommandLine commandLine = Headless_ParseCommandLine(argCount, args);
+	if (!commandLine.valid)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-frames N] [-cycles N] [-pc XXXX] [-mem XXXX=YY] [-colour] [-quiet] [-movie <path>]\n"
+				"       [-checkpoint <path> [-checkpointframes N] [-compress] [-nouring]] [-dump <path> [-dumpformat raw|ppm|y4m]]\n",
+				args[0]);
+		fprintf(stderr, "At least one of -frames, -cycles, -pc, -mem or -movie is required\n");
+		return 1;
+	}
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	machine.romSize = 0x2000;
+	machine.enableColour = commandLine.enableColour;
+	snprintf(machine.romFilename, sizeof(machine.romFilename), "%s", commandLine.romPath);
+	ResetMachine(&cpuState, &machine);
+	
+	u64 romFileSize = 0;
+	u8 *romContents = PlatformReadEntireFile(machine.romFilename, &romFileSize);
+	if (!romContents)
+	{
+		fprintf(stderr, "Could not load ROM: %s\n", machine.romFilename);
+		return 1;
+	}
+	PlatformROMImage *romImage = PlatformCreateROMImage(romContents, (romFileSize < machine.romSize) ? romFileSize : machine.romSize);
+	cpuState.memory = romImage ? PlatformMapInstanceMemory(romImage) : 0;
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(romContents);
+	if (!cpuState.memory)
+	{
+		fprintf(stderr, "Could not map memory for %s\n", machine.romFilename);
+		return 1;
+	}
+	
+	Headless_StopConditions *conditions = &commandLine.conditions;
+	
+	MoviePlayer moviePlayer = {};
+	MoviePlayer *movie = 0;
+	if (commandLine.moviePath)
+	{
+		if (!BeginMoviePlayback(&moviePlayer, commandLine.moviePath, &cpuState, &machine))
+		{
+			fprintf(stderr, "Could not play movie %s, it is missing, damaged or for another ROM\n", commandLine.moviePath);
+			return 1;
+		}
+		movie = &moviePlayer;
+		
+		// NOTE(bSalmon): There is no input past the end so it is always a stop condition
+		MovieHeader *header = movie->header;
+		conditions->checkMovieEnd = true;
+		conditions->movieCycleKeyed = ((MovieKeying)header->keying == MovieKeying::CYCLE);
+		conditions->movieLength = conditions->movieCycleKeyed ? header->cycleCount : header->frameCount;
+	}
+	conditions->startFrame = machine.frameCount;
+	conditions->startCycle = machine.cycles;
+	
+	CheckpointWriter checkpointWriter = {};
+	b32 writingCheckpoints = false;
+	u64 nextCheckpointFrame = 0;
+	if (commandLine.checkpointPath)
+	{
+		linuxDisableIOURing = commandLine.disableIOURing;
+		CheckpointWriterError checkpointError = BeginCheckpointWriter(&checkpointWriter, commandLine.checkpointPath, &cpuState,
+																	  commandLine.compressCheckpoints);
+		if (checkpointError != CheckpointWriterError::NONE)
+		{
+			fprintf(stderr, "Could not start writing checkpoints to %s, %s\n", commandLine.checkpointPath,
+					checkpointWriterErrorNames[(u32)checkpointError]);
+			return 1;
+		}
+		writingCheckpoints = true;
+		nextCheckpointFrame = machine.frameCount + commandLine.checkpointFrames;
+	}
+	
+	FrameDump frameDump = {};
+	b32 dumpingFrames = false;
+	if (commandLine.dumpPath)
+	{
+		dumpingFrames = BeginFrameDump(&frameDump, commandLine.dumpPath, commandLine.dumpFormat, 224, 256, machine.enableColour);
+		if (!dumpingFrames)
+		{
+			fprintf(stderr, "Could not dump frames to %s, it can't be opened or has a %% that isn't one ppm frame number field\n",
+					commandLine.dumpPath);
+			return 1;
+		}
+	}
+	
+	// NOTE(bSalmon): Frames are streamed to stdout with -dump -, so the report goes to stderr
+	FILE *report = (dumpingFrames && strcmp(commandLine.dumpPath, "-") == 0) ? stderr : stdout;
+	
+	b32 checkEachInstruction = conditions->checkPC || conditions->checkMemory;
+	
+	StopReason stopReason = StopReason::NONE;
+	
+	u64 startTime = PlatformGetWallClock();
+	u64 startTSC = ReadTimestampCounter();
+	
+	while (stopReason == StopReason::NONE)
+	{
+		u64 frameCount = machine.frameCount;
+		
+		// NOTE(bSalmon): Whole frames that can't hit a condition go through the normal frame loop
+		u64 cyclesAfterFrame = (machine.cycles - conditions->startCycle) + CYCLES_PER_FRAME;
+		b32 frameHitsCycleLimit = (conditions->maxCycles && cyclesAfterFrame >= conditions->maxCycles) ||
+			(conditions->checkMovieEnd && conditions->movieCycleKeyed && cyclesAfterFrame >= conditions->movieLength);
+		if (checkEachInstruction || frameHitsCycleLimit)
+		{
+			stopReason = Headless_EmulateFrameChecked(&cpuState, &machine, conditions, movie);
+		}
+		else if (movie)
+		{
+			EmulateMovieFrame(movie, &cpuState, &machine);
+		}
+		else
+		{
+			EmulateFrame(&cpuState, &machine);
+		}
+		
+		// NOTE(bSalmon): A run stopped part way through a frame doesn't dump the partial frame
+		if (dumpingFrames && machine.frameCount != frameCount)
+		{
+			SubmitFrameDump(&frameDump, &cpuState, machine.frameCount);
+		}
+		
+		if (writingCheckpoints && machine.frameCount >= nextCheckpointFrame)
+		{
+			SubmitCheckpoint(&checkpointWriter, &cpuState, &machine);
+			nextCheckpointFrame = machine.frameCount + commandLine.checkpointFrames;
+		}
+		
+		if (stopReason == StopReason::NONE)
+		{
+			if (IsMachineStopped(&cpuState))
+			{
+				stopReason = StopReason::HALTED;
+			}
+			else
+			{
+				stopReason = Headless_CheckLimits(&machine, conditions);
+			}
+		}
+	}
+	
+	u64 endTSC = ReadTimestampCounter();
+	f64 secondsElapsed = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	if (secondsElapsed <= 0.0)
+	{
+		secondsElapsed = 1e-9;
+	}
+	
+	// NOTE(bSalmon): Outside the timing, this is where the run waits on the disk
+	CheckpointStats checkpointStats = {};
+	if (writingCheckpoints)
+	{
+		EndCheckpointWriter(&checkpointWriter);
+		checkpointStats = GetCheckpointStats(&checkpointWriter);
+	}
+	FrameDumpStats dumpStats = {};
+	if (dumpingFrames)
+	{
+		EndFrameDump(&frameDump);
+		dumpStats = GetFrameDumpStats(&frameDump);
+	}
+	
+	u64 stateHash = HashMachineState(&cpuState, &machine);
+	u64 frameHash = HashVideoMemory(&cpuState, machine.enableColour);
+	
+	// NOTE(bSalmon): The end state can only be compared if playback stopped right on it
+	b32 movieAtEnd = false;
+	b32 movieMatches = true;
+	if (movie)
+	{
+		movieAtEnd = (machine.frameCount - movie->startFrame) == movie->header->frameCount &&
+			(machine.cycles - movie->startCycle) == movie->header->cycleCount;
+		movieMatches = !movieAtEnd || DoesMovieEndMatch(movie, &cpuState, &machine);
+	}
+	
+	if (commandLine.quiet)
+	{
+		fprintf(report, "%016llx %016llx\n", (unsigned long long)stateHash, (unsigned long long)frameHash);
+	}
+	else
+	{
+		u64 cycles = machine.cycles - conditions->startCycle;
+		u64 frameCount = machine.frameCount - conditions->startFrame;
+		f64 emulatedSeconds = (f64)cycles / CPU_CLOCK_HZ;
+		fprintf(report, "Stopped: %s at PC %04x\n", stopReasonNames[(s32)stopReason], cpuState.programCounter);
+		fprintf(report, "Frames: %llu, Cycles: %llu (%.3fs emulated) in %.3fs\n",
+				(unsigned long long)frameCount, (unsigned long long)cycles, emulatedSeconds, secondsElapsed);
+		fprintf(report, "Speed: %.2f MHz emulated, %.1f fps, %.1fx real time, %.1f host cycles per 8080 cycle\n",
+				(cycles / secondsElapsed) / 1000000.0, frameCount / secondsElapsed, emulatedSeconds / secondsElapsed,
+				cycles ? (f64)(endTSC - startTSC) / cycles : 0.0);
+		fprintf(report, "State Hash: %016llx\n", (unsigned long long)stateHash);
+		fprintf(report, "Frame Hash: %016llx\n", (unsigned long long)frameHash);
+		if (movie)
+		{
+			fprintf(report, "Movie: %u input changes from frame %llu, %s\n", movie->header->changeCount,
+					(unsigned long long)movie->startFrame,
+					movieAtEnd ? (movieMatches ? "end state matches" : "end state DIFFERS") : "stopped before the end");
+		}
+		if (writingCheckpoints)
+		{
+			u64 writtenCount = checkpointStats.writtenCheckpoints;
+			fprintf(report, "Checkpoints (%s): %llu written, %llu superseded, %llu dropped, %llu failed in %llu batches (largest %u)\n",
+					Linux_GetFileBatchBackend(), (unsigned long long)writtenCount,
+					(unsigned long long)checkpointStats.supersededCheckpoints, (unsigned long long)checkpointStats.droppedCheckpoints,
+					(unsigned long long)checkpointStats.failedCheckpoints, (unsigned long long)checkpointStats.batches,
+					checkpointStats.maxBatchSize);
+			fprintf(report, "Checkpoint files avg %llu bytes%s\n",
+					writtenCount ? (unsigned long long)(checkpointStats.bytesWritten / writtenCount) : 0ULL,
+					commandLine.compressCheckpoints ? " compressed" : "");
+			u64 queuedCount = checkpointStats.submittedCheckpoints - checkpointStats.droppedCheckpoints;
+			fprintf(report, "Checkpoint queue depth max %u/%d, latency to disk avg %.2fms max %.2fms, submit avg %.1fus max %.1fus\n",
+					checkpointStats.maxQueueDepth, CHECKPOINT_QUEUE_SIZE,
+					writtenCount ? (checkpointStats.totalLatency / writtenCount) * 1000.0 : 0.0, checkpointStats.maxLatency * 1000.0,
+					queuedCount ? (checkpointStats.totalSubmitTime / queuedCount) * 1000000.0 : 0.0,
+					checkpointStats.maxSubmitTime * 1000000.0);
+		}
+		if (dumpingFrames)
+		{
+			fprintf(report, "Frame Dump (%s): %llu submitted, %llu written, %llu dropped, max queue depth %u/%u\n",
+					frameDumpFormatNames[(u32)commandLine.dumpFormat], (unsigned long long)dumpStats.submittedFrames,
+					(unsigned long long)dumpStats.writtenFrames, (unsigned long long)dumpStats.droppedFrames,
+					dumpStats.maxQueueDepth, FRAME_DUMP_QUEUE_SIZE);
+		}
+	}
+	
+	if (dumpStats.writeFailed)
+	{
+		fprintf(stderr, "Failed writing frames to %s\n", commandLine.dumpPath);
+	}
+	
+	if (checkpointStats.failedCheckpoints)
+	{
+		fprintf(stderr, "Failed writing %llu checkpoints to %s\n", (unsigned long long)checkpointStats.failedCheckpoints,
+				commandLine.checkpointPath);
+	}
+	
+	if (!movieMatches)
+	{
+		fprintf(stderr, "Movie playback did not reach the recorded end state\n");
+	}
+	
+	if (movie)
+	{
+		EndMoviePlayback(movie);
+	}
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	return (movieMatches && !dumpStats.writeFailed && !checkpointStats.failedCheckpoints) ? 0 : 1;
+}
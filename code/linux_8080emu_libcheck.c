@@ -0,0 +1,302 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_libcheck.c
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Library Check, a plain C program that only uses 8080emu_lib.h, built against both the static
+and the shared library. Every instance plays its own scripted game (coin, start, then moves
+and shots picked by a seeded random number per instance). The games are first played one
+after another on this thread to get the expected results, then all at once on one thread per
+instance. Each threaded instance must match its single threaded run: the state hash every
+second, and at the end the state hash, the frame hash and every pixel of the framebuffer.
+
+Usage: linux_8080emu_libcheck <rom> [-instances N] [-frames N]
+
+-instances is how many instances run at once (default 4, at most 64), -frames how many frames
+each one plays (default 3600).
+
+Exits with 1 if any instance differs from its single threaded run.
+*/
+
+#include "8080emu_lib.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LIBCHECK_MAX_INSTANCES 64
+#define LIBCHECK_HASH_INTERVAL 60
+
+typedef struct LibCheckRun
+{
+	const void *rom;
+	size_t romSize;
+	uint32_t seed;
+	uint64_t frameCount;
+	
+	// NOTE(bSalmon): Filled in by the run
+	int failed;
+	uint64_t *stateHashes;
+	uint64_t finalStateHash;
+	uint64_t finalFrameHash;
+	uint32_t *pixels;
+	int32_t pixelBytes;
+} LibCheckRun;
+
+static uint32_t NextLibCheckRandom(uint32_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+// Inputs for one frame of a run's script, every input is set each frame so none stay held by accident
+static void ApplyLibCheckScript(Emu8080 *emu, uint64_t frame, uint32_t *random)
+{
+	Emu8080_SetInput(emu, EMU8080_INPUT_COIN, frame >= 60 && frame < 66);
+	Emu8080_SetInput(emu, EMU8080_INPUT_P1_START, frame >= 120 && frame < 126);
+	
+	int left = 0;
+	int right = 0;
+	int shoot = 0;
+	if (frame >= 200)
+	{
+		uint32_t roll = NextLibCheckRandom(random);
+		left = (roll & 3) == 1;
+		right = (roll & 3) == 2;
+		shoot = (roll & 0x30) == 0x30;
+	}
+	Emu8080_SetInput(emu, EMU8080_INPUT_P1_LEFT, left);
+	Emu8080_SetInput(emu, EMU8080_INPUT_P1_RIGHT, right);
+	Emu8080_SetInput(emu, EMU8080_INPUT_P1_SHOOT, shoot);
+}
+
+static void *PlayLibCheckRun(void *data)
+{
+	LibCheckRun *run = (LibCheckRun *)data;
+	
+	Emu8080 *emu = Emu8080_Create();
+	if (!emu)
+	{
+		return 0;
+	}
+	
+	if (Emu8080_LoadROM(emu, run->rom, run->romSize) == EMU8080_OK)
+	{
+		uint32_t random = 0x9E3779B9u ^ (run->seed * 0x85EBCA6Bu);
+		for (uint64_t frame = 0; frame < run->frameCount; ++frame)
+		{
+			ApplyLibCheckScript(emu, frame, &random);
+			Emu8080_RunFrames(emu, 1);
+			
+			if ((frame % LIBCHECK_HASH_INTERVAL) == 0)
+			{
+				run->stateHashes[frame / LIBCHECK_HASH_INTERVAL] = Emu8080_GetStateHash(emu);
+			}
+		}
+		
+		Emu8080_Framebuffer framebuffer;
+		if (Emu8080_GetFramebuffer(emu, &framebuffer) == EMU8080_OK)
+		{
+			run->finalStateHash = Emu8080_GetStateHash(emu);
+			run->finalFrameHash = Emu8080_GetFrameHash(emu);
+			run->pixelBytes = framebuffer.pitch * framebuffer.height;
+			run->pixels = (uint32_t *)malloc(run->pixelBytes);
+			if (run->pixels)
+			{
+				memcpy(run->pixels, framebuffer.pixels, run->pixelBytes);
+				run->failed = 0;
+			}
+		}
+	}
+	
+	Emu8080_Destroy(emu);
+	return 0;
+}
+
+static int InitLibCheckRun(LibCheckRun *run, const void *rom, size_t romSize, uint32_t seed, uint64_t frameCount)
+{
+	memset(run, 0, sizeof(*run));
+	run->failed = 1;
+	run->rom = rom;
+	run->romSize = romSize;
+	run->seed = seed;
+	run->frameCount = frameCount;
+	run->stateHashes = (uint64_t *)calloc((frameCount / LIBCHECK_HASH_INTERVAL) + 1, sizeof(uint64_t));
+	
+	return run->stateHashes != 0;
+}
+
+static void FreeLibCheckRun(LibCheckRun *run)
+{
+	free(run->stateHashes);
+	free(run->pixels);
+}
+
+// Returns 0 if the runs ended up the same and said how far they got alike if not
+static int CompareLibCheckRuns(LibCheckRun *expected, LibCheckRun *actual, uint32_t instance)
+{
+	if (expected->failed || actual->failed)
+	{
+		fprintf(stderr, "Instance %u: the run failed\n", instance);
+		return 1;
+	}
+	
+	uint64_t hashCount = (expected->frameCount / LIBCHECK_HASH_INTERVAL) + 1;
+	for (uint64_t hashIndex = 0; hashIndex < hashCount; ++hashIndex)
+	{
+		if (expected->stateHashes[hashIndex] != actual->stateHashes[hashIndex])
+		{
+			fprintf(stderr, "Instance %u: state differs from frame %llu\n", instance,
+					(unsigned long long)(hashIndex * LIBCHECK_HASH_INTERVAL));
+			return 1;
+		}
+	}
+	
+	if (expected->finalStateHash != actual->finalStateHash || expected->finalFrameHash != actual->finalFrameHash ||
+		expected->pixelBytes != actual->pixelBytes || memcmp(expected->pixels, actual->pixels, expected->pixelBytes) != 0)
+	{
+		fprintf(stderr, "Instance %u: the final state or framebuffer differs\n", instance);
+		return 1;
+	}
+	
+	return 0;
+}
+
+static void *ReadLibCheckFile(const char *path, size_t *size)
+{
+	void *result = 0;
+	FILE *file = fopen(path, "rb");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		long fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if (fileSize > 0)
+		{
+			result = malloc(fileSize);
+			if (result && fread(result, 1, fileSize, file) != (size_t)fileSize)
+			{
+				free(result);
+				result = 0;
+			}
+			*size = (size_t)fileSize;
+		}
+		fclose(file);
+	}
+	
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	char *romPath = 0;
+	uint32_t instanceCount = 4;
+	uint64_t frameCount = 3600;
+	for (int argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		int hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-instances") == 0 && hasValue)
+		{
+			instanceCount = (uint32_t)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			frameCount = strtoull(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			romPath = args[argIndex];
+		}
+	}
+	
+	if (!romPath || !instanceCount || instanceCount > LIBCHECK_MAX_INSTANCES)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-instances N] [-frames N]\n", args[0]);
+		return 1;
+	}
+	
+	size_t romSize = 0;
+	void *rom = ReadLibCheckFile(romPath, &romSize);
+	if (!rom)
+	{
+		fprintf(stderr, "Failed to read %s\n", romPath);
+		return 1;
+	}
+	
+	static LibCheckRun expected[LIBCHECK_MAX_INSTANCES];
+	static LibCheckRun actual[LIBCHECK_MAX_INSTANCES];
+	for (uint32_t instance = 0; instance < instanceCount; ++instance)
+	{
+		if (!InitLibCheckRun(&expected[instance], rom, romSize, instance, frameCount) ||
+			!InitLibCheckRun(&actual[instance], rom, romSize, instance, frameCount))
+		{
+			fprintf(stderr, "Failed to allocate memory\n");
+			return 1;
+		}
+	}
+	
+	// NOTE(bSalmon): One after another on this thread first, these are what the threaded runs must match
+	for (uint32_t instance = 0; instance < instanceCount; ++instance)
+	{
+		PlayLibCheckRun(&expected[instance]);
+	}
+	
+	pthread_t threads[LIBCHECK_MAX_INSTANCES];
+	uint32_t startedCount = 0;
+	for (; startedCount < instanceCount; ++startedCount)
+	{
+		if (pthread_create(&threads[startedCount], 0, PlayLibCheckRun, &actual[startedCount]) != 0)
+		{
+			break;
+		}
+	}
+	for (uint32_t instance = 0; instance < startedCount; ++instance)
+	{
+		pthread_join(threads[instance], 0);
+	}
+	
+	uint32_t mismatchCount = 0;
+	for (uint32_t instance = 0; instance < instanceCount; ++instance)
+	{
+		mismatchCount += CompareLibCheckRuns(&expected[instance], &actual[instance], instance);
+	}
+	
+	printf("%u instances on %u threads played %llu frames each\n", instanceCount, startedCount,
+		   (unsigned long long)frameCount);
+	for (uint32_t instance = 0; instance < instanceCount; ++instance)
+	{
+		printf("Instance %u: state %016llx frame %016llx\n", instance, (unsigned long long)actual[instance].finalStateHash,
+			   (unsigned long long)actual[instance].finalFrameHash);
+	}
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every threaded instance matched its single threaded run");
+	
+	for (uint32_t instance = 0; instance < instanceCount; ++instance)
+	{
+		FreeLibCheckRun(&expected[instance]);
+		FreeLibCheckRun(&actual[instance]);
+	}
+	free(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
@@ -0,0 +1,234 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_lockstep.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Lockstep Benchmark, runs a group of lanes on the experimental lockstep interpreter (see
+8080emu_lockstep.cpp) and the same lanes one after another with the scalar EmulateFrame(),
+then checks every lane ended up in the same state both ways.
+
+Usage: linux_8080emu_lockstep <rom> [-lanes N] [-frames N] [-players N]
+
+-lanes defaults to 32 (the most a group holds) and -frames to 600. -players N gives the lanes
+N different bot players, lane i gets player i % N, so -players 1 has every lane playing the
+same game and -players equal to -lanes has none the same. With no -players every lane sits
+in attract mode.
+
+Prints the time and emulated MHz of both, how well the lanes were kept in step and the
+result of the check. Exits with 1 if any lane differs.
+
+Lanes playing different games drift further apart the longer they run, so utilisation depends
+heavily on -frames. Measured on invaders with 32 lanes, SSE2, -players 32:
+  -frames 600   47.9% utilisation, lockstep 0.40x scalar
+  -frames 1800  15.3% utilisation, lockstep 0.20x scalar
+  -frames 3600  11.4% utilisation, lockstep 0.17x scalar
+Attract mode (no -players) stays at 100% utilisation and about 0.5x scalar.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_lockstep.cpp"
+
+struct LockstepCommandLine
+{
+	char *romPath;
+	u32 laneCount;
+	u32 frameCount;
+	u32 playerCount;
+};
+
+global_var LockstepGroup globalGroup;
+
+internal_func LockstepCommandLine ParseLockstepCommandLine(s32 argCount, char **args)
+{
+	LockstepCommandLine result = {};
+	result.laneCount = LOCKSTEP_MAX_LANES;
+	result.frameCount = 600;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-lanes") == 0 && hasValue)
+		{
+			result.laneCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-players") == 0 && hasValue)
+		{
+			result.playerCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	if (result.laneCount < 1)
+	{
+		result.laneCount = 1;
+	}
+	else if (result.laneCount > LOCKSTEP_MAX_LANES)
+	{
+		result.laneCount = LOCKSTEP_MAX_LANES;
+	}
+	
+	return result;
+}
+
+internal_func void InitLaneBots(BotPlayer *bots, u32 laneCount, u32 playerCount)
+{
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		InitBotPlayer(&bots[lane], playerCount ? (lane % playerCount) : 0);
+	}
+}
+
+int main(int argCount, char **args)
+{
+	LockstepCommandLine commandLine = ParseLockstepCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-lanes N] [-frames N] [-players N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	if (!rom)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	u32 laneCount = commandLine.laneCount;
+	PlatformROMImage *romImage = PlatformCreateROMImage(rom, romSize);
+	u8 *laneMemory[LOCKSTEP_MAX_LANES];
+	u8 *scalarMemory[LOCKSTEP_MAX_LANES];
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		laneMemory[lane] = romImage ? PlatformMapInstanceMemory(romImage) : 0;
+		scalarMemory[lane] = romImage ? PlatformMapInstanceMemory(romImage) : 0;
+		if (!laneMemory[lane] || !scalarMemory[lane])
+		{
+			fprintf(stderr, "Failed to map memory for %u lanes\n", laneCount);
+			return 1;
+		}
+	}
+	
+	BotPlayer bots[LOCKSTEP_MAX_LANES];
+	
+	// Lockstep
+	LockstepGroup *group = &globalGroup;
+	InitLockstepGroup(group, laneCount, laneMemory);
+	InitLaneBots(bots, laneCount, commandLine.playerCount);
+	
+	u64 startTime = PlatformGetWallClock();
+	for (u32 frameIndex = 0; frameIndex < commandLine.frameCount; ++frameIndex)
+	{
+		if (commandLine.playerCount)
+		{
+			for (u32 lane = 0; lane < laneCount; ++lane)
+			{
+				UpdateBotPlayer(&bots[lane], &group->machines[lane]);
+			}
+		}
+		EmulateLockstepFrame(group);
+	}
+	f64 lockstepSeconds = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	
+	// Scalar reference, lane by lane
+	CPUState cpuStates[LOCKSTEP_MAX_LANES] = {};
+	MachineState machines[LOCKSTEP_MAX_LANES] = {};
+	InitLaneBots(bots, laneCount, commandLine.playerCount);
+	
+	startTime = PlatformGetWallClock();
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		cpuStates[lane].memory = scalarMemory[lane];
+		machines[lane].romSize = 0x2000;
+		ResetMachine(&cpuStates[lane], &machines[lane]);
+		
+		for (u32 frameIndex = 0; frameIndex < commandLine.frameCount; ++frameIndex)
+		{
+			if (commandLine.playerCount)
+			{
+				UpdateBotPlayer(&bots[lane], &machines[lane]);
+			}
+			EmulateFrame(&cpuStates[lane], &machines[lane]);
+		}
+	}
+	f64 scalarSeconds = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	
+	u32 mismatchCount = 0;
+	u64 totalCycles = 0;
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		CPUState laneState;
+		LoadLockstepLane(group, lane, &laneState);
+		if (HashMachineState(&laneState, &group->machines[lane]) != HashMachineState(&cpuStates[lane], &machines[lane]) ||
+			group->machines[lane].cycles != machines[lane].cycles)
+		{
+			fprintf(stderr, "Lane %u differs from the scalar run\n", lane);
+			mismatchCount++;
+		}
+		totalCycles += machines[lane].cycles;
+	}
+	
+	LockstepStats *stats = &group->stats;
+	u64 totalInstructions = stats->vectorInstructions + stats->scalarInstructions;
+	
+	printf("%u lanes, %u frames, %u distinct players, %u-byte vectors\n", laneCount, commandLine.frameCount,
+		   commandLine.playerCount, LOCKSTEP_VECTOR_WIDTH);
+	printf("Lockstep: %.3fs, %.1f emulated MHz\n", lockstepSeconds, (totalCycles / lockstepSeconds) / 1000000.0);
+	printf("Scalar:   %.3fs, %.1f emulated MHz, lockstep is %.2fx\n", scalarSeconds,
+		   (totalCycles / scalarSeconds) / 1000000.0, scalarSeconds / lockstepSeconds);
+	printf("Steps: %llu, lane utilisation %.1f%%, %.1f%% of instructions on the vector path\n",
+		   (unsigned long long)stats->steps, GetLockstepLaneUtilisation(stats) * 100.0,
+		   totalInstructions ? ((f64)stats->vectorInstructions / totalInstructions) * 100.0 : 0.0);
+	printf("Vector steps: %llu, %.1f lanes per vector step\n", (unsigned long long)stats->vectorSteps,
+		   stats->vectorSteps ? (f64)stats->vectorInstructions / stats->vectorSteps : 0.0);
+	
+	// NOTE(bSalmon): Where the vector steps' lane counts fall, in quarters of the group
+	u64 quarterSteps[4] = {};
+	for (u32 lanes = LOCKSTEP_MIN_VECTOR_LANES; lanes <= laneCount; ++lanes)
+	{
+		quarterSteps[((lanes - 1) * 4) / laneCount] += stats->vectorStepLanes[lanes];
+	}
+	printf("Vector steps by lanes used: <=25%% %llu, <=50%% %llu, <=75%% %llu, <=100%% %llu\n",
+		   (unsigned long long)quarterSteps[0], (unsigned long long)quarterSteps[1],
+		   (unsigned long long)quarterSteps[2], (unsigned long long)quarterSteps[3]);
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every lane matches the scalar run");
+	
+	for (u32 lane = 0; lane < laneCount; ++lane)
+	{
+		PlatformUnmapInstanceMemory(laneMemory[lane]);
+		PlatformUnmapInstanceMemory(scalarMemory[lane]);
+	}
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
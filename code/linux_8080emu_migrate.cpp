@@ -0,0 +1,443 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_migrate.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Migration Test, one running game is handed along a line of worker processes over Unix
+sockets with live migration (see 8080emu_migrate.cpp).
+
+Worker 0 starts the game with a bot player (see 8080emu_bot.cpp). After -frames frames it
+starts sending the machine to worker 1 and keeps playing while the rounds go out, then stops,
+sends the commit with the bot in it and worker 1 carries on from there. Each worker does the
+same in turn for -hops hops. -bandwidth limits the bytes a source sends per frame it plays,
+0 sends as fast as the socket takes them.
+
+Afterwards the coordinator plays the same game in one machine, the last worker must finish in
+exactly that state. Prints the rounds, bytes and pause of every hop.
+
+Usage: linux_8080emu_migrate <rom> [-hops N] [-frames N] [-bandwidth BYTES] [-seed N]
+
+Defaults are 8 hops, 600 frames a worker, no bandwidth limit and seed 1. Exits with 1 if the
+game doesn't end up where the reference does.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_migrate.cpp"
+#include "8080emu_bot.cpp"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define MIGRATE_MAX_HOPS 64
+
+struct MigrateCommandLine
+{
+	char *romPath;
+	u32 hopCount;
+	u32 frameCount;
+	u32 bandwidth;
+	u32 seed;
+};
+
+struct MigrateWorkerResult
+{
+	b32 succeeded;
+	
+	// NOTE(bSalmon): Sending side, the pause is as the target measured it
+	MigrationStats sent;
+	u32 precopyFrames;
+	u64 commitFrame;
+	
+	u64 finalHash;
+	u64 finalFrame;
+};
+
+internal_func MigrateCommandLine ParseMigrateCommandLine(s32 argCount, char **args)
+{
+	MigrateCommandLine result = {};
+	result.hopCount = 8;
+	result.frameCount = 600;
+	result.seed = 1;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-hops") == 0 && hasValue)
+		{
+			result.hopCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-bandwidth") == 0 && hasValue)
+		{
+			result.bandwidth = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-seed") == 0 && hasValue)
+		{
+			result.seed = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+internal_func b32 ReadMigrateSocket(s32 socketHandle, u8 *dest, u32 size)
+{
+	while (size)
+	{
+		ssize_t received = recv(socketHandle, dest, size, 0);
+		if (received < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (received <= 0)
+		{
+			return false;
+		}
+		dest += received;
+		size -= (u32)received;
+	}
+	
+	return true;
+}
+
+// Sends up to maxBytes of what the source has left without waiting, 0 for no limit
+internal_func b32 SendMigrateData(s32 socketHandle, MigrationSource *source, u32 maxBytes)
+{
+	u32 size = 0;
+	u8 *data = GetMigrationSendData(source, &size);
+	if (maxBytes && size > maxBytes)
+	{
+		size = maxBytes;
+	}
+	
+	ssize_t sent = size ? send(socketHandle, data, size, MSG_DONTWAIT | MSG_NOSIGNAL) : 0;
+	if (sent > 0)
+	{
+		AdvanceMigrationSend(source, (u32)sent);
+	}
+	
+	b32 result = (sent >= 0) || (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+	return result;
+}
+
+internal_func b32 SendAllMigrateData(s32 socketHandle, MigrationSource *source)
+{
+	while (!IsMigrationMessageSent(source))
+	{
+		if (!SendMigrateData(socketHandle, source, 0))
+		{
+			return false;
+		}
+		
+		if (!IsMigrationMessageSent(source))
+		{
+			pollfd waitFor = {socketHandle, POLLOUT, 0};
+			poll(&waitFor, 1, -1);
+		}
+	}
+	
+	return true;
+}
+
+// Takes the machine from the worker before, returns false if it never arrives whole
+internal_func b32 ReceiveMigratedMachine(s32 socketHandle, CPUState *cpuState, MachineState *machine, BotPlayer *bot)
+{
+	MigrationTarget target;
+	if (!BeginMigrationTarget(&target))
+	{
+		return false;
+	}
+	
+	b32 result = true;
+	while (result && !target.committed)
+	{
+		result = ReadMigrateSocket(socketHandle, target.buffer, sizeof(MigrationMessage));
+		u32 remaining = result ? GetMigrationMessageRemaining(&target) : 0;
+		result = result && ReadMigrateSocket(socketHandle, target.buffer + sizeof(MigrationMessage), remaining) &&
+			ApplyMigrationMessage(&target, cpuState, machine);
+	}
+	
+	if (result)
+	{
+		// NOTE(bSalmon): Running again from here, the answer can go after
+		MigrationMessage resumed;
+		BuildMigrationResumed(&target, &resumed, PlatformGetWallClock());
+		result = (target.userDataSize == sizeof(BotPlayer));
+		memcpy(bot, target.userData, sizeof(BotPlayer));
+		send(socketHandle, &resumed, sizeof(resumed), MSG_NOSIGNAL);
+	}
+	
+	EndMigrationTarget(&target);
+	return result;
+}
+
+internal_func void PlayMigrateFrame(CPUState *cpuState, MachineState *machine, BotPlayer *bot)
+{
+	UpdateBotPlayer(bot, machine);
+	EmulateFrame(cpuState, machine);
+}
+
+// Sends the machine to the next worker while it keeps playing, returns false if it doesn't go
+internal_func b32 SendMigratedMachine(s32 socketHandle, CPUState *cpuState, MachineState *machine, BotPlayer *bot, u32 bandwidth,
+									  MigrateWorkerResult *result)
+{
+	MigrationSource source;
+	if (!BeginMigrationSource(&source, cpuState))
+	{
+		return false;
+	}
+	
+	b32 succeeded = true;
+	for (;;)
+	{
+		succeeded = SendMigrateData(socketHandle, &source, bandwidth);
+		if (!succeeded)
+		{
+			break;
+		}
+		
+		if (IsMigrationMessageSent(&source))
+		{
+			if (ShouldCommitMigration(&source, cpuState))
+			{
+				break;
+			}
+			BuildMigrationRound(&source, cpuState);
+		}
+		
+		PlayMigrateFrame(cpuState, machine, bot);
+		result->precopyFrames++;
+	}
+	
+	if (succeeded)
+	{
+		result->commitFrame = machine->frameCount;
+		BuildMigrationCommit(&source, cpuState, machine, bot, sizeof(*bot), PlatformGetWallClock());
+		
+		MigrationMessage resumed;
+		succeeded = SendAllMigrateData(socketHandle, &source) &&
+			ReadMigrateSocket(socketHandle, (u8 *)&resumed, sizeof(resumed)) &&
+			ReceiveMigrationResumed(&source, &resumed, sizeof(resumed));
+	}
+	
+	result->sent = source.stats;
+	EndMigrationSource(&source);
+	return succeeded;
+}
+
+internal_func void InitMigrateMachine(CPUState *cpuState, MachineState *machine, PlatformROMImage *romImage)
+{
+	*cpuState = {};
+	*machine = {};
+	machine->romSize = 0x2000;
+	ResetMachine(cpuState, machine);
+	cpuState->memory = PlatformMapInstanceMemory(romImage);
+}
+
+internal_func MigrateWorkerResult RunMigrateWorker(MigrateCommandLine *commandLine, PlatformROMImage *romImage, u32 worker,
+												   s32 receiveSocket, s32 sendSocket)
+{
+	MigrateWorkerResult result = {};
+	
+	CPUState cpuState;
+	MachineState machine;
+	BotPlayer bot;
+	InitMigrateMachine(&cpuState, &machine, romImage);
+	if (!cpuState.memory)
+	{
+		return result;
+	}
+	
+	if (receiveSocket >= 0)
+	{
+		if (!ReceiveMigratedMachine(receiveSocket, &cpuState, &machine, &bot))
+		{
+			return result;
+		}
+	}
+	else
+	{
+		InitBotPlayer(&bot, commandLine->seed);
+	}
+	
+	u64 handOnFrame = (u64)(worker + 1) * commandLine->frameCount;
+	while (machine.frameCount < handOnFrame)
+	{
+		PlayMigrateFrame(&cpuState, &machine, &bot);
+	}
+	
+	if (sendSocket >= 0)
+	{
+		result.succeeded = SendMigratedMachine(sendSocket, &cpuState, &machine, &bot, commandLine->bandwidth, &result);
+	}
+	else
+	{
+		result.succeeded = true;
+		result.finalHash = HashMachineState(&cpuState, &machine);
+		result.finalFrame = machine.frameCount;
+	}
+	
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	MigrateCommandLine commandLine = ParseMigrateCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.hopCount || commandLine.hopCount > MIGRATE_MAX_HOPS || !commandLine.frameCount)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-hops N] [-frames N] [-bandwidth BYTES] [-seed N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, (romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	// NOTE(bSalmon): sockets[hop][0] is worker hop's end, sockets[hop][1] the next worker's
+	s32 sockets[MIGRATE_MAX_HOPS][2];
+	for (u32 hop = 0; hop < commandLine.hopCount; ++hop)
+	{
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets[hop]) != 0)
+		{
+			fprintf(stderr, "Failed to create a Unix socket pair\n");
+			return 1;
+		}
+	}
+	
+	u32 workerCount = commandLine.hopCount + 1;
+	printf("%u workers, %u frames each, %s\n", workerCount, commandLine.frameCount,
+		   commandLine.bandwidth ? "bandwidth limited" : "no bandwidth limit");
+	if (commandLine.bandwidth)
+	{
+		printf("Sources send at most %u bytes a frame while they play on\n", commandLine.bandwidth);
+	}
+	fflush(stdout);
+	
+	pid_t processIDs[MIGRATE_MAX_HOPS + 1];
+	s32 resultPipes[MIGRATE_MAX_HOPS + 1];
+	for (u32 worker = 0; worker < workerCount; ++worker)
+	{
+		s32 pipeHandles[2];
+		if (pipe(pipeHandles) != 0)
+		{
+			fprintf(stderr, "Failed to create a pipe\n");
+			return 1;
+		}
+		
+		processIDs[worker] = fork();
+		if (processIDs[worker] == 0)
+		{
+			close(pipeHandles[0]);
+			s32 receiveSocket = worker ? sockets[worker - 1][1] : -1;
+			s32 sendSocket = (worker < commandLine.hopCount) ? sockets[worker][0] : -1;
+			MigrateWorkerResult workerResult = RunMigrateWorker(&commandLine, romImage, worker, receiveSocket, sendSocket);
+			write(pipeHandles[1], &workerResult, sizeof(workerResult));
+			_exit(0);
+		}
+		close(pipeHandles[1]);
+		resultPipes[worker] = pipeHandles[0];
+	}
+	for (u32 hop = 0; hop < commandLine.hopCount; ++hop)
+	{
+		close(sockets[hop][0]);
+		close(sockets[hop][1]);
+	}
+	
+	u32 failureCount = 0;
+	MigrateWorkerResult lastResult = {};
+	u64 totalPause = 0;
+	u64 maxPause = 0;
+	for (u32 worker = 0; worker < workerCount; ++worker)
+	{
+		MigrateWorkerResult workerResult = {};
+		b32 received = (read(resultPipes[worker], &workerResult, sizeof(workerResult)) == sizeof(workerResult));
+		waitpid(processIDs[worker], 0, 0);
+		close(resultPipes[worker]);
+		
+		if (!received || !workerResult.succeeded)
+		{
+			fprintf(stderr, "Worker %u failed\n", worker);
+			failureCount++;
+			continue;
+		}
+		
+		if (worker < commandLine.hopCount)
+		{
+			MigrationStats *sent = &workerResult.sent;
+			printf("Hop %u: %u rounds, %llu pages (%.1fKB) while playing %u frames, commit at frame %llu with %u pages (%u bytes), paused %.1fus\n",
+				   worker + 1, sent->rounds, (unsigned long long)sent->pagesSent, sent->bytesSent / 1024.0, workerResult.precopyFrames,
+				   (unsigned long long)workerResult.commitFrame, sent->commitPages, sent->commitBytes, sent->pauseNanoseconds / 1000.0);
+			totalPause += sent->pauseNanoseconds;
+			maxPause = (sent->pauseNanoseconds > maxPause) ? sent->pauseNanoseconds : maxPause;
+		}
+		else
+		{
+			lastResult = workerResult;
+		}
+	}
+	
+	// NOTE(bSalmon): The same game in one machine, what the last worker must end up at. Sources
+	// play on while they send, so the last worker can finish past hops + 1 lots of -frames
+	CPUState cpuState;
+	MachineState machine;
+	BotPlayer bot;
+	InitMigrateMachine(&cpuState, &machine, romImage);
+	InitBotPlayer(&bot, commandLine.seed);
+	while (machine.frameCount < lastResult.finalFrame)
+	{
+		PlayMigrateFrame(&cpuState, &machine, &bot);
+	}
+	
+	if (lastResult.succeeded && lastResult.finalHash != HashMachineState(&cpuState, &machine))
+	{
+		fprintf(stderr, "The last worker finished at frame %llu in a different state to the reference\n",
+				(unsigned long long)lastResult.finalFrame);
+		failureCount++;
+	}
+	
+	printf("Pause: %.1fus average, %.1fus worst\n", (totalPause / 1000.0) / commandLine.hopCount, maxPause / 1000.0);
+	printf("Check: %s\n", failureCount ? "MISMATCH" : "the last worker finished in the same state as the game played in one process");
+	
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return failureCount ? 1 : 0;
+}
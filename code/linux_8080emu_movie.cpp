@@ -0,0 +1,203 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_movie.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Movie Recorder, records a bot playing (see 8080emu_bot.cpp) into an input movie and plays it
+straight back in a fresh instance to check it ends up in exactly the same state. The movie can
+then be played by linux_8080emu_headless -movie or linux_8080emu -movie.
+
+Usage: linux_8080emu_movie <rom> <movie path> [-frames N] [-seed N] [-from N] [-cycle]
+
+-frames is how long the movie is (3600 by default), -seed picks the bot's game. -from starts
+the movie from a state N frames in instead of from power on. -cycle keys the movie by cycle and
+has the bot change its input part way through each frame rather than between frames.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_movie.cpp"
+
+struct MovieCommandLine
+{
+	char *romPath;
+	char *moviePath;
+	u32 frameCount;
+	u32 seed;
+	u32 fromFrame;
+	MovieKeying keying;
+};
+
+internal_func MovieCommandLine ParseMovieCommandLine(s32 argCount, char **args)
+{
+	MovieCommandLine result = {};
+	result.frameCount = 3600;
+	result.seed = 1;
+	result.keying = MovieKeying::FRAME;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-seed") == 0 && hasValue)
+		{
+			result.seed = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-from") == 0 && hasValue)
+		{
+			result.fromFrame = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-cycle") == 0)
+		{
+			result.keying = MovieKeying::CYCLE;
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			if (!result.romPath)
+			{
+				result.romPath = args[argIndex];
+			}
+			else
+			{
+				result.moviePath = args[argIndex];
+			}
+		}
+	}
+	
+	return result;
+}
+
+// Part way through the first half of the frame, somewhere different every frame
+internal_func u64 GetMidFrameCycles(u64 frameCount)
+{
+	u64 result = 1 + (((frameCount + 1) * 2654435761ULL) % ((CYCLES_PER_FRAME / 2) - 32));
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	MovieCommandLine commandLine = ParseMovieCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.moviePath || !commandLine.frameCount)
+	{
+		fprintf(stderr, "Usage: %s <rom> <movie path> [-frames N] [-seed N] [-from N] [-cycle]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, (romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	machine.romSize = 0x2000;
+	ResetMachine(&cpuState, &machine);
+	
+	BotPlayer bot;
+	InitBotPlayer(&bot, commandLine.seed);
+	for (u32 frameIndex = 0; frameIndex < commandLine.fromFrame; ++frameIndex)
+	{
+		UpdateBotPlayer(&bot, &machine);
+		EmulateFrame(&cpuState, &machine);
+	}
+	
+	MovieRecorder recorder;
+	if (!BeginMovieRecording(&recorder, commandLine.keying, commandLine.fromFrame == 0, &cpuState, &machine))
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	b32 recorded = true;
+	for (u32 frameIndex = 0; frameIndex < commandLine.frameCount && recorded; ++frameIndex)
+	{
+		if (commandLine.keying == MovieKeying::CYCLE)
+		{
+			EmulateCycles(&cpuState, &machine, GetMidFrameCycles(machine.frameCount));
+		}
+		UpdateBotPlayer(&bot, &machine);
+		recorded = RecordMovieInput(&recorder, &machine);
+		EmulateFrame(&cpuState, &machine);
+	}
+	
+	u64 recordedHash = HashMachineState(&cpuState, &machine);
+	u64 recordedFrames = machine.frameCount - recorder.startFrame;
+	MovieHeader header = recorder.header;
+	recorded = recorded && EndMovieRecording(&recorder, commandLine.moviePath, &cpuState, &machine);
+	if (!recorded)
+	{
+		fprintf(stderr, "Failed to record %s\n", commandLine.moviePath);
+		return 1;
+	}
+	
+	u64 movieSize = 0;
+	u8 *movieFile = PlatformReadEntireFile(commandLine.moviePath, &movieSize);
+	PlatformFreeMemory(movieFile);
+	printf("Recorded %s: %llu frames, %u input changes in %u bytes, %llu bytes with the %s\n", commandLine.moviePath,
+		   (unsigned long long)recordedFrames, header.changeCount, header.changeBytes,
+		   (unsigned long long)movieSize, (header.flags & MOVIE_FLAG_POWER_ON) ? "header, from power on" : "header and start state");
+	
+	// NOTE(bSalmon): Play back in a fresh instance, unthrottled
+	CPUState playState = {};
+	MachineState playMachine = {};
+	playState.memory = PlatformMapInstanceMemory(romImage);
+	playMachine.romSize = 0x2000;
+	
+	MoviePlayer player;
+	if (!BeginMoviePlayback(&player, commandLine.moviePath, &playState, &playMachine))
+	{
+		fprintf(stderr, "Failed to play %s\n", commandLine.moviePath);
+		return 1;
+	}
+	
+	u64 startTime = PlatformGetWallClock();
+	while (!IsMovieFinished(&player, &playMachine) && !IsMachineStopped(&playState))
+	{
+		EmulateMovieFrame(&player, &playState, &playMachine);
+	}
+	f64 secondsElapsed = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	
+	u64 playedFrames = playMachine.frameCount - player.startFrame;
+	b32 matches = DoesMovieEndMatch(&player, &playState, &playMachine) &&
+		HashMachineState(&playState, &playMachine) == recordedHash;
+	printf("Played back %llu frames in %.3fs (%.0f fps), end state %s\n", (unsigned long long)playedFrames, secondsElapsed,
+		   playedFrames / secondsElapsed, matches ? "matches" : "DIFFERS");
+	
+	EndMoviePlayback(&player);
+	PlatformUnmapInstanceMemory(playState.memory);
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return matches ? 0 : 1;
+}
@@ -0,0 +1,457 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_netplay.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Netplay Test, two peer processes play a two player game against each other over UDP on
+localhost with rollback (see 8080emu_rollback.cpp). Peer 0 is player 1 and peer 1 is player 2,
+each one's controls come from a bot that only it runs, so neither knows what the other will do.
+Both run at 60 frames a second of wall clock, as they would with people playing.
+
+Packets are held back before sending to fake a real network: -delay milliseconds each way, up
+to -jitter more at random, and -loss percent of them are dropped on arrival.
+
+Afterwards the coordinator plays the same game with both bots in one machine and no network.
+Both peers must finish in exactly that state, and their desync checks must all have matched.
+
+Usage: linux_8080emu_netplay <rom> [-frames N] [-delay MS] [-jitter MS] [-loss PERCENT] [-seed N]
+
+Defaults are 600 frames, 50ms delay, no jitter and no loss. Exits with 1 if the peers don't end
+up where the reference does.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_rollback.cpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define NETPLAY_QUEUE_SIZE 512
+#define NETPLAY_LINGER_FRAMES 30
+#define NETPLAY_TIMEOUT_FRAMES (FRAMES_PER_SECOND * 10)
+
+struct NetplayCommandLine
+{
+	char *romPath;
+	u32 frameCount;
+	u32 delayMS;
+	u32 jitterMS;
+	u32 lossPercent;
+	u32 seed;
+};
+
+struct NetplayBot
+{
+	u32 randomState;
+	u8 heldInput;
+	u32 framesLeft;
+};
+
+struct NetplayQueuedPacket
+{
+	b32 used;
+	u64 sendTime;
+	RollbackPacket packet;
+};
+
+struct NetplayPeerResult
+{
+	b32 settled;
+	u64 finalHash;
+	b32 desynced;
+	u32 desyncFrame;
+	u64 packetsDropped;
+	RollbackStats stats;
+};
+
+internal_func NetplayCommandLine ParseNetplayCommandLine(s32 argCount, char **args)
+{
+	NetplayCommandLine result = {};
+	result.frameCount = 600;
+	result.delayMS = 50;
+	result.seed = 1;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-delay") == 0 && hasValue)
+		{
+			result.delayMS = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-jitter") == 0 && hasValue)
+		{
+			result.jitterMS = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-loss") == 0 && hasValue)
+		{
+			result.lossPercent = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-seed") == 0 && hasValue)
+		{
+			result.seed = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+internal_func u32 NextNetplayRandom(u32 *state)
+{
+	// NOTE(bSalmon): xorshift32
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	
+	return x;
+}
+
+internal_func void InitNetplayBot(NetplayBot *bot, u32 seed, u32 player)
+{
+	*bot = {};
+	bot->randomState = ((seed * 2 + player + 1) * 0x9E3779B9) | 1;
+}
+
+// Player 1 puts in two coins, player 2 starts a two player game, then both move and shoot at
+// random. Call once for every frame in order
+internal_func u8 NextNetplayBotInput(NetplayBot *bot, u32 player, u32 frame)
+{
+	u8 result = 0;
+	if (player == 0 && ((frame >= 60 && frame < 70) || (frame >= 90 && frame < 100)))
+	{
+		result = ROLLBACK_INPUT_COIN;
+	}
+	else if (player == 1 && frame >= 150 && frame < 160)
+	{
+		result = ROLLBACK_INPUT_START;
+	}
+	else if (frame >= 200)
+	{
+		if (bot->framesLeft == 0)
+		{
+			local_persist const u8 botInputs[] = {ROLLBACK_INPUT_SHOOT, ROLLBACK_INPUT_LEFT, ROLLBACK_INPUT_RIGHT, 0};
+			u32 random = NextNetplayRandom(&bot->randomState);
+			bot->heldInput = botInputs[random % ARRAY_COUNT(botInputs)];
+			bot->framesLeft = 4 + ((random >> 8) % 30);
+		}
+		
+		bot->framesLeft--;
+		result = bot->heldInput;
+	}
+	
+	return result;
+}
+
+internal_func b32 InitNetplayMachine(CPUState *cpuState, MachineState *machine, PlatformROMImage *romImage)
+{
+	*cpuState = {};
+	*machine = {};
+	cpuState->memory = PlatformMapInstanceMemory(romImage);
+	machine->romSize = 0x2000;
+	ResetMachine(cpuState, machine);
+	
+	b32 result = (cpuState->memory != 0);
+	return result;
+}
+
+internal_func void SendDueNetplayPackets(NetplayQueuedPacket *queue, s32 socketHandle, u64 now)
+{
+	for (u32 queueIndex = 0; queueIndex < NETPLAY_QUEUE_SIZE; ++queueIndex)
+	{
+		NetplayQueuedPacket *queued = &queue[queueIndex];
+		if (queued->used && queued->sendTime <= now)
+		{
+			send(socketHandle, &queued->packet, sizeof(queued->packet), MSG_DONTWAIT);
+			queued->used = false;
+		}
+	}
+}
+
+// A full queue drops the packet, the same as a congested network would
+internal_func void QueueNetplayPacket(NetplayQueuedPacket *queue, RollbackPacket *packet, u64 sendTime)
+{
+	for (u32 queueIndex = 0; queueIndex < NETPLAY_QUEUE_SIZE; ++queueIndex)
+	{
+		NetplayQueuedPacket *queued = &queue[queueIndex];
+		if (!queued->used)
+		{
+			queued->used = true;
+			queued->sendTime = sendTime;
+			queued->packet = *packet;
+			break;
+		}
+	}
+}
+
+internal_func NetplayPeerResult RunNetplayPeer(NetplayCommandLine *commandLine, PlatformROMImage *romImage, u32 player,
+											   s32 socketHandle)
+{
+	NetplayPeerResult result = {};
+	
+	CPUState cpuState;
+	MachineState machine;
+	RollbackSession session;
+	NetplayQueuedPacket *queue = (NetplayQueuedPacket *)PlatformAllocateMemory(NETPLAY_QUEUE_SIZE * sizeof(NetplayQueuedPacket));
+	if (!InitNetplayMachine(&cpuState, &machine, romImage) || !InitRollbackSession(&session, player) || !queue)
+	{
+		return result;
+	}
+	
+	NetplayBot bot;
+	InitNetplayBot(&bot, commandLine->seed, player);
+	u32 randomState = ((commandLine->seed + 17) * 0x9E3779B9 + player) | 1;
+	
+	u64 nanosecondsPerFrame = 1000000000ULL / FRAMES_PER_SECOND;
+	u64 tickTime = PlatformGetWallClock();
+	u32 lingerFrames = 0;
+	u32 tickLimit = commandLine->frameCount + NETPLAY_TIMEOUT_FRAMES;
+	for (u32 tick = 0; tick < tickLimit; ++tick)
+	{
+		u64 now = PlatformGetWallClock();
+		SendDueNetplayPackets(queue, socketHandle, now);
+		
+		RollbackPacket packet;
+		ssize_t packetSize;
+		while ((packetSize = recv(socketHandle, &packet, sizeof(packet), MSG_DONTWAIT)) > 0)
+		{
+			if ((NextNetplayRandom(&randomState) % 100) < commandLine->lossPercent)
+			{
+				result.packetsDropped++;
+			}
+			else
+			{
+				ReceiveRollbackPacket(&session, &packet, (u64)packetSize);
+			}
+		}
+		
+		if (session.frame < commandLine->frameCount)
+		{
+			if (!ShouldRollbackWait(&session))
+			{
+				if (CanAdvanceRollbackFrame(&session))
+				{
+					u8 input = NextNetplayBotInput(&bot, player, session.frame);
+					AdvanceRollbackFrame(&session, &cpuState, &machine, input);
+				}
+				else
+				{
+					session.stats.stalls++;
+				}
+			}
+		}
+		else
+		{
+			ResolveRollback(&session, &cpuState, &machine);
+		}
+		
+		BuildRollbackPacket(&session, &packet);
+		u64 jitterNanoseconds = commandLine->jitterMS ?
+			((u64)(NextNetplayRandom(&randomState) % (commandLine->jitterMS * 1000)) * 1000) : 0;
+		QueueNetplayPacket(queue, &packet, now + ((u64)commandLine->delayMS * 1000000) + jitterNanoseconds);
+		
+		// NOTE(bSalmon): Keep sending for a while after finishing so the other side hears every ack
+		if (IsRollbackSettled(&session, commandLine->frameCount) && session.remoteAcked >= commandLine->frameCount)
+		{
+			result.settled = true;
+			if (++lingerFrames >= NETPLAY_LINGER_FRAMES)
+			{
+				break;
+			}
+		}
+		
+		tickTime += nanosecondsPerFrame;
+		Linux_SleepUntil(tickTime);
+	}
+	
+	result.finalHash = HashMachineState(&cpuState, &machine);
+	result.desynced = session.desynced;
+	result.desyncFrame = session.desyncFrame;
+	result.stats = session.stats;
+	
+	FreeRollbackSession(&session);
+	PlatformFreeMemory(queue);
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	
+	return result;
+}
+
+internal_func s32 OpenNetplaySocket(u16 *port)
+{
+	s32 result = socket(AF_INET, SOCK_DGRAM, 0);
+	
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addressSize = sizeof(address);
+	if (result < 0 || bind(result, (sockaddr *)&address, sizeof(address)) != 0 ||
+		getsockname(result, (sockaddr *)&address, &addressSize) != 0)
+	{
+		return -1;
+	}
+	*port = ntohs(address.sin_port);
+	
+	return result;
+}
+
+internal_func b32 ConnectNetplaySocket(s32 socketHandle, u16 port)
+{
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	
+	b32 result = (connect(socketHandle, (sockaddr *)&address, sizeof(address)) == 0);
+	return result;
+}
+
+internal_func void PrintNetplayPeerResult(u32 player, NetplayPeerResult *peer)
+{
+	RollbackStats *stats = &peer->stats;
+	printf("Peer %u: %llu rollbacks, %llu frames run again (at most %u at once, %.1fus), %llu stalls, %llu sync waits\n",
+		   player, (unsigned long long)stats->rollbacks, (unsigned long long)stats->resimulatedFrames,
+		   stats->maxRollbackFrames, stats->maxRollbackNanoseconds / 1000.0, (unsigned long long)stats->stalls,
+		   (unsigned long long)stats->syncWaits);
+	printf("        frame work %.1fus average, %.1fus worst of a %.1fms budget, %llu packets in, %llu dropped, %llu checks matched%s\n",
+		   stats->frames ? (stats->totalFrameNanoseconds / 1000.0) / stats->frames : 0.0, stats->maxFrameNanoseconds / 1000.0,
+		   1000.0 / FRAMES_PER_SECOND, (unsigned long long)stats->packetsReceived, (unsigned long long)peer->packetsDropped,
+		   (unsigned long long)stats->checksMatched, peer->desynced ? ", DESYNCED" : "");
+}
+
+int main(int argCount, char **args)
+{
+	NetplayCommandLine commandLine = ParseNetplayCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.frameCount)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-frames N] [-delay MS] [-jitter MS] [-loss PERCENT] [-seed N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, (romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	u16 ports[2];
+	s32 sockets[2];
+	sockets[0] = OpenNetplaySocket(&ports[0]);
+	sockets[1] = OpenNetplaySocket(&ports[1]);
+	if (sockets[0] < 0 || sockets[1] < 0 || !ConnectNetplaySocket(sockets[0], ports[1]) ||
+		!ConnectNetplaySocket(sockets[1], ports[0]))
+	{
+		fprintf(stderr, "Failed to open UDP sockets on localhost\n");
+		return 1;
+	}
+	
+	printf("Two peers on localhost:%u and localhost:%u, %u frames, %ums delay, %ums jitter, %u%% loss\n",
+		   ports[0], ports[1], commandLine.frameCount, commandLine.delayMS, commandLine.jitterMS, commandLine.lossPercent);
+	fflush(stdout);
+	
+	pid_t processIDs[2];
+	s32 resultPipes[2];
+	for (u32 player = 0; player < 2; ++player)
+	{
+		s32 pipeHandles[2];
+		if (pipe(pipeHandles) != 0)
+		{
+			fprintf(stderr, "Failed to create a pipe\n");
+			return 1;
+		}
+		
+		processIDs[player] = fork();
+		if (processIDs[player] == 0)
+		{
+			close(pipeHandles[0]);
+			close(sockets[player ^ 1]);
+			NetplayPeerResult peerResult = RunNetplayPeer(&commandLine, romImage, player, sockets[player]);
+			write(pipeHandles[1], &peerResult, sizeof(peerResult));
+			_exit(0);
+		}
+		close(pipeHandles[1]);
+		resultPipes[player] = pipeHandles[0];
+	}
+	close(sockets[0]);
+	close(sockets[1]);
+	
+	// NOTE(bSalmon): The same game with nothing in between, what both peers must end up at
+	CPUState cpuState;
+	MachineState machine;
+	NetplayBot bots[2];
+	InitNetplayMachine(&cpuState, &machine, romImage);
+	InitNetplayBot(&bots[0], commandLine.seed, 0);
+	InitNetplayBot(&bots[1], commandLine.seed, 1);
+	for (u32 frame = 0; frame < commandLine.frameCount; ++frame)
+	{
+		u8 player1 = NextNetplayBotInput(&bots[0], 0, frame);
+		u8 player2 = NextNetplayBotInput(&bots[1], 1, frame);
+		ApplyRollbackInputs(&machine, player1, player2);
+		EmulateFrame(&cpuState, &machine);
+	}
+	u64 referenceHash = HashMachineState(&cpuState, &machine);
+	
+	u32 failureCount = 0;
+	for (u32 player = 0; player < 2; ++player)
+	{
+		NetplayPeerResult peerResult = {};
+		b32 received = (read(resultPipes[player], &peerResult, sizeof(peerResult)) == sizeof(peerResult));
+		waitpid(processIDs[player], 0, 0);
+		close(resultPipes[player]);
+		
+		if (!received || !peerResult.settled)
+		{
+			fprintf(stderr, "Peer %u never finished\n", player);
+			failureCount++;
+			continue;
+		}
+		
+		PrintNetplayPeerResult(player, &peerResult);
+		if (peerResult.finalHash != referenceHash || peerResult.desynced)
+		{
+			fprintf(stderr, "Peer %u desynced%s\n", player, peerResult.desynced ? "" : " without its checks noticing");
+			failureCount++;
+		}
+	}
+	printf("Check: %s\n", failureCount ? "MISMATCH" : "both peers finished in the same state as the game played with no network");
+	
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return failureCount ? 1 : 0;
+}
@@ -0,0 +1,759 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_platform.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Linux implementation of the services in 8080emu_platform.h, shared by the Linux frontends.
+Include after 8080emu.cpp.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct PlatformWorkQueueEntry
+{
+	PlatformWorkQueueCallback *callback;
+	void *data;
+};
+
+struct PlatformWorkQueue
+{
+	u32 volatile completionGoal;
+	u32 volatile completionCount;
+	
+	u32 volatile nextEntryToWrite;
+	u32 volatile nextEntryToRead;
+	sem_t semaphoreHandle;
+	
+	PlatformWorkQueueEntry entries[256];
+};
+
+struct Linux_ThreadStart
+{
+	PlatformThreadProc *proc;
+	void *data;
+};
+
+internal_func void *PlatformAllocateMemory(u64 size)
+{
+	// NOTE(bSalmon): Size is stored in front of the block so it can be given back to munmap,
+	// a full page is used so the returned memory stays page aligned
+	u64 pageSize = (u64)sysconf(_SC_PAGESIZE);
+	void *block = mmap(0, size + pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (block == MAP_FAILED)
+	{
+		return 0;
+	}
+	
+	*(u64 *)block = size + pageSize;
+	void *result = (u8 *)block + pageSize;
+	return result;
+}
+
+internal_func void PlatformFreeMemory(void *memory)
+{
+	if (memory)
+	{
+		u64 pageSize = (u64)sysconf(_SC_PAGESIZE);
+		void *block = (u8 *)memory - pageSize;
+		munmap(block, *(u64 *)block);
+	}
+}
+
+// NOTE(bSalmon): The 64KB address space plus a page for the reads Emulate can make past the top of it
+#define LINUX_INSTANCE_MAPPING_SIZE (KILOBYTES(64) + KILOBYTES(4))
+
+struct PlatformROMImage
+{
+	s32 fileHandle;
+};
+
+// A null rom gives a blank image
+internal_func PlatformROMImage *PlatformCreateROMImage(u8 *rom, u64 romSize)
+{
+	ASSERT((0x2000 % sysconf(_SC_PAGESIZE)) == 0);
+	
+	s32 fileHandle = memfd_create("8080emu_rom", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fileHandle < 0)
+	{
+		return 0;
+	}
+	
+	u64 copySize = rom ? ((romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (ftruncate(fileHandle, 0x2000) != 0 || pwrite(fileHandle, rom, copySize, 0) != (ssize_t)copySize)
+	{
+		close(fileHandle);
+		return 0;
+	}
+	
+	// NOTE(bSalmon): Sealed so the ROM every instance shares can never be changed, mappings of it
+	// can then only ever be read-only
+	fcntl(fileHandle, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+	
+	PlatformROMImage *result = (PlatformROMImage *)PlatformAllocateMemory(sizeof(PlatformROMImage));
+	result->fileHandle = fileHandle;
+	return result;
+}
+
+// Instances already mapped from the image keep working after it is destroyed
+internal_func void PlatformDestroyROMImage(PlatformROMImage *image)
+{
+	if (image)
+	{
+		close(image->fileHandle);
+		PlatformFreeMemory(image);
+	}
+}
+
+internal_func u8 *PlatformMapInstanceMemory(PlatformROMImage *image)
+{
+	// NOTE(bSalmon): Untouched anonymous pages all read from the kernel's zero page, so of the
+	// whole address space only the RAM pages the game writes to take any memory per instance.
+	// Each instance is 3 mappings, vm.max_map_count (65530 by default) limits it to ~20000
+	u8 *result = (u8 *)mmap(0, LINUX_INSTANCE_MAPPING_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (result == MAP_FAILED)
+	{
+		return 0;
+	}
+	
+	void *rom = mmap(result, 0x2000, PROT_READ, MAP_SHARED | MAP_FIXED, image->fileHandle, 0);
+	if (rom == MAP_FAILED || mprotect(result + 0x2000, 0x2000, PROT_READ | PROT_WRITE) != 0)
+	{
+		munmap(result, LINUX_INSTANCE_MAPPING_SIZE);
+		return 0;
+	}
+	
+	return result;
+}
+
+internal_func void PlatformUnmapInstanceMemory(u8 *memory)
+{
+	if (memory)
+	{
+		munmap(memory, LINUX_INSTANCE_MAPPING_SIZE);
+	}
+}
+
+internal_func u8 *PlatformMapInstanceMemoryFromFile(PlatformROMImage *image, char *path, u64 fileOffset,
+													void *header, u64 headerSize)
+{
+	u8 *result = 0;
+	
+	s32 fileHandle = open(path, O_RDONLY | O_CLOEXEC);
+	if (fileHandle < 0)
+	{
+		return 0;
+	}
+	
+	// NOTE(bSalmon): A file too short for the RAM would fault when the missing pages are touched
+	struct stat fileStatus;
+	if (fstat(fileHandle, &fileStatus) == 0 && (u64)fileStatus.st_size >= (fileOffset + 0x2000) &&
+		pread(fileHandle, header, headerSize, 0) == (ssize_t)headerSize)
+	{
+		result = PlatformMapInstanceMemory(image);
+		if (result && mmap(result + 0x2000, 0x2000, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fileHandle, fileOffset) == MAP_FAILED)
+		{
+			PlatformUnmapInstanceMemory(result);
+			result = 0;
+		}
+	}
+	close(fileHandle);
+	
+	return result;
+}
+
+internal_func u64 PlatformGetWallClock()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	u64 result = ((u64)now.tv_sec * 1000000000ULL) + (u64)now.tv_nsec;
+	return result;
+}
+
+internal_func f64 PlatformGetSecondsElapsed(u64 start, u64 end)
+{
+	f64 result = (f64)(end - start) / 1000000000.0;
+	return result;
+}
+
+internal_func void *Linux_ThreadStartProc(void *param)
+{
+	Linux_ThreadStart start = *(Linux_ThreadStart *)param;
+	PlatformFreeMemory(param);
+	start.proc(start.data);
+	return 0;
+}
+
+internal_func PlatformThread *PlatformStartThread(PlatformThreadProc *proc, void *data)
+{
+	Linux_ThreadStart *start = (Linux_ThreadStart *)PlatformAllocateMemory(sizeof(Linux_ThreadStart));
+	start->proc = proc;
+	start->data = data;
+	
+	pthread_t thread;
+	if (pthread_create(&thread, 0, Linux_ThreadStartProc, start) != 0)
+	{
+		PlatformFreeMemory(start);
+		return 0;
+	}
+	
+	return (PlatformThread *)thread;
+}
+
+internal_func void PlatformJoinThread(PlatformThread *thread)
+{
+	pthread_join((pthread_t)thread, 0);
+}
+
+internal_func void PlatformYieldThread()
+{
+	sched_yield();
+}
+
+internal_func PlatformSemaphore *PlatformCreateSemaphore(u32 initialCount)
+{
+	sem_t *semaphore = (sem_t *)PlatformAllocateMemory(sizeof(sem_t));
+	sem_init(semaphore, 0, initialCount);
+	return (PlatformSemaphore *)semaphore;
+}
+
+internal_func void PlatformSignalSemaphore(PlatformSemaphore *semaphore)
+{
+	sem_post((sem_t *)semaphore);
+}
+
+internal_func void PlatformWaitSemaphore(PlatformSemaphore *semaphore)
+{
+	while (sem_wait((sem_t *)semaphore) != 0)
+	{
+		// NOTE(bSalmon): Interrupted by a signal, keep waiting
+	}
+}
+
+internal_func void PlatformDestroySemaphore(PlatformSemaphore *semaphore)
+{
+	sem_destroy((sem_t *)semaphore);
+	PlatformFreeMemory(semaphore);
+}
+
+internal_func void PlatformAddWorkEntry(PlatformWorkQueue *queue, PlatformWorkQueueCallback *callback, void *data)
+{
+	// NOTE(bSalmon): Only one thread may add entries to a queue
+	u32 newNextEntryToWrite = (queue->nextEntryToWrite + 1) % ARRAY_COUNT(queue->entries);
+	ASSERT(newNextEntryToWrite != queue->nextEntryToRead);
+	PlatformWorkQueueEntry *entry = &queue->entries[queue->nextEntryToWrite];
+	entry->callback = callback;
+	entry->data = data;
+	++queue->completionGoal;
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	
+	queue->nextEntryToWrite = newNextEntryToWrite;
+	sem_post(&queue->semaphoreHandle);
+}
+
+internal_func b32 Linux_DoNextWorkQueueEntry(PlatformWorkQueue *queue)
+{
+	b32 shouldSleep = false;
+	
+	u32 originalNextEntryToRead = queue->nextEntryToRead;
+	u32 newNextEntryToRead = (originalNextEntryToRead + 1) % ARRAY_COUNT(queue->entries);
+	if (originalNextEntryToRead != queue->nextEntryToWrite)
+	{
+		u32 index = AtomicCompareExchangeU32(&queue->nextEntryToRead, newNextEntryToRead, originalNextEntryToRead);
+		if (index == originalNextEntryToRead)
+		{
+			PlatformWorkQueueEntry entry = queue->entries[index];
+			entry.callback(queue, entry.data);
+			AtomicAddU32(&queue->completionCount, 1);
+		}
+	}
+	else
+	{
+		shouldSleep = true;
+	}
+	
+	return shouldSleep;
+}
+
+internal_func void PlatformCompleteAllWork(PlatformWorkQueue *queue)
+{
+	// NOTE(bSalmon): The calling thread helps out instead of waiting
+	while (queue->completionGoal != queue->completionCount)
+	{
+		Linux_DoNextWorkQueueEntry(queue);
+	}
+	
+	queue->completionGoal = 0;
+	queue->completionCount = 0;
+}
+
+internal_func void *Linux_WorkQueueThreadProc(void *param)
+{
+	PlatformWorkQueue *queue = (PlatformWorkQueue *)param;
+	
+	for (;;)
+	{
+		if (Linux_DoNextWorkQueueEntry(queue))
+		{
+			sem_wait(&queue->semaphoreHandle);
+		}
+	}
+	
+	return 0;
+}
+
+internal_func void Linux_MakeWorkQueue(PlatformWorkQueue *queue, u32 threadCount)
+{
+	queue->completionGoal = 0;
+	queue->completionCount = 0;
+	
+	queue->nextEntryToWrite = 0;
+	queue->nextEntryToRead = 0;
+	
+	sem_init(&queue->semaphoreHandle, 0, 0);
+	
+	for (u32 threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+	{
+		pthread_t thread;
+		pthread_create(&thread, 0, Linux_WorkQueueThreadProc, queue);
+		pthread_detach(thread);
+	}
+}
+
+internal_func u32 Linux_GetProcessorCount()
+{
+	s64 processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+	u32 result = (processorCount > 0) ? (u32)processorCount : 1;
+	return result;
+}
+
+// Bytes of private memory the process has resident, pages shared with a file or memfd (like a
+// ROM image) are not included. 0 if it can't be read
+internal_func u64 Linux_GetPrivateMemory()
+{
+	u64 result = 0;
+	
+	FILE *status = fopen("/proc/self/status", "r");
+	if (status)
+	{
+		char line[256];
+		while (fgets(line, sizeof(line), status))
+		{
+			unsigned long long kilobytes = 0;
+			if (sscanf(line, "RssAnon: %llu kB", &kilobytes) == 1)
+			{
+				result = (u64)kilobytes * 1024;
+				break;
+			}
+		}
+		fclose(status);
+	}
+	
+	return result;
+}
+
+// Sleeps until the wall clock reaches target
+internal_func void Linux_SleepUntil(u64 target)
+{
+	timespec targetTime;
+	targetTime.tv_sec = (time_t)(target / 1000000000ULL);
+	targetTime.tv_nsec = (long)(target % 1000000000ULL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &targetTime, 0) != 0)
+	{
+		// NOTE(bSalmon): Interrupted by a signal, keep sleeping
+	}
+}
+
+internal_func u8 *PlatformReadEntireFile(char *path, u64 *size)
+{
+	u8 *result = 0;
+	FILE *file = fopen(path, "rb");
+	if (file)
+	{
+		fseek(file, 0, SEEK_END);
+		s64 fileSize = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		
+		if (fileSize > 0)
+		{
+			result = (u8 *)PlatformAllocateMemory((u64)fileSize);
+			if (result && fread(result, 1, (size_t)fileSize, file) == (size_t)fileSize)
+			{
+				*size = (u64)fileSize;
+			}
+			else
+			{
+				PlatformFreeMemory(result);
+				result = 0;
+			}
+		}
+		
+		fclose(file);
+	}
+	
+	return result;
+}
+
+internal_func b32 PlatformWriteEntireFile(char *path, void *memory, u64 size)
+{
+	b32 result = false;
+	FILE *file = fopen(path, "wb");
+	if (file)
+	{
+		result = (fwrite(memory, 1, (size_t)size, file) == (size_t)size);
+		result = (fclose(file) == 0) && result;
+	}
+	
+	return result;
+}
+
+// NOTE(bSalmon): Batched file writes go through io_uring when the kernel has it, every write and its
+// linked fsync in a batch are handed over with one system call. Without it (or with
+// linuxDisableIOURing set) each file is written and synced in turn. The ring is only ever used
+// from one thread, set up on first use and kept for the life of the process, unless a submission
+// fails and it is torn down
+#define LINUX_IO_URING_ENTRIES 64
+#define LINUX_FILE_BATCH_SIZE (LINUX_IO_URING_ENTRIES / 2)
+
+struct Linux_IOURing
+{
+	s32 handle;
+	u8 *sqRing;
+	u8 *cqRing;
+	io_uring_sqe *sqes;
+	u64 sqRingSize;
+	u64 cqRingSize;
+	u64 sqesSize;
+	
+	u32 *sqHead;
+	u32 *sqTail;
+	u32 *sqMask;
+	u32 *sqArray;
+	u32 *cqHead;
+	u32 *cqTail;
+	u32 *cqMask;
+	io_uring_cqe *cqes;
+	
+	b32 setupTried;
+	b32 available;
+};
+
+global_var Linux_IOURing linuxIOURing;
+global_var b32 linuxDisableIOURing;
+
+internal_func b32 Linux_SetupIOURing(Linux_IOURing *ring)
+{
+	io_uring_params params = {};
+	ring->handle = (s32)syscall(__NR_io_uring_setup, LINUX_IO_URING_ENTRIES, &params);
+	if (ring->handle < 0)
+	{
+		return false;
+	}
+	
+	// NOTE(bSalmon): Older kernels map the two rings separately
+	u64 sqRingSize = params.sq_off.array + (params.sq_entries * sizeof(u32));
+	u64 cqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(io_uring_cqe));
+	b32 singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap && cqRingSize > sqRingSize)
+	{
+		sqRingSize = cqRingSize;
+	}
+	
+	u8 *sqRing = (u8 *)mmap(0, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->handle, IORING_OFF_SQ_RING);
+	u8 *cqRing = sqRing;
+	if (sqRing != MAP_FAILED && !singleMap)
+	{
+		cqRing = (u8 *)mmap(0, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->handle, IORING_OFF_CQ_RING);
+	}
+	u64 sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->handle, IORING_OFF_SQES);
+	if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		close(ring->handle);
+		return false;
+	}
+	
+	ring->sqRing = sqRing;
+	ring->cqRing = singleMap ? 0 : cqRing;
+	ring->sqRingSize = sqRingSize;
+	ring->cqRingSize = cqRingSize;
+	ring->sqesSize = sqesSize;
+	ring->sqHead = (u32 *)(sqRing + params.sq_off.head);
+	ring->sqTail = (u32 *)(sqRing + params.sq_off.tail);
+	ring->sqMask = (u32 *)(sqRing + params.sq_off.ring_mask);
+	ring->sqArray = (u32 *)(sqRing + params.sq_off.array);
+	ring->sqes = (io_uring_sqe *)sqes;
+	ring->cqHead = (u32 *)(cqRing + params.cq_off.head);
+	ring->cqTail = (u32 *)(cqRing + params.cq_off.tail);
+	ring->cqMask = (u32 *)(cqRing + params.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe *)(cqRing + params.cq_off.cqes);
+	
+	return true;
+}
+
+internal_func void Linux_TeardownIOURing(Linux_IOURing *ring)
+{
+	munmap(ring->sqes, ring->sqesSize);
+	if (ring->cqRing)
+	{
+		munmap(ring->cqRing, ring->cqRingSize);
+	}
+	munmap(ring->sqRing, ring->sqRingSize);
+	close(ring->handle);
+	ring->available = false;
+}
+
+internal_func void Linux_QueueIOURingEntry(Linux_IOURing *ring, u32 *tail, u8 opcode, s32 fileHandle, void *memory, u32 size,
+										   u8 flags, u64 userData)
+{
+	u32 index = *tail & *ring->sqMask;
+	io_uring_sqe *entry = &ring->sqes[index];
+	memset(entry, 0, sizeof(*entry));
+	entry->opcode = opcode;
+	entry->flags = flags;
+	entry->fd = fileHandle;
+	entry->addr = (u64)memory;
+	entry->len = size;
+	entry->user_data = userData;
+	ring->sqArray[index] = index;
+	++*tail;
+}
+
+// Writes and syncs the open files with one submission, results are what write and fsync would return
+internal_func b32 Linux_WriteAndSyncWithIOURing(Linux_IOURing *ring, PlatformFileWrite *writes, s32 *fileHandles, u32 count,
+											   s64 *writeResults, s64 *syncResults)
+{
+	u32 tail = *ring->sqTail;
+	u32 submitCount = 0;
+	for (u32 writeIndex = 0; writeIndex < count; ++writeIndex)
+	{
+		writeResults[writeIndex] = -1;
+		syncResults[writeIndex] = -1;
+		if (fileHandles[writeIndex] >= 0)
+		{
+			// NOTE(bSalmon): Linked, the fsync only starts once the write has finished
+			Linux_QueueIOURingEntry(ring, &tail, IORING_OP_WRITE, fileHandles[writeIndex], writes[writeIndex].memory,
+									(u32)writes[writeIndex].size, IOSQE_IO_LINK, writeIndex * 2);
+			Linux_QueueIOURingEntry(ring, &tail, IORING_OP_FSYNC, fileHandles[writeIndex], 0, 0, 0, (writeIndex * 2) + 1);
+			submitCount += 2;
+		}
+	}
+	__atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+	
+	b32 result = true;
+	u32 completedCount = 0;
+	u32 toSubmit = submitCount;
+	while (completedCount < submitCount)
+	{
+		s32 entered = (s32)syscall(__NR_io_uring_enter, ring->handle, toSubmit, submitCount - completedCount,
+								   IORING_ENTER_GETEVENTS, 0, 0);
+		if (entered < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		
+		if (entered < 0)
+		{
+			// NOTE(bSalmon): Whatever the kernel took still points at the buffers and files, which are
+			// reused as soon as this returns. Wait for those to complete, then tear the ring down so
+			// the entries it never took are not picked up later and the files are written the slow way
+			if (!result)
+			{
+				break;
+			}
+			result = false;
+			submitCount -= tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+			toSubmit = 0;
+			continue;
+		}
+		toSubmit -= ((u32)entered < toSubmit) ? (u32)entered : toSubmit;
+		
+		u32 head = *ring->cqHead;
+		u32 cqTail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		for (; head != cqTail; ++head)
+		{
+			io_uring_cqe *completion = &ring->cqes[head & *ring->cqMask];
+			u32 writeIndex = (u32)(completion->user_data / 2);
+			if (completion->user_data & 1)
+			{
+				syncResults[writeIndex] = completion->res;
+			}
+			else
+			{
+				writeResults[writeIndex] = completion->res;
+			}
+			++completedCount;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+	
+	if (!result)
+	{
+		Linux_TeardownIOURing(ring);
+	}
+	
+	return result;
+}
+
+internal_func b32 Linux_WriteAndSyncFile(s32 fileHandle, u8 *memory, u64 size)
+{
+	u64 written = 0;
+	while (written < size)
+	{
+		ssize_t result = pwrite(fileHandle, memory + written, size - written, (off_t)written);
+		if (result < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (result <= 0)
+		{
+			return false;
+		}
+		written += (u64)result;
+	}
+	
+	b32 result = (fsync(fileHandle) == 0);
+	return result;
+}
+
+// Syncs the directory holding path so a rename into it is durable
+internal_func void Linux_SyncParentDirectory(char *path)
+{
+	char directory[512];
+	snprintf(directory, sizeof(directory), "%s", path);
+	char *lastSlash = strrchr(directory, '/');
+	if (lastSlash)
+	{
+		lastSlash[(lastSlash == directory) ? 1 : 0] = 0;
+	}
+	else
+	{
+		snprintf(directory, sizeof(directory), ".");
+	}
+	
+	s32 directoryHandle = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (directoryHandle >= 0)
+	{
+		fsync(directoryHandle);
+		close(directoryHandle);
+	}
+}
+
+internal_func char *Linux_GetFileBatchBackend()
+{
+	char *result = "write + fsync";
+	if (linuxIOURing.available && !linuxDisableIOURing)
+	{
+		result = "io_uring";
+	}
+	
+	return result;
+}
+
+internal_func u32 PlatformWriteFileBatch(PlatformFileWrite *writes, u32 count)
+{
+	Linux_IOURing *ring = &linuxIOURing;
+	if (!ring->setupTried && !linuxDisableIOURing)
+	{
+		ring->setupTried = true;
+		ring->available = Linux_SetupIOURing(ring);
+	}
+	
+	u32 result = 0;
+	for (u32 batchStart = 0; batchStart < count; batchStart += LINUX_FILE_BATCH_SIZE)
+	{
+		PlatformFileWrite *batch = &writes[batchStart];
+		u32 batchCount = ((count - batchStart) < LINUX_FILE_BATCH_SIZE) ? (count - batchStart) : LINUX_FILE_BATCH_SIZE;
+		
+		char tempPaths[LINUX_FILE_BATCH_SIZE][512];
+		s32 fileHandles[LINUX_FILE_BATCH_SIZE];
+		s64 writeResults[LINUX_FILE_BATCH_SIZE];
+		s64 syncResults[LINUX_FILE_BATCH_SIZE];
+		for (u32 writeIndex = 0; writeIndex < batchCount; ++writeIndex)
+		{
+			snprintf(tempPaths[writeIndex], sizeof(tempPaths[writeIndex]), "%s.tmp", batch[writeIndex].path);
+			fileHandles[writeIndex] = open(tempPaths[writeIndex], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		}
+		
+		b32 submitted = false;
+		if (ring->available && !linuxDisableIOURing)
+		{
+			submitted = Linux_WriteAndSyncWithIOURing(ring, batch, fileHandles, batchCount, writeResults, syncResults);
+		}
+		
+		for (u32 writeIndex = 0; writeIndex < batchCount; ++writeIndex)
+		{
+			PlatformFileWrite *write = &batch[writeIndex];
+			write->succeeded = false;
+			
+			s32 fileHandle = fileHandles[writeIndex];
+			if (fileHandle >= 0)
+			{
+				// NOTE(bSalmon): A short write cancels its fsync, the rest is finished the slow way
+				b32 written = submitted && (u64)writeResults[writeIndex] == write->size && syncResults[writeIndex] == 0;
+				if (!written)
+				{
+					written = Linux_WriteAndSyncFile(fileHandle, (u8 *)write->memory, write->size);
+				}
+				close(fileHandle);
+				
+				write->succeeded = written && (rename(tempPaths[writeIndex], write->path) == 0);
+				if (!write->succeeded)
+				{
+					unlink(tempPaths[writeIndex]);
+				}
+			}
+		}
+		
+		// NOTE(bSalmon): Batches usually all land in one directory, it is only synced when it changes
+		char *syncedPath = 0;
+		u64 syncedLength = 0;
+		for (u32 writeIndex = 0; writeIndex < batchCount; ++writeIndex)
+		{
+			PlatformFileWrite *write = &batch[writeIndex];
+			if (write->succeeded)
+			{
+				char *slash = strrchr(write->path, '/');
+				u64 directoryLength = slash ? (u64)(slash - write->path) : 0;
+				if (!syncedPath || directoryLength != syncedLength || strncmp(write->path, syncedPath, directoryLength) != 0)
+				{
+					Linux_SyncParentDirectory(write->path);
+					syncedPath = write->path;
+					syncedLength = directoryLength;
+				}
+				++result;
+			}
+		}
+	}
+	
+	return result;
+}
@@ -0,0 +1,193 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_rewind.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Rewind Benchmark, plays a game with a bot while pushing every frame into a rewind buffer
+(see 8080emu_rewind.cpp), then steps all the way back through the history checking every
+frame it comes to is the frame that was played.
+
+Usage: linux_8080emu_rewind <rom> [-frames N] [-history S] [-storage MB]
+
+-frames defaults to 7200 (two minutes), -history is how many seconds can be stepped back
+(default 60) and -storage the most megabytes of deltas kept (default 4).
+
+Prints the average delta size, how much history fits, the time a frame, a push and a step
+back take, exits with 1 if any step back lands on the wrong state.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_rewind.cpp"
+
+struct RewindCommandLine
+{
+	char *romPath;
+	u32 frameCount;
+	u32 historySeconds;
+	u32 storageMB;
+};
+
+internal_func RewindCommandLine ParseRewindCommandLine(s32 argCount, char **args)
+{
+	RewindCommandLine result = {};
+	result.frameCount = 7200;
+	result.historySeconds = 60;
+	result.storageMB = 4;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-history") == 0 && hasValue)
+		{
+			result.historySeconds = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-storage") == 0 && hasValue)
+		{
+			result.storageMB = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	if (result.historySeconds < 1)
+	{
+		result.historySeconds = 1;
+	}
+	
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	RewindCommandLine commandLine = ParseRewindCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-frames N] [-history S] [-storage MB]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, romSize) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	RewindBuffer rewind;
+	u32 historyFrames = commandLine.historySeconds * FRAMES_PER_SECOND;
+	CPUState cpuState = {};
+	MachineState machine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	u64 *frameHashes = (u64 *)PlatformAllocateMemory((commandLine.frameCount + 1) * sizeof(u64));
+	if (!cpuState.memory || !frameHashes || !InitRewindBuffer(&rewind, historyFrames, commandLine.storageMB * MEGABYTES(1)))
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	machine.romSize = 0x2000;
+	ResetMachine(&cpuState, &machine);
+	BotPlayer bot;
+	InitBotPlayer(&bot, 1);
+	
+	frameHashes[0] = HashMachineState(&cpuState, &machine);
+	PushRewindFrame(&rewind, &cpuState, &machine);
+	
+	u64 frameTicks = 0;
+	u64 pushTicks = 0;
+	u64 encodedBytes = 0;
+	for (u32 frameIndex = 1; frameIndex <= commandLine.frameCount; ++frameIndex)
+	{
+		u64 startTime = PlatformGetWallClock();
+		UpdateBotPlayer(&bot, &machine);
+		EmulateFrame(&cpuState, &machine);
+		u64 frameEnd = PlatformGetWallClock();
+		
+		PushRewindFrame(&rewind, &cpuState, &machine);
+		pushTicks += PlatformGetWallClock() - frameEnd;
+		frameTicks += frameEnd - startTime;
+		
+		// NOTE(bSalmon): The entry just stored is the newest, whatever was dropped to make room for it is not counted
+		RewindEntry *newest = &rewind.entries[(rewind.oldestEntry + rewind.entryCount - 1) % rewind.entryCapacity];
+		encodedBytes += newest->size;
+		
+		frameHashes[frameIndex] = HashMachineState(&cpuState, &machine);
+	}
+	
+	u32 heldFrames = rewind.entryCount;
+	u64 heldBytes = rewind.storedBytes;
+	
+	u32 mismatchCount = 0;
+	u32 stepCount = 0;
+	u64 rewindTicks = 0;
+	u64 startTime = PlatformGetWallClock();
+	while (true)
+	{
+		u64 stepStart = PlatformGetWallClock();
+		b32 stepped = RewindMachineFrame(&rewind, &cpuState, &machine);
+		rewindTicks += PlatformGetWallClock() - stepStart;
+		if (!stepped)
+		{
+			break;
+		}
+		
+		stepCount++;
+		if (machine.frameCount != (commandLine.frameCount - stepCount) ||
+			HashMachineState(&cpuState, &machine) != frameHashes[machine.frameCount])
+		{
+			fprintf(stderr, "Stepping back %u frames gave the wrong state\n", stepCount);
+			mismatchCount++;
+			break;
+		}
+	}
+	
+	f64 averageDelta = (f64)encodedBytes / commandLine.frameCount;
+	printf("%u frames played, %.0f bytes per frame on average (%.1f%% of a %u byte snapshot)\n", commandLine.frameCount,
+		   averageDelta, (averageDelta / sizeof(RewindSnapshot)) * 100.0, (u32)sizeof(RewindSnapshot));
+	printf("History: %u frames (%.1fs) in %.2fMB, a minute takes %.2fMB\n", heldFrames, (f64)heldFrames / FRAMES_PER_SECOND,
+		   (f64)heldBytes / MEGABYTES(1), (averageDelta * FRAMES_PER_SECOND * 60.0) / MEGABYTES(1));
+	printf("Frame %.2fus, push %.2fus, step back %.2fus\n",
+		   PlatformGetSecondsElapsed(0, frameTicks) * 1000000.0 / commandLine.frameCount,
+		   PlatformGetSecondsElapsed(0, pushTicks) * 1000000.0 / commandLine.frameCount,
+		   stepCount ? PlatformGetSecondsElapsed(0, rewindTicks) * 1000000.0 / stepCount : 0.0);
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every step back matched the frame played");
+	
+	FreeRewindBuffer(&rewind);
+	PlatformFreeMemory(frameHashes);
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
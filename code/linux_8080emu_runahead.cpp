@@ -0,0 +1,256 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_runahead.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Run-Ahead Benchmark, measures what run-ahead (see 8080emu_runahead.cpp) costs and how much
+input lag it takes away, for 0 to -max frames ahead with one instance and with a second one.
+
+Latency: from the same point in a game, one run holds P1RIGHT from a set host frame and one
+never presses anything. The latency is how many host frames after the press the frame shown
+first differs between the two.
+
+Cost: a bot plays -frames host frames and the average time of a host frame (the real frame,
+running ahead and getting back) is taken. The real machine must end up in the same state as
+with no run-ahead at all.
+
+Usage: linux_8080emu_runahead <rom> [-max N] [-frames N]
+
+-max defaults to 3 and -frames to 3600. Exits with 1 if run-ahead changed the real machine.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_fork.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_runahead.cpp"
+
+// NOTE(bSalmon): Far enough in for the bot to have started a game
+#define RUNAHEAD_START_FRAME 600
+#define RUNAHEAD_PRESS_FRAME 10
+#define RUNAHEAD_LATENCY_FRAMES 30
+
+struct RunAheadCommandLine
+{
+	char *romPath;
+	u32 maxFrames;
+	u32 hostFrames;
+};
+
+struct RunAheadTrial
+{
+	CPUState cpuState;
+	MachineState machine;
+	RunAhead runAhead;
+	u8 *aheadMemory;
+};
+
+internal_func RunAheadCommandLine ParseRunAheadCommandLine(s32 argCount, char **args)
+{
+	RunAheadCommandLine result = {};
+	result.maxFrames = 3;
+	result.hostFrames = 3600;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-max") == 0 && hasValue)
+		{
+			result.maxFrames = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.hostFrames = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+// Starts a trial from the saved start, frameCount 0 is no run-ahead at all
+internal_func void BeginRunAheadTrial(RunAheadTrial *trial, SaveState *start, u32 frameCount, b32 useSecondInstance)
+{
+	LoadMachineState(start, &trial->cpuState, &trial->machine, start->header.romHash);
+	InitRunAhead(&trial->runAhead, frameCount, useSecondInstance ? trial->aheadMemory : 0);
+}
+
+// One host frame, returns the hash of the video shown
+internal_func u64 RunAheadHostFrame(RunAheadTrial *trial)
+{
+	u64 result = 0;
+	
+	EmulateFrame(&trial->cpuState, &trial->machine);
+	if (trial->runAhead.frameCount)
+	{
+		CPUState *shown = BeginRunAhead(&trial->runAhead, &trial->cpuState, &trial->machine);
+		result = HashVideoMemory(shown, false);
+		EndRunAhead(&trial->runAhead, &trial->cpuState, &trial->machine);
+	}
+	else
+	{
+		result = HashVideoMemory(&trial->cpuState, false);
+	}
+	
+	return result;
+}
+
+// Host frames from the press until the shown frame reacts, -1 if it never does
+internal_func s32 MeasureRunAheadLatency(RunAheadTrial *trial, SaveState *start, u32 frameCount, b32 useSecondInstance)
+{
+	u64 untouched[RUNAHEAD_LATENCY_FRAMES];
+	BeginRunAheadTrial(trial, start, frameCount, useSecondInstance);
+	for (u32 hostFrame = 0; hostFrame < RUNAHEAD_LATENCY_FRAMES; ++hostFrame)
+	{
+		untouched[hostFrame] = RunAheadHostFrame(trial);
+	}
+	FreeRunAhead(&trial->runAhead);
+	
+	s32 result = -1;
+	BeginRunAheadTrial(trial, start, frameCount, useSecondInstance);
+	for (u32 hostFrame = 0; hostFrame < RUNAHEAD_LATENCY_FRAMES; ++hostFrame)
+	{
+		if (hostFrame == RUNAHEAD_PRESS_FRAME)
+		{
+			SetMachineInput(&trial->machine, MachineInput::P1RIGHT, true);
+		}
+		
+		u64 shownHash = RunAheadHostFrame(trial);
+		if (result < 0 && shownHash != untouched[hostFrame])
+		{
+			result = (s32)hostFrame - RUNAHEAD_PRESS_FRAME;
+		}
+	}
+	FreeRunAhead(&trial->runAhead);
+	
+	return result;
+}
+
+// Average microseconds a host frame takes with a bot playing, hash is the real machine at the end
+internal_func f64 MeasureRunAheadCost(RunAheadTrial *trial, SaveState *start, u32 frameCount, b32 useSecondInstance,
+									  u32 hostFrames, u64 *hash, f64 *pagesPerFrame)
+{
+	BotPlayer bot;
+	InitBotPlayer(&bot, 7);
+	BeginRunAheadTrial(trial, start, frameCount, useSecondInstance);
+	
+	u64 startTime = PlatformGetWallClock();
+	for (u32 hostFrame = 0; hostFrame < hostFrames; ++hostFrame)
+	{
+		UpdateBotPlayer(&bot, &trial->machine);
+		RunAheadHostFrame(trial);
+	}
+	f64 result = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock()) * 1000000.0 / hostFrames;
+	
+	*hash = HashMachineState(&trial->cpuState, &trial->machine);
+	*pagesPerFrame = trial->runAhead.hostFrames ? (f64)trial->runAhead.pagesCopied / trial->runAhead.hostFrames : 0.0;
+	FreeRunAhead(&trial->runAhead);
+	
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	RunAheadCommandLine commandLine = ParseRunAheadCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.hostFrames)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-max N] [-frames N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, romSize) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	RunAheadTrial trial = {};
+	trial.cpuState.memory = PlatformMapInstanceMemory(romImage);
+	trial.aheadMemory = PlatformMapInstanceMemory(romImage);
+	SaveState *start = (SaveState *)PlatformAllocateMemory(sizeof(SaveState));
+	if (!trial.cpuState.memory || !trial.aheadMemory || !start)
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	// Play into a game and let go of everything
+	BotPlayer bot;
+	InitBotPlayer(&bot, 1);
+	trial.machine.romSize = 0x2000;
+	ResetMachine(&trial.cpuState, &trial.machine);
+	for (u32 frameIndex = 0; frameIndex < RUNAHEAD_START_FRAME; ++frameIndex)
+	{
+		UpdateBotPlayer(&bot, &trial.machine);
+		EmulateFrame(&trial.cpuState, &trial.machine);
+	}
+	SetMachineInput(&trial.machine, MachineInput::P1LEFT, false);
+	SetMachineInput(&trial.machine, MachineInput::P1RIGHT, false);
+	SetMachineInput(&trial.machine, MachineInput::P1SHOOT, false);
+	SaveMachineState(start, &trial.cpuState, &trial.machine, GetROMHash(trial.cpuState.memory));
+	
+	u64 baseHash = 0;
+	f64 basePages = 0.0;
+	f64 baseCost = MeasureRunAheadCost(&trial, start, 0, false, commandLine.hostFrames, &baseHash, &basePages);
+	s32 baseLatency = MeasureRunAheadLatency(&trial, start, 0, false);
+	printf("%-24s latency %2d frames, %7.2fus a host frame\n", "No run-ahead:", baseLatency, baseCost);
+	
+	u32 mismatchCount = 0;
+	for (u32 frameCount = 1; frameCount <= commandLine.maxFrames; ++frameCount)
+	{
+		for (u32 useSecondInstance = 0; useSecondInstance < 2; ++useSecondInstance)
+		{
+			u64 hash = 0;
+			f64 pagesPerFrame = 0.0;
+			f64 cost = MeasureRunAheadCost(&trial, start, frameCount, useSecondInstance, commandLine.hostFrames, &hash, &pagesPerFrame);
+			s32 latency = MeasureRunAheadLatency(&trial, start, frameCount, useSecondInstance);
+			
+			char name[32];
+			snprintf(name, sizeof(name), "%u ahead, %s:", frameCount, useSecondInstance ? "2 instances" : "1 instance");
+			printf("%-24s latency %2d frames, %7.2fus a host frame (+%.2fus), %4.1f pages copied a frame\n", name,
+				   latency, cost, cost - baseCost, pagesPerFrame);
+			
+			if (hash != baseHash)
+			{
+				fprintf(stderr, "%u frames of run-ahead changed the real machine\n", frameCount);
+				mismatchCount++;
+			}
+		}
+	}
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "the real machine is the same with and without run-ahead");
+	
+	PlatformUnmapInstanceMemory(trial.cpuState.memory);
+	PlatformUnmapInstanceMemory(trial.aheadMemory);
+	PlatformFreeMemory(start);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
@@ -0,0 +1,447 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_savestate.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Save State Check, saves states at random points part way through frames of a bot played game
+and loads each of them back four ways: from memory, copied in from a file, copied in from a
+compressed file and mapped from a file (see 8080emu_savestate.cpp). After every load the game is
+played on for a while with the same bot and must end up exactly where the run that never saved
+or loaded did.
+
+Every state is also compressed and decompressed in memory LZ_BENCH_REPEATS times to measure the
+codec (see 8080emu_lz.cpp) against copying the raw state, and damaged copies of the compressed
+state must be refused, as must copies of the header with a field out of range. The copies and
+decompressions go round a LZ_BENCH_POOL_SIZE pool of states, far bigger than L2, so like a real
+load they write to memory that isn't already in the nearest caches.
+
+Usage: linux_8080emu_savestate <rom> [-rounds N] [-after N] [-state path] [-compressed path]
+
+-rounds is how many states are saved (default 100), -after how many frames are played after
+each one (default 30), -state the file used (default /tmp/8080emu_check.state) and -compressed
+the compressed file (default /tmp/8080emu_check.lzstate).
+
+Prints the average and worst save and load times in microseconds, the compressed sizes and the
+codec throughput. Exits with 1 if any load did not carry on the same as the original or a damaged
+state was accepted.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+
+enum class StateTiming
+{
+	SAVE_MEMORY,
+	SAVE_FILE,
+	SAVE_COMPRESSED_FILE,
+	LOAD_MEMORY,
+	LOAD_FILE,
+	LOAD_COMPRESSED_FILE,
+	MAP_FROM_FILE,
+	
+	COUNT
+};
+
+global_var char *stateTimingNames[] = {"Save to memory", "Save to file", "Save compressed", "Load from memory", "Load from file",
+									   "Load compressed", "Map from file"};
+
+#define LZ_BENCH_REPEATS 64
+#define LZ_BENCH_POOL_SIZE (64 * 1024 * 1024)
+
+struct StateCommandLine
+{
+	char *romPath;
+	char *statePath;
+	char *compressedPath;
+	u32 roundCount;
+	u32 afterFrames;
+};
+
+struct StateTimings
+{
+	u64 totalTicks[(u32)StateTiming::COUNT];
+	u64 maxTicks[(u32)StateTiming::COUNT];
+};
+
+struct CodecBenchmark
+{
+	u64 compressedBytes;
+	u32 minCompressedSize;
+	u32 maxCompressedSize;
+	u64 copyTicks;
+	u64 compressTicks;
+	u64 decompressTicks;
+	u64 containerTicks;
+	u32 damagedAccepted;
+	
+	SaveState *pool;
+	u32 poolCount;
+	u32 poolIndex;
+};
+
+internal_func StateCommandLine ParseStateCommandLine(s32 argCount, char **args)
+{
+	StateCommandLine result = {};
+	result.statePath = "/tmp/8080emu_check.state";
+	result.compressedPath = "/tmp/8080emu_check.lzstate";
+	result.roundCount = 100;
+	result.afterFrames = 30;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-rounds") == 0 && hasValue)
+		{
+			result.roundCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-after") == 0 && hasValue)
+		{
+			result.afterFrames = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-state") == 0 && hasValue)
+		{
+			result.statePath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-compressed") == 0 && hasValue)
+		{
+			result.compressedPath = args[++argIndex];
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+internal_func void RecordStateTiming(StateTimings *timings, StateTiming timing, u64 start)
+{
+	u64 ticks = PlatformGetWallClock() - start;
+	timings->totalTicks[(u32)timing] += ticks;
+	if (ticks > timings->maxTicks[(u32)timing])
+	{
+		timings->maxTicks[(u32)timing] = ticks;
+	}
+}
+
+internal_func SaveState *NextBenchState(CodecBenchmark *bench)
+{
+	SaveState *result = &bench->pool[bench->poolIndex];
+	bench->poolIndex = (bench->poolIndex + 1) % bench->poolCount;
+	return result;
+}
+
+// Times the codec on one state against a plain copy, each repeated LZ_BENCH_REPEATS times
+internal_func void BenchmarkStateCodec(CodecBenchmark *bench, SaveState *state, u8 *compressed, SaveState *scratch)
+{
+	u32 compressedSize = 0;
+	u64 startTime = PlatformGetWallClock();
+	for (u32 repeat = 0; repeat < LZ_BENCH_REPEATS; ++repeat)
+	{
+		compressedSize = CompressSaveState(compressed, state);
+	}
+	bench->compressTicks += PlatformGetWallClock() - startTime;
+	
+	bench->compressedBytes += compressedSize;
+	if (!bench->minCompressedSize || compressedSize < bench->minCompressedSize)
+	{
+		bench->minCompressedSize = compressedSize;
+	}
+	if (compressedSize > bench->maxCompressedSize)
+	{
+		bench->maxCompressedSize = compressedSize;
+	}
+	
+	// NOTE(bSalmon): Every pass writes the next state of the pool, each copy is checked so none can be left out
+	SaveState *copies[LZ_BENCH_REPEATS];
+	startTime = PlatformGetWallClock();
+	for (u32 repeat = 0; repeat < LZ_BENCH_REPEATS; ++repeat)
+	{
+		copies[repeat] = NextBenchState(bench);
+		memcpy(copies[repeat], state, sizeof(SaveState));
+	}
+	bench->copyTicks += PlatformGetWallClock() - startTime;
+	
+	b32 copied = true;
+	for (u32 repeat = 0; repeat < LZ_BENCH_REPEATS; ++repeat)
+	{
+		copied &= (memcmp(copies[repeat], state, sizeof(SaveState)) == 0);
+	}
+	
+	b32 decompressed = true;
+	u8 *block = compressed + sizeof(CompressedStateHeader);
+	u32 blockSize = compressedSize - sizeof(CompressedStateHeader);
+	startTime = PlatformGetWallClock();
+	for (u32 repeat = 0; repeat < LZ_BENCH_REPEATS; ++repeat)
+	{
+		decompressed &= DecompressLZ((u8 *)NextBenchState(bench), sizeof(SaveState), block, blockSize);
+	}
+	bench->decompressTicks += PlatformGetWallClock() - startTime;
+	
+	SaveState *lastState = 0;
+	startTime = PlatformGetWallClock();
+	for (u32 repeat = 0; repeat < LZ_BENCH_REPEATS; ++repeat)
+	{
+		lastState = NextBenchState(bench);
+		decompressed &= DecompressSaveState(lastState, compressed, compressedSize);
+	}
+	bench->containerTicks += PlatformGetWallClock() - startTime;
+	
+	if (!copied || !decompressed || memcmp(lastState, state, sizeof(SaveState)) != 0)
+	{
+		bench->damagedAccepted++;
+	}
+	
+	// NOTE(bSalmon): Cut short and with a flipped byte in the block, neither may come back as a different
+	// state. A flip can still decode to the same bytes (another offset into a run of zeroes) and that's fine
+	if (DecompressSaveState(scratch, compressed, compressedSize - 1))
+	{
+		bench->damagedAccepted++;
+	}
+	u32 flipIndex = sizeof(CompressedStateHeader) + (u32)((state->header.frameCount * 7919) % blockSize);
+	compressed[flipIndex] ^= 0x5A;
+	if (DecompressSaveState(scratch, compressed, compressedSize) && memcmp(scratch, state, sizeof(SaveState)) != 0)
+	{
+		bench->damagedAccepted++;
+	}
+	compressed[flipIndex] ^= 0x5A;
+}
+
+// Returns how many copies of header with one field out of range IsSaveStateValid let through
+internal_func u32 CountAcceptedBadHeaders(SaveStateHeader *header, u64 romHash)
+{
+	u32 result = 0;
+	for (u32 badField = 0; badField < 6; ++badField)
+	{
+		SaveStateHeader bad = *header;
+		switch (badField)
+		{
+			case 0: { bad.romSize = 0; break; }
+			case 1: { bad.romSize = RAM_START + 1; break; }
+			case 2: { bad.nextInterruptNum = 0; break; }
+			case 3: { bad.nextInterruptNum = 3; break; }
+			case 4: { bad.shiftOffset = 8; break; }
+			default: { bad.nextInterruptCycle = bad.cycles + (CYCLES_PER_FRAME * 100); break; }
+		}
+		
+		if (IsSaveStateValid(&bad, romHash))
+		{
+			result++;
+		}
+	}
+	
+	return result;
+}
+
+// Plays on from a loaded state and returns the hash it ends up at
+internal_func u64 PlayAfterState(CPUState *cpuState, MachineState *machine, BotPlayer *bot, u64 endFrame)
+{
+	while (machine->frameCount < endFrame)
+	{
+		UpdateBotPlayer(bot, machine);
+		EmulateFrame(cpuState, machine);
+	}
+	
+	u64 result = HashMachineState(cpuState, machine);
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	StateCommandLine commandLine = ParseStateCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-rounds N] [-after N] [-state path] [-compressed path]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, romSize) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	CPUState loadedState = {};
+	MachineState loadedMachine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	loadedState.memory = PlatformMapInstanceMemory(romImage);
+	SaveState *state = (SaveState *)PlatformAllocateMemory(sizeof(SaveState));
+	SaveState *scratchState = (SaveState *)PlatformAllocateMemory(sizeof(SaveState));
+	u8 *compressed = (u8 *)PlatformAllocateMemory(COMPRESSED_STATE_MAX_SIZE);
+	CodecBenchmark bench = {};
+	bench.poolCount = LZ_BENCH_POOL_SIZE / sizeof(SaveState);
+	bench.pool = (SaveState *)PlatformAllocateMemory(sizeof(SaveState) * bench.poolCount);
+	if (!cpuState.memory || !loadedState.memory || !state || !scratchState || !compressed || !bench.pool)
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	// NOTE(bSalmon): Touched now so the timings don't include the page faults
+	memset(bench.pool, 0, sizeof(SaveState) * bench.poolCount);
+	
+	machine.romSize = 0x2000;
+	ResetMachine(&cpuState, &machine);
+	u64 romHash = GetROMHash(cpuState.memory);
+	
+	BotPlayer bot;
+	InitBotPlayer(&bot, 1);
+	u32 randomState = 0x2545F491;
+	
+	StateTimings timings = {};
+	u32 mismatchCount = 0;
+	for (u32 roundIndex = 0; roundIndex < commandLine.roundCount && !mismatchCount; ++roundIndex)
+	{
+		// NOTE(bSalmon): Play some whole frames then stop a random number of cycles into the next
+		u32 frames = 1 + (NextBotRandom(&bot) % 30);
+		for (u32 frameIndex = 0; frameIndex < frames; ++frameIndex)
+		{
+			UpdateBotPlayer(&bot, &machine);
+			EmulateFrame(&cpuState, &machine);
+		}
+		randomState ^= randomState << 13;
+		randomState ^= randomState >> 17;
+		randomState ^= randomState << 5;
+		EmulateCycles(&cpuState, &machine, randomState % CYCLES_PER_FRAME);
+		
+		u64 startTime = PlatformGetWallClock();
+		SaveMachineState(state, &cpuState, &machine, romHash);
+		RecordStateTiming(&timings, StateTiming::SAVE_MEMORY, startTime);
+		
+		startTime = PlatformGetWallClock();
+		b32 saved = SaveStateToFile(commandLine.statePath, &cpuState, &machine);
+		RecordStateTiming(&timings, StateTiming::SAVE_FILE, startTime);
+		if (!saved)
+		{
+			fprintf(stderr, "Failed to write %s\n", commandLine.statePath);
+			return 1;
+		}
+		
+		startTime = PlatformGetWallClock();
+		saved = SaveStateToFile(commandLine.compressedPath, &cpuState, &machine, true);
+		RecordStateTiming(&timings, StateTiming::SAVE_COMPRESSED_FILE, startTime);
+		if (!saved)
+		{
+			fprintf(stderr, "Failed to write %s\n", commandLine.compressedPath);
+			return 1;
+		}
+		
+		BenchmarkStateCodec(&bench, state, compressed, scratchState);
+		bench.damagedAccepted += CountAcceptedBadHeaders(&state->header, romHash);
+		
+		// NOTE(bSalmon): The original carries on and becomes what every load has to match
+		BotPlayer savedBot = bot;
+		u64 endFrame = machine.frameCount + commandLine.afterFrames;
+		u64 expectedHash = PlayAfterState(&cpuState, &machine, &bot, endFrame);
+		
+		for (u32 method = (u32)StateTiming::LOAD_MEMORY; method < (u32)StateTiming::COUNT; ++method)
+		{
+			// NOTE(bSalmon): Scribble over the instance first so nothing left over can pass for a load
+			ResetMachine(&loadedState, &loadedMachine);
+			memset(&loadedState.memory[RAM_START], 0xCD, RAM_SIZE);
+			
+			b32 loaded = false;
+			startTime = PlatformGetWallClock();
+			switch ((StateTiming)method)
+			{
+				case StateTiming::LOAD_MEMORY:
+				{
+					loaded = LoadMachineState(state, &loadedState, &loadedMachine, romHash);
+					break;
+				}
+				
+				case StateTiming::LOAD_FILE:
+				{
+					loaded = LoadStateFromFile(commandLine.statePath, &loadedState, &loadedMachine);
+					break;
+				}
+				
+				case StateTiming::LOAD_COMPRESSED_FILE:
+				{
+					loaded = LoadStateFromFile(commandLine.compressedPath, &loadedState, &loadedMachine);
+					break;
+				}
+				
+				default:
+				{
+					loaded = MapStateFromFile(romImage, commandLine.statePath, &loadedState, &loadedMachine);
+					break;
+				}
+			}
+			RecordStateTiming(&timings, (StateTiming)method, startTime);
+			
+			BotPlayer loadedBot = savedBot;
+			if (!loaded || PlayAfterState(&loadedState, &loadedMachine, &loadedBot, endFrame) != expectedHash)
+			{
+				fprintf(stderr, "Round %u: %s did not carry on the same as the original\n", roundIndex,
+						stateTimingNames[method]);
+				mismatchCount++;
+			}
+		}
+		
+		// NOTE(bSalmon): Swap the mapped state for plain memory, the file is about to be written again
+		PlatformUnmapInstanceMemory(loadedState.memory);
+		loadedState.memory = PlatformMapInstanceMemory(romImage);
+	}
+	
+	printf("%u states saved part way through frames, each played on for %u frames\n", commandLine.roundCount,
+		   commandLine.afterFrames);
+	for (u32 timing = 0; timing < (u32)StateTiming::COUNT; ++timing)
+	{
+		printf("%-17s avg %7.2fus, max %7.2fus\n", stateTimingNames[timing],
+			   PlatformGetSecondsElapsed(0, timings.totalTicks[timing]) * 1000000.0 / commandLine.roundCount,
+			   PlatformGetSecondsElapsed(0, timings.maxTicks[timing]) * 1000000.0);
+	}
+	
+	f64 rawBytes = (f64)sizeof(SaveState) * commandLine.roundCount * LZ_BENCH_REPEATS;
+	printf("Raw state %u bytes, compressed avg %.0f bytes (min %u, max %u), %.1f:1\n", (u32)sizeof(SaveState),
+		   (f64)bench.compressedBytes / commandLine.roundCount, bench.minCompressedSize, bench.maxCompressedSize,
+		   ((f64)sizeof(SaveState) * commandLine.roundCount) / bench.compressedBytes);
+	printf("Copy raw          %7.2fGB/s\n", rawBytes / PlatformGetSecondsElapsed(0, bench.copyTicks) / 1e9);
+	printf("Compress          %7.2fGB/s\n", rawBytes / PlatformGetSecondsElapsed(0, bench.compressTicks) / 1e9);
+	printf("Decompress        %7.2fGB/s, %.2fGB/s with the container's hash check\n",
+		   rawBytes / PlatformGetSecondsElapsed(0, bench.decompressTicks) / 1e9,
+		   rawBytes / PlatformGetSecondsElapsed(0, bench.containerTicks) / 1e9);
+	
+	printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every load carried on the same as the original");
+	printf("Damaged states: %s\n", bench.damagedAccepted ? "ACCEPTED" : "every one refused");
+	
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformUnmapInstanceMemory(loadedState.memory);
+	PlatformFreeMemory(state);
+	PlatformFreeMemory(scratchState);
+	PlatformFreeMemory(compressed);
+	PlatformFreeMemory(bench.pool);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return (mismatchCount || bench.damagedAccepted) ? 1 : 0;
+}
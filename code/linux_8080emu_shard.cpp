@@ -0,0 +1,705 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_shard.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Sharded Runner, a coordinator process that forks worker processes and hands them jobs, each
+worker runs up to -instances jobs at once, a frame of each in turn. A job is a bot player
+(see 8080emu_bot.cpp) playing for a number of frames from reset, the result is the final
+state and frame hashes.
+
+Jobs, results and control go over a SOCK_SEQPACKET socket pair per worker. Everything bigger
+lives in one MAP_SHARED mapping made before the first fork so restarted workers get it too:
+  - a single producer/single consumer ring per worker the worker puts a copy of an instance's
+	video memory in every -observe frames, the coordinator takes them out so frames never go
+	through a socket
+  - a checkpoint per instance slot the worker writes every -checkpoint frames, double buffered
+	so a worker dying part way through a write leaves the older one whole
+
+When a worker dies the coordinator forks a new one in its place and sends it every job the
+old one had with resume set, the new worker carries on from the slot's last checkpoint.
+-crashes N kills a random worker with SIGKILL N times during the run to test this.
+
+Usage: linux_8080emu_shard <rom> [-workers N] [-instances N] [-jobs N] [-frames N]
+							   [-checkpoint N] [-observe N] [-crashes N] [-noverify]
+
+Defaults are 4 workers with 8 instances each, 64 jobs of 1800 frames, a checkpoint every 60
+frames and an observation every 60 frames. Unless -noverify is given every job is run again
+in the coordinator afterwards and the results compared, exits with 1 if any differ.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+#include "8080emu_fork.cpp"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define SHARD_MAX_WORKERS 64
+#define SHARD_MAX_INSTANCES 64
+#define SHARD_RING_SIZE 64
+#define SHARD_OBSERVATION_SIZE (0x4000 - 0x2400)
+
+enum class ShardMessageType : u32
+{
+	JOB,
+	DONE,
+	QUIT
+};
+
+struct ShardMessage
+{
+	ShardMessageType type;
+	u32 jobIndex;
+	u32 slotIndex;
+	u32 seed;
+	u32 frameCount;
+	b32 resume;
+	
+	// DONE only
+	u32 resumedFrame;
+	u64 stateHash;
+	u64 frameHash;
+};
+
+struct ShardObservation
+{
+	u32 jobIndex;
+	u32 frame;
+	u8 videoMemory[SHARD_OBSERVATION_SIZE];
+};
+
+struct ShardFrameRing
+{
+	// NOTE(bSalmon): Free running, only the worker writes writeIndex and only the coordinator readIndex
+	u32 volatile writeIndex;
+	u32 volatile readIndex;
+	u32 volatile droppedCount;
+	ShardObservation observations[SHARD_RING_SIZE];
+};
+
+struct ShardCheckpoint
+{
+	// NOTE(bSalmon): jobIndex + 1, 0 for none
+	u32 jobId;
+	BotPlayer bot;
+	MachineSnapshot snapshot;
+};
+
+struct ShardInstanceSlot
+{
+	// NOTE(bSalmon): Index of the newest whole checkpoint, only changed after it is written
+	u32 volatile current;
+	ShardCheckpoint checkpoints[2];
+};
+
+struct ShardSharedArea
+{
+	ShardFrameRing ring;
+	ShardInstanceSlot slots[SHARD_MAX_INSTANCES];
+};
+
+enum class ShardJobState
+{
+	PENDING,
+	RUNNING,
+	DONE
+};
+
+struct ShardJob
+{
+	ShardJobState state;
+	u32 seed;
+	u32 frameCount;
+	u32 workerIndex;
+	u32 slotIndex;
+	u64 stateHash;
+	u64 frameHash;
+};
+
+struct ShardWorker
+{
+	pid_t processID;
+	s32 socket;
+	ShardSharedArea *shared;
+	
+	// NOTE(bSalmon): jobIndex + 1 of the job in each instance slot, 0 for free
+	u32 slotJobs[SHARD_MAX_INSTANCES];
+	u32 activeCount;
+	u32 restartCount;
+};
+
+struct ShardCommandLine
+{
+	char *romPath;
+	u32 workerCount;
+	u32 instanceCount;
+	u32 jobCount;
+	u32 frameCount;
+	u32 checkpointInterval;
+	u32 observeInterval;
+	u32 crashCount;
+	b32 verify;
+};
+
+struct ShardWorkerInstance
+{
+	u32 jobIndex;
+	u32 frameCount;
+	u32 resumedFrame;
+	BotPlayer bot;
+	ForkedMachine machine;
+};
+
+struct ShardStats
+{
+	u64 jobsDone;
+	u64 observations;
+	u64 restarts;
+	u64 resumedJobs;
+	u64 resumedFrames;
+};
+
+internal_func ShardCommandLine ParseShardCommandLine(s32 argCount, char **args)
+{
+	ShardCommandLine result = {};
+	result.workerCount = 4;
+	result.instanceCount = 8;
+	result.jobCount = 64;
+	result.frameCount = 1800;
+	result.checkpointInterval = 60;
+	result.observeInterval = 60;
+	result.verify = true;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-workers") == 0 && hasValue)
+		{
+			result.workerCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-instances") == 0 && hasValue)
+		{
+			result.instanceCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-jobs") == 0 && hasValue)
+		{
+			result.jobCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-checkpoint") == 0 && hasValue)
+		{
+			result.checkpointInterval = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-observe") == 0 && hasValue)
+		{
+			result.observeInterval = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-crashes") == 0 && hasValue)
+		{
+			result.crashCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-noverify") == 0)
+		{
+			result.verify = false;
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	if (result.workerCount < 1)
+	{
+		result.workerCount = 1;
+	}
+	else if (result.workerCount > SHARD_MAX_WORKERS)
+	{
+		result.workerCount = SHARD_MAX_WORKERS;
+	}
+	
+	if (result.instanceCount < 1)
+	{
+		result.instanceCount = 1;
+	}
+	else if (result.instanceCount > SHARD_MAX_INSTANCES)
+	{
+		result.instanceCount = SHARD_MAX_INSTANCES;
+	}
+	
+	return result;
+}
+
+internal_func b32 SendShardMessage(s32 socket, ShardMessage *message)
+{
+	// NOTE(bSalmon): MSG_NOSIGNAL so a dead worker shows up as a failed send rather than SIGPIPE
+	b32 result = send(socket, message, sizeof(ShardMessage), MSG_NOSIGNAL) == sizeof(ShardMessage);
+	return result;
+}
+
+// Worker
+
+internal_func void PushShardObservation(ShardFrameRing *ring, ShardWorkerInstance *instance)
+{
+	u32 writeIndex = ring->writeIndex;
+	if ((writeIndex - ring->readIndex) < SHARD_RING_SIZE)
+	{
+		ShardObservation *observation = &ring->observations[writeIndex % SHARD_RING_SIZE];
+		observation->jobIndex = instance->jobIndex;
+		observation->frame = (u32)instance->machine.machine.frameCount;
+		memcpy(observation->videoMemory, &instance->machine.cpuState.memory[0x2400], SHARD_OBSERVATION_SIZE);
+		
+		CompletePreviousWritesBeforeFutureWrites;
+		ring->writeIndex = writeIndex + 1;
+	}
+	else
+	{
+		// NOTE(bSalmon): Never wait on the coordinator, an observation it was too slow for is dropped
+		ring->droppedCount = ring->droppedCount + 1;
+	}
+}
+
+internal_func void WriteShardCheckpoint(ShardInstanceSlot *slot, ShardWorkerInstance *instance)
+{
+	u32 next = slot->current ^ 1;
+	ShardCheckpoint *checkpoint = &slot->checkpoints[next];
+	checkpoint->jobId = instance->jobIndex + 1;
+	checkpoint->bot = instance->bot;
+	CaptureMachineSnapshot(&checkpoint->snapshot, &instance->machine);
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	slot->current = next;
+}
+
+internal_func void StartShardInstance(ShardSharedArea *shared, ShardWorkerInstance *instance, ShardMessage *message)
+{
+	instance->jobIndex = message->jobIndex;
+	instance->frameCount = message->frameCount;
+	instance->resumedFrame = 0;
+	
+	ShardInstanceSlot *slot = &shared->slots[message->slotIndex];
+	ShardCheckpoint *checkpoint = &slot->checkpoints[slot->current];
+	if (message->resume && checkpoint->jobId == (message->jobIndex + 1))
+	{
+		instance->bot = checkpoint->bot;
+		ForkMachine(&instance->machine, &checkpoint->snapshot);
+		instance->resumedFrame = (u32)instance->machine.machine.frameCount;
+	}
+	else
+	{
+		InitBotPlayer(&instance->bot, message->seed);
+		instance->machine.machine.romSize = 0x2000;
+		ResetMachine(&instance->machine.cpuState, &instance->machine.machine);
+		memset(&instance->machine.cpuState.memory[RAM_START], 0, RAM_SIZE);
+	}
+}
+
+internal_func void ShardWorkerMain(s32 socket, ShardSharedArea *shared, PlatformROMImage *romImage, ShardCommandLine *commandLine)
+{
+	ShardWorkerInstance *instances = (ShardWorkerInstance *)PlatformAllocateMemory(SHARD_MAX_INSTANCES * sizeof(ShardWorkerInstance));
+	b32 active[SHARD_MAX_INSTANCES] = {};
+	u32 activeCount = 0;
+	for (u32 slotIndex = 0; slotIndex < commandLine->instanceCount; ++slotIndex)
+	{
+		instances[slotIndex].machine.cpuState.memory = PlatformMapInstanceMemory(romImage);
+		if (!instances[slotIndex].machine.cpuState.memory)
+		{
+			_exit(1);
+		}
+	}
+	
+	b32 running = true;
+	while (running)
+	{
+		// NOTE(bSalmon): Only block for a message when there is nothing to run
+		ShardMessage message;
+		while (recv(socket, &message, sizeof(message), activeCount ? MSG_DONTWAIT : 0) == sizeof(message))
+		{
+			if (message.type == ShardMessageType::JOB)
+			{
+				StartShardInstance(shared, &instances[message.slotIndex], &message);
+				active[message.slotIndex] = true;
+				activeCount++;
+			}
+			else
+			{
+				running = false;
+				break;
+			}
+		}
+		
+		if (!activeCount && running)
+		{
+			// NOTE(bSalmon): The blocking recv failed, the coordinator is gone
+			running = false;
+		}
+		
+		for (u32 slotIndex = 0; slotIndex < commandLine->instanceCount && running; ++slotIndex)
+		{
+			if (active[slotIndex])
+			{
+				ShardWorkerInstance *instance = &instances[slotIndex];
+				MachineState *machine = &instance->machine.machine;
+				UpdateBotPlayer(&instance->bot, machine);
+				EmulateFrame(&instance->machine.cpuState, machine);
+				
+				if (commandLine->observeInterval && (machine->frameCount % commandLine->observeInterval) == 0)
+				{
+					PushShardObservation(&shared->ring, instance);
+				}
+				
+				if (machine->frameCount >= instance->frameCount)
+				{
+					ShardMessage done = {};
+					done.type = ShardMessageType::DONE;
+					done.jobIndex = instance->jobIndex;
+					done.slotIndex = slotIndex;
+					done.resumedFrame = instance->resumedFrame;
+					done.stateHash = HashMachineState(&instance->machine.cpuState, machine);
+					done.frameHash = HashVideoMemory(&instance->machine.cpuState, false);
+					active[slotIndex] = false;
+					activeCount--;
+					
+					if (!SendShardMessage(socket, &done))
+					{
+						running = false;
+					}
+				}
+				else if (commandLine->checkpointInterval && (machine->frameCount % commandLine->checkpointInterval) == 0)
+				{
+					WriteShardCheckpoint(&shared->slots[slotIndex], instance);
+				}
+			}
+		}
+	}
+	
+	_exit(0);
+}
+
+// Coordinator
+
+internal_func b32 StartShardWorker(ShardWorker *workers, u32 workerIndex, PlatformROMImage *romImage, ShardCommandLine *commandLine)
+{
+	s32 sockets[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0)
+	{
+		return false;
+	}
+	
+	pid_t processID = fork();
+	if (processID == 0)
+	{
+		close(sockets[0]);
+		for (u32 otherIndex = 0; otherIndex < commandLine->workerCount; ++otherIndex)
+		{
+			if (workers[otherIndex].socket >= 0)
+			{
+				close(workers[otherIndex].socket);
+			}
+		}
+		ShardWorkerMain(sockets[1], workers[workerIndex].shared, romImage, commandLine);
+	}
+	
+	close(sockets[1]);
+	if (processID < 0)
+	{
+		close(sockets[0]);
+		return false;
+	}
+	
+	workers[workerIndex].processID = processID;
+	workers[workerIndex].socket = sockets[0];
+	return true;
+}
+
+internal_func void SendShardJob(ShardWorker *worker, ShardJob *jobs, u32 jobIndex, u32 slotIndex, b32 resume)
+{
+	ShardMessage message = {};
+	message.type = ShardMessageType::JOB;
+	message.jobIndex = jobIndex;
+	message.slotIndex = slotIndex;
+	message.seed = jobs[jobIndex].seed;
+	message.frameCount = jobs[jobIndex].frameCount;
+	message.resume = resume;
+	
+	// NOTE(bSalmon): A failed send means the worker has died, the job goes back with the rest
+	// of its jobs when the hang up is seen
+	SendShardMessage(worker->socket, &message);
+}
+
+// Forks a replacement for a dead worker and gives it back the dead worker's jobs to resume
+internal_func b32 RestartShardWorker(ShardWorker *workers, u32 workerIndex, ShardJob *jobs, PlatformROMImage *romImage,
+									 ShardCommandLine *commandLine, ShardStats *stats)
+{
+	ShardWorker *worker = &workers[workerIndex];
+	close(worker->socket);
+	worker->socket = -1;
+	waitpid(worker->processID, 0, 0);
+	
+	b32 result = StartShardWorker(workers, workerIndex, romImage, commandLine);
+	if (result)
+	{
+		worker->restartCount++;
+		stats->restarts++;
+		for (u32 slotIndex = 0; slotIndex < commandLine->instanceCount; ++slotIndex)
+		{
+			if (worker->slotJobs[slotIndex])
+			{
+				SendShardJob(worker, jobs, worker->slotJobs[slotIndex] - 1, slotIndex, true);
+			}
+		}
+	}
+	
+	return result;
+}
+
+internal_func void DrainShardRing(ShardFrameRing *ring, ShardJob *jobs, u32 jobCount, ShardStats *stats)
+{
+	u32 readIndex = ring->readIndex;
+	while (readIndex != ring->writeIndex)
+	{
+		CompletePreviousReadsBeforeFutureReads;
+		ShardObservation *observation = &ring->observations[readIndex % SHARD_RING_SIZE];
+		ASSERT(observation->jobIndex < jobCount);
+		stats->observations++;
+		
+		CompletePreviousReadsBeforeFutureReads;
+		ring->readIndex = ++readIndex;
+	}
+}
+
+internal_func u32 VerifyShardJobs(ShardJob *jobs, u32 jobCount, PlatformROMImage *romImage)
+{
+	u32 result = 0;
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	for (u32 jobIndex = 0; jobIndex < jobCount; ++jobIndex)
+	{
+		ShardJob *job = &jobs[jobIndex];
+		BotPlayer bot;
+		InitBotPlayer(&bot, job->seed);
+		machine.romSize = 0x2000;
+		ResetMachine(&cpuState, &machine);
+		memset(&cpuState.memory[RAM_START], 0, RAM_SIZE);
+		while (machine.frameCount < job->frameCount)
+		{
+			UpdateBotPlayer(&bot, &machine);
+			EmulateFrame(&cpuState, &machine);
+		}
+		
+		if (HashMachineState(&cpuState, &machine) != job->stateHash || HashVideoMemory(&cpuState, false) != job->frameHash)
+		{
+			fprintf(stderr, "Job %u differs from the run in the coordinator\n", jobIndex);
+			result++;
+		}
+	}
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	ShardCommandLine commandLine = ParseShardCommandLine(argCount, args);
+	if (!commandLine.romPath)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-workers N] [-instances N] [-jobs N] [-frames N] [-checkpoint N] [-observe N] [-crashes N] [-noverify]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, romSize) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	u32 workerCount = commandLine.workerCount;
+	u64 sharedSize = workerCount * sizeof(ShardSharedArea);
+	ShardSharedArea *shared = (ShardSharedArea *)mmap(0, sharedSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map %llu bytes of shared memory\n", (unsigned long long)sharedSize);
+		return 1;
+	}
+	
+	ShardJob *jobs = (ShardJob *)PlatformAllocateMemory(commandLine.jobCount * sizeof(ShardJob));
+	for (u32 jobIndex = 0; jobIndex < commandLine.jobCount; ++jobIndex)
+	{
+		jobs[jobIndex].seed = jobIndex + 1;
+		jobs[jobIndex].frameCount = commandLine.frameCount;
+	}
+	
+	ShardWorker workers[SHARD_MAX_WORKERS] = {};
+	for (u32 workerIndex = 0; workerIndex < SHARD_MAX_WORKERS; ++workerIndex)
+	{
+		workers[workerIndex].socket = -1;
+	}
+	
+	for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+	{
+		workers[workerIndex].shared = &shared[workerIndex];
+		if (!StartShardWorker(workers, workerIndex, romImage, &commandLine))
+		{
+			fprintf(stderr, "Failed to start worker %u\n", workerIndex);
+			return 1;
+		}
+	}
+	
+	ShardStats stats = {};
+	u32 nextJob = 0;
+	u32 crashesLeft = commandLine.crashCount;
+	u32 crashRandom = 0x9E3779B9;
+	b32 failed = false;
+	
+	u64 startTime = PlatformGetWallClock();
+	while (stats.jobsDone < commandLine.jobCount && !failed)
+	{
+		// Hand out pending jobs to free slots
+		for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+		{
+			ShardWorker *worker = &workers[workerIndex];
+			for (u32 slotIndex = 0; slotIndex < commandLine.instanceCount && nextJob < commandLine.jobCount; ++slotIndex)
+			{
+				if (!worker->slotJobs[slotIndex])
+				{
+					jobs[nextJob].state = ShardJobState::RUNNING;
+					jobs[nextJob].workerIndex = workerIndex;
+					jobs[nextJob].slotIndex = slotIndex;
+					worker->slotJobs[slotIndex] = nextJob + 1;
+					worker->activeCount++;
+					SendShardJob(worker, jobs, nextJob, slotIndex, false);
+					nextJob++;
+				}
+			}
+		}
+		
+		struct pollfd pollFiles[SHARD_MAX_WORKERS];
+		for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+		{
+			pollFiles[workerIndex].fd = workers[workerIndex].socket;
+			pollFiles[workerIndex].events = POLLIN;
+			pollFiles[workerIndex].revents = 0;
+		}
+		poll(pollFiles, workerCount, 1);
+		
+		for (u32 workerIndex = 0; workerIndex < workerCount && !failed; ++workerIndex)
+		{
+			ShardWorker *worker = &workers[workerIndex];
+			DrainShardRing(&worker->shared->ring, jobs, commandLine.jobCount, &stats);
+			
+			if (!pollFiles[workerIndex].revents)
+			{
+				continue;
+			}
+			
+			ShardMessage message;
+			ssize_t received;
+			while ((received = recv(worker->socket, &message, sizeof(message), MSG_DONTWAIT)) == sizeof(message))
+			{
+				ShardJob *job = &jobs[message.jobIndex];
+				job->state = ShardJobState::DONE;
+				job->stateHash = message.stateHash;
+				job->frameHash = message.frameHash;
+				worker->slotJobs[message.slotIndex] = 0;
+				worker->activeCount--;
+				stats.jobsDone++;
+				
+				if (message.resumedFrame)
+				{
+					stats.resumedJobs++;
+					stats.resumedFrames += message.resumedFrame;
+				}
+			}
+			
+			if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ||
+				(pollFiles[workerIndex].revents & (POLLHUP | POLLERR)))
+			{
+				// NOTE(bSalmon): The worker is gone, whatever it finished before dying has been read above
+				if (!RestartShardWorker(workers, workerIndex, jobs, romImage, &commandLine, &stats))
+				{
+					fprintf(stderr, "Failed to restart worker %u\n", workerIndex);
+					failed = true;
+				}
+			}
+		}
+		
+		// NOTE(bSalmon): Crashes are spread evenly over the jobs
+		if (crashesLeft && (stats.jobsDone * (commandLine.crashCount + 1)) >=
+			((u64)(commandLine.crashCount - crashesLeft + 1) * commandLine.jobCount))
+		{
+			crashRandom ^= crashRandom << 13;
+			crashRandom ^= crashRandom >> 17;
+			crashRandom ^= crashRandom << 5;
+			kill(workers[crashRandom % workerCount].processID, SIGKILL);
+			crashesLeft--;
+		}
+	}
+	f64 seconds = PlatformGetSecondsElapsed(startTime, PlatformGetWallClock());
+	
+	u64 droppedCount = 0;
+	for (u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+	{
+		ShardMessage quit = {};
+		quit.type = ShardMessageType::QUIT;
+		SendShardMessage(workers[workerIndex].socket, &quit);
+		close(workers[workerIndex].socket);
+		waitpid(workers[workerIndex].processID, 0, 0);
+		
+		DrainShardRing(&workers[workerIndex].shared->ring, jobs, commandLine.jobCount, &stats);
+		droppedCount += workers[workerIndex].shared->ring.droppedCount;
+	}
+	
+	u64 totalFrames = (u64)stats.jobsDone * commandLine.frameCount;
+	printf("%u workers x %u instances, %llu of %u jobs of %u frames in %.3fs\n", workerCount, commandLine.instanceCount,
+		   (unsigned long long)stats.jobsDone, commandLine.jobCount, commandLine.frameCount, seconds);
+	printf("%.1f jobs/sec, %.0f frames/sec\n", stats.jobsDone / seconds, totalFrames / seconds);
+	printf("Observations: %llu through the rings, %llu dropped\n", (unsigned long long)stats.observations,
+		   (unsigned long long)droppedCount);
+	printf("Restarts: %llu, %llu jobs resumed from checkpoints skipping %llu frames\n", (unsigned long long)stats.restarts,
+		   (unsigned long long)stats.resumedJobs, (unsigned long long)stats.resumedFrames);
+	
+	u32 mismatchCount = failed ? 1 : 0;
+	if (commandLine.verify && !failed)
+	{
+		mismatchCount = VerifyShardJobs(jobs, commandLine.jobCount, romImage);
+		printf("Check: %s\n", mismatchCount ? "MISMATCH" : "every job matches a run in the coordinator");
+	}
+	
+	munmap(shared, sharedSize);
+	PlatformFreeMemory(jobs);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return mismatchCount ? 1 : 0;
+}
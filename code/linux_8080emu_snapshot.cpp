@@ -0,0 +1,326 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_snapshot.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+Snapshot Chain Test, times per-frame snapshots with a snapshot chain (see 8080emu_snapshot.cpp)
+against whole save states and the rewind buffer, and checks every rebuild against a whole copy.
+
+-seeds bot players (see 8080emu_bot.cpp) each play -frames frames with a snapshot pushed after
+every frame. Along the way
+	- a random one of the last SNAPSHOT_TEST_HISTORY snapshots is rebuilt with ReadSnapshot every
+	  SNAPSHOT_TEST_READ_INTERVAL frames and compared to the save state taken on that frame
+	- every SNAPSHOT_TEST_ROLLBACK_INTERVAL frames the machine is restored 1 to 8 frames back with
+	  RestoreSnapshot, compared, then played forward again on the same inputs and compared to
+	  where it was before
+Whole save states and a rewind buffer are kept alongside for the timings and sizes. The same
+machine also keeps an incremental state hash (see 8080emu_hash.cpp), which is checked against
+one from scratch after every frame and restore, so the chain and the hash are shown to track
+dirty pages without getting in each other's way.
+
+Usage: linux_8080emu_snapshot <rom> [-seeds N] [-frames N] [-keyframes N]
+
+Defaults are 4 seeds of 20000 frames and a keyframe every 60. Exits with 1 on any mismatch.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_rewind.cpp"
+#include "8080emu_snapshot.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+
+#include <stdlib.h>
+
+#define SNAPSHOT_TEST_HISTORY 600
+#define SNAPSHOT_TEST_READ_INTERVAL 7
+#define SNAPSHOT_TEST_ROLLBACK_INTERVAL 13
+#define SNAPSHOT_TEST_MAX_ROLLBACK 8
+
+// NOTE(bSalmon): A minute of snapshots, small enough that the oldest are dropped along the way
+#define SNAPSHOT_TEST_MAX_SNAPSHOTS 3600
+#define SNAPSHOT_TEST_STORAGE MEGABYTES(2)
+
+struct SnapshotTestCommandLine
+{
+	char *romPath;
+	u32 seedCount;
+	u32 frameCount;
+	u32 keyframeInterval;
+};
+
+// NOTE(bSalmon): The machine after a frame and the inputs that frame was played with, kept by frameCount
+struct SnapshotTestFrame
+{
+	SaveState state;
+	u8 inputPort1;
+	u8 inputPort2;
+};
+
+struct SnapshotTestTimes
+{
+	u64 chainPush;
+	u64 fullSave;
+	u64 rewindPush;
+	u64 reads;
+	u64 readCount;
+	u64 restores;
+	u64 fullLoads;
+	u64 restoreCount;
+};
+
+internal_func SnapshotTestCommandLine ParseSnapshotTestCommandLine(s32 argCount, char **args)
+{
+	SnapshotTestCommandLine result = {};
+	result.seedCount = 4;
+	result.frameCount = 20000;
+	result.keyframeInterval = SNAPSHOT_DEFAULT_KEYFRAME_INTERVAL;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-seeds") == 0 && hasValue)
+		{
+			result.seedCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-keyframes") == 0 && hasValue)
+		{
+			result.keyframeInterval = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+internal_func b32 DoSaveStatesMatch(SaveState *a, SaveState *b)
+{
+	b32 result = (memcmp(&a->header, &b->header, sizeof(a->header)) == 0) && (memcmp(a->ram, b->ram, RAM_SIZE) == 0);
+	return result;
+}
+
+// Brings the incremental hash up to date and compares it with one of the whole machine
+internal_func b32 DoesStateHashMatch(StateHash *stateHash, CPUState *cpuState, MachineState *machine)
+{
+	StateHash fromScratch = {};
+	b32 result = (UpdateStateHash(stateHash, cpuState, machine) == UpdateStateHash(&fromScratch, cpuState, machine, 0));
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	SnapshotTestCommandLine commandLine = ParseSnapshotTestCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.seedCount || !commandLine.frameCount || !commandLine.keyframeInterval)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-seeds N] [-frames N] [-keyframes N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, (romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	CPUState cpuState = {};
+	MachineState machine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	SnapshotTestFrame *history = (SnapshotTestFrame *)PlatformAllocateMemory(SNAPSHOT_TEST_HISTORY * sizeof(SnapshotTestFrame));
+	SaveState *scratch = (SaveState *)PlatformAllocateMemory(sizeof(SaveState));
+	SnapshotChain chain;
+	RewindBuffer rewind;
+	if (!cpuState.memory || !history || !scratch ||
+		!InitSnapshotChain(&chain, SNAPSHOT_TEST_MAX_SNAPSHOTS, SNAPSHOT_TEST_STORAGE, commandLine.keyframeInterval) ||
+		!InitRewindBuffer(&rewind, SNAPSHOT_TEST_MAX_SNAPSHOTS, SNAPSHOT_TEST_STORAGE))
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	SnapshotTestTimes times = {};
+	u64 readMismatches = 0;
+	u64 restoreMismatches = 0;
+	u64 replayMismatches = 0;
+	u64 unbuildableOldest = 0;
+	u64 hashMismatches = 0;
+	u64 pagesRestored = 0;
+	u64 mostSnapshotsKept = 0;
+	u32 testRandom = 0x2545F491;
+	
+	for (u32 seed = 1; seed <= commandLine.seedCount; ++seed)
+	{
+		machine = {};
+		machine.romSize = 0x2000;
+		ResetMachine(&cpuState, &machine);
+		memset(&cpuState.memory[RAM_START], 0, RAM_SIZE);
+		cpuState.dirtyPages = ~0ULL;
+		ClearSnapshotChain(&chain);
+		ClearRewindBuffer(&rewind);
+		StateHash stateHash = {};
+		
+		BotPlayer bot;
+		InitBotPlayer(&bot, seed);
+		
+		// NOTE(bSalmon): historyCount frames of history[], the chain holds at least as many
+		u32 historyCount = 0;
+		for (u32 frameIndex = 0; frameIndex < commandLine.frameCount; ++frameIndex)
+		{
+			UpdateBotPlayer(&bot, &machine);
+			EmulateFrame(&cpuState, &machine);
+			SnapshotTestFrame *frame = &history[machine.frameCount % SNAPSHOT_TEST_HISTORY];
+			frame->inputPort1 = machine.inputPort1;
+			frame->inputPort2 = machine.inputPort2;
+			
+			u64 startTime = PlatformGetWallClock();
+			PushSnapshot(&chain, &cpuState, &machine);
+			u64 chainTime = PlatformGetWallClock();
+			SaveMachineState(&frame->state, &cpuState, &machine, 0);
+			u64 saveTime = PlatformGetWallClock();
+			PushRewindFrame(&rewind, &cpuState, &machine);
+			u64 rewindTime = PlatformGetWallClock();
+			times.chainPush += chainTime - startTime;
+			times.fullSave += saveTime - chainTime;
+			times.rewindPush += rewindTime - saveTime;
+			
+			if (!DoesStateHashMatch(&stateHash, &cpuState, &machine))
+			{
+				hashMismatches++;
+			}
+			
+			historyCount = (historyCount < SNAPSHOT_TEST_HISTORY) ? (historyCount + 1) : historyCount;
+			if (chain.entryCount > mostSnapshotsKept)
+			{
+				mostSnapshotsKept = chain.entryCount;
+			}
+			if (GetSnapshotRecord(&chain, chain.entryCount - 1)->storedPages != ~0ULL)
+			{
+				unbuildableOldest++;
+			}
+			
+			testRandom = (testRandom * 1664525) + 1013904223;
+			u32 limit = (historyCount < chain.entryCount) ? historyCount : chain.entryCount;
+			if ((frameIndex % SNAPSHOT_TEST_READ_INTERVAL) == 0)
+			{
+				u32 stepsBack = (testRandom >> 8) % limit;
+				
+				startTime = PlatformGetWallClock();
+				ReadSnapshot(&chain, stepsBack, scratch);
+				times.reads += PlatformGetWallClock() - startTime;
+				times.readCount++;
+				
+				if (!DoSaveStatesMatch(scratch, &history[(machine.frameCount - stepsBack) % SNAPSHOT_TEST_HISTORY].state))
+				{
+					readMismatches++;
+				}
+			}
+			
+			if ((frameIndex % SNAPSHOT_TEST_ROLLBACK_INTERVAL) == 0 && limit > SNAPSHOT_TEST_MAX_ROLLBACK)
+			{
+				u32 stepsBack = 1 + ((testRandom >> 16) % SNAPSHOT_TEST_MAX_ROLLBACK);
+				u64 currentHash = HashMachineState(&cpuState, &machine);
+				u64 currentFrame = machine.frameCount;
+				
+				// NOTE(bSalmon): A whole load for comparison, done into scratch so the machine isn't touched
+				startTime = PlatformGetWallClock();
+				memcpy(scratch, &history[(currentFrame - stepsBack) % SNAPSHOT_TEST_HISTORY].state, sizeof(SaveState));
+				times.fullLoads += PlatformGetWallClock() - startTime;
+				
+				u64 pages = GetDirtyPages(&cpuState, DirtyPageUser::SNAPSHOT);
+				for (u32 step = 0; step < stepsBack; ++step)
+				{
+					pages |= GetSnapshotRecord(&chain, step)->writtenPages;
+				}
+				pagesRestored += CountSetBits64(pages);
+				
+				startTime = PlatformGetWallClock();
+				RestoreSnapshot(&chain, stepsBack, &cpuState, &machine);
+				times.restores += PlatformGetWallClock() - startTime;
+				times.restoreCount++;
+				
+				SaveMachineState(scratch, &cpuState, &machine, 0);
+				if (!DoSaveStatesMatch(scratch, &history[machine.frameCount % SNAPSHOT_TEST_HISTORY].state))
+				{
+					restoreMismatches++;
+				}
+				if (!DoesStateHashMatch(&stateHash, &cpuState, &machine))
+				{
+					hashMismatches++;
+				}
+				
+				while (machine.frameCount < currentFrame)
+				{
+					SnapshotTestFrame *replayFrame = &history[(machine.frameCount + 1) % SNAPSHOT_TEST_HISTORY];
+					machine.inputPort1 = replayFrame->inputPort1;
+					machine.inputPort2 = replayFrame->inputPort2;
+					EmulateFrame(&cpuState, &machine);
+					PushSnapshot(&chain, &cpuState, &machine);
+				}
+				
+				if (HashMachineState(&cpuState, &machine) != currentHash)
+				{
+					replayMismatches++;
+				}
+			}
+		}
+	}
+	
+	u64 frameCount = (u64)commandLine.seedCount * commandLine.frameCount;
+	printf("%llu frames from %u games, a keyframe every %u, %llu snapshots kept at most\n", (unsigned long long)frameCount,
+		   commandLine.seedCount, chain.keyframeInterval, (unsigned long long)mostSnapshotsKept);
+	printf("Snapshot chain: %.0fns a frame, %.0f bytes (%.1f pages)\n", (f64)times.chainPush / frameCount,
+		   (f64)chain.stats.bytesStored / chain.stats.snapshots, (f64)chain.stats.pagesStored / chain.stats.snapshots);
+	printf("Save state:     %.0fns a frame, %llu bytes\n", (f64)times.fullSave / frameCount, (unsigned long long)sizeof(SaveState));
+	printf("Rewind buffer:  %.0fns a frame, %.0f bytes\n", (f64)times.rewindPush / frameCount,
+		   rewind.entryCount ? (f64)rewind.storedBytes / rewind.entryCount : 0.0);
+	printf("Rebuild any snapshot: %.0fns, restore 1-%d frames back: %.0fns for %.1f pages (whole copy %.0fns)\n",
+		   times.readCount ? (f64)times.reads / times.readCount : 0.0, SNAPSHOT_TEST_MAX_ROLLBACK,
+		   times.restoreCount ? (f64)times.restores / times.restoreCount : 0.0,
+		   times.restoreCount ? (f64)pagesRestored / times.restoreCount : 0.0,
+		   times.restoreCount ? (f64)times.fullLoads / times.restoreCount : 0.0);
+	printf("Check: %llu of %llu rebuilds, %llu of %llu restores and %llu replays differed, oldest unbuildable %llu times\n",
+		   (unsigned long long)readMismatches, (unsigned long long)times.readCount, (unsigned long long)restoreMismatches,
+		   (unsigned long long)times.restoreCount, (unsigned long long)replayMismatches, (unsigned long long)unbuildableOldest);
+	printf("Check: the state hash kept on the same machine differed from scratch %llu times\n", (unsigned long long)hashMismatches);
+	
+	b32 failed = readMismatches || restoreMismatches || replayMismatches || unbuildableOldest || hashMismatches;
+	
+	FreeRewindBuffer(&rewind);
+	FreeSnapshotChain(&chain);
+	PlatformFreeMemory(scratch);
+	PlatformFreeMemory(history);
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return failed ? 1 : 0;
+}
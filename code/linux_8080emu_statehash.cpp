@@ -0,0 +1,258 @@
+/*
+Project: Intel 8080 CPU Emulator
+File: linux_8080emu_statehash.cpp
+Author: Brock Salmon
+
+Copyright 2018 Brock Salmon
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+   http://www.apache.org/licenses/LICENSE-2.0
+   
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+NOTE(bSalmon):
+
+State Hash Test, times the incremental state hash (see 8080emu_hash.cpp) and looks for
+collisions in it over long games.
+
+-seeds bot players (see 8080emu_bot.cpp) each play -frames frames, the state hash is updated
+after every frame from the pages the frame wrote and checked against hashing everything from
+scratch. Every state is also given a second, unrelated hash of all the same data, two states
+with the same state hash but different second hashes are a collision.
+
+As a check that the hash spreads states out evenly, the low 32 bits of the distinct states'
+hashes are expected to collide about n^2 / 2^33 times.
+
+Usage: linux_8080emu_statehash <rom> [-seeds N] [-frames N]
+
+Defaults are 16 seeds of 20000 frames. Exits with 1 on any collision or incremental mismatch.
+*/
+
+#include "8080emu.cpp"
+#include "8080emu_hash.cpp"
+#include "linux_8080emu_platform.cpp"
+#include "8080emu_bot.cpp"
+
+#include <stdlib.h>
+
+#define STATE_HASH_TIMING_REPEATS 100000
+
+struct StateHashCommandLine
+{
+	char *romPath;
+	u32 seedCount;
+	u32 frameCount;
+};
+
+struct StateHashEntry
+{
+	u64 stateHash;
+	u64 checkHash;
+};
+
+internal_func StateHashCommandLine ParseStateHashCommandLine(s32 argCount, char **args)
+{
+	StateHashCommandLine result = {};
+	result.seedCount = 16;
+	result.frameCount = 20000;
+	
+	for (s32 argIndex = 1; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-seeds") == 0 && hasValue)
+		{
+			result.seedCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (strcmp(args[argIndex], "-frames") == 0 && hasValue)
+		{
+			result.frameCount = (u32)strtoul(args[++argIndex], 0, 10);
+		}
+		else if (args[argIndex][0] != '-')
+		{
+			result.romPath = args[argIndex];
+		}
+	}
+	
+	return result;
+}
+
+// NOTE(bSalmon): Same data as the state hash, hashed whole with a different seed
+internal_func u64 HashStateForCheck(CPUState *cpuState, MachineState *machine)
+{
+	u8 registers[STATE_HASH_REGISTERS_SIZE];
+	PackStateHashRegisters(registers, cpuState, machine);
+	u64 memoryHash = HashMemory64(cpuState->memory, RAM_START + RAM_SIZE, 0x5EED5EED5EED5EEDULL);
+	
+	u64 result = HashMemory64(registers, sizeof(registers), memoryHash);
+	return result;
+}
+
+internal_func s32 CompareStateHashEntries(const void *a, const void *b)
+{
+	StateHashEntry *entryA = (StateHashEntry *)a;
+	StateHashEntry *entryB = (StateHashEntry *)b;
+	
+	s32 result = 0;
+	if (entryA->stateHash != entryB->stateHash)
+	{
+		result = (entryA->stateHash < entryB->stateHash) ? -1 : 1;
+	}
+	else if (entryA->checkHash != entryB->checkHash)
+	{
+		result = (entryA->checkHash < entryB->checkHash) ? -1 : 1;
+	}
+	
+	return result;
+}
+
+internal_func s32 CompareU64(const void *a, const void *b)
+{
+	u64 valueA = *(u64 *)a;
+	u64 valueB = *(u64 *)b;
+	s32 result = (valueA < valueB) ? -1 : ((valueA > valueB) ? 1 : 0);
+	return result;
+}
+
+int main(int argCount, char **args)
+{
+	StateHashCommandLine commandLine = ParseStateHashCommandLine(argCount, args);
+	if (!commandLine.romPath || !commandLine.seedCount || !commandLine.frameCount)
+	{
+		fprintf(stderr, "Usage: %s <rom> [-seeds N] [-frames N]\n", args[0]);
+		return 1;
+	}
+	
+	u64 romSize = 0;
+	u8 *rom = PlatformReadEntireFile(commandLine.romPath, &romSize);
+	PlatformROMImage *romImage = rom ? PlatformCreateROMImage(rom, (romSize < 0x2000) ? romSize : 0x2000) : 0;
+	if (!romImage)
+	{
+		fprintf(stderr, "Failed to read %s\n", commandLine.romPath);
+		return 1;
+	}
+	
+	u64 entryCount = (u64)commandLine.seedCount * commandLine.frameCount;
+	StateHashEntry *entries = (StateHashEntry *)PlatformAllocateMemory(entryCount * sizeof(StateHashEntry));
+	CPUState cpuState = {};
+	MachineState machine = {};
+	cpuState.memory = PlatformMapInstanceMemory(romImage);
+	if (!entries || !cpuState.memory)
+	{
+		fprintf(stderr, "Failed to allocate memory\n");
+		return 1;
+	}
+	
+	u64 mismatchCount = 0;
+	u64 incrementalNanoseconds = 0;
+	u64 pagesHashed = 0;
+	u64 entryIndex = 0;
+	for (u32 seed = 1; seed <= commandLine.seedCount; ++seed)
+	{
+		machine = {};
+		machine.romSize = 0x2000;
+		ResetMachine(&cpuState, &machine);
+		memset(&cpuState.memory[RAM_START], 0, RAM_SIZE);
+		
+		BotPlayer bot;
+		InitBotPlayer(&bot, seed);
+		StateHash stateHash = {};
+		UpdateStateHash(&stateHash, &cpuState, &machine);
+		
+		for (u32 frameIndex = 0; frameIndex < commandLine.frameCount; ++frameIndex)
+		{
+			UpdateBotPlayer(&bot, &machine);
+			EmulateFrame(&cpuState, &machine);
+			
+			pagesHashed += CountSetBits64(GetDirtyPages(&cpuState, DirtyPageUser::STATE_HASH));
+			u64 startTime = PlatformGetWallClock();
+			u64 hash = UpdateStateHash(&stateHash, &cpuState, &machine);
+			incrementalNanoseconds += PlatformGetWallClock() - startTime;
+			
+			StateHash fromScratch = {};
+			if (hash != UpdateStateHash(&fromScratch, &cpuState, &machine, 0))
+			{
+				mismatchCount++;
+			}
+			
+			entries[entryIndex].stateHash = hash;
+			entries[entryIndex].checkHash = HashStateForCheck(&cpuState, &machine);
+			entryIndex++;
+		}
+	}
+	
+	// NOTE(bSalmon): Timed on the last state, over and over. The hashes go into a volatile so the
+	// compiler can't drop the calls
+	u64 startTime = PlatformGetWallClock();
+	u64 volatile sink = 0;
+	for (u32 repeat = 0; repeat < STATE_HASH_TIMING_REPEATS; ++repeat)
+	{
+		StateHash fromScratch;
+		fromScratch.valid = false;
+		sink += UpdateStateHash(&fromScratch, &cpuState, &machine, 0);
+	}
+	f64 fullNanoseconds = (f64)(PlatformGetWallClock() - startTime) / STATE_HASH_TIMING_REPEATS;
+	
+	startTime = PlatformGetWallClock();
+	for (u32 repeat = 0; repeat < STATE_HASH_TIMING_REPEATS; ++repeat)
+	{
+		cpuState.regA = (u8)repeat;
+		sink += HashMachineState(&cpuState, &machine);
+	}
+	f64 machineNanoseconds = (f64)(PlatformGetWallClock() - startTime) / STATE_HASH_TIMING_REPEATS;
+	
+	printf("%llu states from %u games of %u frames\n", (unsigned long long)entryCount, commandLine.seedCount, commandLine.frameCount);
+	printf("Incremental: %.0fns a frame for %.1f pages, from scratch: %.0fns, HashMachineState: %.0fns\n",
+		   (f64)incrementalNanoseconds / entryCount, (f64)pagesHashed / entryCount, fullNanoseconds, machineNanoseconds);
+	
+	qsort(entries, entryCount, sizeof(StateHashEntry), CompareStateHashEntries);
+	
+	u64 distinctCount = 0;
+	u64 collisionCount = 0;
+	u64 *lowBits = (u64 *)PlatformAllocateMemory(entryCount * sizeof(u64));
+	for (u64 index = 0; index < entryCount; ++index)
+	{
+		StateHashEntry *entry = &entries[index];
+		StateHashEntry *previous = index ? &entries[index - 1] : 0;
+		if (!previous || previous->stateHash != entry->stateHash || previous->checkHash != entry->checkHash)
+		{
+			if (previous && previous->stateHash == entry->stateHash)
+			{
+				collisionCount++;
+			}
+			lowBits[distinctCount++] = entry->stateHash & 0xFFFFFFFF;
+		}
+	}
+	
+	qsort(lowBits, distinctCount, sizeof(u64), CompareU64);
+	u64 lowCollisionCount = 0;
+	for (u64 index = 1; index < distinctCount; ++index)
+	{
+		if (lowBits[index] == lowBits[index - 1])
+		{
+			lowCollisionCount++;
+		}
+	}
+	f64 expectedLowCollisions = ((f64)distinctCount * (f64)(distinctCount - 1)) / 8589934592.0;
+	
+	printf("%llu distinct states, %llu collisions in 64 bits, %llu in the low 32 bits (%.1f expected)\n",
+		   (unsigned long long)distinctCount, (unsigned long long)collisionCount, (unsigned long long)lowCollisionCount,
+		   expectedLowCollisions);
+	printf("Incremental against from scratch: %llu mismatches\n", (unsigned long long)mismatchCount);
+	
+	PlatformFreeMemory(lowBits);
+	PlatformFreeMemory(entries);
+	PlatformUnmapInstanceMemory(cpuState.memory);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(rom);
+	
+	return (collisionCount || mismatchCount) ? 1 : 0;
+}
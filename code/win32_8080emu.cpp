@@ -44,6 +44,16 @@ EMULATOR MEMORY LAYOUT:
 
 #include <Windows.h>
 #include "8080emu.cpp"
+#include "8080emu_upscale.cpp"
+#include "8080emu_filters.cpp"
+#include "8080emu_hash.cpp"
+#include "8080emu_lz.cpp"
+#include "8080emu_savestate.cpp"
+#include "8080emu_rewind.cpp"
+#include "8080emu_movie.cpp"
+#include "8080emu_path.cpp"
+#include "8080emu_framedump.cpp"
+#include "8080emu_exchange.cpp"
 
 #if EMU8080_INTERNAL
 #include <stdio.h>
@@ -71,10 +81,393 @@ struct Win32_Menus
 {
 	HMENU emulatorOptions;
 	HMENU settings;
+	HMENU filters;
+};
+
+struct PlatformWorkQueueEntry
+{
+	PlatformWorkQueueCallback *callback;
+	void *data;
+};
+
+struct PlatformWorkQueue
+{
+	u32 volatile completionGoal;
+	u32 volatile completionCount;
+	
+	u32 volatile nextEntryToWrite;
+	u32 volatile nextEntryToRead;
+	HANDLE semaphoreHandle;
+	
+	PlatformWorkQueueEntry entries[256];
+};
+
+struct Win32_Emulation
+{
+	// NOTE(bSalmon): Only touched by the emulation thread once it has started
+	CPUState cpuState;
+	MachineState machine;
+	FrameDump frameDump;
+	b32 dumpingFrames;
+	u64 frameCount;
+	b32 sleepIsGranular;
+	RewindBuffer rewind;
+	b32 rewindEnabled;
+	b32 rewinding;
+	MovieRecorder movieRecorder;
+	b32 recordingMovie;
+	MoviePlayer moviePlayer;
+	b32 playingMovie;
+	
+	// NOTE(bSalmon): Shared, see 8080emu_exchange.cpp
+	InputQueue inputQueue;
+	FrameExchange *frameExchange;
+	HANDLE frameReadyEvent;
+	u32 volatile running;
+	
+	// NOTE(bSalmon): Only touched by the UI thread
+	b32 enableColour;
+	char romFilename[256];
 };
 
 global_var b32 globalRunning;
-global_var Win32_BackBuffer globalBackBuffer = {};
+global_var FrameExchange globalFrameExchange = {};
+global_var Win32_BackBuffer globalPresentBuffer = {};
+global_var FilterPipeline globalFilterPipeline = {};
+global_var LARGE_INTEGER globalPerfCountFrequency;
+
+internal_func void *PlatformAllocateMemory(u64 size)
+{
+	void *result = VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	return result;
+}
+
+internal_func void PlatformFreeMemory(void *memory)
+{
+	if (memory)
+	{
+		VirtualFree(memory, 0, MEM_RELEASE);
+	}
+}
+
+internal_func u8 *PlatformReadEntireFile(char *path, u64 *size)
+{
+	u8 *result = 0;
+	
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER fileSize;
+		if (GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0 && fileSize.QuadPart <= 0xFFFFFFFF)
+		{
+			result = (u8 *)PlatformAllocateMemory(fileSize.QuadPart);
+			DWORD bytesRead;
+			if (result && ReadFile(fileHandle, result, (DWORD)fileSize.QuadPart, &bytesRead, 0) && (s64)bytesRead == fileSize.QuadPart)
+			{
+				*size = fileSize.QuadPart;
+			}
+			else
+			{
+				PlatformFreeMemory(result);
+				result = 0;
+			}
+		}
+		
+		CloseHandle(fileHandle);
+	}
+	
+	return result;
+}
+
+internal_func b32 PlatformWriteEntireFile(char *path, void *memory, u64 size)
+{
+	b32 result = false;
+	
+	HANDLE fileHandle = CreateFileA(path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		DWORD bytesWritten;
+		if (WriteFile(fileHandle, memory, (DWORD)size, &bytesWritten, 0))
+		{
+			result = (bytesWritten == size);
+		}
+		
+		CloseHandle(fileHandle);
+	}
+	
+	return result;
+}
+
+// NOTE(bSalmon): Written and flushed one file at a time, there is no batched flush to make use of
+internal_func u32 PlatformWriteFileBatch(PlatformFileWrite *writes, u32 count)
+{
+	u32 result = 0;
+	
+	for (u32 writeIndex = 0; writeIndex < count; ++writeIndex)
+	{
+		PlatformFileWrite *write = &writes[writeIndex];
+		write->succeeded = false;
+		
+		char tempPath[MAX_PATH];
+		sprintf_s(tempPath, sizeof(tempPath), "%s.tmp", write->path);
+		HANDLE fileHandle = CreateFileA(tempPath, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+		if (fileHandle != INVALID_HANDLE_VALUE)
+		{
+			DWORD bytesWritten = 0;
+			b32 written = WriteFile(fileHandle, write->memory, (DWORD)write->size, &bytesWritten, 0) &&
+				(bytesWritten == write->size) && FlushFileBuffers(fileHandle);
+			CloseHandle(fileHandle);
+			
+			write->succeeded = written && MoveFileExA(tempPath, write->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+			if (!write->succeeded)
+			{
+				DeleteFileA(tempPath);
+			}
+		}
+		
+		if (write->succeeded)
+		{
+			++result;
+		}
+	}
+	
+	return result;
+}
+
+internal_func u64 PlatformGetWallClock()
+{
+	LARGE_INTEGER result;
+	QueryPerformanceCounter(&result);
+	return result.QuadPart;
+}
+
+internal_func f64 PlatformGetSecondsElapsed(u64 start, u64 end)
+{
+	f64 result = (f64)(end - start) / (f64)globalPerfCountFrequency.QuadPart;
+	return result;
+}
+
+// NOTE(bSalmon): Views of a file mapping can only be placed on 64KB boundaries without the
+// Windows 10 placeholder APIs, so the ROM can't share an address space with private RAM here.
+// The Win32 layer only ever runs one instance, so the ROM is copied in and write protected instead
+#define WIN32_INSTANCE_MEMORY_SIZE (KILOBYTES(64) + KILOBYTES(4))
+
+struct PlatformROMImage
+{
+	u8 rom[0x2000];
+};
+
+// A null rom gives a blank image
+internal_func PlatformROMImage *PlatformCreateROMImage(u8 *rom, u64 romSize)
+{
+	PlatformROMImage *result = (PlatformROMImage *)PlatformAllocateMemory(sizeof(PlatformROMImage));
+	if (result)
+	{
+		u64 copySize = rom ? ((romSize < sizeof(result->rom)) ? romSize : sizeof(result->rom)) : 0;
+		memcpy(result->rom, rom, copySize);
+	}
+	
+	return result;
+}
+
+internal_func void PlatformDestroyROMImage(PlatformROMImage *image)
+{
+	PlatformFreeMemory(image);
+}
+
+internal_func u8 *PlatformMapInstanceMemory(PlatformROMImage *image)
+{
+	u8 *result = (u8 *)VirtualAlloc(0, WIN32_INSTANCE_MEMORY_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (result)
+	{
+		memcpy(result, image->rom, sizeof(image->rom));
+		
+		DWORD oldProtect;
+		VirtualProtect(result, sizeof(image->rom), PAGE_READONLY, &oldProtect);
+	}
+	
+	return result;
+}
+
+internal_func void PlatformUnmapInstanceMemory(u8 *memory)
+{
+	if (memory)
+	{
+		VirtualFree(memory, 0, MEM_RELEASE);
+	}
+}
+
+// NOTE(bSalmon): Same 64KB view placement problem as the ROM, the RAM is read in instead of mapped
+internal_func u8 *PlatformMapInstanceMemoryFromFile(PlatformROMImage *image, char *path, u64 fileOffset,
+													void *header, u64 headerSize)
+{
+	u8 *result = 0;
+	
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER fileSize;
+		LARGE_INTEGER ramPosition;
+		ramPosition.QuadPart = fileOffset;
+		DWORD bytesRead;
+		if (GetFileSizeEx(fileHandle, &fileSize) && (u64)fileSize.QuadPart >= (fileOffset + 0x2000) &&
+			ReadFile(fileHandle, header, (DWORD)headerSize, &bytesRead, 0) && bytesRead == headerSize &&
+			SetFilePointerEx(fileHandle, ramPosition, 0, FILE_BEGIN))
+		{
+			result = PlatformMapInstanceMemory(image);
+			if (result && !(ReadFile(fileHandle, result + 0x2000, 0x2000, &bytesRead, 0) && bytesRead == 0x2000))
+			{
+				PlatformUnmapInstanceMemory(result);
+				result = 0;
+			}
+		}
+		
+		CloseHandle(fileHandle);
+	}
+	
+	return result;
+}
+
+struct Win32_ThreadStart
+{
+	PlatformThreadProc *proc;
+	void *data;
+};
+
+DWORD WINAPI Win32_ThreadStartProc(LPVOID param)
+{
+	Win32_ThreadStart start = *(Win32_ThreadStart *)param;
+	PlatformFreeMemory(param);
+	start.proc(start.data);
+	return 0;
+}
+
+internal_func PlatformThread *PlatformStartThread(PlatformThreadProc *proc, void *data)
+{
+	Win32_ThreadStart *start = (Win32_ThreadStart *)PlatformAllocateMemory(sizeof(Win32_ThreadStart));
+	start->proc = proc;
+	start->data = data;
+	
+	DWORD threadID;
+	HANDLE threadHandle = CreateThread(0, 0, Win32_ThreadStartProc, start, 0, &threadID);
+	return (PlatformThread *)threadHandle;
+}
+
+internal_func void PlatformJoinThread(PlatformThread *thread)
+{
+	WaitForSingleObject((HANDLE)thread, INFINITE);
+	CloseHandle((HANDLE)thread);
+}
+
+internal_func void PlatformYieldThread()
+{
+	SwitchToThread();
+}
+
+internal_func PlatformSemaphore *PlatformCreateSemaphore(u32 initialCount)
+{
+	HANDLE semaphoreHandle = CreateSemaphoreExA(0, initialCount, 0x7FFFFFFF, 0, 0, SEMAPHORE_ALL_ACCESS);
+	return (PlatformSemaphore *)semaphoreHandle;
+}
+
+internal_func void PlatformSignalSemaphore(PlatformSemaphore *semaphore)
+{
+	ReleaseSemaphore((HANDLE)semaphore, 1, 0);
+}
+
+internal_func void PlatformWaitSemaphore(PlatformSemaphore *semaphore)
+{
+	WaitForSingleObjectEx((HANDLE)semaphore, INFINITE, FALSE);
+}
+
+internal_func void PlatformDestroySemaphore(PlatformSemaphore *semaphore)
+{
+	CloseHandle((HANDLE)semaphore);
+}
+
+internal_func void PlatformAddWorkEntry(PlatformWorkQueue *queue, PlatformWorkQueueCallback *callback, void *data)
+{
+	// NOTE(bSalmon): Only one thread may add entries to a queue
+	u32 newNextEntryToWrite = (queue->nextEntryToWrite + 1) % ARRAY_COUNT(queue->entries);
+	ASSERT(newNextEntryToWrite != queue->nextEntryToRead);
+	PlatformWorkQueueEntry *entry = &queue->entries[queue->nextEntryToWrite];
+	entry->callback = callback;
+	entry->data = data;
+	++queue->completionGoal;
+	
+	CompletePreviousWritesBeforeFutureWrites;
+	
+	queue->nextEntryToWrite = newNextEntryToWrite;
+	ReleaseSemaphore(queue->semaphoreHandle, 1, 0);
+}
+
+internal_func b32 Win32_DoNextWorkQueueEntry(PlatformWorkQueue *queue)
+{
+	b32 shouldSleep = false;
+	
+	u32 originalNextEntryToRead = queue->nextEntryToRead;
+	u32 newNextEntryToRead = (originalNextEntryToRead + 1) % ARRAY_COUNT(queue->entries);
+	if (originalNextEntryToRead != queue->nextEntryToWrite)
+	{
+		u32 index = AtomicCompareExchangeU32(&queue->nextEntryToRead, newNextEntryToRead, originalNextEntryToRead);
+		if (index == originalNextEntryToRead)
+		{
+			PlatformWorkQueueEntry entry = queue->entries[index];
+			entry.callback(queue, entry.data);
+			AtomicAddU32(&queue->completionCount, 1);
+		}
+	}
+	else
+	{
+		shouldSleep = true;
+	}
+	
+	return shouldSleep;
+}
+
+internal_func void PlatformCompleteAllWork(PlatformWorkQueue *queue)
+{
+	// NOTE(bSalmon): The calling thread helps out instead of waiting
+	while (queue->completionGoal != queue->completionCount)
+	{
+		Win32_DoNextWorkQueueEntry(queue);
+	}
+	
+	queue->completionGoal = 0;
+	queue->completionCount = 0;
+}
+
+DWORD WINAPI Win32_WorkQueueThreadProc(LPVOID param)
+{
+	PlatformWorkQueue *queue = (PlatformWorkQueue *)param;
+	
+	for (;;)
+	{
+		if (Win32_DoNextWorkQueueEntry(queue))
+		{
+			WaitForSingleObjectEx(queue->semaphoreHandle, INFINITE, FALSE);
+		}
+	}
+}
+
+internal_func void Win32_MakeWorkQueue(PlatformWorkQueue *queue, u32 threadCount)
+{
+	queue->completionGoal = 0;
+	queue->completionCount = 0;
+	
+	queue->nextEntryToWrite = 0;
+	queue->nextEntryToRead = 0;
+	
+	u32 initialCount = 0;
+	queue->semaphoreHandle = CreateSemaphoreExA(0, initialCount, threadCount, 0, 0, SEMAPHORE_ALL_ACCESS);
+	
+	for (u32 threadIndex = 0; threadIndex < threadCount; ++threadIndex)
+	{
+		DWORD threadID;
+		HANDLE threadHandle = CreateThread(0, 0, Win32_WorkQueueThreadProc, queue, 0, &threadID);
+		CloseHandle(threadHandle);
+	}
+}
 
 // Return a struct containing the height and width of the window bitmap
 internal_func Win32_WindowDimensions Win32_GetWindowDimensions(HWND window)
@@ -115,16 +508,60 @@ internal_func void Win32_ResizeDIBSection(Win32_BackBuffer *buffer, CPUState *cp
 	buffer->pitch = width * buffer->bytesPerPixel;
 }
 
+internal_func BackBuffer Win32_GetBackBufferView(Win32_BackBuffer *buffer)
+{
+	BackBuffer result = {};
+	result.memory = buffer->memory;
+	result.width = buffer->width;
+	result.height = buffer->height;
+	result.pitch = buffer->pitch;
+	result.bytesPerPixel = buffer->bytesPerPixel;
+	
+	return result;
+}
+
 // Present the Back Buffer to the screen
-internal_func void Win32_PresentBuffer(HDC deviceContext, s32 windowWidth, s32 windowHeight, Win32_BackBuffer *buffer)
+internal_func void Win32_PresentBuffer(HDC deviceContext, s32 windowWidth, s32 windowHeight, BackBuffer *source)
 {
-	StretchDIBits(deviceContext,
-				  0, 0, windowWidth, windowHeight,	/// DEST
-				  0, 0, buffer->width, buffer->height,	/// SRC
-				  buffer->memory,
-				  &buffer->info,
-				  DIB_RGB_COLORS,
-				  SRCCOPY);
+	if (windowWidth <= 0 || windowHeight <= 0)
+	{
+		return;
+	}
+	
+	// NOTE(bSalmon): The Back Buffer is scaled into a window sized buffer by whole numbers
+	// and letterboxed so GDI only ever has to do an unscaled copy
+	if (globalPresentBuffer.width != windowWidth || globalPresentBuffer.height != windowHeight)
+	{
+		Win32_ResizeDIBSection(&globalPresentBuffer, 0, windowWidth, windowHeight);
+	}
+	
+	if (globalPresentBuffer.memory)
+	{
+		BackBuffer *filtered = RunFilterPipeline(&globalFilterPipeline, source);
+
+#if EMU8080_INTERNAL
+		for (s32 stageIndex = 0; stageIndex < globalFilterPipeline.stageCount; ++stageIndex)
+		{
+			FilterStage *stage = &globalFilterPipeline.stages[stageIndex];
+			if ((stage->runCount % 60) == 0)
+			{
+				char timingPrint[128] = {};
+				sprintf_s(timingPrint, sizeof(timingPrint), "Filter Stage %d: last %.3fms, avg %.3fms\n",
+						  stageIndex, stage->lastSeconds * 1000.0, (stage->totalSeconds / stage->runCount) * 1000.0);
+				OutputDebugStringA(timingPrint);
+			}
+		}
+#endif
+		BackBuffer dest = Win32_GetBackBufferView(&globalPresentBuffer);
+		UpscaleBuffer(filtered, &dest);
+		
+		SetDIBitsToDevice(deviceContext,
+						  0, 0, globalPresentBuffer.width, globalPresentBuffer.height,	/// DEST
+						  0, 0, 0, globalPresentBuffer.height,	/// SRC
+						  globalPresentBuffer.memory,
+						  &globalPresentBuffer.info,
+						  DIB_RGB_COLORS);
+	}
 }
 
 internal_func void Win32_ResetEmulator(CPUState *cpuState, MachineState *machine)
@@ -134,85 +571,78 @@ internal_func void Win32_ResetEmulator(CPUState *cpuState, MachineState *machine
 	// on Loading a new ROM
 	
 	// Reset Emulator Memory
-	if (cpuState->memory)
-	{
-		VirtualFree(cpuState->memory, 0, MEM_RELEASE);
-	}
-	
-	cpuState->regA = 0x00;
-	cpuState->regF = {};
-	
-	cpuState->regB = 0x00;
-	cpuState->regC = 0x00;
-	
-	cpuState->regD = 0x00;
-	cpuState->regE = 0x00;
-	
-	cpuState->regH = 0x00;
-	cpuState->regL = 0x00;
+	PlatformUnmapInstanceMemory(cpuState->memory);
 	
+	ResetMachine(cpuState, machine);
 	cpuState->memory = 0;
-	cpuState->enableInterrupt = false;
-	cpuState->stackPointer = 0x0000;
-	cpuState->programCounter = 0x0000;
-	
-	machine->shift0 = 0x00;
-	machine->shift1 = 0x00;
-	machine->shiftOffset = 0x00;
-	
-	machine->inputPort1 = 0x00;
-	machine->inputPort2 = 0x00;
 }
 
 internal_func void Win32_LoadROM(CPUState *cpuState, MachineState *machine)
 {
 	Win32_ResetEmulator(cpuState, machine);
-	cpuState->memory = (u8 *)VirtualAlloc(0, MEGABYTES(1), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
 	
-	HANDLE romHandle =  CreateFileA(machine->romFilename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-	if (romHandle != INVALID_HANDLE_VALUE)
-	{
-		if (cpuState->memory)
-		{
-			DWORD bytesRead;
-			ReadFile(romHandle, cpuState->memory, machine->romSize, &bytesRead, 0);
-		}
-		
-		CloseHandle(romHandle);
-	}
+	// NOTE(bSalmon): A ROM that fails to load leaves blank memory, the same as before any ROM is loaded
+	u64 romFileSize = 0;
+	u8 *romContents = PlatformReadEntireFile(machine->romFilename, &romFileSize);
+	PlatformROMImage *romImage = PlatformCreateROMImage(romContents, romFileSize);
+	cpuState->memory = PlatformMapInstanceMemory(romImage);
+	PlatformDestroyROMImage(romImage);
+	PlatformFreeMemory(romContents);
 }
 
-internal_func void Win32_HandleMenuCommands(CPUState *cpuState, MachineState *machine, Win32_Menus menus, HWND window, WPARAM wParam, LPARAM lParam)
+internal_func void Win32_HandleMenuCommands(Win32_Emulation *emulation, Win32_Menus menus, HWND window, WPARAM wParam, LPARAM lParam)
 {
-	// NOTE(bSalmon): Emulator Options and Settings currently only have one item so there is no need for nested if statements
+	// NOTE(bSalmon): Settings currently only has one item so there is no need for a nested if statement
 	HMENU selectedMenu = (HMENU)lParam;
 	s32 itemPos = wParam;
-	if (selectedMenu == menus.emulatorOptions)
+	if (selectedMenu == menus.emulatorOptions && itemPos > 0)
+	{
+		// NOTE(bSalmon): States and movies go next to the ROM as <rom>.state and <rom>.movie
+		local_persist const InputEventType itemEvents[] = {InputEventType::SAVE_STATE, InputEventType::LOAD_STATE,
+			InputEventType::RECORD_MOVIE, InputEventType::PLAY_MOVIE, InputEventType::STOP_MOVIE};
+		if (itemPos <= (s32)ARRAY_COUNT(itemEvents))
+		{
+			InputEvent event = {};
+			event.type = itemEvents[itemPos - 1];
+			PushInputEvent(&emulation->inputQueue, &event);
+		}
+	}
+	else if (selectedMenu == menus.emulatorOptions)
 	{
 		OPENFILENAMEA openFileNameInfo = {};
 		openFileNameInfo.lStructSize = sizeof(OPENFILENAMEA);
 		openFileNameInfo.hwndOwner = window;
 		openFileNameInfo.lpstrFilter = "All Files\0*.*\0\0";
-		openFileNameInfo.lpstrFile = machine->romFilename;
+		openFileNameInfo.lpstrFile = emulation->romFilename;
 		openFileNameInfo.nMaxFile = 256;
 		openFileNameInfo.lpstrTitle = "Open 8080 ROM File";
 		openFileNameInfo.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
 		if (GetOpenFileNameA(&openFileNameInfo))
 		{
-			Win32_LoadROM(cpuState, machine);
+			// NOTE(bSalmon): The emulation thread frees the filename copy once it has loaded the ROM
+			char *romFilename = (char *)PlatformAllocateMemory(sizeof(emulation->romFilename));
+			memcpy(romFilename, emulation->romFilename, sizeof(emulation->romFilename));
+			
+			InputEvent event = {};
+			event.type = InputEventType::LOAD_ROM;
+			event.data = romFilename;
+			if (!PushInputEvent(&emulation->inputQueue, &event))
+			{
+				PlatformFreeMemory(romFilename);
+			}
 		}
 	}
 	else if (selectedMenu == menus.settings)
 	{
 		MENUITEMINFOA menuItemInfo = {};
 		menuItemInfo.cbSize = sizeof(MENUITEMINFOA);
-		if (machine->enableColour)
+		if (emulation->enableColour)
 		{
 			menuItemInfo.fMask = MIIM_CHECKMARKS | MIIM_FTYPE | MIIM_STATE | MIIM_STRING ;
 			menuItemInfo.fType = MFT_STRING;
 			menuItemInfo.fState = MFS_UNCHECKED;
 			menuItemInfo.dwTypeData = "Enable Colour";
-			machine->enableColour = false;
+			emulation->enableColour = false;
 		}
 		else
 		{
@@ -220,9 +650,22 @@ internal_func void Win32_HandleMenuCommands(CPUState *cpuState, MachineState *ma
 			menuItemInfo.fType = MFT_STRING;
 			menuItemInfo.fState = MFS_CHECKED;
 			menuItemInfo.dwTypeData = "Enable Colour";
-			machine->enableColour = true;
+			emulation->enableColour = true;
 		}
 		SetMenuItemInfo(selectedMenu, itemPos, TRUE, &menuItemInfo);
+		
+		InputEvent event = {};
+		event.type = InputEventType::SET_COLOUR;
+		event.value = emulation->enableColour;
+		PushInputEvent(&emulation->inputQueue, &event);
+	}
+	else if (selectedMenu == menus.filters)
+	{
+		// NOTE(bSalmon): Filter menu items are in the same order as FilterPreset
+		BackBuffer *frameBuffer = &GetReadFrame(&globalFrameExchange)->buffer;
+		ApplyFilterPreset(&globalFilterPipeline, (FilterPreset)itemPos, frameBuffer->width, frameBuffer->height);
+		CheckMenuRadioItem(selectedMenu, 0, (UINT)FilterPreset::CRT, itemPos, MF_BYPOSITION);
+		InvalidateRect(window, 0, FALSE);
 	}
 }
 
@@ -302,8 +745,11 @@ LRESULT CALLBACK Win32_WindowProc(HWND window, UINT msg, WPARAM wParam, LPARAM l
 			PAINTSTRUCT paint;
 			HDC deviceContext = BeginPaint(window, &paint);
 			
+			// NOTE(bSalmon): Also reached from inside modal loops (sizing, menus), so pick up the newest frame here too
+			AcquireFrame(&globalFrameExchange);
+			
 			Win32_WindowDimensions windowDim = Win32_GetWindowDimensions(window);
-			Win32_PresentBuffer(deviceContext, windowDim.width, windowDim.height, &globalBackBuffer);
+			Win32_PresentBuffer(deviceContext, windowDim.width, windowDim.height, &GetReadFrame(&globalFrameExchange)->buffer);
 			EndPaint(window, &paint);
 			break;
 		}
@@ -318,7 +764,16 @@ LRESULT CALLBACK Win32_WindowProc(HWND window, UINT msg, WPARAM wParam, LPARAM l
 	return result;
 }
 
-internal_func void Win32_HandleKeyDown(CPUState *cpuState, MachineState *machine, MSG message)
+internal_func void Win32_QueueMachineKey(InputQueue *inputQueue, InputEventType type, u8 port, u8 key)
+{
+	InputEvent event = {};
+	event.type = type;
+	event.port = port;
+	event.key = key;
+	PushInputEvent(inputQueue, &event);
+}
+
+internal_func void Win32_HandleKeyDown(InputQueue *inputQueue, MSG message)
 {
 	u32 vkCode = (u32)message.wParam;
 	b32 keyWasDown = ((message.lParam & (1 << 30)) != 0);
@@ -328,66 +783,73 @@ internal_func void Win32_HandleKeyDown(CPUState *cpuState, MachineState *machine
 		// Port 1
 		if (vkCode == 'A')
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::P1LEFT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::P1LEFT);
 		}
 		else if (vkCode == 'D')
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::P1RIGHT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::P1RIGHT);
 		}
 		else if (vkCode == VK_SPACE)
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::P1SHOOT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::P1SHOOT);
 		}
 		else if (vkCode == 'C')
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::COIN);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::COIN);
 		}
 		else if (vkCode == VK_SHIFT)
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::P1START);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::P1START);
 		}
 		else if (vkCode == VK_RETURN)
 		{
-			ProcessMachineKeyDown(&machine->inputPort1, (u8)Port1MachineKeys::P2START);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 1, (u8)Port1MachineKeys::P2START);
+		}
+		else if (vkCode == VK_BACK)
+		{
+			InputEvent event = {};
+			event.type = InputEventType::SET_REWIND;
+			event.value = true;
+			PushInputEvent(inputQueue, &event);
 		}
 		
 		// Port 2
 		else if (vkCode == VK_LEFT)
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::P2LEFT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::P2LEFT);
 		}
 		else if (vkCode == VK_RIGHT)
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::P2RIGHT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::P2RIGHT);
 		}
 		else if (vkCode == VK_UP)
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::P2SHOOT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::P2SHOOT);
 		}
 		else if (vkCode == '6')
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCH1);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::DIPSWITCH1);
 		}
 		else if (vkCode == '7')
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCH2);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::DIPSWITCH2);
 		}
 		else if (vkCode == '8')
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::TILT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::TILT);
 		}
 		else if (vkCode == '9')
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCHBONUS);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::DIPSWITCHBONUS);
 		}
 		else if (vkCode == '0')
 		{
-			ProcessMachineKeyDown(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCHCOIN);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_DOWN, 2, (u8)Port2MachineKeys::DIPSWITCHCOIN);
 		}
 	}
 }
 
-internal_func void Win32_HandleKeyUp(CPUState *cpuState, MachineState *machine, MSG message)
+internal_func void Win32_HandleKeyUp(InputQueue *inputQueue, MSG message)
 {
 	u32 vkCode = (u32)message.wParam;
 	b32 keyWasDown = ((message.lParam & (1 << 30)) != 0);
@@ -397,63 +859,419 @@ internal_func void Win32_HandleKeyUp(CPUState *cpuState, MachineState *machine,
 		// Port 1
 		if (vkCode == 'A')
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::P1LEFT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::P1LEFT);
 		}
 		else if (vkCode == 'D')
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::P1RIGHT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::P1RIGHT);
 		}
 		else if (vkCode == VK_SPACE)
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::P1SHOOT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::P1SHOOT);
 		}
 		else if (vkCode == 'C')
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::COIN);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::COIN);
 		}
 		else if (vkCode == VK_SHIFT)
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::P1START);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::P1START);
 		}
 		else if (vkCode == VK_RETURN)
 		{
-			ProcessMachineKeyUp(&machine->inputPort1, (u8)Port1MachineKeys::P2START);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 1, (u8)Port1MachineKeys::P2START);
+		}
+		else if (vkCode == VK_BACK)
+		{
+			InputEvent event = {};
+			event.type = InputEventType::SET_REWIND;
+			event.value = false;
+			PushInputEvent(inputQueue, &event);
 		}
 		
 		// Port 2
 		else if (vkCode == VK_LEFT)
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::P2LEFT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::P2LEFT);
 		}
 		else if (vkCode == VK_RIGHT)
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::P2RIGHT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::P2RIGHT);
 		}
 		else if (vkCode == VK_UP)
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::P2SHOOT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::P2SHOOT);
 		}
 		else if (vkCode == '6')
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCH1);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::DIPSWITCH1);
 		}
 		else if (vkCode == '7')
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCH2);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::DIPSWITCH2);
 		}
 		else if (vkCode == '8')
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::TILT);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::TILT);
 		}
 		else if (vkCode == '9')
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCHBONUS);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::DIPSWITCHBONUS);
 		}
 		else if (vkCode == '0')
 		{
-			ProcessMachineKeyUp(&machine->inputPort2, (u8)Port2MachineKeys::DIPSWITCHCOIN);
+			Win32_QueueMachineKey(inputQueue, InputEventType::KEY_UP, 2, (u8)Port2MachineKeys::DIPSWITCHCOIN);
+		}
+	}
+}
+
+// Stops whichever of recording or playing a movie is going on, a recording is written out
+internal_func void Win32_StopMovie(Win32_Emulation *emulation)
+{
+	MachineState *machine = &emulation->machine;
+	if (emulation->recordingMovie)
+	{
+		char moviePath[sizeof(machine->romFilename) + 8];
+		sprintf_s(moviePath, sizeof(moviePath), "%s.movie", machine->romFilename);
+		if (!EndMovieRecording(&emulation->movieRecorder, moviePath, &emulation->cpuState, machine))
+		{
+			OutputDebugStringA("Failed to save movie\n");
+		}
+		emulation->recordingMovie = false;
+	}
+	
+	if (emulation->playingMovie)
+	{
+		EndMoviePlayback(&emulation->moviePlayer);
+		emulation->playingMovie = false;
+	}
+}
+
+internal_func void Win32_ApplyInputEvent(Win32_Emulation *emulation, InputEvent *event)
+{
+	CPUState *cpuState = &emulation->cpuState;
+	MachineState *machine = &emulation->machine;
+	
+	// NOTE(bSalmon): A movie being played owns the ports
+	b32 isKeyEvent = (event->type == InputEventType::KEY_DOWN || event->type == InputEventType::KEY_UP);
+	if (isKeyEvent && emulation->playingMovie)
+	{
+		return;
+	}
+	
+	switch (event->type)
+	{
+		case InputEventType::KEY_DOWN:
+		{
+			u8 *port = (event->port == 1) ? &machine->inputPort1 : &machine->inputPort2;
+			ProcessMachineKeyDown(port, event->key);
+			break;
+		}
+		
+		case InputEventType::KEY_UP:
+		{
+			u8 *port = (event->port == 1) ? &machine->inputPort1 : &machine->inputPort2;
+			ProcessMachineKeyUp(port, event->key);
+			break;
+		}
+		
+		case InputEventType::SET_COLOUR:
+		{
+			machine->enableColour = event->value;
+			break;
+		}
+		
+		case InputEventType::LOAD_ROM:
+		{
+			memcpy(machine->romFilename, event->data, sizeof(machine->romFilename));
+			PlatformFreeMemory(event->data);
+			Win32_StopMovie(emulation);
+			Win32_LoadROM(cpuState, machine);
+			ClearRewindBuffer(&emulation->rewind);
+			break;
+		}
+		
+		case InputEventType::SAVE_STATE:
+		{
+			char statePath[sizeof(machine->romFilename) + 8];
+			sprintf_s(statePath, sizeof(statePath), "%s.state", machine->romFilename);
+			if (!SaveStateToFile(statePath, cpuState, machine))
+			{
+				OutputDebugStringA("Failed to save state\n");
+			}
+			break;
+		}
+		
+		case InputEventType::LOAD_STATE:
+		{
+			// NOTE(bSalmon): The keys held now win over the ones held when the state was saved
+			u8 inputPort1 = machine->inputPort1;
+			u8 inputPort2 = machine->inputPort2;
+			char statePath[sizeof(machine->romFilename) + 8];
+			sprintf_s(statePath, sizeof(statePath), "%s.state", machine->romFilename);
+			if (LoadStateFromFile(statePath, cpuState, machine))
+			{
+				Win32_StopMovie(emulation);
+				machine->inputPort1 = inputPort1;
+				machine->inputPort2 = inputPort2;
+				ClearRewindBuffer(&emulation->rewind);
+			}
+			else
+			{
+				OutputDebugStringA("Failed to load state\n");
+			}
+			break;
+		}
+		
+		case InputEventType::SET_REWIND:
+		{
+			// NOTE(bSalmon): Movies only go forwards
+			emulation->rewinding = event->value && !emulation->recordingMovie && !emulation->playingMovie;
+			break;
+		}
+		
+		case InputEventType::RECORD_MOVIE:
+		{
+			// NOTE(bSalmon): Records from wherever the machine is now, keyed by frame as input only changes between frames
+			Win32_StopMovie(emulation);
+			emulation->recordingMovie = BeginMovieRecording(&emulation->movieRecorder, MovieKeying::FRAME, false, cpuState, machine);
+			if (!emulation->recordingMovie)
+			{
+				FreeMovieRecorder(&emulation->movieRecorder);
+				OutputDebugStringA("Failed to start recording a movie\n");
+			}
+			break;
+		}
+		
+		case InputEventType::PLAY_MOVIE:
+		{
+			Win32_StopMovie(emulation);
+			char moviePath[sizeof(machine->romFilename) + 8];
+			sprintf_s(moviePath, sizeof(moviePath), "%s.movie", machine->romFilename);
+			emulation->playingMovie = BeginMoviePlayback(&emulation->moviePlayer, moviePath, cpuState, machine);
+			if (emulation->playingMovie)
+			{
+				emulation->rewinding = false;
+				ClearRewindBuffer(&emulation->rewind);
+			}
+			else
+			{
+				OutputDebugStringA("Failed to play movie\n");
+			}
+			break;
+		}
+		
+		case InputEventType::STOP_MOVIE:
+		{
+			Win32_StopMovie(emulation);
+			break;
+		}
+	}
+}
+
+#if EMU8080_INTERNAL
+internal_func void Win32_EmulateTraced(CPUState *cpuState, MachineState *machine)
+{
+	char cpuPrint[128] = {};
+	
+	sprintf_s(cpuPrint, sizeof(cpuPrint), "\n\n%lld: ", machine->instructionCount + 1);
+	OutputDebugStringA(cpuPrint);
+	
+	PrintDisassembly(cpuPrint, &cpuState->memory[cpuState->programCounter]);
+	
+	EmulateStep(cpuState, machine);
+	
+	sprintf_s(cpuPrint, sizeof(cpuPrint), "\tCPU FLAGS:\nS=%d,Z=%d,A=%d,P=%d,C=%d\n", cpuState->regF.s, cpuState->regF.z, cpuState->regF.a, cpuState->regF.p, cpuState->regF.c);
+	OutputDebugStringA(cpuPrint);
+	
+	u8 psw = BuildPSW(cpuState);
+	
+	sprintf_s(cpuPrint, sizeof(cpuPrint), "\tREGISTERS:\nA=%02x, F=%02x, B=%02x, C=%02x, D=%02x, E=%02x, H=%02x, L=%02x, SP=%04x, PC=%04x", cpuState->regA, psw, cpuState->regB, cpuState->regC, cpuState->regD, cpuState->regE, cpuState->regH, cpuState->regL, cpuState->stackPointer, cpuState->programCounter);
+	OutputDebugStringA(cpuPrint);
+}
+#endif
+
+// EmulateFrame, but every instruction is traced to the debugger in the Dev Build
+internal_func void Win32_EmulateFrame(CPUState *cpuState, MachineState *machine)
+{
+#if EMU8080_INTERNAL
+	u64 frameCount = machine->frameCount;
+	while (machine->frameCount == frameCount && !IsMachineStopped(cpuState))
+	{
+		Win32_EmulateTraced(cpuState, machine);
+	}
+#else
+	EmulateFrame(cpuState, machine);
+#endif
+}
+
+internal_func void Win32_SleepUntil(u64 target, b32 sleepIsGranular)
+{
+	u64 now = PlatformGetWallClock();
+	if (now >= target)
+	{
+		return;
+	}
+	
+	if (sleepIsGranular)
+	{
+		// NOTE(bSalmon): Sleep can overshoot by up to a tick, so stop a millisecond early and spin the rest
+		DWORD sleepMS = (DWORD)((1000 * (target - now)) / globalPerfCountFrequency.QuadPart);
+		if (sleepMS > 1)
+		{
+			Sleep(sleepMS - 1);
+		}
+	}
+	
+	while (PlatformGetWallClock() < target)
+	{
+		_mm_pause();
+	}
+}
+
+// NOTE(bSalmon): Runs the CPU at 60 frames a second, paced independently of the window
+internal_func PLATFORM_THREAD_PROC(Win32_EmulationThread)
+{
+	Win32_Emulation *emulation = (Win32_Emulation *)data;
+	CPUState *cpuState = &emulation->cpuState;
+	MachineState *machine = &emulation->machine;
+	
+	// NOTE(bSalmon): Render is skipped when VRAM hasn't changed since the last render
+	u64 lastRenderedHash = 0;
+	
+	u64 ticksPerFrame = globalPerfCountFrequency.QuadPart / FRAMES_PER_SECOND;
+	u64 nextFrameTime = PlatformGetWallClock();
+	
+	// NOTE(bSalmon): Backspace held rewinds
+	emulation->rewindEnabled = InitRewindBuffer(&emulation->rewind, REWIND_DEFAULT_SECONDS * FRAMES_PER_SECOND,
+												REWIND_DEFAULT_SECONDS * REWIND_STORAGE_PER_SECOND);
+	
+	while (emulation->running)
+	{
+		InputEvent event;
+		while (PopInputEvent(&emulation->inputQueue, &event))
+		{
+			Win32_ApplyInputEvent(emulation, &event);
+		}
+		
+		if (emulation->recordingMovie && !RecordMovieInput(&emulation->movieRecorder, machine))
+		{
+			OutputDebugStringA("Ran out of memory recording a movie\n");
+			FreeMovieRecorder(&emulation->movieRecorder);
+			emulation->recordingMovie = false;
+		}
+		
+		if (emulation->playingMovie)
+		{
+			EmulateMovieFrame(&emulation->moviePlayer, cpuState, machine);
+			if (IsMovieFinished(&emulation->moviePlayer, machine))
+			{
+				OutputDebugStringA(DoesMovieEndMatch(&emulation->moviePlayer, cpuState, machine) ?
+								   "Movie finished\n" : "Movie finished but the end state differs\n");
+				Win32_StopMovie(emulation);
+			}
+		}
+		// NOTE(bSalmon): The Dev Build traces every instruction so it doesn't rewind
+		else if (emulation->rewindEnabled && !EMU8080_INTERNAL)
+		{
+			EmulateRewindableFrame(&emulation->rewind, emulation->rewinding, cpuState, machine);
+		}
+		else
+		{
+			Win32_EmulateFrame(cpuState, machine);
+		}
+		emulation->frameCount++;
+		
+		// NOTE(bSalmon): Halted with interrupts disabled, nothing will ever run again so shut down
+		if (IsMachineStopped(cpuState))
+		{
+			emulation->running = false;
+			SetEvent(emulation->frameReadyEvent);
+		}
+		
+		// NOTE(bSalmon): Dump every frame even if it is unchanged
+		if (emulation->dumpingFrames)
+		{
+			emulation->frameDump.enableColour = machine->enableColour;
+			SubmitFrameDump(&emulation->frameDump, cpuState, machine->frameCount);
+		}
+		
+		u64 videoHash = HashVideoMemory(cpuState, machine->enableColour);
+		if (videoHash != lastRenderedHash)
+		{
+			ExchangeFrame *frame = GetWriteFrame(emulation->frameExchange);
+			RenderVideoMemContents(&frame->buffer, cpuState, machine->enableColour);
+			PublishFrame(emulation->frameExchange, emulation->frameCount);
+			SetEvent(emulation->frameReadyEvent);
+			lastRenderedHash = videoHash;
+		}
+		
+		nextFrameTime += ticksPerFrame;
+		u64 now = PlatformGetWallClock();
+		if (now > (nextFrameTime + ticksPerFrame))
+		{
+			// NOTE(bSalmon): Fell more than a frame behind, don't try to catch up
+			nextFrameTime = now;
+		}
+		Win32_SleepUntil(nextFrameTime, emulation->sleepIsGranular);
+	}
+	
+	Win32_StopMovie(emulation);
+	if (emulation->rewindEnabled)
+	{
+		FreeRewindBuffer(&emulation->rewind);
+	}
+}
+
+struct Win32_CommandLine
+{
+	char *dumpPath;
+	FrameDumpFormat dumpFormat;
+	b32 invalid;
+};
+
+// Supported Options: -dump <path> -dumpformat <raw|ppm|y4m>
+internal_func Win32_CommandLine Win32_ParseCommandLine(char *cmdLine)
+{
+	Win32_CommandLine result = {};
+	result.dumpFormat = FrameDumpFormat::Y4M;
+	
+	char *args[16] = {};
+	s32 argCount = 0;
+	for (char *at = cmdLine; *at && argCount < (s32)ARRAY_COUNT(args);)
+	{
+		while (*at == ' ')
+		{
+			*at++ = 0;
+		}
+		
+		if (*at)
+		{
+			args[argCount++] = at;
+			while (*at && *at != ' ')
+			{
+				++at;
+			}
+		}
+	}
+	
+	for (s32 argIndex = 0; argIndex < argCount; ++argIndex)
+	{
+		b32 hasValue = (argIndex + 1) < argCount;
+		if (strcmp(args[argIndex], "-dump") == 0 && hasValue)
+		{
+			result.dumpPath = args[++argIndex];
+		}
+		else if (strcmp(args[argIndex], "-dumpformat") == 0 && hasValue)
+		{
+			if (!FindFrameDumpFormat(args[++argIndex], &result.dumpFormat))
+			{
+				result.invalid = true;
+			}
 		}
 	}
+	
+	return result;
 }
 
 s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLine, s32 showCode)
@@ -462,27 +1280,65 @@ s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLi
 	u32 schedulerGranularity = 1;
 	b32 sleepIsGranular = (timeBeginPeriod(schedulerGranularity) == TIMERR_NOERROR);
 	
+	QueryPerformanceFrequency(&globalPerfCountFrequency);
+	
 	globalRunning = true;
 	
-	CPUState cpuState = {};
-	MachineState machine = {};
-	machine.romSize = 0x2000;
-	Win32_ResetEmulator(&cpuState, &machine);
-	cpuState.memory = (u8 *)VirtualAlloc(0, MEGABYTES(1), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	// NOTE(bSalmon): The main thread also works on the queue while it waits, so leave one core for it
+	SYSTEM_INFO systemInfo;
+	GetSystemInfo(&systemInfo);
+	u32 filterThreadCount = (systemInfo.dwNumberOfProcessors > 1) ? (systemInfo.dwNumberOfProcessors - 1) : 1;
+	
+	PlatformWorkQueue filterQueue = {};
+	Win32_MakeWorkQueue(&filterQueue, filterThreadCount);
+	globalFilterPipeline.queue = &filterQueue;
+	
+	// NOTE(bSalmon): Large enough for the input queue, so kept off the stack
+	Win32_Emulation *emulation = (Win32_Emulation *)PlatformAllocateMemory(sizeof(Win32_Emulation));
+	CPUState *cpuState = &emulation->cpuState;
+	MachineState *machine = &emulation->machine;
+	machine->romSize = 0x2000;
+	Win32_ResetEmulator(cpuState, machine);
+	PlatformROMImage *blankImage = PlatformCreateROMImage(0, 0);
+	cpuState->memory = PlatformMapInstanceMemory(blankImage);
+	PlatformDestroyROMImage(blankImage);
+	emulation->sleepIsGranular = sleepIsGranular;
 	
 	WNDCLASSA windowClass = {};
 	
-	Win32_ResizeDIBSection(&globalBackBuffer, &cpuState, 224, 256);
+	InitFrameExchange(&globalFrameExchange, FrameFormat::ARGB32, 224, 256);
+	emulation->frameExchange = &globalFrameExchange;
+	emulation->frameReadyEvent = CreateEventA(0, FALSE, FALSE, 0);
+	BackBuffer *frameBuffer = &GetReadFrame(&globalFrameExchange)->buffer;
+	
+	Win32_CommandLine commandLine = Win32_ParseCommandLine(cmdLine);
+	if (commandLine.invalid)
+	{
+		MessageBoxA(0, "Usage: -dump <path> -dumpformat <raw|ppm|y4m>", "bSalmon842 8080 Emulator", MB_OK | MB_ICONERROR);
+		return 1;
+	}
+	
+	if (commandLine.dumpPath)
+	{
+		emulation->dumpingFrames = BeginFrameDump(&emulation->frameDump, commandLine.dumpPath, commandLine.dumpFormat,
+												  frameBuffer->width, frameBuffer->height, machine->enableColour);
+		if (!emulation->dumpingFrames)
+		{
+			char dumpError[512] = {};
+			sprintf_s(dumpError, sizeof(dumpError), "Could not dump frames to %s, it can't be opened or has a %% that isn't one ppm frame number field",
+					  commandLine.dumpPath);
+			OutputDebugStringA(dumpError);
+			MessageBoxA(0, dumpError, "bSalmon842 8080 Emulator", MB_OK | MB_ICONERROR);
+			return 1;
+		}
+	}
+	ApplyFilterPreset(&globalFilterPipeline, FilterPreset::NONE, frameBuffer->width, frameBuffer->height);
 	
 	windowClass.style = CS_HREDRAW | CS_VREDRAW | CS_OWNDC;
 	windowClass.lpfnWndProc = Win32_WindowProc;
 	windowClass.hInstance = currInstance;
 	windowClass.lpszClassName = "8080WindowClass";
 	
-	f32 monitorRefreshHz = 60.0f;
-	f64 targetSecondsPerInterrupt = 1.0f / monitorRefreshHz;
-	f64 targetMSPerInterrupt = 1000 * targetSecondsPerInterrupt;
-	
 	if (RegisterClassA(&windowClass))
 	{
 		HWND window = CreateWindowExA(0, 
@@ -511,10 +1367,19 @@ s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLi
 			HMENU settings = CreateMenu();
 			menus.settings = settings;
 			
+			HMENU filters = CreateMenu();
+			menus.filters = filters;
+			
 			AppendMenuA(menuBar, MF_POPUP, (UINT_PTR)emulatorOptions, "Emulator");
 			AppendMenuA(menuBar, MF_POPUP, (UINT_PTR)settings, "Settings");
+			AppendMenuA(menuBar, MF_POPUP, (UINT_PTR)filters, "Filters");
 			
 			AppendMenuA(emulatorOptions, MF_STRING, 0, "Load ROM");
+			AppendMenuA(emulatorOptions, MF_STRING, 0, "Save State");
+			AppendMenuA(emulatorOptions, MF_STRING, 0, "Load State");
+			AppendMenuA(emulatorOptions, MF_STRING, 0, "Record Movie");
+			AppendMenuA(emulatorOptions, MF_STRING, 0, "Play Movie");
+			AppendMenuA(emulatorOptions, MF_STRING, 0, "Stop Movie");
 			
 			MENUITEMINFOA enableColourItemInfo = {};
 			enableColourItemInfo.cbSize = sizeof(MENUITEMINFOA);
@@ -525,18 +1390,30 @@ s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLi
 			
 			BOOL test = InsertMenuItemA(settings, 0, TRUE, &enableColourItemInfo);
 			
+			AppendMenuA(filters, MF_STRING, 0, "None");
+			AppendMenuA(filters, MF_STRING, 0, "Scale2x");
+			AppendMenuA(filters, MF_STRING, 0, "Scale2x + Scale2x (4x)");
+			AppendMenuA(filters, MF_STRING, 0, "Scale2x + Scale3x (6x)");
+			AppendMenuA(filters, MF_STRING, 0, "Scanlines");
+			AppendMenuA(filters, MF_STRING, 0, "CRT");
+			CheckMenuRadioItem(filters, 0, (UINT)FilterPreset::CRT, (UINT)FilterPreset::NONE, MF_BYPOSITION);
+			
 			SetMenu(window, menuBar);
 			
 			HDC deviceContext = GetDC(window);
 			
-			unsigned char *castedMemContents = (unsigned char *)cpuState.memory;
-			f64 lastTimer = 0.0f;
-			f64 nextInterrupt = 0.0f;
-			u8 interruptNum = 1;
-			f64 lastFrame = 0.0f;
+			emulation->running = true;
+			PlatformThread *emulationThread = PlatformStartThread(Win32_EmulationThread, emulation);
 			
 			while (globalRunning)
 			{
+				// NOTE(bSalmon): Sleep until there is a message to handle or a new frame to present
+				MsgWaitForMultipleObjects(1, &emulation->frameReadyEvent, FALSE, INFINITE, QS_ALLINPUT);
+				if (!emulation->running)
+				{
+					globalRunning = false;
+				}
+				
 				MSG message;
 				
 				while (PeekMessageA(&message, 0, 0, 0, PM_REMOVE))
@@ -547,20 +1424,20 @@ s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLi
 						case WM_SYSKEYDOWN:
 						case WM_KEYDOWN:
 						{
-							Win32_HandleKeyDown(&cpuState, &machine, message);
+							Win32_HandleKeyDown(&emulation->inputQueue, message);
 							break;
 						}
 						
 						case WM_SYSKEYUP:
 						case WM_KEYUP:
 						{
-							Win32_HandleKeyUp(&cpuState, &machine, message);
+							Win32_HandleKeyUp(&emulation->inputQueue, message);
 							break;
 						}
 						
 						case WM_MENUCOMMAND:
 						{
-							Win32_HandleMenuCommands(&cpuState, &machine, menus, window, message.wParam, message.lParam);
+							Win32_HandleMenuCommands(emulation, menus, window, message.wParam, message.lParam);
 							break;
 						}
 						
@@ -578,85 +1455,56 @@ s32 CALLBACK WinMain(HINSTANCE currInstance, HINSTANCE prevInstance, LPSTR cmdLi
 					}
 				}
 				
-				BackBuffer backBuffer = {};
-				backBuffer.memory = globalBackBuffer.memory;
-				backBuffer.width = globalBackBuffer.width;
-				backBuffer.height = globalBackBuffer.height;
-				backBuffer.pitch = globalBackBuffer.pitch;
-				backBuffer.bytesPerPixel = globalBackBuffer.bytesPerPixel;
-				
-				f64 now = GetTickCount();
-				u64 cycles = 0;
-				
-				if (lastTimer == 0.0f)
-				{
-					lastTimer = now;
-					nextInterrupt = lastTimer + targetMSPerInterrupt;
-					interruptNum = 1;
-				}
-				
-				if (cpuState.enableInterrupt && (now >= nextInterrupt))
+				if (AcquireFrame(&globalFrameExchange))
 				{
-					if (interruptNum == 1)
-					{
-						Interrupt(&cpuState, 1, &cycles);
-						interruptNum = 2;
-					}
-					else 
+					Win32_WindowDimensions windowDim = Win32_GetWindowDimensions(window);
+					Win32_PresentBuffer(deviceContext, windowDim.width, windowDim.height, &GetReadFrame(&globalFrameExchange)->buffer);
+					RecordFramePresented(&globalFrameExchange);
+
+#if EMU8080_INTERNAL
+					LatencyStats *frameLatency = &globalFrameExchange.latency;
+					if ((frameLatency->count % 600) == 0)
 					{
-						Interrupt(&cpuState, 2, &cycles);
-						interruptNum = 1;
+						LatencyStats *inputLatency = &emulation->inputQueue.latency;
+						char latencyPrint[256] = {};
+						sprintf_s(latencyPrint, sizeof(latencyPrint), "Input Latency: avg %.3fms, max %.3fms | Frame Latency: avg %.3fms, max %.3fms, %llu skipped\n",
+								  GetAverageLatency(inputLatency) * 1000.0, inputLatency->maxSeconds * 1000.0,
+								  GetAverageLatency(frameLatency) * 1000.0, frameLatency->maxSeconds * 1000.0,
+								  globalFrameExchange.skippedFrames);
+						OutputDebugStringA(latencyPrint);
 					}
-					
-					RenderVideoMemContents(&backBuffer, &cpuState, machine.enableColour);
-					
-					nextInterrupt = now + (0.5 * targetMSPerInterrupt);
-				}
-				
-				f64 sinceLast = now - lastTimer;
-				s32 cyclesToCatchUp = 2000 * sinceLast;
-				
-				while (cyclesToCatchUp > cycles)
-				{
-#if EMU8080_INTERNAL
-					local_persist u64 inCount = 0;
-					inCount++;
-					
-					char cpuPrint[128] = {};
-					
-					sprintf_s(cpuPrint, sizeof(cpuPrint), "\n\n%lld: ", inCount);
-					OutputDebugStringA(cpuPrint);
-					
-					PrintDisassembly(cpuPrint, &castedMemContents[cpuState.programCounter]);
 #endif
-					
-					Emulate(&cpuState, &machine, castedMemContents, &cycles);
-					
-#if EMU8080_INTERNAL
-					sprintf_s(cpuPrint, sizeof(cpuPrint), "\tCPU FLAGS:\nS=%d,Z=%d,A=%d,P=%d,C=%d\n", cpuState.regF.s, cpuState.regF.z, cpuState.regF.a, cpuState.regF.p, cpuState.regF.c);
-					OutputDebugStringA(cpuPrint);
-					
-					u8 psw = BuildPSW(&cpuState);
-					
-					sprintf_s(cpuPrint, sizeof(cpuPrint), "\tREGISTERS:\nA=%02x, F=%02x, B=%02x, C=%02x, D=%02x, E=%02x, H=%02x, L=%02x, SP=%04x, PC=%04x", cpuState.regA, psw, cpuState.regB, cpuState.regC, cpuState.regD, cpuState.regE, cpuState.regH, cpuState.regL, cpuState.stackPointer, cpuState.programCounter);
-					OutputDebugStringA(cpuPrint);
-#endif
-				}
-				
-				
-				if ((now - lastFrame) >= 16.66667)
-				{
-					Win32_WindowDimensions windowDim = Win32_GetWindowDimensions(window);
-					Win32_PresentBuffer(deviceContext, windowDim.width, windowDim.height, &globalBackBuffer);
-					lastFrame = now;
 				}
-				
-				lastTimer = now;
 			}
+			
+			emulation->running = false;
+			PlatformJoinThread(emulationThread);
+			
+			LatencyStats *inputLatency = &emulation->inputQueue.latency;
+			LatencyStats *frameLatency = &globalFrameExchange.latency;
+			char latencyPrint[256] = {};
+			sprintf_s(latencyPrint, sizeof(latencyPrint), "Emulated %llu frames | Input: %llu events, %llu dropped, avg %.3fms, max %.3fms | Frames: %llu presented, %llu skipped, avg %.3fms, max %.3fms\n",
+					  emulation->frameCount, emulation->inputQueue.pushedEvents, emulation->inputQueue.droppedEvents,
+					  GetAverageLatency(inputLatency) * 1000.0, inputLatency->maxSeconds * 1000.0,
+					  frameLatency->count, globalFrameExchange.skippedFrames,
+					  GetAverageLatency(frameLatency) * 1000.0, frameLatency->maxSeconds * 1000.0);
+			OutputDebugStringA(latencyPrint);
 		}
 	}
 	
-	VirtualFree(cpuState.memory, 0, MEM_RELEASE);
+	if (emulation->dumpingFrames)
+	{
+		EndFrameDump(&emulation->frameDump);
+		
+		FrameDumpStats dumpStats = GetFrameDumpStats(&emulation->frameDump);
+		char dumpPrint[256] = {};
+		sprintf_s(dumpPrint, sizeof(dumpPrint), "Frame Dump: %llu submitted, %llu written, %llu dropped, max queue depth %u/%u\n",
+				  dumpStats.submittedFrames, dumpStats.writtenFrames, dumpStats.droppedFrames,
+				  dumpStats.maxQueueDepth, FRAME_DUMP_QUEUE_SIZE);
+		OutputDebugStringA(dumpPrint);
+	}
+	
+	VirtualFree(cpuState->memory, 0, MEM_RELEASE);
 	return 0;
 }
 